@@ -33,6 +33,8 @@
  *
  * DOF_type - Struct for storing data that remains constant
  *  from power on to power off of the surgical robot.
+ *  Filled in by initDOFs() and read-only afterwards; per-cycle estimator
+ *  state lives in state_estimate.cpp, controller gains in pid_control.cpp.
  *
  */
 
@@ -41,7 +43,6 @@
 
 #define MAX_WINDOW_SIZE 1000 /* ms */
 #define DAC_STORE_SIZE 10    /* s */
-#define HISTORY_SIZE 10
 
 struct Window {
   int length;
@@ -69,6 +70,7 @@ struct DOF_type {
   // DOF current variables
   float i_max;
   float i_cont;
+  float overdrive_time;  // s at i_max from cold before the I2t limit
 
   // Motor Transmission Ratio
   float TR;
@@ -80,24 +82,6 @@ struct DOF_type {
   float DAC_per_amp;
 
   float DAC_zero_offset;
-
-  // Controller Gains
-  float KP;
-  float KD;
-  float KI;
-
-  // Old position data
-  int filterRdy;
-  float old_mpos[HISTORY_SIZE];
-  float old_filtered_mpos[HISTORY_SIZE];
-  float old_mpos_d[HISTORY_SIZE];
-
-  // Old velocity data
-  float old_mvel[HISTORY_SIZE];
-  float old_mvel_d[HISTORY_SIZE];
-
-  // Length of time motor has been overdriven
-  int overdrive_time;
 };
 
 #endif
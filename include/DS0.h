@@ -139,6 +139,18 @@ typedef enum {
   dv_adapter
 } e_tool_type;
 
+/********************************************************
+ *
+ *  Encoder map: count direction and scale of each channel
+ *      of a mechanism, computed once at init by initEncMap()
+ *
+ */
+struct enc_map {
+  int motor_sign[MAX_DOF_PER_MECH];    // motor encoder count direction
+  int joint_sign[MAX_DOF_PER_MECH];    // joint encoder count direction
+  float joint_cnts[MAX_DOF_PER_MECH];  // joint encoder counts per rad or m, 0 if none
+};
+
 /********************************************************
  *
  *  mechanism Struct
@@ -155,6 +167,7 @@ struct mechanism {
   orientation ori_d;
   orientation base_ori;  // base orientation in world frame
   DOF joint[MAX_DOF_PER_MECH];
+  enc_map enc;         // encoder directions and scales
   u_08 inputs;         // input pins
   u_08 outputs;        // output pins
   r2_jacobian r2_jac;  // class needed to avoid build error about forward declarations
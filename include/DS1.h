@@ -57,6 +57,9 @@ struct param_pass {
   int surgeon_mode;
   int robotControlMode;
   int last_sequence;
+  int abs_pose_active[MAX_MECH_PER_DEV];  // xd/rd hold an absolute target, not master-relative
+  int abs_pose_seq[MAX_MECH_PER_DEV];     // incremented on each new absolute target
+  int abs_pose_ticks[MAX_MECH_PER_DEV];   // control cycles in which to reach the target
 };
 
 #endif
@@ -0,0 +1,109 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file command_fanin.h
+ *
+ * \brief Arbitration between multiple command sources (masters, automove)
+ *
+ * Every producer of incremental teleop commands registers as a named source
+ *with a priority and blend gain.  Producers deposit their increments into the
+ *source's own slot; once per control tick local_io merges the slots into a
+ *single command for data1.
+ *
+ * Unless noted otherwise, functions must be called with data1Mutex held.
+ *
+ * \ingroup Networking
+ */
+
+#ifndef COMMAND_FANIN_H
+#define COMMAND_FANIN_H
+
+#include <tf/transform_datatypes.h>
+#include "DS0.h"
+
+#define MAX_CMD_SOURCES 8
+#define CMD_SOURCE_TIMEOUT 100  // ms without packets before a source loses its arms
+
+/// Result of checking a packet sequence number against its source
+enum seq_status {
+  seq_valid = 0,     // next packet, use it
+  seq_reflect,       // zero sequence number: reflect packet to sender
+  seq_skipped,       // packets were dropped before this one
+  seq_duplicate,     // same sequence number as the last packet
+  seq_reset,         // source restarted its numbering
+  seq_out_of_order   // older than the last packet
+};
+
+#define LATENCY_BINS 8  // bins of the arrival-to-consume latency histogram
+
+/// Network QoS counters of one source.  Sequence and arrival counters are kept
+/// by the producer, latency by the RT merge; snapshots are read without locking.
+struct source_stats {
+  char name[32];
+  unsigned int packets;        // packets received
+  unsigned int lost;           // sequence numbers skipped over
+  unsigned int duplicates;     // repeated sequence numbers
+  unsigned int out_of_order;   // packets older than the last accepted one
+  unsigned int max_reorder;    // deepest out-of-order packet, in sequence numbers
+  unsigned int resets;         // sequence numbering restarts
+  unsigned int checksum_fail;  // packets whose checksum did not match
+  float rate;                  // packets/sec over the last second
+  float jitter_us;             // smoothed inter-arrival jitter (RFC 3550 style)
+  float latency_max_us;        // worst arrival-to-RT-consume latency
+  unsigned int latency_hist[LATENCY_BINS];
+};
+
+extern const int latency_bin_us[LATENCY_BINS - 1];
+
+/// An incremental command for one arm
+struct cmd_increment {
+  int dx;             // micrometers
+  int dy;
+  int dz;
+  tf::Quaternion dq;  // rotation increment, pre-multiplied onto the current orientation
+  int dgrasp;         // milliradians
+};
+
+// Registration (takes its own lock, do not hold data1Mutex)
+int registerCommandSource(const char *name, int priority, float blend, int has_pedal);
+const char *commandSourceName(int src);
+int numCommandSources();
+
+// Statistics (no lock needed)
+void noteSourcePacket(int src, int checksum_ok);
+int getSourceStats(int src, source_stats *out);
+u_64 sourceLastPacket(int src);
+
+// Producer side
+seq_status checkSourceSequence(int src, unsigned int seq, unsigned int *prev = NULL);
+void restartSourceSequence(int src);
+void depositSourceIncrement(int src, int armidx, const cmd_increment &inc);
+void depositSourcePedal(int src, int surgeon_mode);
+void noteSourceArmAlive(int src, int armidx);
+
+// Liveness (no lock needed)
+u_64 armLastArrival(int armidx);
+
+// Consumer side, once per control tick
+int arbitrateArm(int armidx, cmd_increment *out);
+int arbitratePedal(int *surgeon_mode, int *last_sequence);
+
+#endif
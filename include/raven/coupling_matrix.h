@@ -0,0 +1,56 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file coupling_matrix.h
+ *
+ * \brief Cable coupling of each arm as matrices between joint and motor space
+ *
+ * \ingroup Control
+ */
+
+#ifndef COUPLING_MATRIX_H
+#define COUPLING_MATRIX_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+#define CPL_N MAX_DOF_PER_MECH
+
+/// Coupling matrices of one arm, indexed by DOF (NO_CONNECTION maps to itself)
+struct coupling_map {
+  int valid;
+  float joint_to_motor[CPL_N][CPL_N];  // A: motor = A * joint + B * motor
+  float motor_to_motor[CPL_N][CPL_N];  // B: motors feeding other motors (tool on insertion)
+  float motor_to_joint[CPL_N][CPL_N];  // A^-1 (I - B), positions and velocities
+  float capstan_to_joint[CPL_N][CPL_N];  // joint torque from capstan torque
+  float joint_to_capstan[CPL_N][CPL_N];  // capstan torque from joint torque
+};
+
+int init_cable_coupling(ros::NodeHandle &n);
+int initCouplingMatrices(mechanism *mech);
+const coupling_map *getCouplingMap(mechanism *mech);
+void couplingMotorToJoint(const coupling_map *c, const float m[CPL_N], float q[CPL_N]);
+void couplingJointToMotor(const coupling_map *c, const float q[CPL_N], const float *m_actual,
+                          float m[CPL_N]);
+void couplingJointToCapstanTorque(int arm, const float tau_j[CPL_N], float tau_c[CPL_N]);
+void couplingCapstanToJointTorque(int arm, const float tau_c[CPL_N], float tau_j[CPL_N]);
+
+#endif
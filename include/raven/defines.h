@@ -55,7 +55,7 @@
 #define JOINT_ENC_SERIAL 99  // 99 if no joint encoder board
 
 // Our choice of the safety level and policy for RAVEN teleoperation
-#define SAFETY_POLICY SOFT_REGULATION  // User can change this! (this value is used in
+#define SAFETY_POLICY SOFT_REGULATION  // Default for the /safety_policy parameter (see
                                        // overdrive_detect.cpp)
 #define SAFETY_LEVEL MODERATE_MODE     // User can change this! (this value is used in init.cpp)
                                        // CHOICES: BEGINNER, MODERATE, ADVANCED
@@ -377,6 +377,10 @@
 #define V_MAX ((float)3.0) /* rad/s   */
 #define A_MAX ((float)1.0) /* rad/s^2 */
 
+// Absolute pose command interpolation limits
+#define ABS_POSE_MAX_VEL ((float)0.1)     /* m/s   */
+#define ABS_POSE_MAX_ANG_VEL ((float)2.0) /* rad/s */
+
 // Grasping Defines
 #define GRASP_OPEN 1
 #define GRASP_CLOSE 0
@@ -388,7 +392,14 @@
 // Watchdog timer Period
 #define WD_PERIOD 50
 
-// Master connection timeout (time to trigger pedal up)
+// Master connection timeout in ms of wall-clock silence per arm (starts the ramp down)
 #define MASTER_CONN_TIMEOUT 5000
+// Time in ms to ramp the commands of a silent arm to a hold before pedal up
+#define MASTER_RAMP_TIME 500
+
+// Pedal-up motion of the desired pose that makes the master origin follow it
+#define ORIGIN_DEADBAND_POS 10      // micrometers
+#define ORIGIN_DEADBAND_GRASP 2     // milliradians
+#define ORIGIN_DEADBAND_ROT 0.001   // rotation matrix elements
 
 #endif
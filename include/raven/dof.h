@@ -38,7 +38,8 @@
 #define JOINT_ANGLE 1
 
 // Function prototypes
-int processEncVal(unsigned char buffer[], int channel);
+void decodeEncVals(const unsigned char buffer[], int numChannels, int out[]);
+void initEncMap(mechanism *mech);
 
 void encToJPos(DOF *joint);
 void encToMPos(DOF *joint);
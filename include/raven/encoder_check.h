@@ -0,0 +1,51 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file encoder_check.h
+ *
+ * \brief Validation of motor encoder counts between USB decode and state estimation
+ *
+ * \ingroup IO
+ */
+
+#ifndef ENCODER_CHECK_H
+#define ENCODER_CHECK_H
+
+#include "DS0.h"
+
+#define ENC_MAX_MOTOR_VEL 1000.0  // rad/s, fastest physically possible motor speed
+#define ENC_MAX_HOLD 5            // packets a glitched channel may hold its last good count
+#define ENC_GLITCH_WINDOW 1000    // packets over which glitches are counted
+#define ENC_MAX_GLITCHES 20       // glitches per window that count as a persistent fault
+
+/// Glitch counters of one motor encoder
+struct enc_stats {
+  unsigned int glitches;  // samples rejected as impossible jumps
+  unsigned int faults;    // times the hold limit or glitch rate was exceeded
+  unsigned int wraps;     // 24-bit counter wraps unrolled
+  int held;               // packets the channel is currently holding
+};
+
+void validateEncoders(mechanism *mech, const int encVals[], int numChannels);
+int checkEncoderFaults(int runlevel);
+int getEncoderStats(int arm, int dof, enc_stats *out);
+
+#endif
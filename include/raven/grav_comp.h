@@ -30,14 +30,34 @@
 #define GRAV_COMP_H
 
 #include <cmath>
+#include <ros/ros.h>
 #include <tf/transform_datatypes.h>
 
 #include "struct.h"
 #include "defines.h"
 
+/// Mass properties of one link, expressed in its own link frame
+struct link_mass {
+  double m;         // kg
+  tf::Vector3 com;  // meters
+  tf::Matrix3x3 I;  // kg m^2 about the COM
+};
+
 /*
- * Calculate gravity load on joints 1,2,3 on both arms
+ * Calculate gravity load on every joint on both arms, plus the optional
+ * Newton-Euler feed-forward of the desired motion
  */
 void getGravityTorque(device &d0, param_pass &params);
+tf::Vector3 getCurrentG(device *d0, int m);
+
+int init_dynamics(ros::NodeHandle &n);
+void setDynamicsFeedForward(int on);
+int dynamicsFeedForward();
+
+void getGravityParams(int arm, link_mass out[6]);
+int setGravityParams(const link_mass gold[6], const link_mass green[6]);
+void gravityJointTorques(const tf::Transform *links, int arm, const tf::Vector3 &G0,
+                         double out_tau[6]);
+unsigned int gravityParamsVersion();
 
 #endif
@@ -0,0 +1,50 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file grav_ident.h
+ *
+ * \brief Online identification of the gravity model mass properties
+ *
+ * The RT thread queues quasi-static samples of joint positions and torques;
+ *a ROS timer fits link masses and first moments with recursive least squares
+ *and publishes them to the gravity model (see setGravityParams()).
+ *
+ * \ingroup Control
+ */
+
+#ifndef GRAV_IDENT_H
+#define GRAV_IDENT_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+#include "DS1.h"
+
+#define GRAV_IDENT_QUEUE 256           // sample queue length
+#define GRAV_IDENT_DECIMATE 10         // control cycles between samples
+#define GRAV_IDENT_MAX_VEL 0.05        // rad/s, shoulder and elbow, for a quasi-static sample
+#define GRAV_IDENT_MAX_INS_VEL 0.005   // m/s, insertion
+#define GRAV_IDENT_MIN_SAMPLES 200     // new samples of an arm before publishing its parameters
+#define GRAV_IDENT_PUBLISH_PERIOD 5.0  // seconds between published parameter sets
+
+int init_gravity_ident(ros::NodeHandle &n);
+void sampleGravityIdent(device *d0, param_pass *currParams);
+
+#endif
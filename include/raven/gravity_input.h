@@ -0,0 +1,42 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file gravity_input.h
+ *
+ * \brief Gravity direction from a ROS gravity or IMU topic
+ *
+ * \ingroup Control
+ */
+
+#ifndef GRAVITY_INPUT_H
+#define GRAVITY_INPUT_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+#define GRAVITY_FILTER_HZ 2.0  // default low-pass cutoff of the gravity direction
+#define GRAVITY_MAX_RATE 10.0  // default limit on the direction change, deg/s
+#define GRAVITY_MAG_TOL 0.2    // readings further than this fraction from g are ignored
+
+int init_gravity_input(ros::NodeHandle &n);
+int getGravityInput(position *out_dir);
+
+#endif
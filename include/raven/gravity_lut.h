@@ -0,0 +1,43 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file gravity_lut.h
+ *
+ * \brief Interpolated lookup table of gravity torques
+ *
+ * \ingroup Control
+ */
+
+#ifndef GRAVITY_LUT_H
+#define GRAVITY_LUT_H
+
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+#include "DS0.h"
+
+#define GRAVITY_LUT_TOL 0.002      // default error bound, Nm at the joint (N for insertion)
+#define GRAVITY_LUT_MAX_NODES 257  // grid refinement limit per axis
+#define GRAVITY_LUT_BENCH 20000    // evaluations timed at startup
+
+int init_gravity_lut(ros::NodeHandle &n);
+int gravityLUTTorques(int arm, const mechanism *_mech, const tf::Vector3 &G0, double *out_GZ);
+
+#endif
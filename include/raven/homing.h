@@ -17,7 +17,6 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 /**
 *   \file homing.h
 *
@@ -30,11 +29,47 @@
 *
 *   \ingroup Control
 */
+
+#ifndef HOMING_H
+#define HOMING_H
+
+#include <ros/ros.h>
 #include "DS0.h"
 
-/** prototype for homing()
+/// Joint groups of a mechanism that run to their hard stops together
+#define HOMING_GROUP_TOOL 1  // tool roll, wrist and grasp joints
+#define HOMING_GROUP_ARM 2   // shoulder, elbow and insertion
+#define HOMING_GROUP_ALL (HOMING_GROUP_TOOL | HOMING_GROUP_ARM)
+
+#define HOMING_AMP_DELAY 1000     // default ms for the amplifiers to come up
+#define HOMING_RAMP_TIME 0.25     // s to ramp up to the search velocity
+#define HOMING_MIN_TRAVEL 0.25    // s at the search velocity to travel before a tuned or stall stop
+#define HOMING_STALL_CURRENT 0.6  // fraction of the hard-stop current that can mean a stall
+#define HOMING_STALL_VEL 0.2      // fraction of the search velocity below which a joint stalls
+#define HOMING_STALL_TICKS 15     // consecutive stalled cycles that mark a hard stop
+#define HOMING_SETTLE_VEL 0.1     // fraction of the search velocity that counts as settled
+#define HOMING_SETTLE_TICKS 30    // consecutive settled cycles before zeroing the encoders
+#define HOMING_SETTLE_MAX 200     // ms, longest wait for the cables to settle
+#define HOMING_RETURN_MIN 0.5     // s, shortest move from the hard stops to home
+
+/// Progress of one mechanism through homing
+enum homing_phase {
+  hphase_idle = 0,    // waiting for the init run level
+  hphase_amps = 1,    // waiting for the amplifiers
+  hphase_search = 2,  // running the active group to its hard stops
+  hphase_settle = 3,  // letting the cables settle at the hard stops
+  hphase_return = 4,  // moving the zeroed joints home
+  hphase_done = 5,
+  hphase_last
+};
+
+/** prototype for init_homing()
  */
-void homing(DOF *);
+int init_homing(ros::NodeHandle &n);
+
+/** prototype for homingPhase()
+ */
+int homingPhase(int arm);
 
 /** prototype for homing()
  */
@@ -43,3 +78,5 @@ void homing(DOF *, tool);
 /** prototype for check_homing_condition()
  */
 int check_homing_condition(DOF *);
+
+#endif
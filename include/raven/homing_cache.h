@@ -0,0 +1,43 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file homing_cache.h
+ *
+ * \brief Saved homing calibration for a warm start without the hard-stop sweep
+ *
+ * \ingroup Control
+ */
+
+#ifndef HOMING_CACHE_H
+#define HOMING_CACHE_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+#define HOMING_CACHE_TOL 0.5     // default motor rad an encoder may have drifted by
+#define HOMING_CACHE_PERIOD 1.0  // s between checks for a calibration to save
+
+int init_homing_cache(ros::NodeHandle &n);
+int homingCacheRestore(mechanism *_mech);
+void homingCacheStore(mechanism *_mech);
+void saveHomingCache(device *device0);
+
+#endif
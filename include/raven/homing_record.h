@@ -0,0 +1,86 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file homing_record.h
+ *
+ * \brief Recorded homing traces, per-joint homing report and hard-stop
+ *threshold tuning
+ *
+ * \ingroup Control
+ */
+
+#ifndef HOMING_RECORD_H
+#define HOMING_RECORD_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+#define HOMING_REC_LEN 4096       // samples (ms) of each joint's search kept, ending at the stop
+#define HOMING_REC_CONTACT 150    // ms before the stop left out of the free-running current
+#define HOMING_TOOL_TYPES 9       // end_effector_type values
+#define HOMING_TUNE_RUNS 3        // runs of a joint and tool before its threshold is tuned
+#define HOMING_TUNE_WEIGHT 0.25   // weight of the newest run in the history
+#define HOMING_TUNE_GAIN 1.6      // tuned threshold over the free-running current
+#define HOMING_TUNE_FLOOR 0.5     // lowest tuned threshold, as a fraction of the default
+#define HOMING_DRIFT_WARN 1.3     // free-running current over its history that warns
+#define HOMING_MARGIN_WARN 0.2    // margin under this fraction of the threshold warns
+
+/// Why a joint's search ended
+enum homing_stop {
+  hstop_none = 0,     // no hard stop found (grasp2, or the search was cut short)
+  hstop_current = 1,  // current reached the threshold
+  hstop_stall = 2,    // joint stalled with high current
+  hstop_last
+};
+
+/// Homing report of one joint from the last run
+struct homing_joint_report {
+  int searched;      // TRUE if the joint ran to its hard stop in the last run
+  int stop;          // homing_stop
+  float search_ms;   // from the start of the search to the stop
+  float threshold;   // hard-stop current used (A)
+  float free_amps;   // peak current while running free (A)
+  float stop_amps;   // current at the stop (A)
+  float margin;      // threshold - free_amps (A)
+  float history;     // free-running current averaged over past runs (A), 0 if none
+  float tuned;       // threshold tuned from the history (A), 0 until HOMING_TUNE_RUNS
+};
+
+/// Homing report of one arm from the last run
+struct homing_report {
+  int runs;            // homing runs completed since start
+  int warm;            // TRUE if the last run was a warm start
+  int tool;            // end_effector_type of the last run
+  float duration_ms;   // from entering homing to ready
+  int warnings;        // joints with a low margin or rising free-running current
+  homing_joint_report joint[MAX_DOF_PER_MECH];
+};
+
+int init_homing_record(ros::NodeHandle &n);
+void homingRecordBegin(mechanism *_mech);
+void homingRecordJointStart(DOF *_joint);
+void homingRecordSample(DOF *_joint);
+void homingRecordStop(DOF *_joint, int stop, float threshold);
+void homingRecordEnd(mechanism *_mech, unsigned long int duration, int warm);
+float homingThreshold(DOF *_joint, float i_default);
+int getHomingReport(int arm, homing_report *out);
+
+#endif
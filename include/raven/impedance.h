@@ -0,0 +1,57 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file impedance.h
+ *
+ * \brief Cartesian impedance control of the arms
+ *
+ * \ingroup Control
+ */
+
+#ifndef IMPEDANCE_H
+#define IMPEDANCE_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+#define IMPEDANCE_K_POS 200.0      // default translational stiffness, N/m
+#define IMPEDANCE_K_ROT 0.05       // default rotational stiffness, Nm/rad
+#define IMPEDANCE_D_POS 4.0        // default translational damping, N s/m
+#define IMPEDANCE_D_ROT 0.0005     // default rotational damping, Nm s/rad
+#define IMPEDANCE_K_GRASP 0.05     // default jaw opening stiffness, Nm/rad
+#define IMPEDANCE_D_GRASP 0.0005   // default jaw opening damping, Nm s/rad
+#define IMPEDANCE_MAX_FORCE 5.0    // default limit on the task-space force, N
+#define IMPEDANCE_MAX_TORQUE 0.05  // default limit on the task-space torque, Nm
+
+/// Task-space impedance, in frame 0: x, y, z, then rotation about x, y, z
+struct impedance_gains {
+  float k[6];       // stiffness, N/m and Nm/rad
+  float d[6];       // damping, N s/m and Nm s/rad
+  float k_grasp;    // jaw opening stiffness and damping, in joint space
+  float d_grasp;
+  float max_force;  // limits on the commanded wrench
+  float max_torque;
+};
+
+int impedanceTorques(mechanism *mech, int m, float out_tau[MAX_DOF_PER_MECH]);
+int init_impedance(ros::NodeHandle &n);
+
+#endif
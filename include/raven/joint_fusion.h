@@ -0,0 +1,52 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file joint_fusion.h
+ *
+ * \brief Fusion of motor and joint encoders into the joint state
+ *
+ * \ingroup Control
+ */
+
+#ifndef JOINT_FUSION_H
+#define JOINT_FUSION_H
+
+#include <ros/ros.h>
+#include "DS0.h"
+
+/// Source of jpos/jvel of the positioning joints
+enum fusion_type {
+  fuse_motor = 0,          // motor encoders through the cable coupling only
+  fuse_complementary = 1,  // motor encoders, cable stretch low-passed from the joint encoders
+  fuse_kalman = 2,         // Kalman filter on position, velocity and cable stretch
+  fuse_last_type
+};
+
+#define FUSION_STRETCH_HZ 2.0  // crossover of the complementary filter
+
+int init_joint_fusion(ros::NodeHandle &n);
+void fuseJointEncoders(device *device0);
+float fusedStretch(mechanism *mech, int j);
+int setJointFusion(int type);
+int getJointFusion();
+const char *jointFusionName(int type);
+
+#endif
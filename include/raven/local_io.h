@@ -38,18 +38,19 @@
 int initLocalioData();
 
 // update controller state w/ toolkit input
-void teleopIntoDS1(u_struct *);
+void teleopIntoDS1(u_struct *, int src);
 
 // fifo handler to recv command data
-int receiveUserspace(void *u, int size);
+int receiveUserspace(void *u, int size, int src);
 
 // Check: have any command updates happened?
 int checkLocalUpdates();
+float masterWatchdogGain(int armidx);
 
 // Return current parameter-update set
 param_pass *getRcvdParams(param_pass *);
 
-void updateMasterRelativeOrigin(device *device0);
+void updateMasterRelativeOrigin(device *device0, int moved = TRUE);
 
 int init_ravenstate_publishing(ros::NodeHandle &n);
 void publish_ravenstate_ros(robot_device *, param_pass *);
@@ -45,20 +45,24 @@
 #define T_PER_AMP_RE40 0.0603 /* Nm/A - From datasheet*/
 #define I_CONT_RE40 3.12      /* A - From datasheet*/
 #define I_MAX_RE40 10         /* A */
+#define OVERDRIVE_TIME_RE40 4.0 /* s at I_MAX from cold, winding time constant 41.6 s */
 // RE 30 motor constants
 #define T_PER_AMP_RE30 0.0538 /* Nm/A From datasheet*/
 #define I_CONT_RE30 1.72      /* A - From  datasheet*/
 #define I_MAX_RE30 10         /* A why? */
+#define OVERDRIVE_TIME_RE30 0.5 /* s at I_MAX from cold, winding time constant 16.3 s */
 #define ENC_CNTS_PER_REV_R_II 4000.0
 
 // Motor constants
 #define T_PER_AMP_BIG_MOTOR T_PER_AMP_RE40
 #define I_CONT_BIG_MOTOR I_CONT_RE40
 #define I_MAX_BIG_MOTOR I_MAX_RE40
+#define OVERDRIVE_TIME_BIG_MOTOR OVERDRIVE_TIME_RE40
 
 #define T_PER_AMP_SMALL_MOTOR T_PER_AMP_RE30
 #define I_CONT_SMALL_MOTOR I_CONT_RE30
 #define I_MAX_SMALL_MOTOR I_MAX_RE30
+#define OVERDRIVE_TIME_SMALL_MOTOR OVERDRIVE_TIME_RE30
 
 /// Encoder ticks per motor revolution
 #define ENC_CNTS_PER_REV ENC_CNTS_PER_REV_R_II
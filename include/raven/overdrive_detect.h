@@ -19,19 +19,73 @@
  */
 
 /**
- * overdrive_detect.c - Functions related to checking for motor over heating
+ * overdrive_detect.h - Runtime safety supervisor: motor current, I2t thermal,
+ * joint velocity and workspace limits
  *
  */
 
+#ifndef OVERDRIVE_DETECT_H
+#define OVERDRIVE_DETECT_H
+
 //#include <rtai.h>
+#include <ros/ros.h>
 #include "struct.h"
 #include "defines.h"
 #include "utils.h"
 #include "log.h"
 #include <cstdlib>
 
-#define TIME_WINDOW 10000
-#define MAX_OVERDRIVE_TIME 50000
+#define SAFETY_QUEUE 256           // fault event queue length
+#define SAFETY_DEBOUNCE 10         // default cycles over a limit before a HARD_REGULATION e-stop
+#define SAFETY_THERMAL_WARN 0.8    // fraction of the I2t limit that warns
+#define SAFETY_WORKSPACE_ANG 0.1   // rad past a joint's software limits that counts as out
+#define SAFETY_WORKSPACE_LIN 0.01  // m, "" for insertion
+#define SAFETY_EVENT_PERIOD 0.1    // s between drains of the event queue
+
+/// Limits the supervisor checks on every joint
+enum safety_check {
+  sc_inst_current = 0,  // DAC command above MAX_INST_DAC
+  sc_current = 1,       // DAC command above the joint's DAC_max
+  sc_thermal = 2,       // I2t model above the continuous current
+  sc_velocity = 3,      // joint velocity above /safety_joint_vel
+  sc_workspace = 4,     // joint outside its software limits with pedal down
+  sc_last
+};
+
+/// How far a limit has been exceeded
+enum safety_stage {
+  ss_ok = 0,
+  ss_warn = 1,   // reported only
+  ss_limit = 2,  // current clipped
+  ss_fault = 3,  // current cut and robot e-stopped
+  ss_last
+};
+
+/// One limit crossing, as queued by the RT thread
+struct safety_event {
+  unsigned long int time;  // control cycle (gTime)
+  int joint;               // joint type
+  int check;               // safety_check
+  int stage;               // safety_stage
+  float value;             // DAC counts, A^2, rad/s or m/s, rad or m
+  float limit;             // "" the limit it crossed
+};
+
+/// Counters of the supervisor, kept by the ROS thread
+struct safety_stats {
+  int policy;                        // NO_REGULATION, SOFT_REGULATION or HARD_REGULATION
+  unsigned int events[sc_last];      // events of each check
+  unsigned int faults;               // events that e-stopped the robot
+  unsigned int dropped;              // events lost to a full queue
+  safety_event last;                 // most recent event
+  float cost_mean_ns, cost_max_ns;   // time of overdriveDetect() per cycle
+};
 
 // Function prototypes
+int init_overdrive_detect(ros::NodeHandle &n);
 int overdriveDetect(device *device0, int runlevel);
+int getSafetyStats(safety_stats *out);
+const char *safetyCheckName(int check);
+const char *safetyStageName(int stage);
+
+#endif
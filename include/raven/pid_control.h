@@ -32,6 +32,7 @@
 #define PD_CONTROL_H
 
 // Local include files
+#include <ros/ros.h>
 #include "struct.h" /*Includes DS0, DS1, DOF_type*/
 #include "dof.h"
 
@@ -40,8 +41,43 @@
 #define MOTOR_PD_CTRL 2
 #define MOTOR_VEL_CTRL 2
 
+/// Desired motor velocity (rad/s) below which the Coulomb friction term ramps
+#define FRICTION_FF_DEADBAND 1.0
+
+/// Position control laws of the joint controllers
+enum ctrl_law { ctrl_pd, ctrl_pid, ctrl_last_law };
+
+/// Gains of one joint controller, swapped in as a whole between cycles
+struct joint_gains {
+  int law;         // ctrl_law of the motor position controller
+  float kp;        // motor position control
+  float kd;
+  float ki;
+  float i_limit;   // largest integral torque, 0 for none
+  float fc;        // Coulomb friction feed-forward torque
+  float fv;        // viscous friction feed-forward, torque per rad/s
+  float kg;        // scale of the gravity compensation torque
+  float kv;        // joint velocity PI control
+  float kvi;
+};
+
+/// State of one joint controller
+struct joint_controller {
+  float pos_int;  // integral of the motor position error
+  float vel_int;  // integral of the joint velocity error
+  float ki;       // integral gain pos_int was accumulated with
+};
+
 // Function Prototypes
 void mpos_PD_control(DOF *joint, int reset_I = 0);
 float jvel_PI_control(DOF *, int);
+float gravityFeedforward(DOF *joint);
+
+void updateControllerGains();
+int setJointGains(const joint_gains gains[MAX_MECH * MAX_DOF_PER_MECH]);
+void getJointGains(joint_gains gains[MAX_MECH * MAX_DOF_PER_MECH]);
+void defaultJointGains(int dof_type, joint_gains *gains);
+const char *controlLawName(int law);
+int init_gain_service(ros::NodeHandle &n);
 
 #endif  // PD_CONTROL_H
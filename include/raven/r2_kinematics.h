@@ -56,6 +56,15 @@ struct ik_solution {
 
 const ik_solution ik_zerosol = {ik_valid, dh_left, 0, 0, 0, 0, 0, 0};
 
+#define IK_ALL_BRANCHES 0xff
+
+/// Branch selection counters of one arm's analytic inverse kinematics
+struct ik_branch_stats {
+  unsigned long solves;     ///< analytic solutions
+  unsigned long fallbacks;  ///< solutions that had to search all eight branches
+  unsigned long switches;   ///< changes of the chosen branch
+};
+
 // Robot constants
 const double La12 = 75 * M_PI / 180;
 const double La23 = 52 * M_PI / 180;
@@ -71,6 +80,10 @@ const double GM1 = sin(La12), GM2 = cos(La12), GM3 = sin(La23), GM4 = cos(La23);
 void print_tf(tf::Transform);
 void print_btVector(tf::Vector3 vv);
 tf::Transform getFKTransform(int a, int b);
+tf::Transform getLinkTransform(int a);
+const tf::Transform *getFKLinks(int m);
+void getLinkTransforms(const double in_thetas[6], l_r in_arm, tf::Transform out_links[6]);
+void getJacobian(const tf::Transform in_links[6], double out_J[6][6]);
 
 void showInverseKinematicsSolutions(device *d0, int runlevel);
 
@@ -84,23 +97,28 @@ int getATransform(mechanism &in_mch, tf::Transform &out_xform, int frameA, int f
  *            Arm type, left / right ( kin.armtype arm = left/right)
  *   Outputs: cartesian transform as 4x4 transformation matrix ( bullit
  * transform.  WHAT'S THE SYNTAX FOR THAT???)
+ *            Optionally the six link transforms ^i_{i+1}T
  *   Return: 0 on success, -1 on failure
  */
 int __attribute__((optimize("0")))
-fwd_kin(double in_j[6], l_r in_armtype, tf::Transform &out_xform);
+fwd_kin(double in_j[6], l_r in_armtype, tf::Transform &out_xform,
+        tf::Transform *out_links = NULL);
 
 int r2_inv_kin(device *d0, int runlevel);
+int getIKBranchStats(int m, ik_branch_stats *out);
 
 /** inv_kin()
  *   Runs the Raven II INVERSE kinematics to determine end effector position.
  *   Inputs:  cartesian transform as 4x4 transformation matrix ( bullit
  * transform.  WHAT'S THE SYNTAX FOR THAT???)
  *            Arm type, left / right ( kin.armtype arm = left/right)
+ *            Bit mask of the solutions to compute
  *   Outputs: 6 element array of joint angles ( float j[] = {shoulder, elbow,
  * ins, roll, wrist, grasp} )
  *   Return: 0 on success, -1 on failure
  */
-int inv_kin(tf::Transform in_xf, l_r in_arm, ik_solution iksol[8]);
+int inv_kin(tf::Transform in_xf, l_r in_arm, ik_solution iksol[8],
+            unsigned int in_branches = IK_ALL_BRANCHES);
 
 void joint2theta(double *out_iktheta, double *in_J, l_r);
 void theta2joint(ik_solution in_iktheta, double *out_J);
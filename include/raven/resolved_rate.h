@@ -0,0 +1,60 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file resolved_rate.h
+ *
+ * \brief Resolved-rate (damped least squares) inverse kinematics
+ *
+ * \ingroup Kinematics
+ */
+
+#ifndef RESOLVED_RATE_H
+#define RESOLVED_RATE_H
+
+#include <ros/ros.h>
+#include "r2_kinematics.h"
+
+/// Inverse kinematics used by r2_inv_kin()
+enum ik_method {
+  ik_analytic = 0,       // all eight analytic branches, closest to the current joints
+  ik_resolved_rate = 1,  // damped least squares steps from the last command
+  ik_last_method
+};
+
+#define IK_RR_ITERATIONS 2          // damped least squares steps per cycle
+#define IK_RR_LENGTH 0.01           // m, weight of position against orientation errors
+#define IK_RR_MANIPULABILITY 100.0  // default manipulability below which the step is damped
+#define IK_RR_DAMPING 0.05          // default damping at a singularity
+#define IK_RR_TOL_POS 1.0e-5        // m, residual that calls for an analytic solution
+#define IK_RR_TOL_ROT 1.0e-4        // rad, ""
+#define IK_RR_ANCHOR_PERIOD 1000    // default cycles between analytic re-anchors
+#define IK_RR_BENCH 2000            // poses in the startup benchmark
+
+int init_resolved_rate(ros::NodeHandle &n);
+int updateIKMethod();
+int setIKMethod(int method);
+int getIKMethod();
+const char *ikMethodName(int method);
+int resolvedRateIK(int m, l_r arm, const tf::Transform &in_xf, double *in_thetas, int runlevel,
+                   ik_solution &out_sol);
+void resolvedRateCommit(int m, l_r arm, double *in_joints);
+
+#endif
@@ -28,10 +28,53 @@
  *
  */
 
+#ifndef STATE_ESTIMATE_H
+#define STATE_ESTIMATE_H
+
+#include <ros/ros.h>
+
 #include "struct.h"
 #include "defines.h"
 #include "dof.h"
 
+#define EST_HISTORY 4  // filter history ring length, power of two
+
+/// Motor state estimators, selectable per joint
+enum estimator_type {
+  est_raw = 0,          // unfiltered position, first difference velocity
+  est_butterworth = 1,  // 3rd order 120 Hz Butterworth on position
+  est_kalman = 2,       // steady-state constant velocity Kalman filter
+  est_levant = 3,       // Levant robust exact differentiator
+  est_last_type
+};
+
+/// Estimator selection and state of one joint, one cache line
+struct joint_estimator {
+  int type;                // estimator_type in use
+  volatile int requested;  // estimator_type to switch to, set from any thread
+  int ready;               // state initialized
+  int head;                // newest entry of in/out
+  float pos, vel;          // latest estimate
+  float x[2];              // Kalman, Levant: position, velocity
+  float in[EST_HISTORY];   // measured position ring
+  float out[EST_HISTORY];  // filtered position ring
+};
+
+/// Estimator state of one mechanism, indexed like the DOF_types of that arm
+struct mech_estimator {
+  joint_estimator joint[MAX_DOF_PER_MECH];
+} __attribute__((aligned(64)));
+
 void stateEstimate(robot_device *device0);
-void getStateLPF(DOF *joint, int tool_type);
-void resetFilter(DOF *_joint);
+void getStateLPF(mechanism *mech, int dof);
+void runEstimator(joint_estimator *e, float motorPos);
+void initEstimator(joint_estimator *e, float pos, float vel);
+void resetFilter(mechanism *mech);
+void clearFilter(mechanism *mech);
+int setJointEstimator(int arm, int dof, int type);
+int getJointEstimator(int arm, int dof);
+const char *estimatorName(int type);
+int estimatorFromName(const char *name);
+int init_estimators(ros::NodeHandle &n);
+
+#endif
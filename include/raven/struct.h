@@ -60,6 +60,8 @@ enum t_controlmode {
   motor_pd_control = 5,
   cartesian_space_control = 6,
   multi_dof_sinusoid = 7,
+  cartesian_impedance_control = 8,
+  trajectory_control = 9,
   LAST_TYPE
 };
 
@@ -25,10 +25,19 @@
 *    Generate joint and cartesian trajectories.
 *    Internal datastructures track trajectory state, and update DOFs as needed
 *upon calling.
+*
+*    Polynomial paths through waypoints are in trajectory_plan.h.
 */
 
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <ros/ros.h>
 #include "struct.h"
 
+int init_trajectory(ros::NodeHandle &n);
+void getSinusoidParams(float *out_period, float *out_magnitude);
+
 // Setup and teardown of trajectory generation
 // int start_trajectory(DOF*);
 int start_trajectory(DOF *, float = 0, float = 0);
@@ -43,3 +52,8 @@ int update_linear_sinusoid_velocity_trajectory(DOF *);
 int update_sinusoid_position_trajectory(DOF *);
 int update_linear_sinusoid_position_trajectory(DOF *);
 int update_position_trajectory(DOF *);
+
+// Cartesian trajectories
+int update_absolute_pose_trajectory(device *, param_pass *);
+
+#endif
@@ -0,0 +1,122 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file trajectory_plan.h
+ *
+ * \brief Queued multi-waypoint paths of polynomial segments, in joint or
+ * Cartesian space
+ *
+ * \ingroup Control
+ */
+
+#ifndef TRAJECTORY_PLAN_H
+#define TRAJECTORY_PLAN_H
+
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+#include "DS0.h"
+
+/// Time law of a segment
+enum traj_profile {
+  traj_quintic = 0,    // quintic through the waypoints, moving through the inner ones
+  traj_min_jerk = 1,   // minimum jerk, at rest at every waypoint
+  traj_trapezoid = 2,  // constant acceleration, cruise, constant deceleration
+  traj_cubic = 3,      // cubic Hermite through streamed points, not for planned paths
+  traj_last_profile
+};
+
+/// Coordinates the waypoints are given and interpolated in
+enum traj_space {
+  traj_joint = 0,      // the eight DOFs of the arm, rad and m
+  traj_cartesian = 1,  // tool position, orientation and grasp
+  traj_last_space
+};
+
+#define TRAJ_QUEUE_LEN 512          // segments queued per arm, one per streamed point
+#define TRAJ_MAX_WAYPOINTS 32       // waypoints in one planned path
+#define TRAJ_MAX_STREAM 256         // points in one streamed batch
+#define TRAJ_AXES MAX_DOF_PER_MECH  // interpolated axes of a segment
+#define TRAJ_MAX_AGE 100            // cycles after which the state seen by the planner is stale
+#define TRAJ_START_TOL_POS 1000     // micrometers, allowed gap at the start of a path
+#define TRAJ_START_TOL_ANG 0.02     // rad (and m / 10 for the insertion), ""
+#define TRAJ_LIN_ACC 0.5            // default Cartesian acceleration, m/s^2
+#define TRAJ_ANG_ACC 10.0           // default angular acceleration, rad/s^2
+
+/// One waypoint of a path.  Joint paths use q, Cartesian paths pos, R and grasp.
+struct traj_waypoint {
+  float q[MAX_DOF_PER_MECH];  // joint positions, rad and m
+  float pos[3];               // tool position in frame 0, m
+  float R[3][3];              // tool orientation in frame 0
+  float grasp;                // jaw opening, rad
+  float duration;             // shortest time from the previous waypoint, s
+};
+
+/// Speed and acceleration limits a path is timed to respect
+struct traj_limits {
+  float jvel[MAX_DOF_PER_MECH];  // joint speed, rad/s and m/s, 0 to leave the DOF alone
+  float jacc[MAX_DOF_PER_MECH];  // joint acceleration, rad/s^2 and m/s^2
+  float lin_vel;                 // Cartesian speed, m/s
+  float lin_acc;                 // m/s^2
+  float ang_vel;                 // tool angular speed, rad/s
+  float ang_acc;                 // rad/s^2
+};
+
+/// A precomputed segment, evaluated by the control loop with Horner's rule
+struct traj_segment {
+  int space;                // traj_space
+  int profile;              // traj_profile
+  int ticks;                // length in control cycles
+  unsigned long int start;  // gTime the segment is due to start
+  int more;                 // further streamed points are expected after it
+  int stop;                 // brought to rest at its end, as no later point was queued
+  float beta;               // trapezoid, fraction of the segment spent accelerating
+  double c[TRAJ_AXES][6];   // polynomial in normalized time, or start and change (trapezoid)
+  tf::Quaternion ori[2];    // Cartesian, orientation at the start and the end
+};
+
+/// Playback statistics of one arm
+struct traj_stats {
+  int queued;                   // segments queued or playing
+  long int lead;                // cycles of motion queued ahead of the control loop
+  long int lag;                 // cycles the current segment started behind its time stamp
+  long int max_lag;             // largest lag so far
+  unsigned long int segments;   // segments played
+  unsigned long int underruns;  // times a stream ran dry before its end
+  unsigned long int late;       // streamed points dropped for arriving after their time stamp
+  unsigned long int overflows;  // batches refused for lack of room in the queue
+  unsigned long int dropped;    // paths dropped on cancel, pedal up or a moved start
+};
+
+int init_trajectory_plan(ros::NodeHandle &n);
+int trajPlanPath(int arm, int space, int profile, const traj_waypoint *wps, int num,
+                 const traj_limits *lim = NULL);
+int trajStream(int arm, int space, const traj_waypoint *wps, const long int *at, int num,
+               int end);
+int trajCancel(int arm);
+int trajQueued(int arm);
+void getTrajLimits(traj_limits *out);
+int getTrajStats(int arm, traj_stats *out);
+const char *trajProfileName(int profile);
+const char *trajSpaceName(int space);
+int trajUpdate(device *device0, int runlevel);
+void trajApply(device *device0);
+
+#endif
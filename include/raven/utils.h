@@ -32,6 +32,8 @@
 #define __UTILS_H__
 
 #include <ctime>
+#include <string>
+#include <ros/ros.h>
 #include "DS0.h"
 
 #ifndef NULL
@@ -75,8 +77,14 @@ static inline void tsnorm(timespec *ts) {
 
 timespec tsSubtract(timespec time1, timespec time2);
 
+// Current CLOCK_MONOTONIC time in nanoseconds
+u_64 monotonic_ns();
+
 // Reset posd so that it is coincident with pos.
-void set_posd_to_pos(robot_device *device0);
+int set_posd_to_pos(robot_device *device0);
+
+// Read a fixed-length list of numbers from a ROS parameter
+int getParamList(ros::NodeHandle &n, const std::string &name, float *out, unsigned int size);
 
 #define isbefore(a, b) ((a.tv_sec < b.tv_sec) || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec))
 
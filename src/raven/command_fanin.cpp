@@ -0,0 +1,446 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file command_fanin.cpp
+ *
+ * \brief Arbitration between multiple command sources (masters, automove)
+ *
+ * Each source has its own sequence space, a priority and a blend gain.  Per
+ *arm, the live sources with the highest priority compete: the current owner
+ *keeps the arm as long as it stays live at that priority, otherwise the arm is
+ *handed to the first live source at the top priority.  Because every source
+ *deposits increments, handover is jump-free and takes effect at the next merge
+ *(one control tick).
+ *
+ * An owner with blend gain 0 is exclusive.  Otherwise the increments of all
+ *top-priority sources with a non-zero gain are summed, scaled by their gains.
+ *The defaults (priority 0, gain 1) reproduce the old behaviour of adding every
+ *source's increments.  Both can be overridden from the parameter server with
+ *the parameters command_sources/NAME/priority and command_sources/NAME/blend.
+ *
+ * \ingroup Networking
+ */
+
+#include <cmath>
+#include <cstring>
+#include <pthread.h>
+#include <ros/ros.h>
+
+#include "command_fanin.h"
+#include "defines.h"
+#include "log.h"
+#include "utils.h"
+
+/// Per-source state.  Only the source's producer writes last_seq; the rest is
+/// protected by data1Mutex.
+struct cmd_source {
+  char name[32];
+  int priority;
+  float blend;            // gain when sharing the top priority, 0 = exclusive
+  int has_pedal;          // source carries a surgeon_mode (pedal) state
+  unsigned int last_seq;  // last accepted sequence number
+  u_64 last_arrival;      // monotonic ns of the last deposit
+  u_64 arm_arrival[MAX_MECH_PER_DEV];  // monotonic ns of the last command per arm
+  int surgeon_mode;
+  int pending[MAX_MECH_PER_DEV];  // increments waiting for the next merge
+  cmd_increment inc[MAX_MECH_PER_DEV];
+  u_64 first_pending[MAX_MECH_PER_DEV];  // arrival of the oldest unmerged increment
+
+  // QoS bookkeeping, producer side
+  source_stats stats;
+  u_64 last_packet;      // monotonic ns of the last packet
+  u_64 last_interval;    // ns between the last two packets
+  u_64 window_start;     // start of the packet rate window
+  unsigned int window_packets;
+};
+
+/// Upper bounds of the latency histogram bins in microseconds; the last bin is
+/// open ended.
+const int latency_bin_us[LATENCY_BINS - 1] = {100, 250, 500, 1000, 2000, 5000, 10000};
+
+static cmd_source sources[MAX_CMD_SOURCES];
+static volatile int numSources = 0;
+static pthread_mutex_t registerMutex = PTHREAD_MUTEX_INITIALIZER;
+static int armOwner[MAX_MECH_PER_DEV] = {-1, -1};
+static int pedalOwner = -1;
+
+static void clearIncrement(cmd_increment *inc) {
+  inc->dx = inc->dy = inc->dz = 0;
+  inc->dq = tf::Quaternion::getIdentity();
+  inc->dgrasp = 0;
+}
+
+static int sourceLive(int src, u_64 now) {
+  return sources[src].last_arrival != 0 &&
+         now - sources[src].last_arrival < (u_64)CMD_SOURCE_TIMEOUT * 1000000;
+}
+
+/**
+ * \brief Registers a named command source, or returns the existing one
+ *
+ * \param name       unique source name, used in logs and parameter lookup
+ * \param priority   default priority, higher wins
+ * \param blend      default blend gain, 0 for exclusive
+ * \param has_pedal  TRUE if the source carries surgeon_mode
+ * \return source id, -1 if the table is full
+ *
+ * \ingroup Networking
+ */
+int registerCommandSource(const char *name, int priority, float blend, int has_pedal) {
+  int src;
+
+  pthread_mutex_lock(&registerMutex);
+  for (src = 0; src < numSources; src++) {
+    if (strncmp(sources[src].name, name, sizeof(sources[src].name)) == 0) {
+      pthread_mutex_unlock(&registerMutex);
+      return src;
+    }
+  }
+  if (numSources >= MAX_CMD_SOURCES) {
+    pthread_mutex_unlock(&registerMutex);
+    err_msg("Too many command sources, ignoring %s\n", name);
+    return -1;
+  }
+
+  std::string ns = std::string("/command_sources/") + name;
+  double d_blend = blend;
+  ros::param::get(ns + "/priority", priority);
+  ros::param::get(ns + "/blend", d_blend);
+
+  cmd_source *s = &sources[numSources];
+  strncpy(s->name, name, sizeof(s->name) - 1);
+  s->name[sizeof(s->name) - 1] = '\0';
+  s->priority = priority;
+  s->blend = d_blend;
+  s->has_pedal = has_pedal;
+  s->last_seq = 0;
+  s->last_arrival = 0;
+  s->surgeon_mode = 0;
+  for (int i = 0; i < MAX_MECH_PER_DEV; i++) {
+    s->pending[i] = 0;
+    clearIncrement(&s->inc[i]);
+  }
+  memset(&s->stats, 0, sizeof(s->stats));
+  strcpy(s->stats.name, s->name);
+  s->last_packet = s->last_interval = s->window_start = 0;
+  s->window_packets = 0;
+
+  __sync_synchronize();  // slot is complete before it becomes visible
+  src = numSources++;
+  pthread_mutex_unlock(&registerMutex);
+
+  log_msg("Command source %d: %s (priority %d, blend %.2f)", src, s->name, s->priority, s->blend);
+  return src;
+}
+
+/**
+ * \brief name of a registered source, for logging
+ * \ingroup Networking
+ */
+const char *commandSourceName(int src) {
+  if (src < 0 || src >= numSources) return "none";
+  return sources[src].name;
+}
+
+/**
+ * \brief number of registered sources
+ * \ingroup Networking
+ */
+int numCommandSources() { return numSources; }
+
+/**
+ * \brief Updates the arrival statistics of a source for one packet
+ *
+ * Called only from the source's own producer thread, no lock needed.
+ *
+ * \param src          command source
+ * \param checksum_ok  FALSE if the packet failed its checksum
+ *
+ * \ingroup Networking
+ */
+void noteSourcePacket(int src, int checksum_ok) {
+  cmd_source *s = &sources[src];
+  u_64 now = monotonic_ns();
+
+  s->stats.packets++;
+  if (!checksum_ok) s->stats.checksum_fail++;
+
+  if (s->last_packet != 0) {
+    u_64 interval = now - s->last_packet;
+    if (s->last_interval != 0) {
+      double d_us = ((double)interval - (double)s->last_interval) / 1000;
+      s->stats.jitter_us += (fabs(d_us) - s->stats.jitter_us) / 16;
+    }
+    s->last_interval = interval;
+  }
+  s->last_packet = now;
+
+  s->window_packets++;
+  if (s->window_start == 0) {
+    s->window_start = now;
+  } else if (now - s->window_start >= (u_64)NSEC_PER_SEC) {
+    s->stats.rate = s->window_packets * (double)NSEC_PER_SEC / (now - s->window_start);
+    s->window_start = now;
+    s->window_packets = 0;
+  }
+}
+
+/**
+ * \brief Arrival time of the last packet from a source
+ *
+ * Safe to call without locks; the timestamp is a single 64-bit word.
+ *
+ * \return monotonic ns of the last packet, 0 if none has arrived
+ * \ingroup Networking
+ */
+u_64 sourceLastPacket(int src) {
+  if (src < 0 || src >= numSources) return 0;
+  return sources[src].last_packet;
+}
+
+/**
+ * \brief Copies the statistics of a source
+ *
+ * \param src  command source
+ * \param out  snapshot of the counters
+ * \return 0 on success, -1 for an unknown source
+ *
+ * \ingroup Networking
+ */
+int getSourceStats(int src, source_stats *out) {
+  if (src < 0 || src >= numSources) return -1;
+  *out = sources[src].stats;
+
+  // the rate window only closes on packet arrival
+  if (monotonic_ns() - sources[src].last_packet > 2 * (u_64)NSEC_PER_SEC) out->rate = 0;
+  return 0;
+}
+
+/**
+ * \brief Checks a packet's sequence number against its own source
+ *
+ * Called only from the source's own producer thread, no lock needed.
+ * Same rules as the old single-master check in network_process.
+ *
+ * \param src   command source
+ * \param seq   sequence number of the packet
+ * \param prev  if not NULL, set to the source's previous sequence number
+ *
+ * \ingroup Networking
+ */
+seq_status checkSourceSequence(int src, unsigned int seq, unsigned int *prev) {
+  unsigned int *last = &sources[src].last_seq;
+
+  source_stats *st = &sources[src].stats;
+
+  if (prev) *prev = *last;
+
+  if (seq == 0) return seq_reflect;
+
+  if (seq > *last + 1) {
+    if (*last != 0) st->lost += seq - *last - 1;
+    *last = seq;
+    return seq_skipped;
+  }
+  if (seq == *last) {
+    st->duplicates++;
+    return seq_duplicate;
+  }
+
+  if (seq > *last) {
+    *last = seq;
+    return seq_valid;
+  }
+  if (*last > 1000 && seq < *last - 1000) {
+    st->resets++;
+    *last = seq;
+    return seq_reset;
+  }
+  st->out_of_order++;
+  if (*last - seq > st->max_reorder) st->max_reorder = *last - seq;
+  return seq_out_of_order;
+}
+
+/**
+ * \brief Starts a new sequence space for a source whose sender has changed
+ *
+ * Called only from the source's own producer thread, no lock needed.
+ *
+ * \ingroup Networking
+ */
+void restartSourceSequence(int src) { sources[src].last_seq = 0; }
+
+/**
+ * \brief Accumulates an increment for one arm until the next merge
+ * \ingroup Networking
+ */
+void depositSourceIncrement(int src, int armidx, const cmd_increment &inc) {
+  cmd_source *s = &sources[src];
+  cmd_increment *acc = &s->inc[armidx];
+
+  acc->dx += inc.dx;
+  acc->dy += inc.dy;
+  acc->dz += inc.dz;
+  acc->dq = inc.dq * acc->dq;
+  acc->dgrasp += inc.dgrasp;
+  s->last_arrival = monotonic_ns();
+  s->arm_arrival[armidx] = s->last_arrival;
+  if (!s->pending[armidx]) s->first_pending[armidx] = s->last_arrival;
+  s->pending[armidx] = 1;
+}
+
+/**
+ * \brief Marks an arm as commanded by a source that bypasses arbitration
+ *
+ * Sources such as absolute pose commands write data1 directly, but still keep
+ * the arm alive for the master watchdog.
+ *
+ * \ingroup Networking
+ */
+void noteSourceArmAlive(int src, int armidx) { sources[src].arm_arrival[armidx] = monotonic_ns(); }
+
+/**
+ * \brief Most recent command for an arm from any source
+ *
+ * Safe to call without locks; the timestamps are single 64-bit words.
+ *
+ * \return monotonic ns of the last arrival, 0 if the arm was never commanded
+ * \ingroup Networking
+ */
+u_64 armLastArrival(int armidx) {
+  u_64 last = 0;
+  int n = numSources;
+
+  for (int i = 0; i < n; i++)
+    if (sources[i].arm_arrival[armidx] > last) last = sources[i].arm_arrival[armidx];
+  return last;
+}
+
+/**
+ * \brief Records the pedal state reported by a source
+ * \ingroup Networking
+ */
+void depositSourcePedal(int src, int surgeon_mode) {
+  sources[src].surgeon_mode = surgeon_mode;
+  sources[src].last_arrival = monotonic_ns();
+}
+
+/**
+ * \brief Picks the owner of an arm and merges the increments for this tick
+ *
+ * Clears the pending increments of every source for the arm, whether they were
+ *used or not, so nothing stale survives a handover.
+ *
+ * \param armidx  0 for gold, 1 for green
+ * \param out     merged increment
+ * \return owning source id, -1 if no source is live
+ *
+ * \ingroup Networking
+ */
+int arbitrateArm(int armidx, cmd_increment *out) {
+  u_64 now = monotonic_ns();
+  int n = numSources;
+  int top = -1;
+
+  clearIncrement(out);
+
+  for (int i = 0; i < n; i++)
+    if (sourceLive(i, now) && (top < 0 || sources[i].priority > sources[top].priority)) top = i;
+
+  int owner = armOwner[armidx];
+  if (top >= 0 &&
+      (owner < 0 || !sourceLive(owner, now) || sources[owner].priority != sources[top].priority))
+    owner = top;
+  if (top < 0) owner = -1;
+
+  if (owner != armOwner[armidx]) {
+    log_msg("Arm %d command source: %s", armidx, commandSourceName(owner));
+    armOwner[armidx] = owner;
+  }
+
+  for (int i = 0; i < n; i++) {
+    cmd_source *s = &sources[i];
+    if (!s->pending[armidx]) continue;
+
+    float gain = 0;
+    if (i == owner && s->blend <= 0)
+      gain = 1;
+    else if (owner >= 0 && sources[owner].blend > 0 && sourceLive(i, now) &&
+             s->priority == sources[owner].priority)
+      gain = s->blend;
+
+    if (gain > 0) {
+      cmd_increment *in = &s->inc[armidx];
+      out->dx += (int)(gain * in->dx);
+      out->dy += (int)(gain * in->dy);
+      out->dz += (int)(gain * in->dz);
+      out->dgrasp += (int)(gain * in->dgrasp);
+      if (gain == 1)
+        out->dq = in->dq * out->dq;
+      else
+        out->dq = tf::Quaternion::getIdentity().slerp(in->dq, gain) * out->dq;
+    }
+
+    // arrival-to-consume latency of the oldest increment
+    float latency_us = (now - s->first_pending[armidx]) / 1000.0;
+    int bin = 0;
+    while (bin < LATENCY_BINS - 1 && latency_us > latency_bin_us[bin]) bin++;
+    s->stats.latency_hist[bin]++;
+    if (latency_us > s->stats.latency_max_us) s->stats.latency_max_us = latency_us;
+
+    s->pending[armidx] = 0;
+    clearIncrement(&s->inc[armidx]);
+  }
+
+  return owner;
+}
+
+/**
+ * \brief Picks the source whose pedal drives surgeon_mode
+ *
+ * \param surgeon_mode   set to the owner's pedal state
+ * \param last_sequence  set to the owner's last sequence number
+ * \return owning source id, -1 if no pedal-carrying source is live
+ *
+ * \ingroup Networking
+ */
+int arbitratePedal(int *surgeon_mode, int *last_sequence) {
+  u_64 now = monotonic_ns();
+  int n = numSources;
+  int top = -1;
+
+  for (int i = 0; i < n; i++)
+    if (sources[i].has_pedal && sourceLive(i, now) &&
+        (top < 0 || sources[i].priority > sources[top].priority))
+      top = i;
+
+  if (top < 0) return -1;
+
+  if (pedalOwner < 0 || !sourceLive(pedalOwner, now) || !sources[pedalOwner].has_pedal ||
+      sources[pedalOwner].priority != sources[top].priority) {
+    pedalOwner = top;
+    log_msg("Pedal source: %s", sources[top].name);
+  }
+
+  *surgeon_mode = sources[pedalOwner].surgeon_mode;
+  *last_sequence = sources[pedalOwner].last_seq;
+  return pedalOwner;
+}
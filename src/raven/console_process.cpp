@@ -46,6 +46,13 @@
 
 #include "rt_process_preempt.h"
 #include "rt_raven.h"
+#include "command_fanin.h"
+#include "grav_comp.h"
+#include "state_estimate.h"
+#include "encoder_check.h"
+#include "joint_fusion.h"
+#include "resolved_rate.h"
+#include "pid_control.h"
 
 using namespace std;
 
@@ -58,6 +65,9 @@ extern DOF_type DOF_types[];     // Defined in globals.cpp
 extern std::queue<char *> msgqueue;
 
 void outputRobotState();
+void outputSourceStats();
+void outputEncoderStats();
+void outputIKStats();
 int getkey();
 
 /**
@@ -99,6 +109,12 @@ void *console_process(void *) {
       log_msg("[[\t'C'    : toggle console messages ]]");
       log_msg("[[\t'T'    : specify joint torque    ]]");
       log_msg("[[\t'M'    : set control mode        ]]");
+      log_msg("[[\t'N'    : network statistics      ]]");
+      log_msg("[[\t'F'    : toggle dynamics feed-fwd ]]");
+      log_msg("[[\t'S'    : select state estimator  ]]");
+      log_msg("[[\t'G'    : encoder glitch counters ]]");
+      log_msg("[[\t'J'    : joint encoder fusion    ]]");
+      log_msg("[[\t'K'    : inverse kinematics      ]]");
       log_msg("[[\t'U/D'  : Pedal Up/Down           ]]");
       log_msg("[[\t'^C'   : Quit                      ]]");
       print_msg = 0;
@@ -180,13 +196,87 @@ void *console_process(void *) {
         setDofTorque(_mech, _joint, _torqueval);
         break;
       }
+      case 'n':
+      case 'N': {
+        outputSourceStats();
+        print_msg = 1;
+        break;
+      }
+      case 'f':
+      case 'F': {
+        setDynamicsFeedForward(!dynamicsFeedForward());
+        print_msg = 1;
+        break;
+      }
+      case 'g':
+      case 'G': {
+        outputEncoderStats();
+        print_msg = 1;
+        break;
+      }
+      case 'j':
+      case 'J': {
+        print_msg = 1;
+        printf("\n\nJoint state from %s. Enter a source: 0-motor, 1-complementary, 2-kalman:\t",
+               jointFusionName(getJointFusion()));
+        cin.getline(inputbuffer, 100);
+        int _type = atoi(inputbuffer);
+        if (setJointFusion(_type) < 0)
+          log_msg("Unknown joint fusion %d", _type);
+        else
+          log_msg("Joint state from %s", jointFusionName(_type));
+        break;
+      }
+      case 'k':
+      case 'K': {
+        print_msg = 1;
+        outputIKStats();
+        printf("\n\nInverse kinematics is %s. Enter a method: 0-analytic, 1-resolved rate:\t",
+               ikMethodName(getIKMethod()));
+        cin.getline(inputbuffer, 100);
+        int _method = atoi(inputbuffer);
+        if (setIKMethod(_method) < 0)
+          log_msg("Unknown inverse kinematics %d", _method);
+        else
+          log_msg("Inverse kinematics: %s", ikMethodName(_method));
+        break;
+      }
+      case 's':
+      case 'S': {
+        print_msg = 1;
+        printf("\n\nEnter a mechanism number: 0-Gold, 1-Green:\t");
+        cin.getline(inputbuffer, 100);
+        unsigned int _mech = atoi(inputbuffer);
+        if (_mech > 1) break;
+
+        printf(
+            "\nEnter a joint number: 0-shoulder, 1-elbow, 2-zins, "
+            "4-tool_roll, 5-wrist, 6/7- grasp 1/2, 8-all:\t");
+        cin.getline(inputbuffer, 100);
+        unsigned int _joint = atoi(inputbuffer);
+        if (_joint > MAX_DOF_PER_MECH) break;
+
+        printf("\nEnter an estimator: 0-raw, 1-butterworth, 2-kalman, 3-levant:\t");
+        cin.getline(inputbuffer, 100);
+        int _type = atoi(inputbuffer);
+
+        for (unsigned int i = 0; i < MAX_DOF_PER_MECH; i++) {
+          if (_joint != MAX_DOF_PER_MECH && i != _joint) continue;
+          if (setJointEstimator(_mech, i, _type) < 0) {
+            log_msg("Unknown estimator %d", _type);
+            break;
+          }
+        }
+        log_msg("State estimator mech.joint %d.%d: %s", _mech, _joint, estimatorName(_type));
+        break;
+      }
       case 'm':
       case 'M': {
         // Get user-input DAC value #
         printf(
             "\n\nEnter new control mode: 0=NULL, 1=NULL, 2=joint_velocity, "
             "3=apply_torque, 4=homing, 5=motor_pd, 6=cartesian_space_motion, "
-            "7=multi_dof_sinusoid \t");
+            "7=multi_dof_sinusoid, 8=cartesian_impedance, 9=trajectory \t");
         cin.getline(inputbuffer, 100);
         t_controlmode _cmode = (t_controlmode)(atoi(inputbuffer));
         log_msg("received control mode:%d\n\n", _cmode);
@@ -378,14 +468,22 @@ void outputRobotState() {
            << "\t";
     cout << "\n";
 
+    joint_gains gains[MAX_MECH * MAX_DOF_PER_MECH];
+    getJointGains(gains);
+
     cout << "KP gains:\t";
     for (int i = 0; i < MAX_DOF_PER_MECH; i++)
-      cout << fixed << setprecision(3) << DOF_types[j * MAX_DOF_PER_MECH + i].KP << "\t";
+      cout << fixed << setprecision(3) << gains[j * MAX_DOF_PER_MECH + i].kp << "\t";
     cout << "\n";
 
     cout << "KD gains:\t";
     for (int i = 0; i < MAX_DOF_PER_MECH; i++)
-      cout << fixed << setprecision(3) << DOF_types[j * MAX_DOF_PER_MECH + i].KD << "\t";
+      cout << fixed << setprecision(3) << gains[j * MAX_DOF_PER_MECH + i].kd << "\t";
+    cout << "\n";
+
+    cout << "KI gains:\t";
+    for (int i = 0; i < MAX_DOF_PER_MECH; i++)
+      cout << fixed << setprecision(3) << gains[j * MAX_DOF_PER_MECH + i].ki << "\t";
     cout << "\n";
     /*
 cout<<"jac force:\t";
@@ -427,3 +525,80 @@ cout<<"\n";
     cout << "\n";
   }
 }
+
+/**
+ *	\fn void outputSourceStats()
+ *
+ *	\brief prints the network QoS statistics of every command source
+ *
+ *	\ingroup IO
+ *
+ *	\return void
+ */
+void outputSourceStats() {
+  source_stats st;
+
+  if (numCommandSources() == 0) cout << "No command sources yet\n";
+
+  for (int src = 0; src < numCommandSources(); src++) {
+    if (getSourceStats(src, &st) < 0) continue;
+    unsigned int total = st.packets + st.lost;
+
+    cout << st.name << ":\n";
+    cout << "  rate: " << fixed << setprecision(1) << st.rate << " pkt/s\tpackets: " << st.packets
+         << "\tlost: " << st.lost << " (" << setprecision(2)
+         << (total ? 100.0 * st.lost / total : 0.0) << "%)\n";
+    cout << "  duplicates: " << st.duplicates << "\tout of order: " << st.out_of_order
+         << " (depth " << st.max_reorder << ")\tresets: " << st.resets
+         << "\tchecksum failures: " << st.checksum_fail << "\n";
+    cout << "  jitter: " << setprecision(1) << st.jitter_us
+         << " us\tmax latency: " << st.latency_max_us << " us\n";
+    cout << "  latency (us):";
+    for (int b = 0; b < LATENCY_BINS - 1; b++)
+      cout << "  <=" << latency_bin_us[b] << ":" << st.latency_hist[b];
+    cout << "  >" << latency_bin_us[LATENCY_BINS - 2] << ":" << st.latency_hist[LATENCY_BINS - 1]
+         << "\n";
+  }
+}
+
+/**
+ *	\fn void outputEncoderStats()
+ *
+ *	\brief prints the glitch counters of every motor encoder
+ *
+ *	\ingroup IO
+ *
+ *	\return void
+ */
+void outputEncoderStats() {
+  enc_stats st;
+
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    cout << (arm == 0 ? "Gold" : "Green") << " encoders (glitches/faults/wraps):\n ";
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+      if (getEncoderStats(arm, j, &st) < 0) continue;
+      cout << "  " << j << ":" << st.glitches << "/" << st.faults << "/" << st.wraps;
+    }
+    cout << "\n";
+  }
+}
+
+/**
+ *	\fn void outputIKStats()
+ *
+ *	\brief prints the branch selection counters of the analytic inverse kinematics
+ *
+ *	\ingroup IO
+ *
+ *	\return void
+ */
+void outputIKStats() {
+  ik_branch_stats st;
+
+  for (int m = 0; m < MAX_MECH; m++) {
+    if (getIKBranchStats(m, &st) < 0 || st.solves == 0) continue;
+    cout << "Mechanism " << m << " IK branch (solves/fallbacks/switches): " << st.solves << "/"
+         << st.fallbacks << "/" << st.switches << " (" << 100.0 * st.fallbacks / st.solves
+         << "% fallback)\n";
+  }
+}
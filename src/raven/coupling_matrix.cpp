@@ -0,0 +1,281 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file coupling_matrix.cpp
+ *
+ * \brief Cable coupling of each arm as matrices between joint and motor space
+ *
+ * The motor positions of an arm follow from its joint positions as
+ *
+ *     m = A q + B m
+ *
+ * where A holds the transmission ratios and the cable coupling between the
+ * positioning joints, and B lets a motor follow other motors: the tool cables
+ * run over the insertion axis, so the tool motors follow the insertion motor.
+ * B may only read motors whose own row of B is zero.  The inverse cable
+ * coupling evaluates this directly, with either the desired or the actual
+ * insertion motor position; the forward coupling applies
+ *
+ *     q = A^-1 (I - B) m
+ *
+ * to positions and velocities.  By virtual work the joint torques are
+ * C^T times the motor shaft torques, with C = (I + B) A; the capstan torques
+ * the controllers use are the shaft torques times the gearbox ratio.
+ *
+ * The default A and B are built from the transmission ratios in DOF_types,
+ * the CABLE_COUPLING_* terms, and the arm's tool style and wrist coupling.
+ * Either can be replaced per arm without code changes through the parameters
+ * /cable_coupling/{gold,green}/joint_to_motor and .../motor_to_motor, each a
+ * row-major list of 64 numbers over the DOF indices.
+ *
+ * The matrices are computed once in initDOFs() and only read afterwards; all
+ * maps are small fixed-size matrix-vector products.
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <Eigen/Dense>
+
+#include "coupling_matrix.h"
+#include "fwd_cable_coupling.h"
+#include "defines.h"
+#include "log.h"
+#include "utils.h"
+
+extern DOF_type DOF_types[];
+
+typedef Eigen::Matrix<double, CPL_N, CPL_N> cpl_mat;
+
+static coupling_map maps[MAX_MECH];
+
+/// Matrices given as parameters, per arm
+static int have_param_A[MAX_MECH], have_param_B[MAX_MECH];
+static float param_A[MAX_MECH][CPL_N][CPL_N], param_B[MAX_MECH][CPL_N][CPL_N];
+
+/**
+ * \return the arm index (0 gold, 1 green) of a mechanism
+ */
+static inline int mechArm(mechanism *mech) { return mech->type == GOLD_ARM ? 0 : 1; }
+
+/**
+ * \brief y = M x for the fixed coupling size
+ */
+static inline void matVec(const float M[CPL_N][CPL_N], const float x[CPL_N], float y[CPL_N]) {
+  for (int r = 0; r < CPL_N; r++) {
+    float acc = 0;
+    for (int c = 0; c < CPL_N; c++) acc += M[r][c] * x[c];
+    y[r] = acc;
+  }
+}
+
+static void toEigen(const float in[CPL_N][CPL_N], cpl_mat &out) {
+  for (int r = 0; r < CPL_N; r++)
+    for (int c = 0; c < CPL_N; c++) out(r, c) = in[r][c];
+}
+
+static void fromEigen(const cpl_mat &in, float out[CPL_N][CPL_N]) {
+  for (int r = 0; r < CPL_N; r++)
+    for (int c = 0; c < CPL_N; c++) out[r][c] = in(r, c);
+}
+
+/**
+ * \brief Default coupling of an arm from its transmission ratios and tool
+ */
+static void defaultCoupling(mechanism *mech, cpl_mat &A, cpl_mat &B) {
+  const int base = mechArm(mech) * MAX_DOF_PER_MECH;
+  float tr[CPL_N];
+  for (int j = 0; j < CPL_N; j++) tr[j] = DOF_types[base + j].TR;
+
+  A.setZero();
+  B.setZero();
+  A(NO_CONNECTION, NO_CONNECTION) = 1;
+
+  // positioning joints, cables of the elbow and insertion run over the shoulder
+  A(SHOULDER, SHOULDER) = tr[SHOULDER];
+  A(ELBOW, SHOULDER) = tr[ELBOW] * CABLE_COUPLING_01;
+  A(ELBOW, ELBOW) = tr[ELBOW];
+  A(Z_INS, SHOULDER) = tr[Z_INS] * CABLE_COUPLING_02;
+  A(Z_INS, ELBOW) = tr[Z_INS] * CABLE_COUPLING_12;
+  A(Z_INS, Z_INS) = tr[Z_INS];
+
+  // tool joints, the grasp jaws also follow the wrist
+  float tool_coupling = mech->mech_tool.wrist_coupling;
+  A(TOOL_ROT, TOOL_ROT) = tr[TOOL_ROT];
+  A(WRIST, WRIST) = tr[WRIST];
+  A(GRASP1, GRASP1) = tr[GRASP1];
+  A(GRASP1, WRIST) = tr[GRASP1] * tool_coupling;
+  A(GRASP2, GRASP2) = tr[GRASP2];
+  A(GRASP2, WRIST) = -tr[GRASP2] * tool_coupling;
+
+  // tool motors follow the insertion motor
+  int sgn = 0;
+  switch (mech->mech_tool.t_style) {
+    case raven:
+      sgn = (mech->type == GOLD_ARM) ? 1 : -1;
+      break;
+    case dv:
+      sgn = (mech->type != GOLD_ARM) ? 1 : -1;
+      break;
+    case square_raven:
+      sgn = -1;
+      break;
+    default:
+      log_msg("undefined tool style!!! coupling_matrix.cpp");
+      break;
+  }
+  int sgn_6 = sgn;
+#ifdef OPPOSE_GRIP
+  sgn_6 *= -1;
+#endif
+  B(TOOL_ROT, Z_INS) = sgn / GB_RATIO;
+  B(WRIST, Z_INS) = sgn / GB_RATIO;
+  B(GRASP1, Z_INS) = sgn_6 / GB_RATIO;
+  B(GRASP2, Z_INS) = sgn / GB_RATIO;
+}
+
+/**
+ * \brief Builds the coupling matrices of a mechanism
+ *
+ * Uses the parameter matrices where given, the default coupling otherwise.
+ * Run once the transmission ratios and the tool are known.
+ *
+ * \param mech  the mechanism
+ * \return 0 on success, -1 if the coupling is singular or B is not allowed
+ */
+int initCouplingMatrices(mechanism *mech) {
+  const int arm = mechArm(mech);
+  coupling_map *c = &maps[arm];
+  cpl_mat A, B;
+
+  defaultCoupling(mech, A, B);
+  if (have_param_A[arm]) toEigen(param_A[arm], A);
+  if (have_param_B[arm]) toEigen(param_B[arm], B);
+
+  cpl_mat I = cpl_mat::Identity();
+  Eigen::FullPivLU<cpl_mat> lu(A);
+  if (!lu.isInvertible() || (B * B).cwiseAbs().maxCoeff() > 1e-9) {
+    log_msg("Cable coupling of arm %d is singular or chains motors, using the default", arm);
+    defaultCoupling(mech, A, B);
+    lu.compute(A);
+  }
+
+  cpl_mat fwd = lu.inverse() * (I - B);
+  cpl_mat C = (I + B) * A;
+  cpl_mat gb = cpl_mat::Zero();
+  for (int j = 0; j < CPL_N; j++)
+    gb(j, j) = (j == NO_CONNECTION) ? 1 : (j < NO_CONNECTION) ? GEAR_BOX_GP42_TR : GEAR_BOX_GP32_TR;
+
+  fromEigen(A, c->joint_to_motor);
+  fromEigen(B, c->motor_to_motor);
+  fromEigen(fwd, c->motor_to_joint);
+  fromEigen(C.transpose() * gb.inverse(), c->capstan_to_joint);
+  fromEigen(gb * fwd.transpose(), c->joint_to_capstan);
+  c->valid = TRUE;
+
+  return 0;
+}
+
+/**
+ * \return the coupling of a mechanism, NULL for a bad mechanism type or
+ *         before initCouplingMatrices()
+ */
+const coupling_map *getCouplingMap(mechanism *mech) {
+  if (mech->type != GOLD_ARM && mech->type != GREEN_ARM) return NULL;
+  const coupling_map *c = &maps[mechArm(mech)];
+  return c->valid ? c : NULL;
+}
+
+/**
+ * \brief Joint positions (or velocities) from motor positions (or velocities)
+ */
+void couplingMotorToJoint(const coupling_map *c, const float m[CPL_N], float q[CPL_N]) {
+  matVec(c->motor_to_joint, m, q);
+}
+
+/**
+ * \brief Motor positions from joint positions
+ *
+ * \param c         the coupling
+ * \param q         joint positions
+ * \param m_actual  motor positions the B terms follow, NULL to follow the
+ *                  motor positions computed from q
+ * \param m         receives the motor positions
+ */
+void couplingJointToMotor(const coupling_map *c, const float q[CPL_N], const float *m_actual,
+                          float m[CPL_N]) {
+  float mA[CPL_N], mB[CPL_N];
+
+  matVec(c->joint_to_motor, q, mA);
+  matVec(c->motor_to_motor, m_actual ? m_actual : mA, mB);
+  for (int j = 0; j < CPL_N; j++) m[j] = mA[j] + mB[j];
+}
+
+/**
+ * \brief Capstan torques that produce the given joint torques
+ *
+ * \param arm  0 for gold, 1 for green
+ */
+void couplingJointToCapstanTorque(int arm, const float tau_j[CPL_N], float tau_c[CPL_N]) {
+  matVec(maps[arm].joint_to_capstan, tau_j, tau_c);
+}
+
+/**
+ * \brief Joint torques produced by the given capstan torques
+ *
+ * \param arm  0 for gold, 1 for green
+ */
+void couplingCapstanToJointTorque(int arm, const float tau_c[CPL_N], float tau_j[CPL_N]) {
+  matVec(maps[arm].capstan_to_joint, tau_c, tau_j);
+}
+
+/**
+ * \brief Reads one coupling matrix parameter
+ *
+ * \return TRUE if the parameter holds a valid matrix
+ */
+static int readMatrixParam(ros::NodeHandle &n, const std::string &name, float out[CPL_N][CPL_N]) {
+  float v[CPL_N * CPL_N];
+
+  if (!getParamList(n, name, v, CPL_N * CPL_N)) return FALSE;
+  for (int r = 0; r < CPL_N; r++)
+    for (int c = 0; c < CPL_N; c++) out[r][c] = v[r * CPL_N + c];
+  log_msg("Cable coupling from %s", name.c_str());
+  return TRUE;
+}
+
+/**
+ * \brief Reads coupling matrices given as parameters
+ *
+ * \param n  the ros node handle
+ * \return 0
+ */
+int init_cable_coupling(ros::NodeHandle &n) {
+  const char *arm_names[MAX_MECH] = {"gold", "green"};
+
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    std::string prefix = std::string("/cable_coupling/") + arm_names[arm];
+    have_param_A[arm] = readMatrixParam(n, prefix + "/joint_to_motor", param_A[arm]);
+    have_param_B[arm] = readMatrixParam(n, prefix + "/motor_to_motor", param_B[arm]);
+  }
+
+  return 0;
+}
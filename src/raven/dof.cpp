@@ -20,7 +20,8 @@
 
 /**
  * dof.c - functions that fill in the DOF structure
- *     processEncVal - process an encoder value from a USB packet
+ *     decodeEncVals - decode the encoder values of a USB packet
+ *     initEncMap - compute the encoder directions of a mechanism
  *     encToJPos - go from an encoder value to a Joint position
  *
  * Kenneth Fodero
@@ -35,9 +36,10 @@
 *        \brief This is a file to translate motor encoder values to robot
 *position or joint angles.
 *
-*        \fn These are the 4 functions in dof.cpp file.
+*        \fn These are the functions in dof.cpp file.
 *            Functions marked with "*" are called explicitly from other files.
-*             *(1) processEncVal
+*             *(1) decodeEncVals
+*             *(1a) initEncMap
 *              (2) encToMPos               :uses (3)
 *              (3) encToMPos2              :uses (4)
 *              (4) normalizedEncCnt
@@ -56,31 +58,77 @@
 extern DOF_type DOF_types[];
 
 /**
- * processEncVal - reads an encoder value from a USB packet buffer
- *   and returns the integer result
+ * decodeEncVals - decodes all encoder channels of a USB packet buffer
+ *
+ * Each channel is a little-endian 24 bit two's complement count in bytes
+ * 3 + 3 * channel onwards (see atmel_code/main.c: in_packet()).  The loop is
+ * branch free over a fixed channel count so the compiler can vectorize it;
+ * the count is sign extended by an arithmetic shift.
  *
  * \param buffer[] - the USB packet buffer
- * \param channel - the encoder channel to load
+ * \param numChannels - the number of channels in the packet
+ * \param out[] - receives numChannels encoder counts
+ */
+void decodeEncVals(const unsigned char buffer[], int numChannels, int out[]) {
+  int vals[MAX_DOF_PER_MECH];
+#ifdef RAVEN_I
+  const int sign = 1;
+#else
+  const int sign = -1;
+#endif
+
+  for (int i = 0; i < MAX_DOF_PER_MECH; i++) {
+    const unsigned char *b = &buffer[3 * i + 3];
+    unsigned int raw = ((unsigned int)b[2] << 24) | ((unsigned int)b[1] << 16) | (b[0] << 8);
+    vals[i] = sign * ((int)raw >> 8);
+  }
+
+  if (numChannels > MAX_DOF_PER_MECH) numChannels = MAX_DOF_PER_MECH;
+  for (int i = 0; i < numChannels; i++) out[i] = vals[i];
+}
+
+/**
+ * initEncMap - computes the encoder directions and scales of a mechanism from
+ *   its arm and tool style.  Run once the tool is known.
  *
- * \return the resulting encoder value
+ * \param mech the mechanism
  */
-int processEncVal(unsigned char buffer[], int channel) {
-  int result;
+void initEncMap(mechanism *mech) {
+  enc_map *map = &mech->enc;
+  int gold = (mech->type == GOLD_ARM);
 
-  // encoder value is in bytes 3,4,and 5 of the usb in-packet
-  // see atmel_code/main.c: in_packet() for more info
-  result =
-      (buffer[3 * channel + 5] << 16) | (buffer[3 * channel + 4] << 8) | (buffer[3 * channel + 3]);
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    int tool = (j == TOOL_ROT || j == WRIST || j == GRASP1 || j == GRASP2);
+    int flip;
 
-  // Handle negative values by padding result with ones
-  if (result >> 23) {
-    result = result | 0xFF000000;
-  }
-#ifdef RAVEN_I
-  return result;
-#else
-  return (-1 * result);
+    // Motor encoder values on the Gold arm are reversed
+    switch (mech->mech_tool.t_style) {
+      case dv:
+        flip = gold && !tool;
+        break;
+      case square_raven:
+        // Green arm tools are also reversed with square pattern
+        flip = (gold && !tool) || (!gold && tool);
+        break;
+      default:
+        flip = gold || tool;
+        break;
+    }
+#ifdef OPPOSE_GRIP
+    if (j == GRASP1) flip = !flip;  // switch encoder value for opposed grasp
 #endif
+    map->motor_sign[j] = flip ? -1 : 1;
+
+    // Joint encoders count the other way on the Green arm and on insertion
+    map->joint_sign[j] = (gold ? 1 : -1) * (j == Z_INS ? -1 : 1);
+
+    if ((j == SHOULDER) || (j == ELBOW))
+      map->joint_cnts[j] = ROTARY_JOINT_ENC_PER_REV / (2 * PI);
+    else if (j == Z_INS)
+      map->joint_cnts[j] = LINEAR_JOINT_ENC_PER_M;
+    else
+      map->joint_cnts[j] = 0;
+  }
 }
 
 /**
@@ -0,0 +1,159 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file encoder_check.cpp
+ *
+ * \brief Validation of motor encoder counts between USB decode and state estimation
+ *
+ * A bit error in a 24-bit encoder count shows up as a jump no motor could make
+ * in one cycle, and would otherwise become a velocity spike the PD loop acts on.
+ * Each decoded count is compared with the last good one: the step, taken
+ * modulo 2^24 so a counter wrap is a small step, must stay below what
+ * ENC_MAX_MOTOR_VEL allows for the packets since that good sample.  Good steps
+ * are accumulated into an unwrapped count written to enc_val.  A bad sample is
+ * dropped and the channel holds its last good count.
+ *
+ * A channel that holds for more than ENC_MAX_HOLD packets, or a mechanism with
+ * more than ENC_MAX_GLITCHES glitches in ENC_GLITCH_WINDOW packets, is a
+ * persistent fault: the channel resynchronizes to the new count and the RT loop
+ * soft e-stops through checkEncoderFaults().
+ *
+ * \ingroup IO
+ */
+
+#include <cstdlib>
+
+#include "encoder_check.h"
+#include "defines.h"
+#include "struct.h"
+#include "motor.h"
+#include "log.h"
+
+/// Largest count step per packet at ENC_MAX_MOTOR_VEL
+const static int ENC_MAX_STEP = ENC_MAX_MOTOR_VEL * ENC_CNTS_PER_REV / (2 * M_PI) * STEP_PERIOD;
+
+/// Validation state of one motor encoder
+struct enc_check {
+  int valid;     // seeded with a first count
+  int last_raw;  // last good decoded count
+  int good;      // unwrapped count of the last good sample
+  enc_stats st;
+};
+
+/// Validation state of one mechanism, indexed by arm
+struct mech_enc_check {
+  enc_check joint[MAX_DOF_PER_MECH];
+  int packets;          // packets in the current glitch window
+  int window_glitches;  // glitches in the current glitch window
+};
+
+static mech_enc_check checks[MAX_MECH];
+static volatile int fault_pending = FALSE;
+
+/**
+ * \brief Validates the decoded motor encoder counts of a mechanism
+ *
+ * Called for every encoder packet.  Writes the accepted (or held) unwrapped
+ * count of each channel to enc_val.
+ *
+ * \param mech         the mechanism the packet belongs to
+ * \param encVals      decoded counts, see decodeEncVals()
+ * \param numChannels  channels in the packet
+ */
+void validateEncoders(mechanism *mech, const int encVals[], int numChannels) {
+  mech_enc_check *mc = &checks[mech->type == GOLD_ARM ? 0 : 1];
+
+  for (int i = 0; i < numChannels && i < MAX_DOF_PER_MECH; i++) {
+    enc_check *c = &mc->joint[i];
+    int raw = encVals[i];
+
+    if (!c->valid) {
+      c->valid = TRUE;
+      c->last_raw = c->good = raw;
+      mech->joint[i].enc_val = raw;
+      continue;
+    }
+
+    // step modulo 2^24, so the counter wrapping around is a small step
+    int diff = raw - c->last_raw;
+    int delta = (int)((unsigned int)diff << 8) >> 8;
+    int max_step = ENC_MAX_STEP * (c->st.held + 1);
+
+    if (abs(delta) <= max_step) {
+      if (delta != diff) c->st.wraps++;
+      c->good += delta;
+      c->last_raw = raw;
+      c->st.held = 0;
+    } else {
+      c->st.glitches++;
+      mc->window_glitches++;
+      if (c->st.glitches == 1)
+        log_msg("Encoder glitch on arm %d channel %d: step of %d counts", mech->type, i, delta);
+
+      if (++c->st.held > ENC_MAX_HOLD) {
+        log_msg("Encoder fault on arm %d channel %d: %d bad packets in a row", mech->type, i,
+                c->st.held);
+        c->st.faults++;
+        c->st.held = 0;
+        c->good += delta;
+        c->last_raw = raw;
+        fault_pending = TRUE;
+      }
+    }
+    mech->joint[i].enc_val = c->good;
+  }
+
+  if (++mc->packets >= ENC_GLITCH_WINDOW) {
+    if (mc->window_glitches > ENC_MAX_GLITCHES) {
+      log_msg("Encoder fault on arm %d: %d glitches in %d packets", mech->type,
+              mc->window_glitches, mc->packets);
+      fault_pending = TRUE;
+    }
+    mc->packets = mc->window_glitches = 0;
+  }
+}
+
+/**
+ * \brief Reports a persistent encoder fault once
+ *
+ * \param runlevel  the current runlevel; faults found in e-stop are dropped
+ * \return TRUE if the robot should soft e-stop, FALSE otherwise
+ */
+int checkEncoderFaults(int runlevel) {
+  if (!fault_pending) return FALSE;
+  fault_pending = FALSE;
+
+  return runlevel != RL_E_STOP;
+}
+
+/**
+ * \brief Copies the counters of one motor encoder
+ *
+ * \param arm  0 for gold, 1 for green
+ * \param dof  the DOF index within the arm
+ * \param out  receives the counters
+ * \return 0 on success, -1 for an unknown arm or DOF
+ */
+int getEncoderStats(int arm, int dof, enc_stats *out) {
+  if (arm < 0 || arm >= MAX_MECH || dof < 0 || dof >= MAX_DOF_PER_MECH) return -1;
+  *out = checks[arm].joint[dof].st;
+  return 0;
+}
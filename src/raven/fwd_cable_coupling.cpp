@@ -40,6 +40,7 @@
  */
 
 #include "fwd_cable_coupling.h"
+#include "coupling_matrix.h"
 #include "log.h"
 
 extern DOF_type DOF_types[];
@@ -70,41 +71,14 @@ int fwdJointEncoders(device *device0) {
   DOF *_joint = NULL;
   mechanism *_mech = NULL;
   int i = 0, j = 0;
-  int enc_count_per_unit;
-  int enc_val, enc_off;
-  static int twice = 0;
 
   // loop over joints, calculate only major axes with joint encoders
   while (loop_over_joints(device0, _mech, _joint, i, j)) {
-    if (!is_toolDOF(_joint)) {
-      if ((j == SHOULDER) || (j == ELBOW))  // if joint is shoulder or elbow
-        enc_count_per_unit = ROTARY_JOINT_ENC_PER_REV / (2 * PI);
-      else if (j == Z_INS)
-        enc_count_per_unit = LINEAR_JOINT_ENC_PER_M;
+    float enc_count_per_unit = _mech->enc.joint_cnts[j];
+    if (enc_count_per_unit == 0) continue;
 
-      enc_val = _joint->joint_enc_val;
-      enc_off = _joint->joint_enc_offset;
-
-      // flip encoder direction for GOLD arm
-      if ((_mech->type == GREEN_ARM)) {
-        enc_val *= -1;
-      }
-      if (j == Z_INS) {
-        enc_val *= -1;
-      }
-
-      _joint->j_enc_pos = (float)(enc_val - enc_off) / (float)((enc_count_per_unit));
-      /*
-      if (gTime % 3000 == 0){
-              log_msg("joint		%d", j);
-              log_msg("enc value			= %d", encoder_val);
-              log_msg("enc offset			= %d", encoder_off);
-              log_msg("enc count per rev 	= %d", enc_count_per_rev);
-              log_msg("");
-              twice++;
-      }
-      */
-    }
+    int enc_val = _mech->enc.joint_sign[j] * _joint->joint_enc_val;
+    _joint->j_enc_pos = (float)(enc_val - _joint->joint_enc_offset) / enc_count_per_unit;
   }
 
   return 0;
@@ -112,114 +86,37 @@ int fwdJointEncoders(device *device0) {
 
 /**
  * \fn void fwdMechCableCoupling(mechanism *mech)
+ * \brief calculates joint positions and velocities from motor positions and
+ *velocities through the coupling matrices of the arm
  * \param mech
  * \return void
  */
 
 void fwdMechCableCoupling(mechanism *mech) {
-  float th1, th2, th3, th5, th6, th7;
-  float th1_dot, th2_dot;
-  float d4;
-  float d4_dot;
-  float m1, m2, m3, m4, m5, m6, m7;
-  float m1_dot, m2_dot, m4_dot;
-  float tr1 = 0, tr2 = 0, tr3 = 0, tr4 = 0, tr5 = 0, tr6 = 0, tr7 = 0;
-
-  // get motor positions
-  m1 = mech->joint[SHOULDER].mpos;
-  m2 = mech->joint[ELBOW].mpos;
-  m3 = mech->joint[TOOL_ROT].mpos;
-  m4 = mech->joint[Z_INS].mpos;
-  m5 = mech->joint[WRIST].mpos;
-  m6 = mech->joint[GRASP1].mpos;
-  m7 = mech->joint[GRASP2].mpos;
-
-  // get motor velocities
-  m1_dot = mech->joint[SHOULDER].mvel;
-  m2_dot = mech->joint[ELBOW].mvel;
-  m4_dot = mech->joint[Z_INS].mvel;
-
-  // get transfer ratios for each arm
-  if (mech->type == GOLD_ARM) {
-    tr1 = DOF_types[SHOULDER_GOLD].TR;
-    tr2 = DOF_types[ELBOW_GOLD].TR;
-    tr3 = DOF_types[TOOL_ROT_GOLD].TR;
-    tr4 = DOF_types[Z_INS_GOLD].TR;
-    tr5 = DOF_types[WRIST_GOLD].TR;
-    tr6 = DOF_types[GRASP1_GOLD].TR;
-    tr7 = DOF_types[GRASP2_GOLD].TR;
-
-  } else if (mech->type == GREEN_ARM) {
-    tr1 = DOF_types[SHOULDER_GREEN].TR;
-    tr2 = DOF_types[ELBOW_GREEN].TR;
-    tr3 = DOF_types[TOOL_ROT_GREEN].TR;
-    tr4 = DOF_types[Z_INS_GREEN].TR;
-    tr5 = DOF_types[WRIST_GREEN].TR;
-    tr6 = DOF_types[GRASP1_GREEN].TR;
-    tr7 = DOF_types[GRASP2_GREEN].TR;
-  } else {
+  const coupling_map *c = getCouplingMap(mech);
+  if (c == NULL) {
     log_msg("ERROR: incorrect device type in fwdMechCableCoupling");
     return;
   }
 
+  float m[CPL_N], m_dot[CPL_N], q[CPL_N], q_dot[CPL_N];
+  for (int j = 0; j < CPL_N; j++) {
+    m[j] = mech->joint[j].mpos;
+    m_dot[j] = mech->joint[j].mvel;
+  }
+
   // Forward Cable Coupling equations
   //   Originally based on 11/7/2005, Mitch notebook pg. 169
-  //   Updated from UCSC code.  Code simplified by HK 8/11
-  th1 = (1.0 / tr1) * m1;
-
-  // DELETEME
-  //	th2 = (1.0/tr2) * m2; // additional CC terms added 3/13
-  //	d4  = (1.0/tr4) * m4;
-
-  th2 = (1.0 / tr2) * m2 - CABLE_COUPLING_01 * th1;
-  d4 = (1.0 / tr4) * m4 - CABLE_COUPLING_02 * th1 - CABLE_COUPLING_12 * th2;
-
-  // TODO:: Update with new cable coupling terms
-  th1_dot = (1.0 / tr1) * m1_dot;
-  th2_dot = (1.0 / tr2) * m2_dot;
-  d4_dot = (1.0 / tr4) * m4_dot;
-
-  // Tool degrees of freedom ===========================================
-  int sgn = 0;
-  switch (mech->mech_tool.t_style) {
-    case raven:
-      sgn = (mech->type == GOLD_ARM) ? 1 : -1;
-      break;
-    case dv:
-      sgn = (mech->type != GOLD_ARM) ? 1 : -1;
-      break;
-    case square_raven:
-      sgn = -1;
-      break;
-    default:
-      log_msg("undefined tool style!!! inv_cable_coupling.cpp");
-      break;
+  //   The coupling is linear, so velocities map like positions.
+  couplingMotorToJoint(c, m, q);
+  couplingMotorToJoint(c, m_dot, q_dot);
+
+  for (int j = 0; j < CPL_N; j++) {
+    if (j == NO_CONNECTION) continue;
+    mech->joint[j].jpos = q[j];
+    mech->joint[j].jvel = q_dot[j];
   }
 
-  int sgn_6 = sgn;
-#ifdef OPPOSE_GRIP
-  sgn_6 *= -1;
-#endif
-
-  float tool_coupling = mech->mech_tool.wrist_coupling;
-  th3 = (1.0 / tr3) * (m3 - sgn * m4 / GB_RATIO);
-  th5 = (1.0 / tr5) * (m5 - sgn * m4 / GB_RATIO);
-  th6 = (1.0 / tr6) * (m6 - sgn_6 * m4 / GB_RATIO) - th5 * tool_coupling;
-  th7 = (1.0 / tr7) * (m7 - sgn * m4 / GB_RATIO) + th5 * tool_coupling;
-
-  // Now have solved for th1, th2, d3, th4, th5, th6
-  mech->joint[SHOULDER].jpos = th1;  // - mech->joint[SHOULDER].jpos_off;
-  mech->joint[ELBOW].jpos = th2;     // - mech->joint[ELBOW].jpos_off;
-  mech->joint[TOOL_ROT].jpos = th3;  // - mech->joint[TOOL_ROT].jpos_off;
-  mech->joint[Z_INS].jpos = d4;      //  - mech->joint[Z_INS].jpos_off;
-  mech->joint[WRIST].jpos = th5;     // - mech->joint[WRIST].jpos_off;
-  mech->joint[GRASP1].jpos = th6;    // - mech->joint[GRASP1].jpos_off;
-  mech->joint[GRASP2].jpos = th7;    // - mech->joint[GRASP2].jpos_off;
-
-  mech->joint[SHOULDER].jvel = th1_dot;  // - mech->joint[SHOULDER].jpos_off;
-  mech->joint[ELBOW].jvel = th2_dot;     // - mech->joint[ELBOW].jpos_off;
-  mech->joint[Z_INS].jvel = d4_dot;      //  - mech->joint[Z_INS].jpos_off;
-
   return;
 }
 
@@ -241,99 +138,10 @@ void fwdTorqueCoupling(device *device0, int runlevel) {
 /**
  * \fn void fwdMechTorqueCoupling(mechanism *mech)
  * \brief calculates joint position and velocity based on motor position and
- *velocity
+ *velocity, same as fwdMechCableCoupling
  *
  * \param mech
  * \return void
  */
 
-void fwdMechTorqueCoupling(mechanism *mech) {
-  float th1 = 0, th2 = 0, th3 = 0, th5 = 0, th6 = 0, th7 = 0;
-  float th1_dot, th2_dot;
-  float d4;
-  float d4_dot;
-  float m1, m2, m3, m4, m5, m6, m7;
-  float m1_dot, m2_dot, m4_dot;
-  float tr1 = 0, tr2 = 0, tr3 = 0, tr4 = 0, tr5 = 0, tr6 = 0, tr7 = 0;
-
-  m1 = mech->joint[SHOULDER].mpos;
-  m2 = mech->joint[ELBOW].mpos;
-  m3 = mech->joint[TOOL_ROT].mpos;
-  m4 = mech->joint[Z_INS].mpos;
-  m5 = mech->joint[WRIST].mpos;
-  m6 = mech->joint[GRASP1].mpos;
-  m7 = mech->joint[GRASP2].mpos;
-
-  m1_dot = mech->joint[SHOULDER].mvel;
-  m2_dot = mech->joint[ELBOW].mvel;
-  m4_dot = mech->joint[Z_INS].mvel;
-
-  if (mech->type == GOLD_ARM) {
-    tr1 = DOF_types[SHOULDER_GOLD].TR;
-    tr2 = DOF_types[ELBOW_GOLD].TR;
-    tr3 = DOF_types[TOOL_ROT_GOLD].TR;
-    tr4 = DOF_types[Z_INS_GOLD].TR;
-    tr5 = DOF_types[WRIST_GOLD].TR;
-    tr6 = DOF_types[GRASP1_GOLD].TR;
-    tr7 = DOF_types[GRASP2_GOLD].TR;
-
-  } else if (mech->type == GREEN_ARM) {
-    tr1 = DOF_types[SHOULDER_GREEN].TR;
-    tr2 = DOF_types[ELBOW_GREEN].TR;
-    tr3 = DOF_types[TOOL_ROT_GREEN].TR;
-    tr4 = DOF_types[Z_INS_GREEN].TR;
-    tr5 = DOF_types[WRIST_GREEN].TR;
-    tr6 = DOF_types[GRASP1_GREEN].TR;
-    tr7 = DOF_types[GRASP2_GREEN].TR;
-  } else {
-    log_msg("ERROR: incorrect device type in fwdMechCableCoupling");
-    return;
-  }
-
-  // Forward Cable Coupling equations
-  //   Originally based on 11/7/2005, Mitch notebook pg. 169
-  //   Updated from UCSC code.  Code simplified by HK 8/11
-  th1 = (1.0 / tr1) * m1;
-
-  // DELETEME
-  //	th2 = (1.0/tr2) * m2; // additional CC terms added 3/13
-  //	d4  = (1.0/tr4) * m4;
-
-  th2 = (1.0 / tr2) * m2 - CABLE_COUPLING_01 * th1;
-  d4 = (1.0 / tr4) * m4 - CABLE_COUPLING_02 * th1 - CABLE_COUPLING_12 * th2;
-
-  // TODO:: Update with new cable coupling terms
-  th1_dot = (1.0 / tr1) * m1_dot;
-  th2_dot = (1.0 / tr2) * m2_dot;
-  d4_dot = (1.0 / tr4) * m4_dot;
-
-  // TODO:: why is only the RAVEN tool referenced in this?
-  // Tool degrees of freedom ===========================================
-  //	if (mech->tool_type == TOOL_GRASPER_10MM)
-  //	{
-  int sgn = (mech->type == GOLD_ARM) ? 1 : -1;
-  int sgn_6 = sgn;
-#ifdef OPPOSE_GRIP
-  sgn_6 = -1 * sgn;
-#endif
-  th3 = (1.0 / tr3) * (m3 - sgn * m4 / GB_RATIO);
-  th5 = (1.0 / tr5) * (m5 - sgn * m4 / GB_RATIO);
-  th6 = (1.0 / tr6) * (m6 - sgn_6 * m4 / GB_RATIO);
-  th7 = (1.0 / tr7) * (m7 - sgn * m4 / GB_RATIO);
-  //	}
-
-  // Now have solved for th1, th2, d3, th4, th5, th6
-  mech->joint[SHOULDER].jpos = th1;  // - mech->joint[SHOULDER].jpos_off;
-  mech->joint[ELBOW].jpos = th2;     // - mech->joint[ELBOW].jpos_off;
-  mech->joint[TOOL_ROT].jpos = th3;  // - mech->joint[TOOL_ROT].jpos_off;
-  mech->joint[Z_INS].jpos = d4;      //  - mech->joint[Z_INS].jpos_off;
-  mech->joint[WRIST].jpos = th5;     // - mech->joint[WRIST].jpos_off;
-  mech->joint[GRASP1].jpos = th6;    // - mech->joint[GRASP1].jpos_off;
-  mech->joint[GRASP2].jpos = th7;    // - mech->joint[GRASP2].jpos_off;
-
-  mech->joint[SHOULDER].jvel = th1_dot;  // - mech->joint[SHOULDER].jpos_off;
-  mech->joint[ELBOW].jvel = th2_dot;     // - mech->joint[ELBOW].jpos_off;
-  mech->joint[Z_INS].jvel = d4_dot;      //  - mech->joint[Z_INS].jpos_off;
-
-  return;
-}
+void fwdMechTorqueCoupling(mechanism *mech) { fwdMechCableCoupling(mech); }
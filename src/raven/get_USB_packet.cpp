@@ -36,6 +36,7 @@
  */
 
 #include "get_USB_packet.h"
+#include "encoder_check.h"
 
 extern unsigned long int gTime;
 extern USBStruct USBBoards;
@@ -149,8 +150,8 @@ int getUSBPacket(int id, device *dev, int index) {
   \param buffer
  */
 void processEncoderPacket(mechanism *mech, unsigned char buffer[]) {
-  int i, numChannels;
-  int encVal;
+  int numChannels;
+  int encVals[MAX_DOF_PER_MECH];
 
   // Determine channels of data received
   numChannels = buffer[1];
@@ -162,12 +163,10 @@ void processEncoderPacket(mechanism *mech, unsigned char buffer[]) {
   mech->inputs = buffer[2];
 #endif
 
-  // Loop through and read data for each channel
-  for (i = 0; i < numChannels; i++) {
-    // Load encoder values
-    encVal = processEncVal(buffer, i);
-    mech->joint[i].enc_val = encVal;
-  }
+  // Decode all channels, then load the validated encoder values
+  if (numChannels > MAX_DOF_PER_MECH) numChannels = MAX_DOF_PER_MECH;
+  decodeEncVals(buffer, numChannels, encVals);
+  validateEncoders(mech, encVals, numChannels);
 
   return;
 }
@@ -180,7 +179,7 @@ void processEncoderPacket(mechanism *mech, unsigned char buffer[]) {
  */
 void processJointEncoderPacket(device *dev, unsigned char buffer[]) {
   int i, numChannels;
-  int encVal;
+  int encVals[MAX_DOF_PER_MECH];
   mechanism *mech_gold;
   mechanism *mech_green;
 
@@ -196,19 +195,14 @@ void processJointEncoderPacket(device *dev, unsigned char buffer[]) {
     }
   }
 
-  // Loop through and read data for each channel
-  // place the values in the appropriate mechanism
-  for (i = 0; i < numChannels / 2; i++) {
-    // Load encoder values
-    encVal = processEncVal(buffer, i);
-    mech_gold->joint[i].joint_enc_val = encVal;
-  }
+  // Decode all channels, then place the values in the appropriate mechanism
+  if (numChannels > MAX_DOF_PER_MECH) numChannels = MAX_DOF_PER_MECH;
+  decodeEncVals(buffer, numChannels, encVals);
+  for (i = 0; i < numChannels / 2; i++) mech_gold->joint[i].joint_enc_val = encVals[i];
 
-  for (i = 0; i < numChannels / 2; i++) {
-    // Load green encoder values (4-7) into mech joints 0-3
-    encVal = processEncVal(buffer, i + numChannels / 2);
-    mech_green->joint[i].joint_enc_val = encVal;
-  }
+  // Load green encoder values (4-7) into mech joints 0-3
+  for (i = 0; i < numChannels / 2; i++)
+    mech_green->joint[i].joint_enc_val = encVals[i + numChannels / 2];
 
   return;
 }
@@ -20,19 +20,26 @@
 
 /** \file  grav_comp.cpp
  *
- *  \brief Functions for calculating gravity torques
+ *  \brief Functions for calculating gravity and dynamics torques
  *
- *  \desc  These functions will calculate gravity loads on each of the first 3
- *DOFs with predefined mass properties.
- *         However, arbitrary gravity vectors can be specified in the currParams
- *data structure, which are then
- *         used in these calculations.
+ *  \desc  These functions calculate the gravity load on every DOF with
+ *predefined mass properties, reusing the link transforms from this cycle's
+ *forward kinematics.  Arbitrary gravity vectors can be specified in the device
+ *struct, which are then used in these calculations.  Optionally a recursive
+ *Newton-Euler pass adds the inertial and Coriolis torques of the desired
+ *motion as feed-forward.
  *
- *  \fn    These are the 3 functions in grav_comp.cpp file.
+ *  \fn    These are the functions in grav_comp.cpp file.
  *         Functions marked with "*" are called explicitly from other files.
  *             (1) getCurrentG
- * 	      *(2) getGravityTorque			:uses (1)(3)
- *             (3) getMotorTorqueFromJointTorque
+ * 	      *(2) getGravityTorque			:uses (1)(3)(4)(5)
+ *             (3) updateDesiredMotion
+ *             (4) newtonEuler
+ *             (5) getMotorTorqueFromJointTorque
+ *            *(6) init_dynamics
+ *            *(7) setDynamicsFeedForward
+ *            *(8) getGravityParams / setGravityParams
+ *            *(9) gravityJointTorques
  *
  *  \log   Re-written March 2013 by Andy Lewis and Hawkeye King
  *         Equations re-derived for UW Kinematics formulations for Raven II
@@ -47,7 +54,9 @@
  */
 
 #include "grav_comp.h"
+#include "gravity_lut.h"
 #include "r2_kinematics.h"
+#include "coupling_matrix.h"
 #include "log.h"
 
 extern int NUM_MECH;
@@ -76,8 +85,44 @@ const static double M2 = 0.750;  // kg --> ? lb
 const static double M3 = 0.231;  // kg --> ? lb
 // masses updated using fresh links from raven 2.1 build 6/13
 
+// Links 1..6 (frames 1..6) of each arm.  The tool shaft, wrist and jaws are
+// lumped into link 3 until they are measured separately.
+const static tf::Matrix3x3 I_ZERO(0, 0, 0, 0, 0, 0, 0, 0, 0);
+const static link_mass LINKS_GL[6] = {{M1, COM1_1_GL, I_ZERO}, {M2, COM2_2_GL, I_ZERO},
+                                      {M3, COM3_3_GL, I_ZERO}, {0, tf::Vector3(0, 0, 0), I_ZERO},
+                                      {0, tf::Vector3(0, 0, 0), I_ZERO},
+                                      {0, tf::Vector3(0, 0, 0), I_ZERO}};
+const static link_mass LINKS_GR[6] = {{M1, COM1_1_GR, I_ZERO}, {M2, COM2_2_GR, I_ZERO},
+                                      {M3, COM3_3_GR, I_ZERO}, {0, tf::Vector3(0, 0, 0), I_ZERO},
+                                      {0, tf::Vector3(0, 0, 0), I_ZERO},
+                                      {0, tf::Vector3(0, 0, 0), I_ZERO}};
+
+// Mass properties in use, double buffered so an identified set can be swapped
+// in between control cycles: [buffer][0 gold, 1 green][link]
+static link_mass linkSets[2][2][6];
+static volatile int activeSet = 0;
+static volatile int pendingSet = FALSE;
+static volatile unsigned int paramsVersion = 0;  // number of sets adopted
+
+// DH link (theta index) driving each DOF; link 6 is driven by both grasp DOFs
+const static int DOF_LINK[MAX_DOF_PER_MECH] = {0, 1, 2, -1, 3, 4, 5, 5};
+
+// Smoothing of the differentiated desired motion (per 1 ms cycle)
+#define DYN_FF_ALPHA 0.1
+
+static volatile int dynamics_ff = FALSE;
+
+/// Desired joint motion of one mechanism in DH (theta) coordinates
+struct desired_motion {
+  int valid;
+  double q[6];
+  double qd[6];
+  double qdd[6];
+};
+static desired_motion motion[MAX_MECH];
+
 tf::Vector3 getCurrentG(device *d0, int m);
-void getMotorTorqueFromJointTorque(int, double, double, double, double &, double &, double &);
+void getMotorTorqueFromJointTorque(int, const double *, double *);
 
 /**
  * getCurrentG()
@@ -108,152 +153,296 @@ tf::Vector3 getCurrentG(device *d0, int m) {
   return tf::Vector3(xG0, yG0, zG0);
 }
 
+/**
+ * updateDesiredMotion()
+ * \brief Differentiate the desired joint positions into smoothed desired
+ *velocities and accelerations for the feed-forward
+ *
+ * \param _mech     the mechanism
+ * \param m         the mechanism index
+ * \param active    FALSE resets the motion to rest at the current setpoint
+ *
+ * \return pointer to the desired motion of mechanism m
+ */
+static const desired_motion *updateDesiredMotion(mechanism *_mech, int m, int active) {
+  desired_motion *dm = &motion[m];
+  double joints[6] = {_mech->joint[SHOULDER].jpos_d, _mech->joint[ELBOW].jpos_d,
+                      _mech->joint[Z_INS].jpos_d,    _mech->joint[TOOL_ROT].jpos_d,
+                      _mech->joint[WRIST].jpos_d,
+                      (_mech->joint[GRASP2].jpos_d - _mech->joint[GRASP1].jpos_d) / 2.0};
+  const double dt = 0.001;
+
+  for (int i = 0; i < 6; i++) {
+    if (!active || !dm->valid) {
+      dm->qd[i] = dm->qdd[i] = 0;
+    } else {
+      double qd = (joints[i] - dm->q[i]) / dt;
+      double qdd = (qd - dm->qd[i]) / dt;
+      dm->qdd[i] += DYN_FF_ALPHA * (qdd - dm->qdd[i]);
+      dm->qd[i] += DYN_FF_ALPHA * (qd - dm->qd[i]);
+    }
+    dm->q[i] = joints[i];
+  }
+  dm->valid = TRUE;
+
+  return dm;
+}
+
+/**
+ * newtonEuler()
+ * \brief Recursive Newton-Euler joint torques of one arm
+ *
+ * Outward pass propagates link velocities and accelerations, inward pass the
+ *link forces and moments.  The base is accelerated by -G, so gravity comes out
+ *of the same recursion.  Rotations are orthonormal, so frame changes use the
+ *transpose (Vector3 * Matrix3x3) rather than an inverse.
+ *
+ * \param links    link transforms ^i_{i+1}T, i = 0..5, from forward kinematics
+ * \param lm       link mass properties
+ * \param G0       gravity in frame 0
+ * \param dm       desired joint motion, or NULL for gravity only
+ * \param out_tau  torque (force for the prismatic link 3) that each DH joint
+ *must apply, i.e. the compensation torque
+ *
+ * \return void
+ *
+ *    Notation:
+ *    R_i, p_i - rotation and origin of frame i+1 in frame i
+ *    w, dw    - link angular velocity and acceleration in its own frame
+ *    dv       - acceleration of the link frame origin
+ *    F, N     - net force and moment on the link at its COM
+ *    f, n     - force and moment exerted on link i by link i-1
+ */
+static void newtonEuler(const tf::Transform *links, const link_mass *lm, const tf::Vector3 &G0,
+                        const desired_motion *dm, double *out_tau) {
+  const tf::Vector3 z(0, 0, 1);
+  tf::Vector3 w(0, 0, 0), dw(0, 0, 0), dv = -G0;
+  tf::Vector3 F[6], N[6];
+
+  // outward
+  for (int i = 0; i < 6; i++) {
+    const tf::Matrix3x3 &R = links[i].getBasis();
+    const tf::Vector3 &p = links[i].getOrigin();
+    double qd = dm ? dm->qd[i] : 0, qdd = dm ? dm->qdd[i] : 0;
+
+    dv = (dw.cross(p) + w.cross(w.cross(p)) + dv) * R;
+    w = w * R;
+    dw = dw * R;
+    if (i == 2) {
+      // prismatic insertion
+      dv += 2 * w.cross(qd * z) + qdd * z;
+    } else {
+      dw += w.cross(qd * z) + qdd * z;
+      w += qd * z;
+    }
+
+    const tf::Vector3 &c = lm[i].com;
+    F[i] = lm[i].m * (dw.cross(c) + w.cross(w.cross(c)) + dv);
+    N[i] = lm[i].I * dw + w.cross(lm[i].I * w);
+  }
+
+  // inward
+  tf::Vector3 f(0, 0, 0), n(0, 0, 0);
+  for (int i = 5; i >= 0; i--) {
+    tf::Vector3 f_next(0, 0, 0), n_next(0, 0, 0), p(0, 0, 0);
+    if (i < 5) {
+      const tf::Matrix3x3 &R = links[i + 1].getBasis();
+      p = links[i + 1].getOrigin();
+      f_next = R * f;
+      n_next = R * n;
+    }
+    n = N[i] + n_next + lm[i].com.cross(F[i]) + p.cross(f_next);
+    f = F[i] + f_next;
+
+    out_tau[i] = (i == 2) ? z.dot(f) : z.dot(n);
+  }
+}
+
 /**
  * getGravityTorque()
- * \brief Calculate and set the gravity torque for each of the first three
- joints on both arms
+ * \brief Calculate and set the gravity torque for every joint on both arms
  *
- * Using the current gravity vector in the input parameter struct and predefined
- COM information,
- * this function calculates the desired gravity compensation torque and sets the
- corresponding value in the
- * device struct.
+ * Using the current gravity vector and predefined mass properties, this
+ *function calculates the gravity compensation torque of every DOF, tool DOFs
+ *included, and sets the corresponding value in the device struct.  When the
+ *dynamics feed-forward is enabled and the pedal is down, the inertial and
+ *Coriolis torques of the desired motion are added too.  Otherwise the torques
+ *of the first three joints come from the gravity lookup table when it is
+ *enabled and covers the pose (see gravity_lut.cpp).
+ *
+ * The link transforms are taken from this cycle's forward kinematics, so
+ *r2_fwd_kin() must have run first.
  *
  * \param &d0		the robot device
  * \param &params	the current robot parameters struct
  *
  * \return void
  *
- * 	 Calculate Torque: T_i = sum( j=i..3 , (M_j * G_i) x ^iCOM_j )
-                GT1 = (M1*G1) x ^1COM_1 + (M2*G1) x ^1COM_2 + (M3*G1) x ^1COM_3
-                GT2 = (M2*G2) x ^2COM_2 + (M3*G2) x ^2COM_3
-                GT3 = (M3 * G3)
- *
+ * 	 For gravity alone this reduces to: T_i = sum( j=i..6 , (M_j * G_i) x ^iCOM_j )
  *
  *    Notation:
- *    Txy    - Transform from frame x to frame y
- *    COMx_y - Center of mass of link x in link-frame y
- *    Gx     - Gravity vector represented in link-frame x
- *    GTx    - 3-vector of gravitational torque at joint x (z-component
- represents torque around joint)
- *    Mx     - mass of link x
+ *    ^iCOM_j - Center of mass of link j in link-frame i
+ *    G_i     - Gravity vector represented in link-frame i
+ *    T_i     - 3-vector of gravitational torque at joint i (z-component
+ *represents torque around joint)
+ *    M_j     - mass of link j
  */
 void getGravityTorque(device &d0, param_pass &params) {
   mechanism *_mech;
-  tf::Vector3 G0;
-  // static tf::Vector3 G0Static = tf::Vector3(-9.8, 0, 0); //unused
-  tf::Vector3 COM1_1, COM2_2, COM3_3;
+  int ff = dynamics_ff && params.runlevel == RL_PEDAL_DN;
+
+  // Safe point: adopt newly published mass properties before either arm uses them
+  if (pendingSet) {
+    activeSet = !activeSet;
+    paramsVersion++;
+    __sync_synchronize();
+    pendingSet = FALSE;
+  }
+  link_mass(*lm_set)[6] = linkSets[activeSet];
 
-  /// Do FK for each mechanism
   for (int m = 0; m < NUM_MECH; m++) {
     _mech = &(d0.mech[m]);
-    // G0 = G0Static;
-    G0 = getCurrentG(&d0, m);  // uncomment this line to enable dynamic gravity vectors
-
-    if (_mech->type == GOLD_ARM_SERIAL) {
-      COM1_1 = COM1_1_GL;
-      COM2_2 = COM2_2_GL;
-      COM3_3 = COM3_3_GL;
-
-    } else {
-      COM1_1 = COM1_1_GR;
-      COM2_2 = COM2_2_GR;
-      COM3_3 = COM3_3_GR;
-    }
+    tf::Vector3 G0 = getCurrentG(&d0, m);
+    int arm = (_mech->type == GOLD_ARM_SERIAL) ? 0 : 1;
+    const desired_motion *dm = updateDesiredMotion(_mech, m, ff);
 
-    ///// Get the transforms: ^0_1T, ^1_2T, ^2_3T
-    tf::Transform T01, T12, T23;
-    tf::Matrix3x3 R01, R12, R23;
-    tf::Matrix3x3 iR01, iR12, iR23;
+    // joint torques, from the lookup table if it covers this pose, then motor torques
+    double GZ[6], MT[MAX_DOF_PER_MECH];
+    if (ff || !gravityLUTTorques(arm, _mech, G0, GZ))
+      newtonEuler(getFKLinks(m), lm_set[arm], G0, ff ? dm : NULL, GZ);
+    getMotorTorqueFromJointTorque(arm, GZ, MT);
 
-    getATransform(*_mech, T01, 0, 1);
-    getATransform(*_mech, T12, 1, 2);
-    getATransform(*_mech, T23, 2, 3);
-
-    R01 = T01.getBasis();
-    R12 = T12.getBasis();
-    R23 = T23.getBasis();
-
-    ///// Calculate COM in lower link frames (closer to base)
-    // Get COM3
-    tf::Vector3 COM3_2 = T23 * COM3_3;
-    tf::Vector3 COM3_1 = T12 * COM3_2;
-    // tf::Vector3 COM3_0 = T01 * COM3_1; //unused?
-
-    // Get COM2
-    tf::Vector3 COM2_1 = T12 * COM2_2;
-    // tf::Vector3 COM2_0 = T01 * COM2_1; //unused?
+    // Set motor g-torque
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) _mech->joint[j].tau_g = MT[j];
+  }
 
-    // Get COM1
-    // tf::Vector3 COM1_0 = T01 * COM1_1; //unused?
+  return;
+}
 
-    ///// Get gravity vector in each link frame
-    // Map G into Frame1
-    iR01 = R01.inverse();
-    tf::Vector3 G1 = iR01 * G0;
+/**
+ * \brief Calculates the motor torque required to output the specified joint
+ *torques
+ *
+ * Goes through the cable coupling of the arm, so the torque an axis needs to
+ *hold the axes coupled to it is included.
+ *
+ * \param	arm 		0 for gold, 1 for green
+ * \param 	in_GZ		the desired DH joint torques, links 1..6
+ * \param 	out_MT  	output motor torque of every DOF of the mechanism
+ *
+ * \return void
+ */
 
-    // Map G into Frame2
-    iR12 = R12.inverse();
-    tf::Vector3 G2 = iR12 * G1;
+// TODO: this should be in a different file, maybe motors.cpp?
+void getMotorTorqueFromJointTorque(int arm, const double *in_GZ, double *out_MT) {
+  float tau_j[MAX_DOF_PER_MECH], tau_c[MAX_DOF_PER_MECH];
+
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    int link = DOF_LINK[j];
+    double tau = (link < 0) ? 0 : in_GZ[link];
+
+    // theta6 = (grasp2 - grasp1) / 2, so each jaw carries half the torque
+    if (j == GRASP1)
+      tau = -tau / 2;
+    else if (j == GRASP2)
+      tau = tau / 2;
+    tau_j[j] = tau;
+  }
 
-    // Map G into Frame3
-    iR23 = R23.inverse();
-    tf::Vector3 G3 = iR23 * G2;
+  couplingJointToCapstanTorque(arm, tau_j, tau_c);
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) out_MT[j] = tau_c[j];
 
-    ///// Calculate Torque: T_i = sum( j=i..3 , (M_j * G_i) x ^iCOM_j )
-    // T1 = (M1*G1) x ^1COM_1 + (M2*G1) x ^1COM_2 + (M3*G1) x ^1COM_3
-    // T2 = (M2*G2) x ^2COM_2 + (M3*G2) x ^2COM_3
+  return;
+}
 
-    tf::Vector3 GT1 = COM1_1.cross(M1 * G1) + COM2_1.cross(M2 * G1) + COM3_1.cross(M3 * G1);
 
-    tf::Vector3 GT2 = COM2_2.cross(M2 * G2) + COM3_2.cross(M3 * G2);
+/**
+ * \brief Gravity torques of one arm with the mass properties in use
+ *
+ * Reentrant, for building tables outside the RT loop.
+ *
+ * \param links    link transforms ^i_{i+1}T, see getLinkTransforms()
+ * \param arm      0 for gold, 1 for green
+ * \param G0       gravity in frame 0
+ * \param out_tau  compensation torque of each DH joint
+ */
+void gravityJointTorques(const tf::Transform *links, int arm, const tf::Vector3 &G0,
+                         double out_tau[6]) {
+  newtonEuler(links, linkSets[activeSet][arm], G0, NULL, out_tau);
+}
 
-    tf::Vector3 GT3 = M3 * G3;
+/**
+ * \return the number of mass property sets adopted since startup
+ */
+unsigned int gravityParamsVersion() { return paramsVersion; }
 
-    // Set joint g-torque from -Z-axis projection:
-    double GZ1 = tf::Vector3(0, 0, -1).dot(GT1);
-    double GZ2 = tf::Vector3(0, 0, -1).dot(GT2);
-    double GZ3 = tf::Vector3(0, 0, -1).dot(GT3);
+/**
+ * \brief Copies the mass properties currently used by the gravity model
+ *
+ * \param arm  0 for gold, 1 for green
+ * \param out  receives the six link mass properties
+ */
+void getGravityParams(int arm, link_mass out[6]) {
+  for (int i = 0; i < 6; i++) out[i] = linkSets[activeSet][arm][i];
+}
 
-    // Get motor torque from joint torque
-    double MT1, MT2, MT3;
-    getMotorTorqueFromJointTorque(_mech->type, GZ1, GZ2, GZ3, MT1, MT2, MT3);
+/**
+ * \brief Publishes new mass properties to the gravity model
+ *
+ * The set is written to the idle buffer and adopted by the RT thread at the
+ *start of its next gravity computation.  Single writer only.
+ *
+ * \param gold   six link mass properties of the gold arm
+ * \param green  six link mass properties of the green arm
+ * \return 0 on success, -1 if the previous set has not been adopted yet
+ */
+int setGravityParams(const link_mass gold[6], const link_mass green[6]) {
+  if (pendingSet) return -1;
 
-    // Set motor g-torque
-    _mech->joint[SHOULDER].tau_g = MT1;
-    _mech->joint[ELBOW].tau_g = MT2;
-    _mech->joint[Z_INS].tau_g = MT3;
+  link_mass(*idle)[6] = linkSets[!activeSet];
+  for (int i = 0; i < 6; i++) {
+    idle[0][i] = gold[i];
+    idle[1][i] = green[i];
   }
+  __sync_synchronize();
+  pendingSet = TRUE;
 
-  return;
+  return 0;
 }
 
 /**
- * \brief Calculates the motor torque required to output a specified joint
- *torque
- *
- * \param	arm 		the type of mechanism that the output is
- *calculate for
- * \param 	in_GZ1		the desired joint torque at DOF1
- * \param  	in_GZ2 		the desired joint torque at DOF2
- * \param  	in_GZ3 		the desired joint torque at DOF3
- * \param 	&out_MT1	an output pointer for calculated motor torque 1
- * \param 	&out_MT2	an output pointer for calculated motor torque 2
- * \param 	&out_MT3	an output pointer for calculated motor torque 3
+ * \brief Loads the default mass properties and reads the dynamics options
+ *from the parameter server.  Must run before the RT thread starts.
  *
- * \return void
+ * /dynamics_feedforward (bool, default false) enables the Newton-Euler
+ *feed-forward at startup; it can be toggled later from the console.
+ *
+ * \param n  the ros node handle
+ * \return 0
  */
+int init_dynamics(ros::NodeHandle &n) {
+  bool ff = false;
 
-// TODO: this function will need to be updated when cable coupling between first
-// three axes is implemented as non-diagonal.
-// TODO: this should be in a different file, maybe motors.cpp?
-void getMotorTorqueFromJointTorque(int arm, double in_GZ1, double in_GZ2, double in_GZ3,
-                                   double &out_MT1, double &out_MT2, double &out_MT3) {
-  // claculate motor torques from joint torques
-  // TODO:: add in additional cable-coupling terms
-  out_MT1 = in_GZ1 / SHOULDER_TR_GOLD_ARM * GEAR_BOX_GP42_TR;
-  out_MT2 = in_GZ2 / ELBOW_TR_GOLD_ARM * GEAR_BOX_GP42_TR;
-  out_MT3 = in_GZ3 / Z_INS_TR_GOLD_ARM * GEAR_BOX_GP42_TR;
+  for (int i = 0; i < 6; i++) {
+    linkSets[0][0][i] = linkSets[1][0][i] = LINKS_GL[i];
+    linkSets[0][1][i] = linkSets[1][1][i] = LINKS_GR[i];
+  }
 
-  return;
+  n.param("/dynamics_feedforward", ff, false);
+  setDynamicsFeedForward(ff);
+  return 0;
+}
+
+/**
+ * \brief Enables or disables the inertial and Coriolis feed-forward
+ * \param on  TRUE to add the feed-forward to tau_g in pedal down
+ */
+void setDynamicsFeedForward(int on) {
+  dynamics_ff = on;
+  log_msg("Dynamics feed-forward %s", on ? "on" : "off");
 }
+
+/**
+ * \return TRUE if the dynamics feed-forward is enabled
+ */
+int dynamicsFeedForward() { return dynamics_ff; }
@@ -0,0 +1,298 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file grav_ident.cpp
+ *
+ * \brief Online identification of the gravity model mass properties
+ *
+ * Gravity torque is linear in the mass m_j and first moment h_j = m_j * COM_j
+ *of each link, so with the arm held nearly still the commanded joint torques
+ *give one linear equation per joint.  The RT thread pushes such samples into a
+ *single-producer/single-consumer queue without blocking; a ROS timer drains it
+ *and runs a recursive least squares fit with forgetting per arm.
+ *
+ * Only the first three links are fitted (the tool is lumped into link 3).
+ *Parameter directions the samples do not excite, like the mass of link 1,
+ *keep their prior.  Every GRAV_IDENT_PUBLISH_PERIOD the estimate is sanity
+ *checked and handed to the gravity model, which adopts it at the start of a
+ *control cycle.
+ *
+ * Enabled with the parameter /gravity_identification (default false).
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <Eigen/Dense>
+
+#include "grav_ident.h"
+#include "grav_comp.h"
+#include "r2_kinematics.h"
+#include "coupling_matrix.h"
+#include "defines.h"
+#include "log.h"
+
+extern int NUM_MECH;
+
+#define GRAV_IDENT_PARAMS 12  // (m, hx, hy, hz) of links 1..3
+
+// RLS tuning
+const static double LAMBDA = 0.9995;  // forgetting factor per scalar update
+const static double P0 = 0.01;        // prior variance, (kg or kg m)^2
+const static double P_MAX_TRACE = 1.0;
+
+/// One quasi-static sample of one arm
+struct grav_sample {
+  int arm;          // 0 gold, 1 green
+  double theta[6];  // DH joint values
+  double tau[3];    // joint torques of the first three DOFs
+  double G0[3];     // gravity in frame 0
+};
+
+typedef Eigen::Matrix<double, GRAV_IDENT_PARAMS, 1> ident_vec;
+typedef Eigen::Matrix<double, GRAV_IDENT_PARAMS, GRAV_IDENT_PARAMS> ident_mat;
+
+/// RLS state of one arm
+struct rls_state {
+  ident_vec theta;
+  ident_mat P;
+  unsigned int samples;  // since the last publish
+  double err2;           // smoothed squared prediction error
+};
+
+static grav_sample queue[GRAV_IDENT_QUEUE];
+static volatile unsigned int qHead = 0, qTail = 0;
+static volatile unsigned int qDropped = 0;
+
+static volatile int ident_enabled = FALSE;
+static rls_state rls[2];
+static link_mass prior[2][6];
+static ros::Timer ident_timer;
+
+void identUpdate(const ros::TimerEvent &);
+
+/**
+ * \brief Queues a sample of each arm if the arm is nearly still
+ *
+ * Called from the RT thread after the control torques are final.  Never
+ *blocks; samples are dropped when the queue is full.
+ *
+ * \param d0          the robot device
+ * \param currParams  the current robot parameters
+ * \ingroup Control
+ */
+void sampleGravityIdent(device *d0, param_pass *currParams) {
+  static unsigned int tick = 0;
+
+  if (!ident_enabled || currParams->runlevel != RL_PEDAL_DN) return;
+  if (++tick % GRAV_IDENT_DECIMATE) return;
+
+  for (int m = 0; m < NUM_MECH; m++) {
+    mechanism *_mech = &(d0->mech[m]);
+    if (fabs(_mech->joint[SHOULDER].jvel) > GRAV_IDENT_MAX_VEL ||
+        fabs(_mech->joint[ELBOW].jvel) > GRAV_IDENT_MAX_VEL ||
+        fabs(_mech->joint[Z_INS].jvel) > GRAV_IDENT_MAX_INS_VEL)
+      continue;
+
+    unsigned int next = (qHead + 1) % GRAV_IDENT_QUEUE;
+    if (next == qTail) {
+      qDropped++;
+      continue;
+    }
+
+    grav_sample *s = &queue[qHead];
+    l_r arm = (_mech->type == GOLD_ARM_SERIAL) ? dh_left : dh_right;
+    double joints[6] = {_mech->joint[SHOULDER].jpos, _mech->joint[ELBOW].jpos,
+                        _mech->joint[Z_INS].jpos,    _mech->joint[TOOL_ROT].jpos,
+                        _mech->joint[WRIST].jpos,
+                        (_mech->joint[GRASP2].jpos - _mech->joint[GRASP1].jpos) / 2.0};
+    joint2theta(s->theta, joints, arm);
+    s->arm = arm;
+
+    // joint torques through the arm's cable coupling, cross terms included
+    float tau_c[MAX_DOF_PER_MECH], tau_j[MAX_DOF_PER_MECH];
+    for (int i = 0; i < MAX_DOF_PER_MECH; i++) tau_c[i] = _mech->joint[i].tau_d;
+    couplingCapstanToJointTorque(_mech->type == GOLD_ARM_SERIAL ? 0 : 1, tau_c, tau_j);
+    for (int i = 0; i < 3; i++) s->tau[i] = tau_j[i];
+
+    tf::Vector3 G0 = getCurrentG(d0, m);
+    for (int i = 0; i < 3; i++) s->G0[i] = G0[i];
+
+    __sync_synchronize();
+    qHead = next;
+  }
+}
+
+/**
+ * \brief Regressor row of joint i (0..2): tau_i = phi . theta
+ *
+ * Revolute joint i compensates tau_i = -z . sum_j (R_ij h_j + m_j p_ij) x G_i,
+ *i.e. the coefficient of m_j is -z . (p_ij x G_i) and the coefficient of h_j
+ *is -(G_j x R_ij^T z).  The prismatic insertion compensates -m_3 G_3z.
+ */
+static void regressor(const tf::Transform *links, const tf::Vector3 *G, int i, ident_vec &phi) {
+  const tf::Vector3 z(0, 0, 1);
+
+  phi.setZero();
+  if (i == 2) {
+    phi(8) = -G[2].z();
+    return;
+  }
+
+  tf::Transform T;
+  T.setIdentity();
+  for (int j = i; j < 3; j++) {
+    if (j > i) T *= links[j];
+    tf::Vector3 hc = -G[j].cross(z * T.getBasis());
+    phi(4 * j) = -z.dot(T.getOrigin().cross(G[i]));
+    phi(4 * j + 1) = hc.x();
+    phi(4 * j + 2) = hc.y();
+    phi(4 * j + 3) = hc.z();
+  }
+}
+
+/**
+ * \brief Folds one sample into the RLS estimate of its arm
+ */
+static void rlsUpdate(const grav_sample &s) {
+  rls_state *r = &rls[s.arm];
+  tf::Transform links[6];
+  tf::Vector3 G[3];
+
+  getLinkTransforms(s.theta, (l_r)s.arm, links);
+  tf::Vector3 G0(s.G0[0], s.G0[1], s.G0[2]);
+  G[0] = G0 * links[0].getBasis();
+  G[1] = G[0] * links[1].getBasis();
+  G[2] = G[1] * links[2].getBasis();
+
+  for (int i = 0; i < 3; i++) {
+    ident_vec phi;
+    regressor(links, G, i, phi);
+
+    double err = s.tau[i] - phi.dot(r->theta);
+    ident_vec Pphi = r->P * phi;
+    ident_vec k = Pphi / (LAMBDA + phi.dot(Pphi));
+
+    r->theta += k * err;
+    r->P -= k * Pphi.transpose();
+    // forget only while the covariance is bounded, against windup in
+    // unexcited directions
+    if (r->P.trace() < P_MAX_TRACE) r->P /= LAMBDA;
+    r->err2 += 0.01 * (err * err - r->err2);
+  }
+  r->samples++;
+}
+
+/**
+ * \brief Converts an arm's estimate to link mass properties
+ *
+ * \return 0 if the estimate is plausible, -1 otherwise
+ */
+static int estimateToLinks(int arm, link_mass out[6]) {
+  rls_state *r = &rls[arm];
+
+  getGravityParams(arm, out);
+  for (int j = 0; j < 3; j++) {
+    // masses with little information keep their prior
+    double m = r->theta(4 * j);
+    if (r->P(4 * j, 4 * j) > 0.5 * P0) m = prior[arm][j].m;
+
+    if (m < 0.25 * prior[arm][j].m || m > 4 * prior[arm][j].m) return -1;
+
+    out[j].m = m;
+    out[j].com = tf::Vector3(r->theta(4 * j + 1), r->theta(4 * j + 2), r->theta(4 * j + 3)) / m;
+    if (out[j].com.length() > 0.5) return -1;  // meters, larger than the arm
+  }
+  return 0;
+}
+
+/**
+ * \brief Drains the sample queue and periodically publishes the estimate
+ * \ingroup Control
+ */
+void identUpdate(const ros::TimerEvent &) {
+  static ros::Time lastPublish = ros::Time::now();
+
+  while (qTail != qHead) {
+    __sync_synchronize();
+    rlsUpdate(queue[qTail]);
+    qTail = (qTail + 1) % GRAV_IDENT_QUEUE;
+  }
+
+  if ((ros::Time::now() - lastPublish).toSec() < GRAV_IDENT_PUBLISH_PERIOD) return;
+  lastPublish = ros::Time::now();
+
+  link_mass links[2][6];
+  int publish = FALSE;
+  for (int arm = 0; arm < 2; arm++) {
+    getGravityParams(arm, links[arm]);
+    if (rls[arm].samples < GRAV_IDENT_MIN_SAMPLES) continue;
+
+    link_mass est[6];
+    if (estimateToLinks(arm, est) < 0) {
+      log_msg("Gravity identification of arm %d implausible, not adopted", arm);
+    } else {
+      for (int j = 0; j < 6; j++) links[arm][j] = est[j];
+      publish = TRUE;
+      log_msg("Gravity identification arm %d: m = %.3f %.3f %.3f kg, rms err %.4f (%d dropped)",
+              arm, est[0].m, est[1].m, est[2].m, sqrt(rls[arm].err2), qDropped);
+    }
+    rls[arm].samples = 0;
+  }
+
+  if (publish && setGravityParams(links[0], links[1]) < 0)
+    log_msg("Gravity identification: previous parameters not adopted yet");
+}
+
+/**
+ * \brief Starts the gravity identification if /gravity_identification is set
+ *
+ * Seeds the estimate from the gravity model, so init_dynamics() must run first.
+ *
+ * \param n  the ros node handle
+ * \return 0
+ * \ingroup Control
+ */
+int init_gravity_ident(ros::NodeHandle &n) {
+  bool enable = false;
+  n.param("/gravity_identification", enable, false);
+  if (!enable) return 0;
+
+  for (int arm = 0; arm < 2; arm++) {
+    getGravityParams(arm, prior[arm]);
+    for (int j = 0; j < 3; j++) {
+      tf::Vector3 h = prior[arm][j].m * prior[arm][j].com;
+      rls[arm].theta(4 * j) = prior[arm][j].m;
+      rls[arm].theta(4 * j + 1) = h.x();
+      rls[arm].theta(4 * j + 2) = h.y();
+      rls[arm].theta(4 * j + 3) = h.z();
+    }
+    rls[arm].P = P0 * ident_mat::Identity();
+    rls[arm].samples = 0;
+    rls[arm].err2 = 0;
+  }
+
+  ident_timer = n.createTimer(ros::Duration(0.05), identUpdate);
+  ident_enabled = TRUE;
+  log_msg("Gravity identification on");
+
+  return 0;
+}
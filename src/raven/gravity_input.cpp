@@ -0,0 +1,221 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file gravity_input.cpp
+ *
+ * \brief Gravity direction from a ROS gravity or IMU topic
+ *
+ * For robots on tilting tables the gravity vector used by the gravity
+ *compensation can follow an external sensor, chosen by /gravity_source:
+ *  - none (default): gravity stays straight down, nothing is subscribed
+ *  - vector: raven_gravity (geometry_msgs/Vector3Stamped), the gravity vector
+ *    in the Raven gravity frame (the frame of device.grav_dir, +z down when
+ *    level)
+ *  - imu: raven_imu (sensor_msgs/Imu), the linear acceleration of an IMU fixed
+ *    to the base.  At rest this is minus gravity in the IMU frame, which is
+ *    rotated into the gravity frame by /gravity_imu_rpy (default IMU level, z
+ *    up).  Remap raven_imu to the IMU on the base.
+ *
+ * Samples are filtered in the ROS thread: readings whose magnitude is off by
+ *more than GRAVITY_MAG_TOL are dropped as the base accelerating, the direction
+ *is low-pass filtered at /gravity_filter_hz and its rate of change is limited
+ *by /gravity_max_rate (deg/s), so the compensation torques change smoothly.  The
+ *result is handed to the RT thread through a sequence lock; the RT thread
+ *never waits.  Until a first sample arrives gravity stays straight down, and if
+ *the topic stops the last direction is kept.
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <geometry_msgs/Vector3Stamped.h>
+#include <sensor_msgs/Imu.h>
+#include <tf/transform_datatypes.h>
+
+#include "gravity_input.h"
+#include "defines.h"
+#include "struct.h"
+#include "log.h"
+
+const static double G_STD = 9.8;     // m/s^2
+const static int G_DIR_SCALE = 980;  // grav_dir units per unit vector
+
+/// Gravity direction handed to the RT thread.  seq is odd while dir is written.
+struct gravity_handoff {
+  volatile unsigned int seq;
+  volatile int valid;
+  position dir;
+};
+static gravity_handoff handoff;
+
+static ros::Subscriber sub_gravity, sub_imu;
+static tf::Matrix3x3 imu_mount;
+static double filter_hz = GRAVITY_FILTER_HZ;
+static double max_rate = GRAVITY_MAX_RATE;
+
+static tf::Vector3 g_filt;  // filtered gravity direction, unit vector
+static ros::Time g_last;
+static int g_valid = FALSE;
+static unsigned int g_rejected = 0;
+
+/**
+ * \brief Writes the filtered direction for the RT thread
+ */
+static void publishGravity(const tf::Vector3 &dir) {
+  handoff.seq++;
+  __sync_synchronize();
+  handoff.dir.x = (int)(dir.x() * G_DIR_SCALE);
+  handoff.dir.y = (int)(dir.y() * G_DIR_SCALE);
+  handoff.dir.z = (int)(dir.z() * G_DIR_SCALE);
+  handoff.valid = TRUE;
+  __sync_synchronize();
+  handoff.seq++;
+}
+
+/**
+ * \brief Filters and rate limits one gravity reading
+ *
+ * \param g      gravity in the Raven gravity frame, m/s^2
+ * \param stamp  time of the reading
+ */
+static void filterGravity(const tf::Vector3 &g, const ros::Time &stamp) {
+  double mag = g.length();
+  if (fabs(mag - G_STD) > GRAVITY_MAG_TOL * G_STD) {
+    if (g_rejected++ % 1000 == 0)
+      log_msg("Gravity input: ignoring acceleration of %.2f m/s^2 (%u so far)", mag, g_rejected);
+    return;
+  }
+  tf::Vector3 dir = g / mag;
+
+  if (!g_valid) {
+    g_filt = dir;
+    g_last = stamp;
+    g_valid = TRUE;
+    publishGravity(g_filt);
+    log_msg("Gravity input: first reading (%.3f, %.3f, %.3f)", dir.x(), dir.y(), dir.z());
+    return;
+  }
+
+  double dt = (stamp - g_last).toSec();
+  if (dt <= 0) return;
+  if (dt > 1) dt = 1;
+  g_last = stamp;
+
+  // first order low pass
+  double a = 1 - exp(-2 * M_PI * filter_hz * dt);
+  tf::Vector3 target = (g_filt + a * (dir - g_filt)).normalized();
+
+  // rate limit the change of direction
+  double angle = g_filt.angle(target);
+  double max_angle = max_rate * M_PI / 180 * dt;
+  if (angle > max_angle) target = g_filt.rotate(g_filt.cross(target).normalized(), max_angle);
+
+  g_filt = target.normalized();
+  publishGravity(g_filt);
+}
+
+/**
+ * \brief Callback for the raven_gravity topic
+ * \ingroup ROS
+ */
+void gravityCallback(geometry_msgs::Vector3Stamped msg) {
+  ros::Time stamp = msg.header.stamp.isZero() ? ros::Time::now() : msg.header.stamp;
+  filterGravity(tf::Vector3(msg.vector.x, msg.vector.y, msg.vector.z), stamp);
+}
+
+/**
+ * \brief Callback for the imu topic
+ * \ingroup ROS
+ */
+void imuCallback(sensor_msgs::Imu msg) {
+  ros::Time stamp = msg.header.stamp.isZero() ? ros::Time::now() : msg.header.stamp;
+  tf::Vector3 a(msg.linear_acceleration.x, msg.linear_acceleration.y, msg.linear_acceleration.z);
+  filterGravity(imu_mount * -a, stamp);
+}
+
+/**
+ * \brief Reads the latest filtered gravity direction
+ *
+ * Lock-free, for the RT thread.  Keeps the previous value if the writer is
+ *busy for more than a few retries.
+ *
+ * \param out_dir  receives the gravity direction in grav_dir units
+ * \return TRUE if a gravity input is available, FALSE otherwise
+ * \ingroup Control
+ */
+int getGravityInput(position *out_dir) {
+  static position last;
+  static int have_last = FALSE;
+
+  if (!handoff.valid) return FALSE;
+
+  for (int tries = 0; tries < 3; tries++) {
+    unsigned int seq = handoff.seq;
+    if (seq & 1) continue;
+    __sync_synchronize();
+    position dir = handoff.dir;
+    __sync_synchronize();
+    if (seq == handoff.seq) {
+      last = dir;
+      have_last = TRUE;
+      break;
+    }
+  }
+  if (!have_last) return FALSE;
+
+  *out_dir = last;
+  return TRUE;
+}
+
+/**
+ * \brief Subscribes to the gravity or IMU topic picked by /gravity_source
+ *
+ * \param n  the ros node handle
+ * \return 0, or -1 if /gravity_source is unknown (gravity stays down)
+ * \ingroup ROS
+ */
+int init_gravity_input(ros::NodeHandle &n) {
+  std::vector<double> rpy;
+  std::string source;
+
+  n.param("/gravity_source", source, std::string("none"));
+  n.param("/gravity_filter_hz", filter_hz, GRAVITY_FILTER_HZ);
+  n.param("/gravity_max_rate", max_rate, GRAVITY_MAX_RATE);
+  if (!n.getParam("/gravity_imu_rpy", rpy) || rpy.size() != 3) {
+    rpy.assign(3, 0);
+    rpy[0] = M_PI;  // IMU level with z up; gravity frame has z down
+  }
+  imu_mount.setRPY(rpy[0], rpy[1], rpy[2]);
+
+  if (source == "vector") {
+    sub_gravity = n.subscribe<geometry_msgs::Vector3Stamped>("raven_gravity", 1, gravityCallback);
+  } else if (source == "imu") {
+    sub_imu = n.subscribe<sensor_msgs::Imu>("raven_imu", 1, imuCallback);
+  } else if (source != "none") {
+    log_msg("Unknown gravity source %s, gravity stays down", source.c_str());
+    return -1;
+  }
+  if (source != "none") log_msg("Gravity direction from %s", source.c_str());
+
+  return 0;
+}
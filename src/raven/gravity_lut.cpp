@@ -0,0 +1,404 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file gravity_lut.cpp
+ *
+ * \brief Interpolated lookup table of gravity torques
+ *
+ * With the tool links massless, the gravity torque of the first three joints
+ *depends only on the shoulder, elbow and insertion positions, and is linear
+ *in the gravity vector: tau = A(q) G0.  The table stores the 3x3 matrix A on a
+ *grid over the SHOULDER/ELBOW/Z_INS limits for each arm and interpolates it
+ *trilinearly, so a changing gravity direction costs nothing extra.
+ *
+ * The grid is refined until the interpolation error bound is below the
+ *tolerance /gravity_lut_tol.  The bound is the larger of the trilinear remainder
+ *(h^2/8 times the second derivatives, estimated on the grid, with a 1.5x
+ *margin) and the worst error actually measured at the cell centres.
+ *
+ * If /gravity_lut_file is set the table is mmap'd from that file when it was
+ *built for the same grid and mass properties, otherwise it is generated and
+ *written there.  A startup benchmark logs the speedup over the analytic model.
+ *
+ * The table is used only while the mass properties it was built for are in
+ *use; after a new set is adopted (see grav_ident.cpp) the analytic model takes
+ *over again.  Enabled with /gravity_lut (default false).
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gravity_lut.h"
+#include "grav_comp.h"
+#include "r2_kinematics.h"
+#include "defines.h"
+#include "struct.h"
+#include "log.h"
+#include "utils.h"
+
+#define LUT_MAGIC "R2GLUT1"
+
+/// Table file header, followed by the data of both arms
+struct lut_header {
+  char magic[8];
+  int n[3];                // nodes along shoulder, elbow, insertion
+  double lo[3];            // grid limits
+  double hi[3];
+  double params[2][3][4];  // (m, com) of links 1-3 per arm the table was built for
+  double bound[3];         // error bound per joint
+};
+
+static lut_header lut;
+static const float *lut_data = NULL;  // [arm][i0][i1][i2][3x3], row major
+static std::vector<float> lut_mem;
+static unsigned int lut_version;  // gravityParamsVersion() the table is valid for
+static volatile int lut_enabled = FALSE;
+
+static const double LUT_LO[3] = {SHOULDER_MIN_LIMIT, ELBOW_MIN_LIMIT, Z_INS_MIN_LIMIT};
+static const double LUT_HI[3] = {SHOULDER_MAX_LIMIT, ELBOW_MAX_LIMIT, Z_INS_MAX_LIMIT};
+
+static inline size_t lutIndex(const lut_header &h, int arm, int i0, int i1, int i2) {
+  return ((((size_t)arm * h.n[0] + i0) * h.n[1] + i1) * h.n[2] + i2) * 9;
+}
+
+static size_t lutSize(const lut_header &h) { return lutIndex(h, 2, 0, 0, 0); }
+
+/**
+ * \brief Analytic A(q) of one arm at shoulder, elbow and insertion q
+ */
+static void analyticA(int arm, const double q[3], double A[9]) {
+  double joints[6] = {q[0], q[1], q[2], 0, 0, 0}, thetas[6];
+  tf::Transform links[6];
+
+  joint2theta(thetas, joints, (l_r)arm);
+  getLinkTransforms(thetas, (l_r)arm, links);
+  for (int c = 0; c < 3; c++) {
+    double tau[6];
+    tf::Vector3 G0(c == 0, c == 1, c == 2);
+    gravityJointTorques(links, arm, G0, tau);
+    for (int r = 0; r < 3; r++) A[3 * r + c] = tau[r];
+  }
+}
+
+static void nodeQ(const lut_header &h, int i0, int i1, int i2, double q[3]) {
+  int i[3] = {i0, i1, i2};
+  for (int k = 0; k < 3; k++) q[k] = h.lo[k] + (h.hi[k] - h.lo[k]) * i[k] / (h.n[k] - 1);
+}
+
+/**
+ * \brief Trilinear interpolation of A
+ *
+ * \return FALSE if q is outside the grid
+ */
+static int interpolateA(const lut_header &h, const float *data, int arm, const double q[3],
+                        double A[9]) {
+  int i[3];
+  double t[3];
+
+  for (int k = 0; k < 3; k++) {
+    double u = (q[k] - h.lo[k]) / (h.hi[k] - h.lo[k]) * (h.n[k] - 1);
+    if (!(u >= 0 && u <= h.n[k] - 1)) return FALSE;
+    i[k] = (int)u;
+    if (i[k] > h.n[k] - 2) i[k] = h.n[k] - 2;
+    t[k] = u - i[k];
+  }
+
+  for (int e = 0; e < 9; e++) A[e] = 0;
+  for (int c = 0; c < 8; c++) {
+    int d0 = c & 1, d1 = (c >> 1) & 1, d2 = (c >> 2) & 1;
+    double w = (d0 ? t[0] : 1 - t[0]) * (d1 ? t[1] : 1 - t[1]) * (d2 ? t[2] : 1 - t[2]);
+    const float *a = &data[lutIndex(h, arm, i[0] + d0, i[1] + d1, i[2] + d2)];
+    for (int e = 0; e < 9; e++) A[e] += w * a[e];
+  }
+  return TRUE;
+}
+
+/**
+ * \brief Error bound of a generated table for a gravity vector of G_STD
+ *
+ * Per joint: 1.5 * sum_k h_k^2/8 * max |d2 A_row / dq_k^2| from second
+ *differences on the grid, or the worst error at the cell centres if larger.
+ */
+static void errorBound(const lut_header &h, const float *data, double bound[3]) {
+  const double G_STD = 9.8;
+  double d2max[3][3] = {{0}};  // [joint][axis]
+
+  for (int arm = 0; arm < 2; arm++)
+    for (int i0 = 0; i0 < h.n[0]; i0++)
+      for (int i1 = 0; i1 < h.n[1]; i1++)
+        for (int i2 = 0; i2 < h.n[2]; i2++) {
+          int i[3] = {i0, i1, i2};
+          for (int k = 0; k < 3; k++) {
+            if (i[k] == 0 || i[k] == h.n[k] - 1) continue;
+            int lo[3] = {i0, i1, i2}, hi[3] = {i0, i1, i2};
+            lo[k]--;
+            hi[k]++;
+            const float *a = &data[lutIndex(h, arm, lo[0], lo[1], lo[2])];
+            const float *b = &data[lutIndex(h, arm, i0, i1, i2)];
+            const float *c = &data[lutIndex(h, arm, hi[0], hi[1], hi[2])];
+            for (int r = 0; r < 3; r++) {
+              double n2 = 0;
+              for (int col = 0; col < 3; col++) {
+                double d2 = a[3 * r + col] - 2 * b[3 * r + col] + c[3 * r + col];
+                n2 += d2 * d2;
+              }
+              // second difference ~ h^2 f'', so the remainder is d2/8
+              if (sqrt(n2) > d2max[r][k]) d2max[r][k] = sqrt(n2);
+            }
+          }
+        }
+
+  for (int r = 0; r < 3; r++) {
+    bound[r] = 0;
+    for (int k = 0; k < 3; k++) bound[r] += 1.5 * d2max[r][k] / 8 * G_STD;
+  }
+
+  // measured at the cell centres, where trilinear interpolation is worst
+  for (int arm = 0; arm < 2; arm++)
+    for (int i0 = 0; i0 < h.n[0] - 1; i0++)
+      for (int i1 = 0; i1 < h.n[1] - 1; i1++)
+        for (int i2 = 0; i2 < h.n[2] - 1; i2++) {
+          double q[3], A[9], Ai[9];
+          nodeQ(h, i0, i1, i2, q);
+          for (int k = 0; k < 3; k++) q[k] += (h.hi[k] - h.lo[k]) / (h.n[k] - 1) / 2;
+          analyticA(arm, q, A);
+          interpolateA(h, data, arm, q, Ai);
+          for (int r = 0; r < 3; r++) {
+            double n2 = 0;
+            for (int col = 0; col < 3; col++)
+              n2 += (A[3 * r + col] - Ai[3 * r + col]) * (A[3 * r + col] - Ai[3 * r + col]);
+            if (sqrt(n2) * G_STD > bound[r]) bound[r] = sqrt(n2) * G_STD;
+          }
+        }
+}
+
+/**
+ * \brief Fills the table for the grid in h
+ */
+static void generate(const lut_header &h, std::vector<float> &data) {
+  data.resize(lutSize(h));
+  for (int arm = 0; arm < 2; arm++)
+    for (int i0 = 0; i0 < h.n[0]; i0++)
+      for (int i1 = 0; i1 < h.n[1]; i1++)
+        for (int i2 = 0; i2 < h.n[2]; i2++) {
+          double q[3], A[9];
+          nodeQ(h, i0, i1, i2, q);
+          analyticA(arm, q, A);
+          for (int e = 0; e < 9; e++) data[lutIndex(h, arm, i0, i1, i2) + e] = A[e];
+        }
+}
+
+/**
+ * \brief Maps a table file if it matches the wanted header
+ *
+ * \return TRUE on success
+ */
+static int loadTable(const std::string &path, const lut_header &want, double tol) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return FALSE;
+
+  struct stat st;
+  lut_header h;
+  int ok = fstat(fd, &st) == 0 && read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) &&
+           memcmp(h.magic, LUT_MAGIC, sizeof(h.magic)) == 0 &&
+           memcmp(h.lo, want.lo, sizeof(h.lo)) == 0 && memcmp(h.hi, want.hi, sizeof(h.hi)) == 0 &&
+           memcmp(h.params, want.params, sizeof(h.params)) == 0 && h.bound[0] <= tol &&
+           h.bound[1] <= tol && h.bound[2] <= tol &&
+           (size_t)st.st_size == sizeof(h) + lutSize(h) * sizeof(float);
+  if (!ok) {
+    close(fd);
+    return FALSE;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return FALSE;
+
+  lut = h;
+  lut_data = (const float *)((const char *)p + sizeof(h));
+  return TRUE;
+}
+
+/**
+ * \brief Writes the generated table to a file for the next start
+ */
+static void saveTable(const std::string &path) {
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    log_msg("Gravity LUT: cannot write %s", tmp.c_str());
+    return;
+  }
+  int ok = fwrite(&lut, sizeof(lut), 1, f) == 1 &&
+           fwrite(&lut_mem[0], sizeof(float), lut_mem.size(), f) == lut_mem.size();
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    log_msg("Gravity LUT: failed to save %s", path.c_str());
+}
+
+/**
+ * \brief Times the table against the analytic model at random poses
+ */
+static void benchmark() {
+  std::vector<tf::Transform> links(6 * GRAVITY_LUT_BENCH);
+  std::vector<double> q(3 * GRAVITY_LUT_BENCH);
+  unsigned int seed = 1;
+  volatile double sink = 0;
+  tf::Vector3 G0(-9.8, 0, 0);
+
+  for (int s = 0; s < GRAVITY_LUT_BENCH; s++) {
+    double joints[6] = {0}, thetas[6];
+    for (int k = 0; k < 3; k++) {
+      q[3 * s + k] = lut.lo[k] + (lut.hi[k] - lut.lo[k]) * rand_r(&seed) / RAND_MAX;
+      joints[k] = q[3 * s + k];
+    }
+    joint2theta(thetas, joints, dh_left);
+    getLinkTransforms(thetas, dh_left, &links[6 * s]);
+  }
+
+  // analytic: the RT loop already has the link transforms from FK
+  u_64 t0 = monotonic_ns();
+  for (int s = 0; s < GRAVITY_LUT_BENCH; s++) {
+    double tau[6];
+    gravityJointTorques(&links[6 * s], 0, G0, tau);
+    sink = sink + tau[0];
+  }
+  u_64 t1 = monotonic_ns();
+  for (int s = 0; s < GRAVITY_LUT_BENCH; s++) {
+    double A[9];
+    interpolateA(lut, lut_data, 0, &q[3 * s], A);
+    sink = sink + A[0] * G0[0] + A[1] * G0[1] + A[2] * G0[2];
+  }
+  u_64 t2 = monotonic_ns();
+
+  double analytic = (double)(t1 - t0) / GRAVITY_LUT_BENCH;
+  double table = (double)(t2 - t1) / GRAVITY_LUT_BENCH;
+  log_msg("Gravity LUT: %.0f ns per arm vs %.0f ns analytic (%.1fx)", table, analytic,
+          analytic / table);
+}
+
+/**
+ * \brief Gravity torques of the first three joints from the table
+ *
+ * \param arm     0 for gold, 1 for green
+ * \param _mech   the mechanism, for its joint positions
+ * \param G0      gravity in frame 0
+ * \param out_GZ  compensation torque of each DH joint; tool joints are zero
+ * \return FALSE if the table is disabled, stale or does not cover the pose
+ * \ingroup Control
+ */
+int gravityLUTTorques(int arm, const mechanism *_mech, const tf::Vector3 &G0, double *out_GZ) {
+  if (!lut_enabled || lut_version != gravityParamsVersion()) return FALSE;
+
+  double q[3] = {_mech->joint[SHOULDER].jpos, _mech->joint[ELBOW].jpos, _mech->joint[Z_INS].jpos};
+  double A[9];
+  if (!interpolateA(lut, lut_data, arm, q, A)) return FALSE;
+
+  for (int r = 0; r < 3; r++)
+    out_GZ[r] = A[3 * r] * G0[0] + A[3 * r + 1] * G0[1] + A[3 * r + 2] * G0[2];
+  out_GZ[3] = out_GZ[4] = out_GZ[5] = 0;
+  return TRUE;
+}
+
+/**
+ * \brief Builds or loads the gravity table if /gravity_lut is set
+ *
+ * Must run after init_dynamics() and before the RT thread starts.
+ *
+ * \param n  the ros node handle
+ * \return 0 on success or when disabled, -1 if the table cannot be used
+ * \ingroup Control
+ */
+int init_gravity_lut(ros::NodeHandle &n) {
+  bool enable = false;
+  double tol = GRAVITY_LUT_TOL;
+  std::string path;
+
+  n.param("/gravity_lut", enable, false);
+  if (!enable) return 0;
+  n.param("/gravity_lut_tol", tol, GRAVITY_LUT_TOL);
+  n.param("/gravity_lut_file", path, std::string(""));
+
+  // the table only holds links 1-3
+  lut_header want;
+  memset(&want, 0, sizeof(want));
+  strncpy(want.magic, LUT_MAGIC, sizeof(want.magic));
+  for (int arm = 0; arm < 2; arm++) {
+    link_mass lm[6];
+    getGravityParams(arm, lm);
+    for (int j = 3; j < 6; j++) {
+      if (lm[j].m != 0) {
+        log_msg("Gravity LUT: tool links have mass, table disabled");
+        return -1;
+      }
+    }
+    for (int j = 0; j < 3; j++) {
+      want.params[arm][j][0] = lm[j].m;
+      for (int k = 0; k < 3; k++) want.params[arm][j][k + 1] = lm[j].com[k];
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    want.lo[k] = LUT_LO[k];
+    want.hi[k] = LUT_HI[k];
+  }
+
+  if (path.empty() || !loadTable(path, want, tol)) {
+    // A is affine in the insertion for massless tool links, so three
+    // insertion nodes are exact; refine the angles until the bound holds
+    lut = want;
+    lut.n[0] = lut.n[1] = 9;
+    lut.n[2] = 3;
+    for (;;) {
+      generate(lut, lut_mem);
+      errorBound(lut, &lut_mem[0], lut.bound);
+      if ((lut.bound[0] <= tol && lut.bound[1] <= tol && lut.bound[2] <= tol) ||
+          lut.n[0] >= GRAVITY_LUT_MAX_NODES)
+        break;
+      lut.n[0] = 2 * lut.n[0] - 1;
+      lut.n[1] = 2 * lut.n[1] - 1;
+    }
+    if (lut.bound[0] > tol || lut.bound[1] > tol || lut.bound[2] > tol) {
+      log_msg("Gravity LUT: bound %.2g/%.2g/%.2g above tolerance %.2g, table disabled",
+              lut.bound[0], lut.bound[1], lut.bound[2], tol);
+      return -1;
+    }
+    lut_data = &lut_mem[0];
+    if (!path.empty()) saveTable(path);
+  }
+
+  log_msg("Gravity LUT: %dx%dx%d grid, error bound %.2g/%.2g/%.2g Nm,N (tolerance %.2g)",
+          lut.n[0], lut.n[1], lut.n[2], lut.bound[0], lut.bound[1], lut.bound[2], tol);
+  benchmark();
+
+  lut_version = gravityParamsVersion();
+  lut_enabled = TRUE;
+  return 0;
+}
@@ -17,7 +17,6 @@
  * You should have received a copy of the GNU Lesser General Public License
  * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 /**
  *   \file homing.cpp
  *
@@ -29,22 +28,26 @@
  *joints
  * 			to their limits (hard stop indicated by increased current)
  *and then
- *			to their predefined "home" position.
+ *			to their predefined "home" position.  Each mechanism runs its own
+ *			homing state machine (see homing_phase) with its own timers, so one
+ *			arm never waits on the other.  An arm whose saved calibration still
+ *			matches (see homing_cache.cpp) skips the hard-stop search.
  *
- *	\fn These are the 5 functions in homing.cpp file.
+ *	\fn These are the 6 functions in homing.cpp file.
  *           Functions marked with "*" are called explicitly from other files.
  * 	       *(1) raven_homing	 	:uses (2)(3)(4)(5), utils.cpp
  *(2)(3)(4)(6), inv_cable_coupling.cpp (1),
- *                                                     trajectory.cpp (3),
- *t_to_DAC_val.cpp (1), pid_control.cpp (1)(2)
- *       	(2) set_joints_known_pos	:uses (2)(3)(4)(5), utils.cpp
+ *                                                     t_to_DAC_val.cpp (1),
+ *pid_control.cpp (1)(2)
+ *       	(2) set_joints_known_pos	:uses utils.cpp
  *(3)(4), state_estimate.cpp (2)(3),
  *                                                     inv_cable_coupling.cpp
  *(1), fwd_cable_coupling.cpp (2)
- * 		(3) homing(joint)		:uses trajectory.cpp
- *(1)(2)(7)(8)
- * 		(4) homing(joint,tool)
+ * 		(3) homingStep
+ * 		(4) homing(joint,tool)		:uses trajectory.cpp
+ *(1)(8)
  * 		(5) check_homing_condition
+ * 	       *(6) init_homing
  *
  *	\author Hawkeye King
  *
@@ -54,6 +57,8 @@
  */
 
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 
 #include "trajectory.h"
 #include "pid_control.h"
@@ -62,16 +67,215 @@
 #include "fwd_cable_coupling.h"
 #include "t_to_DAC_val.h"
 #include "homing.h"
+#include "homing_cache.h"
+#include "homing_record.h"
 #include "state_estimate.h"
 #include "log.h"
 
 #include <iostream>
 
-int set_joints_known_pos(mechanism *_mech, int tool_only);
+int set_joints_known_pos(mechanism *_mech, int group);
 
+extern int NUM_MECH;
 extern unsigned long int gTime;
 extern DOF_type DOF_types[];
 
+/// Homing progress of one mechanism
+struct homing_mech {
+  homing_phase phase;
+  int group;                // joints in the current search, HOMING_GROUP_*
+  unsigned long int tick;   // start of the current phase
+  unsigned long int begin;  // start of homing
+  int warm;                 // TRUE if started from the saved calibration
+  int quiet;                // consecutive settled cycles
+};
+
+/// Hard-stop search of one joint
+struct homing_joint {
+  unsigned long int start;  // start of the search
+  float from;               // joint position at the start of the search
+  float vel;                // search velocity (rad/s or m/s)
+  int stall;                // consecutive stalled cycles
+};
+
+static homing_mech hmech[MAX_MECH];
+static homing_joint hjoint[MAX_MECH * MAX_DOF_PER_MECH];
+
+static int concurrent = 0;  // home tool and arm joints at the same time
+static int amp_delay = HOMING_AMP_DELAY;
+static float speed_scale = 1;
+
+static inline int mechArm(mechanism *mech) { return mech->type == GOLD_ARM ? 0 : 1; }
+
+/// peak speed of the move from the hard stops to home (rad/s or m/s)
+static const float return_vel[MAX_DOF_PER_MECH] = {0.6, 0.6, 0.12, 0, 1.5, 1.5, 1.5, 1.5};
+
+/**
+ *   \fn static int inGroup(DOF *_joint, int group)
+ *
+ *	\brief Check whether a joint belongs to one of the HOMING_GROUP_* groups.
+ *
+ *	\return 1 if it does, 0 otherwise
+ */
+static int inGroup(DOF *_joint, int group) {
+  return (group & (is_toolDOF(_joint) ? HOMING_GROUP_TOOL : HOMING_GROUP_ARM)) ? 1 : 0;
+}
+
+/**
+ *   \fn static int groupAtStop(mechanism *_mech, int group)
+ *
+ *	\brief Check whether the joints of a group have all found their hard stops.
+ *
+ *	\return 1 if they have, 0 otherwise
+ *
+ *	\todo check for grasp2 - bug?
+ */
+static int groupAtStop(mechanism *_mech, int group) {
+  if ((group & HOMING_GROUP_TOOL) &&
+      (_mech->joint[TOOL_ROT].state != jstate_hard_stop ||
+       _mech->joint[WRIST].state != jstate_hard_stop ||
+       _mech->joint[GRASP1].state != jstate_hard_stop))
+    return 0;
+  if ((group & HOMING_GROUP_ARM) &&
+      (_mech->joint[SHOULDER].state != jstate_hard_stop ||
+       _mech->joint[ELBOW].state != jstate_hard_stop ||
+       _mech->joint[Z_INS].state != jstate_hard_stop))
+    return 0;
+  return 1;
+}
+
+/**
+ *   \fn static int groupSettled(mechanism *_mech, int group)
+ *
+ *	\brief Check whether the joints of a group have come to rest.
+ *
+ *	\return 1 if every joint moves slower than HOMING_SETTLE_VEL of its search
+ *velocity
+ */
+static int groupSettled(mechanism *_mech, int group) {
+  DOF *_joint = NULL;
+  int j = 0;
+
+  while (loop_over_joints(_mech, _joint, j)) {
+    if (!inGroup(_joint, group)) continue;
+    if (fabs(_joint->jvel) > HOMING_SETTLE_VEL * fabs(hjoint[_joint->type].vel)) return 0;
+  }
+  return 1;
+}
+
+/**
+ *   \fn static int mechReady(mechanism *_mech)
+ *
+ *	\brief Check whether every joint of a mechanism has finished homing.
+ *
+ *	\return 1 if all joints are ready, 0 otherwise
+ */
+static int mechReady(mechanism *_mech) {
+  DOF *_joint = NULL;
+  int j = 0;
+
+  while (loop_over_joints(_mech, _joint, j))
+    if (_joint->state != jstate_ready) return 0;
+  return 1;
+}
+
+/**
+ *   \fn static void homingStep(mechanism *_mech, homing_mech *hm)
+ *
+ *	\brief Advance the homing state machine of one mechanism by one cycle.
+ *
+ *	\desc With concurrent homing the tool and arm groups search for their hard
+ *stops together and are zeroed together.  Otherwise the tool group is zeroed
+ *and homed before the arm group starts, as the original procedure did.
+ *
+ *	\param _mech  which mechanism (gold/green)
+ *	\param hm     its homing state
+ *
+ *	\ingroup Control
+ */
+static void homingStep(mechanism *_mech, homing_mech *hm) {
+  DOF *_joint = NULL;
+  int j = 0;
+
+  switch (hm->phase) {
+    case hphase_idle:
+      // Zero out joint torques, and control inputs. Set joint.state=not_ready.
+      while (loop_over_joints(_mech, _joint, j)) {
+        _joint->tau_d = 0;
+        _joint->mpos_d = _joint->mpos;
+        _joint->jpos_d = _joint->jpos;
+        _joint->jvel_d = 0;
+        _joint->state = jstate_not_ready;
+
+        if (is_toolDOF(_joint)) jvel_PI_control(_joint, 1);  // reset PI control integral term
+      }
+      hm->phase = hphase_amps;
+      hm->tick = hm->begin = gTime;
+      hm->warm = FALSE;
+      homingRecordBegin(_mech);
+      return;
+
+    case hphase_amps:
+      // Wait a short time for amps to turn on
+      if (gTime - hm->tick < (unsigned long int)amp_delay) return;
+      if (homingCacheRestore(_mech)) {
+        hm->group = HOMING_GROUP_ALL;
+        hm->phase = hphase_return;
+        hm->tick = gTime;
+        hm->warm = TRUE;
+        log_msg("Arm %d warm start from saved calibration", _mech->type);
+        break;
+      }
+      hm->group = concurrent ? HOMING_GROUP_ALL : HOMING_GROUP_TOOL;
+      if (tools_ready(_mech)) hm->group = HOMING_GROUP_ARM;  // dummy tools need no homing
+      hm->phase = hphase_search;
+      hm->tick = gTime;
+      log_msg("Homing sequence initialized on arm %d", _mech->type);
+      break;
+
+    case hphase_search:
+      if (groupAtStop(_mech, hm->group)) {
+        hm->phase = hphase_settle;
+        hm->tick = gTime;
+        hm->quiet = 0;
+      }
+      break;
+
+    case hphase_settle:
+      hm->quiet = groupSettled(_mech, hm->group) ? hm->quiet + 1 : 0;
+      if (hm->quiet >= HOMING_SETTLE_TICKS || gTime - hm->tick >= HOMING_SETTLE_MAX) {
+        set_joints_known_pos(_mech, hm->group);  // perform second phase
+        hm->phase = hphase_return;
+        hm->tick = gTime;
+      }
+      break;
+
+    case hphase_return:
+      if (hm->group == HOMING_GROUP_TOOL && tools_ready(_mech)) {
+        hm->group = HOMING_GROUP_ARM;
+        hm->phase = hphase_search;
+        hm->tick = gTime;
+        break;
+      }
+      if (mechReady(_mech)) {
+        hm->phase = hphase_done;
+        homingCacheStore(_mech);
+        homingRecordEnd(_mech, gTime - hm->begin, hm->warm);
+        log_msg("Arm %d homed in %lu ms", _mech->type, gTime - hm->begin);
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  // Specify motion commands
+  _joint = NULL;
+  while (loop_over_joints(_mech, _joint, j))
+    if (_joint->state != jstate_not_ready || inGroup(_joint, hm->group))
+      homing(_joint, _mech->mech_tool);
+}
+
 /**
  *   \fn int raven_homing(device *device0, param_pass *currParams, int
  *begin_homing)
@@ -83,8 +287,8 @@ extern DOF_type DOF_types[];
  *		This function operates in two phases:
  *    -# Discover joint position by running to hard stop. Using PD control (I
  *term zero'd) we move the
- *           joint at a smooth rate until current increases which indicates
- *hitting hard mechanical stop.
+ *           joint at a smooth rate until current increases or the joint
+ *stalls, which indicates hitting hard mechanical stop.
  *    -# Move joints to "home" position.  In this phase the robot moves from the
  *joint limits to a
  *			designated pose in the center of the workspace.
@@ -97,12 +301,8 @@ extern DOF_type DOF_types[];
  *   \ingroup Control
  *
  *	\return 0
- *
- *   \todo   Homing limits should be Amps not DAC units (see homing()).
  */
 int raven_homing(device *device0, param_pass *currParams, int begin_homing) {
-  static int homing_inited = 0;
-  static unsigned long int delay, delay2;
   DOF *_joint = NULL;
   mechanism *_mech = NULL;
   int i = 0, j = 0;
@@ -121,56 +321,28 @@ int raven_homing(device *device0, param_pass *currParams, int begin_homing) {
 
   // Only run in init mode
   if (!(currParams->runlevel == RL_INIT && currParams->sublevel == SL_AUTO_INIT)) {
-    homing_inited = 0;
-    delay = gTime;
+    for (i = 0; i < MAX_MECH; i++) hmech[i].phase = hphase_idle;
     return 0;  // return if we are in the WRONG run level (PLC state)
   }
 
-  // Wait a short time for amps to turn on
-  if (gTime - delay < 1000) {
-    return 0;
-  }
-  // Initialize the homing sequence.
-  if (begin_homing || !homing_inited)  // only do this the first time through
-  {
-    // Zero out joint torques, and control inputs. Set joint.state=not_ready.
-    _mech = NULL;
-    _joint = NULL;
-    while (loop_over_joints(device0, _mech, _joint, i, j))  // foreach (joint)
-    {
-      _joint->tau_d = 0;
-      _joint->mpos_d = _joint->mpos;
-      _joint->jpos_d = _joint->jpos;
-      _joint->jvel_d = 0;
-      _joint->state = jstate_not_ready;
-
-      if (is_toolDOF(_joint)) jvel_PI_control(_joint, 1);  // reset PI control integral term
-      homing_inited = 1;
-    }
-    log_msg("Homing sequence initialized");
-  }
-
-  // Specify motion commands
-  _mech = NULL;
-  _joint = NULL;
-  while (loop_over_joints(device0, _mech, _joint, i, j)) {
-    // Initialize tools first.
-    if (is_toolDOF(_joint)) {
-      homing(_joint, device0->mech[i].mech_tool);
-
-    } else if (tools_ready(&(device0->mech[i]))) {
-      homing(_joint);
-    }
+  // Step each mechanism through its own homing sequence.
+  for (i = 0; i < NUM_MECH; i++) {
+    homing_mech *hm = &hmech[mechArm(&device0->mech[i])];
+    if (begin_homing) hm->phase = hphase_idle;
+    homingStep(&device0->mech[i], hm);
   }
 
   // Inverse Cable Coupling
   invCableCoupling(device0, currParams->runlevel);
 
-  // Do PD control on all joints
+  // Do PD control on all joints, leaving arms with amps still coming up idle
   _mech = NULL;
   _joint = NULL;
   while (loop_over_joints(device0, _mech, _joint, i, j)) {
-    mpos_PD_control(_joint);
+    if (hmech[mechArm(_mech)].phase <= hphase_amps)
+      _joint->tau_d = 0;
+    else
+      mpos_PD_control(_joint);
   }
 
   // Calculate output DAC values
@@ -180,36 +352,14 @@ int raven_homing(device *device0, param_pass *currParams, int begin_homing) {
   _mech = NULL;
   _joint = NULL;
   while (loop_over_joints(device0, _mech, _joint, i, j)) {
-    DOF *_joint = &(_mech->joint[j]);  ///\todo is this line necessary?
+    if (_joint->state == jstate_pos_unknown) homingRecordSample(_joint);
 
     // Check to see if we've reached the joint limit.
     if (check_homing_condition(_joint)) {
-      log_msg("Found limit on joint %d cmd: %d \t", _joint->type, _joint->current_cmd,
-              DOF_types[_joint->type].DAC_max);
+      log_msg("Found limit on joint %d cmd: %d \t", _joint->type, _joint->current_cmd);
       _joint->state = jstate_hard_stop;
       _joint->current_cmd = 0;
       stop_trajectory(_joint);
-      log_msg("joint %d checked ", j);
-    }
-
-    // For each mechanism, check to see if the mech is finished homing.
-    if (j == (MAX_DOF_PER_MECH - 1)) {
-      /// if we're homing tools, wait for tools to be finished
-      if ((!tools_ready(_mech) && _mech->joint[TOOL_ROT].state == jstate_hard_stop &&
-           _mech->joint[WRIST].state == jstate_hard_stop &&
-           _mech->joint[GRASP1].state == jstate_hard_stop)  // \TODO check for grasp2 - bug?
-          ||
-          (tools_ready(_mech) && _mech->joint[SHOULDER].state == jstate_hard_stop &&
-           _mech->joint[ELBOW].state == jstate_hard_stop &&
-           _mech->joint[Z_INS].state == jstate_hard_stop)) {
-        if (delay2 == 0) delay2 = gTime;
-
-        if (gTime > delay2 + 200)  // wait 200 ticks for cables to settle down
-        {
-          set_joints_known_pos(_mech, !tools_ready(_mech));  // perform second phase
-          delay2 = 0;
-        }
-      }
     }
   }
 
@@ -217,7 +367,21 @@ int raven_homing(device *device0, param_pass *currParams, int begin_homing) {
 }
 
 /**
- *   \fn int set_joints_known_pos(mechanism* _mech, int tool_only)
+ *   \fn int homingPhase(int arm)
+ *
+ *	\brief Report how far an arm has got through homing.
+ *
+ *	\param arm   0 for the gold arm, 1 for the green arm
+ *
+ *	\return a homing_phase
+ */
+int homingPhase(int arm) {
+  if (arm < 0 || arm >= MAX_MECH) return hphase_idle;
+  return hmech[arm].phase;
+}
+
+/**
+ *   \fn int set_joints_known_pos(mechanism* _mech, int group)
  *
  *	\brief  Set joint angles to known values after hard stops are reached.
  *
@@ -225,7 +389,7 @@ int raven_homing(device *device0, param_pass *currParams, int begin_homing) {
  *       Propagate the joint angle to motor position and encoder offset.
  *
  *   \param _mech       which mechanism (gold/green)
- *   \param tool_only   flag which initializes only the tool/wrist joints
+ *   \param group       HOMING_GROUP_* joints that are at their hard stops
  *
  *	\ingroup Control
  *
@@ -236,7 +400,7 @@ int raven_homing(device *device0, param_pass *currParams, int begin_homing) {
  * 	\todo  This MAYBE needs to be changed to support device specific
  *parameter changes read from a config file or ROS service.
  */
-int set_joints_known_pos(mechanism *_mech, int tool_only) {
+int set_joints_known_pos(mechanism *_mech, int group) {
   DOF *_joint = NULL;
   int j = 0;
 
@@ -248,17 +412,17 @@ int set_joints_known_pos(mechanism *_mech, int tool_only) {
 
   //    int offset = 0;
   //    if (_mech->type == GREEN_ARM) offset = 8;
-  /// Set joint position reference for just tools, or all DOFS
+  /// Set joint position reference for the tools, the positioning joints, or all DOFS
   _joint = NULL;
   while (loop_over_joints(_mech, _joint, j)) {
     // when tool joints finish, set positioning joints to neutral
-    if (tool_only && !is_toolDOF(_joint->type)) {
+    if (!inGroup(_joint, group) && !is_toolDOF(_joint->type)) {
       // Set jpos_d to the joint limit value.
       _joint->jpos_d = DOF_types[_joint->type].home_position;  // keep non tool joints from moving
     }
 
     // when positioning joints finish, set tool joints to nothing special
-    else if (!tool_only && is_toolDOF(_joint->type)) {
+    else if (!inGroup(_joint, group) && is_toolDOF(_joint->type)) {
       _joint->jpos_d = _joint->jpos;
     }
     // when tool or positioning joints finish, set them to max_angle
@@ -279,80 +443,28 @@ int set_joints_known_pos(mechanism *_mech, int tool_only) {
   // use_actual flag triggered for insertion axis
   invMechCableCoupling(_mech, 1);
 
+  // Reset the state-estimate filter
+  resetFilter(_mech);
+
   _joint = NULL;
   while (loop_over_joints(_mech, _joint, j)) {
-    // Reset the state-estimate filter
     _joint->mpos = _joint->mpos_d;
-    resetFilter(_joint);
 
     // Convert the motor position to an encoder offset.
     // mpos = k * (enc_val - enc_offset)  --->  enc_offset = enc_val - mpos/k
-    float f_enc_val = _joint->enc_val;
-    int j_flip = 1;
-
-    // Encoder values on Gold arm are reversed.  See also state_machine.cpp
-    switch (_mech->mech_tool.t_style) {
-      case dv:
-        if (_mech->type == GOLD_ARM && !is_toolDOF(_joint)) {
-          f_enc_val *= -1.0;
-        } else if (_mech->type == GREEN_ARM) {
-          j_flip *= -1.0;
-        }
-        break;
-      case square_raven:
-        if ((_mech->type == GOLD_ARM && !is_toolDOF(_joint)) ||
-            (_mech->type == GREEN_ARM &&
-             is_toolDOF(_joint))  // Green arm tools are also reversed with square pattern
-            )
-          f_enc_val *= -1.0;
-        break;
-      default:
-        if (_mech->type == GOLD_ARM || is_toolDOF(_joint)) {
-          f_enc_val *= -1.0;
-        }
-        if (_mech->type == GREEN_ARM) {
-          j_flip *= -1.0;
-        }
-        break;
-    }
-#ifdef OPPOSE_GRIP
-    if (j == GRASP1) {
-      f_enc_val *= -1;  // switch encoder value for opposed grasp
-    }
-#endif
-
-    if (j == Z_INS) {
-      j_flip *= -1;
-    }
+    float f_enc_val = _mech->enc.motor_sign[j] * _joint->enc_val;
 
     /// Set the joint offset in encoder space.
     float cc = ENC_CNTS_PER_REV / (2 * M_PI);
     _joint->enc_offset = f_enc_val - (_joint->mpos_d * cc);
 
     // set the joint encoder offset in encoder space
-    float j_enc_val = j_flip * _joint->joint_enc_val;
-
-    if ((j == SHOULDER) || (j == ELBOW)) {  // if joint is shoulder or elbow
-      cc = ROTARY_JOINT_ENC_PER_REV / (2 * PI);
-      // log_msg("joint		%d", j);
-      // log_msg("cc value			= %f", cc);
-    } else if (j == Z_INS) {
-      cc = LINEAR_JOINT_ENC_PER_M;
-      // log_msg("joint		%d", j);
-      // log_msg("cc value			= %f", cc);
-    }
-
-    if (!is_toolDOF(_joint->type)) {
-      // log_msg("j_enc value			= %f", j_enc_val);
-      // log_msg("j_pos_d				= %f", _joint->jpos_d);
-      // log_msg("j_pos_d*cc				= %f", _joint->jpos_d *
-      // cc);
-
-      _joint->joint_enc_offset = j_enc_val - (_joint->jpos_d * cc);
+    if (_mech->enc.joint_cnts[j] != 0) {
+      float j_enc_val = _mech->enc.joint_sign[j] * _joint->joint_enc_val;
+      _joint->joint_enc_offset = j_enc_val - (_joint->jpos_d * _mech->enc.joint_cnts[j]);
     }
 
-    getStateLPF(_joint, _mech->tool_type);
-    // getStateLPF(_joint, _mech->mech_tool.t_style);
+    getStateLPF(_mech, j);
   }
 
   fwdMechCableCoupling(_mech);
@@ -360,94 +472,16 @@ int set_joints_known_pos(mechanism *_mech, int tool_only) {
 }
 
 /**
- *	\fn void homing(DOF* _joint)
+ *	\fn void homing(DOF* _joint, tool a_tool)
  *
  *	\brief Set trajectory behavior for each joint during the homing process.
  *
- *   \param _joint The joint being controlled.
- *
- * 	\ingroup Control
- *
- *	\return void
- *
- *   \todo  Homing limits should be Amps not DAC units
- *   \todo  Change square vs. diamond to a config-file based runtime system
- *instead of #ifdef
- */
-void homing(DOF *_joint) {
-  // duration for homing of each joint
-  const float f_period[MAX_MECH * MAX_DOF_PER_MECH] = {1, 1, 1, 9999999, 1, 1, 1, 1,
-                                                       1, 1, 1, 9999999, 1, 1, 1, 1};
-// degrees for homing of each joint
-#ifdef RAVEN_II_SQUARE
-  // roll is backwards because of the 'click' in the mechanism
-  const float f_magnitude[MAX_MECH * MAX_DOF_PER_MECH] = {
-      -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, -80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-      -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, -80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD};
-#else
-#ifdef DV_ADAPTER
-  const float f_magnitude[MAX_MECH * MAX_DOF_PER_MECH] = {
-      -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-      -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD};
-#else  // default
-  const float f_magnitude[MAX_MECH * MAX_DOF_PER_MECH] = {
-      -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-      -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD};
-#endif
-#endif
-
-  switch (_joint->state) {
-    case jstate_wait:
-      break;
-
-    case jstate_not_ready:
-      // Initialize velocity trajectory
-      // log_msg("Starting homing on joint %d", _joint->type);
-      _joint->state = jstate_pos_unknown;
-      start_trajectory_mag(_joint, f_magnitude[_joint->type], f_period[_joint->type]);
-      break;
-
-    case jstate_pos_unknown:
-      // Set desired joint trajectory
-      update_linear_sinusoid_position_trajectory(_joint);
-      break;
-
-    case jstate_hard_stop:
-      // Wait for all joints. No trajectory here.
-
-      break;
-
-    case jstate_homing1:
-      start_trajectory(_joint, DOF_types[_joint->type].home_position, 2.5);
-      _joint->state = jstate_homing2;
-      break;
-
-    case jstate_homing2:
-      // Move to start position
-      // Update position trajectory
-      if (!update_position_trajectory(_joint)) {
-        _joint->state = jstate_ready;
-        log_msg("Joint %d ready", _joint->type);
-      }
-      break;
-
-    default:
-      // not doing joint homing.
-      break;
-
-  }  // switch
-
-  return;
-}
-
-/**
- *	\fn void homing(DOF* _joint, tool a_tool)
- *
- *	\brief Set trajectory behavior for each tool joint during the homing
- *process.
+ *	\desc A joint searches for its hard stop by ramping smoothly up to its
+ *search velocity over HOMING_RAMP_TIME and then holding it.  Once zeroed it
+ *moves home in a time set by the distance and its return speed.
  *
  *   \param _joint The joint being controlled.
- *	\param a_tool The tool being controlled.
+ *	\param a_tool The tool on this joint's mechanism.
  *
  * 	\ingroup Control
  *
@@ -455,52 +489,15 @@ void homing(DOF *_joint) {
  *   \TODO refactor for tool class
  */
 void homing(DOF *_joint, tool a_tool) {
-  // duration for homing of each joint
-  const float f_period[MAX_MECH * MAX_DOF_PER_MECH] = {1, 1, 1, 9999999, 1, 1, 1, 1,
-                                                       1, 1, 1, 9999999, 1, 1, 1, 1};
-  //    // degrees for homing of each joint
-  //#ifdef RAVEN_II_SQUARE
-  //    //roll is backwards because of the 'click' in the mechanism
-  //    const float f_magnitude[MAX_MECH*MAX_DOF_PER_MECH] = {-10 DEG2RAD, 10
-  //    DEG2RAD, 0.02, 9999999, -80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-  //                                                          -10 DEG2RAD, 10
-  //                                                          DEG2RAD, 0.02,
-  //                                                          9999999, -80
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD};
-  //#else
-  //#ifdef DV_ADAPTER
-  //    const float f_magnitude[MAX_MECH*MAX_DOF_PER_MECH] = {-10 DEG2RAD, 10
-  //    DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-  //                                                          -10 DEG2RAD, 10
-  //                                                          DEG2RAD, 0.02,
-  //                                                          9999999, 80
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD};
-  //#else //default
-  //    const float f_magnitude[MAX_MECH*MAX_DOF_PER_MECH] = {-10 DEG2RAD, 10
-  //    DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
-  //                                                          -10 DEG2RAD, 10
-  //                                                          DEG2RAD, 0.02,
-  //                                                          9999999, 80
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD, 40
-  //                                                          DEG2RAD};
-  //#endif
-  //#endif
-
-  // check if scissors
-  int scissor = ((a_tool.t_end == mopocu_scissor) || (a_tool.t_end == potts_scissor)) ? 1 : 0;
-
+  // search velocity of each joint (rad/s or m/s)
   float f_magnitude[MAX_MECH * MAX_DOF_PER_MECH] = {
       -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD,
       -10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 80 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD, 40 DEG2RAD};
 
+  // check if scissors
+  int scissor = ((a_tool.t_end == mopocu_scissor) || (a_tool.t_end == potts_scissor)) ? 1 : 0;
+
+  // roll is backwards on square tools because of the 'click' in the mechanism
   if (a_tool.t_style == square_raven) {
     if (a_tool.mech_type == GOLD_ARM)
       f_magnitude[TOOL_ROT_GOLD] = -80 DEG2RAD;
@@ -514,29 +511,45 @@ void homing(DOF *_joint, tool a_tool) {
       f_magnitude[GRASP2_GREEN] = -40 DEG2RAD;
   }
 
+  homing_joint *h = &hjoint[_joint->type];
+  float t, vel, dist;
+
   switch (_joint->state) {
     case jstate_wait:
       break;
 
     case jstate_not_ready:
-      // Initialize velocity trajectory
+      // Start the search from rest where the joint is now
       // log_msg("Starting homing on joint %d", _joint->type);
       _joint->state = jstate_pos_unknown;
-      start_trajectory_mag(_joint, f_magnitude[_joint->type], f_period[_joint->type]);
+      _joint->jpos_d = _joint->jpos;
+      _joint->jvel_d = 0;
+      h->start = gTime;
+      h->from = _joint->jpos;
+      h->vel = speed_scale * f_magnitude[_joint->type];
+      h->stall = 0;
+      homingRecordJointStart(_joint);
       break;
 
     case jstate_pos_unknown:
       // Set desired joint trajectory
-      update_linear_sinusoid_position_trajectory(_joint);
+      t = (gTime - h->start) * ONE_MS;
+      vel = h->vel;
+      if (t < HOMING_RAMP_TIME) vel *= 0.5 * (1 - cos(M_PI * t / HOMING_RAMP_TIME));
+      _joint->jpos_d += ONE_MS * vel;
       break;
 
     case jstate_hard_stop:
-      // Wait for all joints. No trajectory here.
+      // Wait for the rest of the group. No trajectory here.
 
       break;
 
     case jstate_homing1:
-      start_trajectory(_joint, DOF_types[_joint->type].home_position, 2.5);
+      // update_position_trajectory() peaks at pi/2 times the mean speed
+      dist = fabs(DOF_types[_joint->type].home_position - _joint->jpos);
+      t = std::max((float)HOMING_RETURN_MIN,
+                   (float)(M_PI / 2) * dist / return_vel[_joint->type % MAX_DOF_PER_MECH]);
+      start_trajectory(_joint, DOF_types[_joint->type].home_position, t);
       _joint->state = jstate_homing2;
       break;
 
@@ -598,29 +611,86 @@ const int homing_max_dac[8] = {2100,  // shoulder
 /**
  *  \fn int check_homing_condition(DOF *_joint)
  *
- * 	\brief Monitor joint currents to end the homing cycle at hard stop.
+ * 	\brief Monitor joint currents and velocities to end the homing cycle at
+ *hard stop.
+ *
+ *  \desc A joint has reached it's mechanical limit when its current rises
+ *above the hard-stop current, or when it stalls: its current is above
+ *HOMING_STALL_CURRENT of that and it has moved slower than HOMING_STALL_VEL of
+ *its search velocity for HOMING_STALL_TICKS cycles.  The hard-stop currents are
+ *the homing_max_dac limits in amps, lowered by homingThreshold() once enough
+ *runs have been recorded (see homing_record.cpp).
  *
- *  \desc Checks to see if a joint current is above a certain max value which
- *indicates that the
- *			joint has reached it's mechanical limit.
+ *       The tuned threshold is learnt from free-running current after the
+ *ramp-up, so until the joint has ramped up and travelled HOMING_MIN_TRAVEL
+ *seconds' worth of its search velocity only the default current ends the
+ *search.  Breakaway friction and the integral build-up at the start of a search
+ *can then not be taken for the hard stop.
  *
  *  \param _joint    A joint struct
  *
  * 	\ingroup Control
  *
- *	\return 1 if DAC output is greater than the maximum allowable
+ *	\return 1 if the joint is at its hard stop
  *			0 otherwise
- *
- *  \todo Homing limits should be Amps not DAC units (see homing()).
  */
 int check_homing_condition(DOF *_joint) {
   if (_joint->state != jstate_pos_unknown) return 0;
 
-  // check if the DAC output is greater than the maximum allowable.
-  // Note, current_cmd is an integer, so using abs (not fabs) is okay.
-  if (abs(_joint->current_cmd) >= homing_max_dac[_joint->type % 8]) {
+  homing_joint *h = &hjoint[_joint->type];
+  float dac_per_amp = DOF_types[_joint->type].DAC_per_amp;
+  float amps = fabs(_joint->current_cmd / dac_per_amp);
+  float i_default = homing_max_dac[_joint->type % 8] / dac_per_amp;
+
+  int moving = (gTime - h->start) * ONE_MS >= HOMING_RAMP_TIME &&
+               fabs(_joint->jpos - h->from) >= HOMING_MIN_TRAVEL * fabs(h->vel);
+  float i_stop = moving ? homingThreshold(_joint, i_default) : i_default;
+
+  if (amps >= i_stop) {
+    homingRecordStop(_joint, hstop_current, i_stop);
     return 1;
   }
 
+  if (moving && amps >= HOMING_STALL_CURRENT * i_stop &&
+      fabs(_joint->jvel) < HOMING_STALL_VEL * fabs(h->vel))
+    h->stall++;
+  else
+    h->stall = 0;
+
+  if (h->stall < HOMING_STALL_TICKS) return 0;
+  homingRecordStop(_joint, hstop_stall, i_stop);
+  return 1;
+}
+
+/**
+ *  \fn int init_homing(ros::NodeHandle &n)
+ *
+ * 	\brief Read the homing options.
+ *
+ *  \desc /homing_concurrent homes the tool and arm joints of each mechanism
+ *together rather than tools first (the default), /homing_amp_delay is the wait in
+ *ms for the amplifiers and /homing_speed_scale scales the hard-stop search
+ *velocities (0.25 to 2).
+ *
+ *  \param n    the ROS node handle
+ *
+ * 	\ingroup Control
+ *
+ *	\return 0
+ */
+int init_homing(ros::NodeHandle &n) {
+  bool together;
+  double scale;
+
+  n.param("/homing_concurrent", together, false);
+  n.param("/homing_amp_delay", amp_delay, HOMING_AMP_DELAY);
+  n.param("/homing_speed_scale", scale, 1.0);
+
+  concurrent = together ? 1 : 0;
+  amp_delay = std::max(amp_delay, 0);
+  speed_scale = std::min(std::max(scale, 0.25), 2.0);
+  log_msg("Homing: %s, search speed x%.2f", concurrent ? "concurrent" : "tools first",
+          speed_scale);
+
   return 0;
 }
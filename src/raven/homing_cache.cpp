@@ -0,0 +1,363 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file homing_cache.cpp
+ *
+ * \brief Saved homing calibration for a warm start without the hard-stop sweep
+ *
+ * The encoder offsets that homing finds stay valid for as long as the boards
+ *keep counting, so they are saved with everything they depend on: the board
+ *serial, the tool type and a fingerprint of the joint limits, encoder map and
+ *cable coupling.  The encoder readings are saved alongside and refreshed at
+ *shutdown.
+ *
+ * On the next start an arm whose record matches its board, tool and
+ *fingerprint, and whose encoders are within /homing_cache_tol motor radians of
+ *the saved readings, takes the saved offsets and moves straight home.  Any
+ *mismatch falls back to the full homing sweep.  A power-cycled board reads
+ *zero, so a record whose readings were all within tolerance of zero is never
+ *used: a power cycle could not be told apart from an arm that stayed still.  A
+ *tool swapped for another of the same type without moving its discs cannot be
+ *detected.
+ *
+ * The RT thread records a calibration when an arm finishes homing; a timer in
+ *the ROS thread writes it to /homing_cache_file (default
+ *~/.ros/raven_homing.cal).  Enabled with /homing_warm_start (default false).
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "homing_cache.h"
+#include "coupling_matrix.h"
+#include "state_estimate.h"
+#include "fwd_cable_coupling.h"
+#include "defines.h"
+#include "log.h"
+
+#define CACHE_MAGIC "R2HOME1"
+
+extern int NUM_MECH;
+extern DOF_type DOF_types[];
+
+/// Calibration of one arm
+struct homing_cal {
+  int valid;
+  int serial;   // board serial, i.e. the mechanism type
+  int t_end;    // tool end effector
+  int t_style;  // tool interface style
+  u_32 config;  // fingerprint of the constants the offsets depend on
+  int enc_offset[MAX_DOF_PER_MECH];
+  int joint_enc_offset[MAX_DOF_PER_MECH];
+  int enc_val[MAX_DOF_PER_MECH];  // encoder readings when last saved
+  int joint_enc_val[MAX_DOF_PER_MECH];
+};
+
+/// Layout of the cache file
+struct cache_file {
+  char magic[8];
+  homing_cal arm[MAX_MECH];
+  u_32 checksum;
+};
+
+static homing_cal loaded[MAX_MECH];   // read from disk, used by the RT thread
+static homing_cal current[MAX_MECH];  // latest calibration, written by the RT thread
+static volatile unsigned int cacheSeq = 0;
+static volatile int homed[MAX_MECH];  // arms homed or warm started in this run
+static unsigned int writtenSeq = 0;  // cacheSeq last written to disk
+
+static int warm_start = FALSE;
+static float tol_counts = HOMING_CACHE_TOL * ENC_CNTS_PER_REV / (2 * M_PI);
+static std::string cache_path;
+static ros::Timer cache_timer;
+
+static inline int mechArm(mechanism *mech) { return mech->type == GOLD_ARM ? 0 : 1; }
+
+/**
+ * \brief Folds bytes into a 32 bit FNV-1a hash
+ */
+static u_32 fnv1a(u_32 h, const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+/**
+ * \brief Fingerprint of everything that maps a mechanism's joint limits to
+ *encoder offsets
+ */
+static u_32 fingerprint(mechanism *mech) {
+  u_32 h = 2166136261u;
+  int cnts = ENC_CNTS_PER_REV;
+
+  h = fnv1a(h, &cnts, sizeof(cnts));
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    if (j == NO_CONNECTION) continue;
+    const DOF_type *t = &DOF_types[mech->joint[j].type];
+    h = fnv1a(h, &t->max_position, sizeof(t->max_position));
+    h = fnv1a(h, &t->home_position, sizeof(t->home_position));
+    h = fnv1a(h, &mech->enc.motor_sign[j], sizeof(mech->enc.motor_sign[j]));
+    h = fnv1a(h, &mech->enc.joint_sign[j], sizeof(mech->enc.joint_sign[j]));
+    h = fnv1a(h, &mech->enc.joint_cnts[j], sizeof(mech->enc.joint_cnts[j]));
+  }
+  h = fnv1a(h, &mech->mech_tool.grasp2_min_angle, sizeof(mech->mech_tool.grasp2_min_angle));
+
+  const coupling_map *c = getCouplingMap(mech);
+  if (c && c->valid) {
+    h = fnv1a(h, c->joint_to_motor, sizeof(c->joint_to_motor));
+    h = fnv1a(h, c->motor_to_motor, sizeof(c->motor_to_motor));
+  }
+  return h;
+}
+
+/**
+ * \brief Reads the cache file into loaded[]
+ *
+ * \return TRUE if the file was read and its checksum matches
+ */
+static int loadCache(const std::string &path) {
+  cache_file f;
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) return FALSE;
+  int ok = fread(&f, sizeof(f), 1, fp) == 1;
+  fclose(fp);
+
+  if (!ok || memcmp(f.magic, CACHE_MAGIC, sizeof(f.magic)) != 0 ||
+      f.checksum != fnv1a(2166136261u, f.arm, sizeof(f.arm)))
+    return FALSE;
+  memcpy(loaded, f.arm, sizeof(loaded));
+  return TRUE;
+}
+
+/**
+ * \brief Writes calibrations to the cache file, replacing it atomically
+ */
+static void writeCache(const homing_cal *arms) {
+  cache_file f;
+  memset(&f, 0, sizeof(f));
+  strncpy(f.magic, CACHE_MAGIC, sizeof(f.magic));
+  memcpy(f.arm, arms, sizeof(f.arm));
+  f.checksum = fnv1a(2166136261u, f.arm, sizeof(f.arm));
+
+  std::string tmp = cache_path + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp) {
+    log_msg("Homing cache: cannot write %s", tmp.c_str());
+    return;
+  }
+  int ok = fwrite(&f, sizeof(f), 1, fp) == 1;
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), cache_path.c_str()) != 0)
+    log_msg("Homing cache: failed to save %s", cache_path.c_str());
+}
+
+/**
+ * \brief Copies the latest calibrations written by the RT thread
+ *
+ * \return the sequence number of the copy
+ */
+static unsigned int readCurrent(homing_cal *out) {
+  unsigned int seq;
+
+  do {
+    seq = cacheSeq;
+    __sync_synchronize();
+    memcpy(out, current, sizeof(current));
+    __sync_synchronize();
+  } while ((seq & 1) || seq != cacheSeq);
+  return seq;
+}
+
+/**
+ * \brief Saves a calibration the RT thread recorded since the last save
+ */
+static void cacheTimer(const ros::TimerEvent &) {
+  homing_cal arms[MAX_MECH];
+  unsigned int seq = readCurrent(arms);
+
+  if (seq == writtenSeq) return;
+  writeCache(arms);
+  writtenSeq = seq;
+}
+
+/**
+ * \brief Records an arm's calibration once it has finished homing
+ *
+ * Called from the RT thread; the file is written by the ROS thread.
+ *
+ * \param _mech  the homed mechanism
+ * \ingroup Control
+ */
+void homingCacheStore(mechanism *_mech) {
+  int arm = mechArm(_mech);
+  homing_cal *cal = &current[arm];
+
+  cacheSeq++;
+  __sync_synchronize();
+
+  cal->valid = TRUE;
+  cal->serial = _mech->type;
+  cal->t_end = _mech->mech_tool.t_end;
+  cal->t_style = _mech->mech_tool.t_style;
+  cal->config = fingerprint(_mech);
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    cal->enc_offset[j] = _mech->joint[j].enc_offset;
+    cal->joint_enc_offset[j] = _mech->joint[j].joint_enc_offset;
+    cal->enc_val[j] = _mech->joint[j].enc_val;
+    cal->joint_enc_val[j] = _mech->joint[j].joint_enc_val;
+  }
+
+  __sync_synchronize();
+  cacheSeq++;
+  homed[arm] = TRUE;
+}
+
+/**
+ * \brief Restores an arm's saved calibration if it still matches the robot
+ *
+ * On success the encoder offsets are set, the state estimate restarts from
+ *the calibrated position and every joint is left in jstate_homing1 to move
+ *home.  Called from the RT thread once the amplifiers are up.
+ *
+ * \param _mech  the mechanism to restore
+ * \return TRUE if the calibration was restored, FALSE to home normally
+ * \ingroup Control
+ */
+int homingCacheRestore(mechanism *_mech) {
+  const homing_cal *cal = &loaded[mechArm(_mech)];
+  const float cc = ENC_CNTS_PER_REV / (2 * M_PI);
+
+  if (!warm_start || !cal->valid || cal->serial != _mech->type ||
+      cal->t_end != _mech->mech_tool.t_end || cal->t_style != _mech->mech_tool.t_style ||
+      cal->config != fingerprint(_mech))
+    return FALSE;
+
+  // Readings near zero cannot tell a still arm from a power-cycled board
+  int nearZero = TRUE;
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    if (j == NO_CONNECTION) continue;
+    if (fabs((float)cal->enc_val[j]) > tol_counts) nearZero = FALSE;
+    if (_mech->enc.joint_cnts[j] != 0 && fabs((float)cal->joint_enc_val[j]) > tol_counts)
+      nearZero = FALSE;
+  }
+  if (nearZero) {
+    log_msg("Homing cache: saved encoders of arm %d are near zero, homing", mechArm(_mech));
+    return FALSE;
+  }
+
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    if (j == NO_CONNECTION) continue;
+    if (fabs((float)(_mech->joint[j].enc_val - cal->enc_val[j])) > tol_counts) return FALSE;
+    if (_mech->enc.joint_cnts[j] != 0 &&
+        fabs((float)(_mech->joint[j].joint_enc_val - cal->joint_enc_val[j])) > tol_counts)
+      return FALSE;
+  }
+
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    DOF *_joint = &_mech->joint[j];
+    _joint->enc_offset = cal->enc_offset[j];
+    _joint->joint_enc_offset = cal->joint_enc_offset[j];
+    _joint->mpos = _joint->mpos_d =
+        (_mech->enc.motor_sign[j] * _joint->enc_val - _joint->enc_offset) / cc;
+  }
+
+  // Restart the state estimate at the calibrated position
+  resetFilter(_mech);
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) getStateLPF(_mech, j);
+  fwdMechCableCoupling(_mech);
+
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    if (j == NO_CONNECTION) continue;
+    _mech->joint[j].jpos_d = _mech->joint[j].jpos;
+    _mech->joint[j].jvel_d = 0;
+    _mech->joint[j].state = jstate_homing1;
+  }
+  return TRUE;
+}
+
+/**
+ * \brief Saves the calibrations with the final encoder readings
+ *
+ * Call after the RT thread has stopped, so the next start can check that the
+ *encoders have not moved since.  Arms never homed keep the record they were
+ *started with.
+ *
+ * \param device0  the robot
+ * \ingroup Control
+ */
+void saveHomingCache(device *device0) {
+  if (cache_path.empty()) return;
+
+  homing_cal arms[MAX_MECH];
+  readCurrent(arms);
+  for (int m = 0; m < NUM_MECH; m++) {
+    mechanism *mech = &device0->mech[m];
+    homing_cal *cal = &arms[mechArm(mech)];
+    if (!homed[mechArm(mech)]) continue;
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+      cal->enc_val[j] = mech->joint[j].enc_val;
+      cal->joint_enc_val[j] = mech->joint[j].joint_enc_val;
+    }
+  }
+  writeCache(arms);
+  log_msg("Homing cache: saved %s", cache_path.c_str());
+}
+
+/**
+ * \brief Loads the saved homing calibration and starts the timer that saves
+ *new ones
+ *
+ * Must run before the RT thread starts.
+ *
+ * \param n  the ros node handle
+ * \return 0, or -1 if no usable calibration was found
+ * \ingroup Control
+ */
+int init_homing_cache(ros::NodeHandle &n) {
+  bool enable = false;
+  double tol = HOMING_CACHE_TOL;
+  const char *home = getenv("HOME");
+
+  n.param("/homing_warm_start", enable, false);
+  n.param("/homing_cache_tol", tol, HOMING_CACHE_TOL);
+  n.param("/homing_cache_file", cache_path,
+          std::string(home ? home : ".") + "/.ros/raven_homing.cal");
+
+  warm_start = enable ? TRUE : FALSE;
+  tol_counts = tol * ENC_CNTS_PER_REV / (2 * M_PI);
+  if (cache_path.empty()) return 0;
+
+  cache_timer = n.createTimer(ros::Duration(HOMING_CACHE_PERIOD), cacheTimer);
+
+  if (!loadCache(cache_path)) {
+    log_msg("Homing cache: no calibration in %s", cache_path.c_str());
+    return -1;
+  }
+  memcpy(current, loaded, sizeof(current));
+  log_msg("Homing cache: loaded %s, warm start %s", cache_path.c_str(),
+          warm_start ? "on" : "off");
+  return 0;
+}
@@ -0,0 +1,485 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file homing_record.cpp
+ *
+ * \brief Recorded homing traces, per-joint homing report and hard-stop
+ *threshold tuning
+ *
+ * While a joint searches for its hard stop the RT thread records its current,
+ *position and velocity every cycle into a preallocated ring that keeps the last
+ *HOMING_REC_LEN ms before the stop.  When an arm finishes homing, a 1 Hz timer
+ *in the ROS thread takes the frozen buffers and does the rest:
+ *  - writes the traces as CSV to /homing_record_dir (default ~/.ros/raven_homing);
+ *  - measures each joint's peak free-running current, i.e. after the velocity
+ *ramp and more than HOMING_REC_CONTACT ms before the stop;
+ *  - folds that into a history per arm, tool type and joint, saved in the
+ *same directory;
+ *  - logs and publishes the report: search time, stop current, threshold and
+ *margin per joint, and the arm's homing duration.
+ *
+ * Once a joint has HOMING_TUNE_RUNS runs with a tool type its hard-stop
+ *threshold is tuned to HOMING_TUNE_GAIN times its free-running current.  A
+ *tuned threshold is only ever used between HOMING_TUNE_FLOOR of the default
+ *and the default itself, so tuning can end a search sooner but never push
+ *harder on a stop.  A margin below HOMING_MARGIN_WARN of the threshold, or a
+ *free-running current HOMING_DRIFT_WARN over its history, flags the joint; both
+ *point to rising friction in the cables or the tool.
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <algorithm>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "homing_record.h"
+#include "homing.h"
+#include "defines.h"
+#include "struct.h"
+#include "log.h"
+
+#define HIST_MAGIC "R2HHIST"
+
+extern DOF_type DOF_types[];
+extern unsigned long int gTime;
+
+/// Ownership of an arm's recording
+enum rec_state {
+  rec_idle = 0,       // free
+  rec_recording = 1,  // being written by the RT thread
+  rec_done = 2,       // complete, waiting for the ROS thread
+  rec_writing = 3     // being saved by the ROS thread
+};
+
+struct rec_sample {
+  float amps;  // commanded current (A)
+  float jpos;
+  float jvel;
+};
+
+/// Recording of one joint's search
+struct rec_joint {
+  rec_sample buf[HOMING_REC_LEN];
+  unsigned long int count;  // samples recorded
+  unsigned long int start;  // cycle the search started
+  unsigned long int end;    // cycle the stop was found
+  int searched;             // TRUE once the stop was found
+  int stop;                 // homing_stop
+  float threshold;          // hard-stop current (A)
+  float stop_amps;          // current at the stop (A)
+};
+
+/// Recording of one arm's homing run
+struct rec_arm {
+  volatile int state;  // rec_state
+  int tool;            // end_effector_type
+  int warm;
+  unsigned long int duration;
+  rec_joint joint[MAX_DOF_PER_MECH];
+};
+
+/// History of one joint with one tool
+struct hist_entry {
+  int runs;
+  float free_amps;  // weighted average of the peak free-running current (A)
+  float search_ms;  // weighted average of the search time
+};
+
+/// Layout of the history file
+struct hist_file {
+  char magic[8];
+  hist_entry h[MAX_MECH][HOMING_TOOL_TYPES][MAX_DOF_PER_MECH];
+  u_32 checksum;
+};
+
+static rec_arm rec[MAX_MECH];
+static int recording[MAX_MECH];    // RT thread: this run is being recorded
+static int active_tool[MAX_MECH];  // RT thread: end_effector_type being homed
+
+static hist_file history;  // ROS thread only
+static volatile float tuned[MAX_MECH][HOMING_TOOL_TYPES][MAX_DOF_PER_MECH];
+
+static homing_report reports[MAX_MECH];
+static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static std::string rec_dir;
+static ros::Timer rec_timer;
+
+static const char *dofNames[MAX_DOF_PER_MECH] = {"shoulder", "elbow",  "insertion", "",
+                                                 "tool roll", "wrist", "grasp 1",   "grasp 2"};
+static const char *stopNames[hstop_last] = {"none", "current", "stall"};
+
+static inline int mechArm(mechanism *mech) { return mech->type == GOLD_ARM ? 0 : 1; }
+
+/**
+ * \brief Folds bytes into a 32 bit FNV-1a hash
+ */
+static u_32 fnv1a(const void *data, size_t len) {
+  const unsigned char *p = (const unsigned char *)data;
+  u_32 h = 2166136261u;
+  for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+/**
+ * \brief Sets the tuned thresholds from the history
+ */
+static void updateTuned() {
+  for (int a = 0; a < MAX_MECH; a++)
+    for (int t = 0; t < HOMING_TOOL_TYPES; t++)
+      for (int d = 0; d < MAX_DOF_PER_MECH; d++) {
+        const hist_entry *e = &history.h[a][t][d];
+        tuned[a][t][d] = e->runs >= HOMING_TUNE_RUNS ? HOMING_TUNE_GAIN * e->free_amps : 0;
+      }
+}
+
+/**
+ * \brief Reads the history file, if there is a valid one
+ */
+static void loadHistory(const std::string &path) {
+  hist_file f;
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (!fp) return;
+  int ok = fread(&f, sizeof(f), 1, fp) == 1;
+  fclose(fp);
+
+  if (!ok || memcmp(f.magic, HIST_MAGIC, sizeof(f.magic)) != 0 ||
+      f.checksum != fnv1a(f.h, sizeof(f.h))) {
+    log_msg("Homing record: ignoring bad history %s", path.c_str());
+    return;
+  }
+  history = f;
+}
+
+/**
+ * \brief Writes the history file, replacing it atomically
+ */
+static void saveHistory(const std::string &path) {
+  std::string tmp = path + ".tmp";
+  history.checksum = fnv1a(history.h, sizeof(history.h));
+
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp) {
+    log_msg("Homing record: cannot write %s", tmp.c_str());
+    return;
+  }
+  int ok = fwrite(&history, sizeof(history), 1, fp) == 1;
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    log_msg("Homing record: failed to save %s", path.c_str());
+}
+
+/**
+ * \brief Peak free-running current of a recorded search
+ *
+ * \return the current (A), or 0 if the search was too short to run free
+ */
+static float freeAmps(const rec_joint *rj) {
+  unsigned long int first = (unsigned long int)(HOMING_RAMP_TIME * 1000);
+  unsigned long int last = rj->count > HOMING_REC_CONTACT ? rj->count - HOMING_REC_CONTACT : 0;
+  float peak = 0;
+
+  if (rj->count > HOMING_REC_LEN) first = std::max(first, rj->count - HOMING_REC_LEN);
+  for (unsigned long int k = first; k < last; k++)
+    peak = std::max(peak, (float)fabs(rj->buf[k % HOMING_REC_LEN].amps));
+  return peak;
+}
+
+/**
+ * \brief Writes an arm's recorded traces as CSV
+ */
+static void writeTraces(int arm, const rec_arm *ra, const homing_report &r) {
+  char name[64], stamp[32];
+  time_t now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+  snprintf(name, sizeof(name), "/homing_%s_%s.csv", arm == 0 ? "gold" : "green", stamp);
+
+  std::string path = rec_dir + name;
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp) {
+    log_msg("Homing record: cannot write %s", path.c_str());
+    return;
+  }
+
+  fprintf(fp, "# tool %d, duration %.0f ms\n", r.tool, r.duration_ms);
+  for (int d = 0; d < MAX_DOF_PER_MECH; d++) {
+    const homing_joint_report *jr = &r.joint[d];
+    if (!jr->searched) continue;
+    fprintf(fp, "# %s: stop %s at %.0f ms, %.3f A, threshold %.3f A, free %.3f A\n", dofNames[d],
+            stopNames[jr->stop], jr->search_ms, jr->stop_amps, jr->threshold, jr->free_amps);
+  }
+  fprintf(fp, "dof,ms,amps,jpos,jvel\n");
+  for (int d = 0; d < MAX_DOF_PER_MECH; d++) {
+    const rec_joint *rj = &ra->joint[d];
+    unsigned long int first = rj->count > HOMING_REC_LEN ? rj->count - HOMING_REC_LEN : 0;
+    for (unsigned long int k = first; k < rj->count; k++) {
+      const rec_sample *s = &rj->buf[k % HOMING_REC_LEN];
+      fprintf(fp, "%d,%lu,%.4f,%.5f,%.5f\n", d, k, s->amps, s->jpos, s->jvel);
+    }
+  }
+  if (fclose(fp) != 0) log_msg("Homing record: failed to save %s", path.c_str());
+}
+
+/**
+ * \brief Reports a finished homing run, updates the history and saves the
+ *traces
+ */
+static void processRun(int arm, rec_arm *ra) {
+  homing_report r;
+  int tool = std::min(std::max(ra->tool, 0), HOMING_TOOL_TYPES - 1);
+
+  pthread_mutex_lock(&report_mutex);
+  r = reports[arm];
+  pthread_mutex_unlock(&report_mutex);
+
+  r.runs++;
+  r.warm = ra->warm;
+  r.tool = tool;
+  r.duration_ms = ra->duration;
+  r.warnings = 0;
+  memset(r.joint, 0, sizeof(r.joint));
+
+  for (int d = 0; d < MAX_DOF_PER_MECH; d++) {
+    const rec_joint *rj = &ra->joint[d];
+    homing_joint_report *jr = &r.joint[d];
+    hist_entry *e = &history.h[arm][tool][d];
+    if (d == NO_CONNECTION || !rj->searched) continue;
+
+    jr->searched = TRUE;
+    jr->stop = rj->stop;
+    jr->search_ms = rj->end - rj->start;
+    jr->threshold = rj->threshold;
+    jr->free_amps = freeAmps(rj);
+    jr->stop_amps = rj->stop_amps;
+    jr->margin = jr->threshold - jr->free_amps;
+    jr->history = e->runs ? e->free_amps : 0;
+
+    if (jr->margin < HOMING_MARGIN_WARN * jr->threshold ||
+        (jr->history > 0 && jr->free_amps > HOMING_DRIFT_WARN * jr->history))
+      r.warnings++;
+
+    if (jr->free_amps > 0) {
+      float w = e->runs ? HOMING_TUNE_WEIGHT : 1;
+      e->free_amps += w * (jr->free_amps - e->free_amps);
+      e->search_ms += w * (jr->search_ms - e->search_ms);
+      e->runs++;
+    }
+    jr->tuned = e->runs >= HOMING_TUNE_RUNS ? HOMING_TUNE_GAIN * e->free_amps : 0;
+
+    log_msg("Homing %s %s: %s stop at %.0f ms, %.2f A of %.2f A, free %.2f A (avg %.2f A)",
+            arm == 0 ? "gold" : "green", dofNames[d], stopNames[jr->stop], jr->search_ms,
+            jr->stop_amps, jr->threshold, jr->free_amps, jr->history);
+  }
+  log_msg("Homing %s: %s in %.0f ms, %d warnings", arm == 0 ? "gold" : "green",
+          r.warm ? "warm start" : "homed", r.duration_ms, r.warnings);
+
+  pthread_mutex_lock(&report_mutex);
+  reports[arm] = r;
+  pthread_mutex_unlock(&report_mutex);
+
+  if (r.warm || rec_dir.empty()) return;
+  updateTuned();
+  saveHistory(rec_dir + "/history.bin");
+  writeTraces(arm, ra, r);
+}
+
+/**
+ * \brief Picks up homing runs the RT thread has finished recording
+ */
+static void recordTimer(const ros::TimerEvent &) {
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    rec_arm *ra = &rec[arm];
+    if (!__sync_bool_compare_and_swap(&ra->state, rec_done, rec_writing)) continue;
+    __sync_synchronize();
+    processRun(arm, ra);
+    __sync_synchronize();
+    ra->state = rec_idle;
+  }
+}
+
+/**
+ * \brief Starts recording an arm's homing run
+ *
+ * Called from the RT thread when homing (re)starts.  The run is not recorded
+ *if the previous one is still being saved.
+ *
+ * \param _mech  the mechanism
+ * \ingroup Control
+ */
+void homingRecordBegin(mechanism *_mech) {
+  int arm = mechArm(_mech);
+  rec_arm *ra = &rec[arm];
+  int s = ra->state;
+
+  active_tool[arm] = std::min(std::max((int)_mech->mech_tool.t_end, 0), HOMING_TOOL_TYPES - 1);
+  recording[arm] = s != rec_writing && __sync_bool_compare_and_swap(&ra->state, s, rec_recording);
+  if (!recording[arm]) return;
+
+  ra->tool = _mech->mech_tool.t_end;
+  ra->warm = FALSE;
+  for (int d = 0; d < MAX_DOF_PER_MECH; d++) {
+    ra->joint[d].count = 0;
+    ra->joint[d].searched = FALSE;
+  }
+}
+
+/**
+ * \brief Starts recording a joint's hard-stop search
+ *
+ * \param _joint  the joint
+ * \ingroup Control
+ */
+void homingRecordJointStart(DOF *_joint) {
+  int arm = _joint->type / MAX_DOF_PER_MECH;
+  if (!recording[arm]) return;
+
+  rec_joint *rj = &rec[arm].joint[_joint->type % MAX_DOF_PER_MECH];
+  rj->count = 0;
+  rj->start = gTime;
+  rj->searched = FALSE;
+  rj->stop = hstop_none;
+}
+
+/**
+ * \brief Records one cycle of a joint's search
+ *
+ * \param _joint  the joint
+ * \ingroup Control
+ */
+void homingRecordSample(DOF *_joint) {
+  int arm = _joint->type / MAX_DOF_PER_MECH;
+  if (!recording[arm]) return;
+
+  rec_joint *rj = &rec[arm].joint[_joint->type % MAX_DOF_PER_MECH];
+  rec_sample *s = &rj->buf[rj->count % HOMING_REC_LEN];
+  s->amps = _joint->current_cmd / DOF_types[_joint->type].DAC_per_amp;
+  s->jpos = _joint->jpos;
+  s->jvel = _joint->jvel;
+  rj->count++;
+}
+
+/**
+ * \brief Records the end of a joint's search at its hard stop
+ *
+ * \param _joint     the joint
+ * \param stop       why the search ended, a homing_stop
+ * \param threshold  the hard-stop current in use (A)
+ * \ingroup Control
+ */
+void homingRecordStop(DOF *_joint, int stop, float threshold) {
+  int arm = _joint->type / MAX_DOF_PER_MECH;
+  if (!recording[arm]) return;
+
+  rec_joint *rj = &rec[arm].joint[_joint->type % MAX_DOF_PER_MECH];
+  rj->end = gTime;
+  rj->searched = TRUE;
+  rj->stop = stop;
+  rj->threshold = threshold;
+  rj->stop_amps = fabs(_joint->current_cmd / DOF_types[_joint->type].DAC_per_amp);
+}
+
+/**
+ * \brief Finishes recording an arm's homing run and hands it to the ROS thread
+ *
+ * \param _mech     the mechanism
+ * \param duration  ms from entering homing to ready
+ * \param warm      TRUE if the run was a warm start
+ * \ingroup Control
+ */
+void homingRecordEnd(mechanism *_mech, unsigned long int duration, int warm) {
+  int arm = mechArm(_mech);
+  if (!recording[arm]) return;
+
+  rec[arm].duration = duration;
+  rec[arm].warm = warm;
+  recording[arm] = FALSE;
+  __sync_synchronize();
+  rec[arm].state = rec_done;
+}
+
+/**
+ * \brief Hard-stop current of a joint with the tool on its arm
+ *
+ * \param _joint     the joint
+ * \param i_default  the default hard-stop current (A)
+ * \return the tuned threshold within [HOMING_TUNE_FLOOR * i_default,
+ *i_default], or i_default until there is enough history
+ * \ingroup Control
+ */
+float homingThreshold(DOF *_joint, float i_default) {
+  int arm = _joint->type / MAX_DOF_PER_MECH;
+  float t = tuned[arm][active_tool[arm]][_joint->type % MAX_DOF_PER_MECH];
+
+  if (t <= 0) return i_default;
+  return std::min(i_default, std::max((float)(HOMING_TUNE_FLOOR * i_default), t));
+}
+
+/**
+ * \brief Copies the report of an arm's last homing run
+ *
+ * \param arm  0 for gold, 1 for green
+ * \param out  the report
+ * \return 0, or -1 if the arm has not finished homing yet
+ */
+int getHomingReport(int arm, homing_report *out) {
+  if (arm < 0 || arm >= MAX_MECH) return -1;
+
+  pthread_mutex_lock(&report_mutex);
+  *out = reports[arm];
+  pthread_mutex_unlock(&report_mutex);
+  return out->runs ? 0 : -1;
+}
+
+/**
+ * \brief Loads the homing history and starts the timer that saves each run
+ *
+ * Must run before the RT thread starts.
+ *
+ * \param n  the ros node handle
+ * \return 0
+ * \ingroup Control
+ */
+int init_homing_record(ros::NodeHandle &n) {
+  const char *home = getenv("HOME");
+
+  n.param("/homing_record_dir", rec_dir, std::string(home ? home : ".") + "/.ros/raven_homing");
+
+  memset(&history, 0, sizeof(history));
+  strncpy(history.magic, HIST_MAGIC, sizeof(history.magic));
+  memset(rec, 0, sizeof(rec));  // touch the buffers before the RT thread needs them
+
+  if (!rec_dir.empty()) {
+    mkdir(rec_dir.c_str(), 0775);
+    loadHistory(rec_dir + "/history.bin");
+  }
+  updateTuned();
+
+  rec_timer = n.createTimer(ros::Duration(1.0), recordTimer);
+  log_msg("Homing record: %s", rec_dir.empty() ? "not saved" : rec_dir.c_str());
+  return 0;
+}
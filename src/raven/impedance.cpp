@@ -0,0 +1,182 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file impedance.cpp
+ *
+ * \brief Cartesian impedance control of the arms
+ *
+ * In the cartesian impedance mode the arm behaves as a spring and damper
+ * between its end effector and the desired pose pos_d / ori_d.R:
+ *
+ *     F = K dx - D v,    tau = J^T F
+ *
+ * where dx is the position error and the rotation error as axis times angle,
+ * v = J qdot the end effector velocity and J the geometric Jacobian built from
+ * the link frames of this cycle's forward kinematics (getJacobian()).  K and D
+ * are diagonal in frame 0.  The wrench is limited to max_force / max_torque so
+ * large pose errors, e.g. from a master jump, do not command large torques.
+ *
+ * The jaw opening (grasp1 + grasp2) is not part of the pose and is held at
+ * ori_d.grasp by a joint-space spring and damper.  The joint torques are
+ * mapped to capstan torques through the cable coupling; no inverse kinematics
+ * or motor position control runs in this mode, and there are no soft joint
+ * limits.
+ *
+ * Gains come from the parameters /impedance_stiffness and /impedance_damping
+ * (six values each), /impedance_grasp (stiffness, damping) and
+ * /impedance_max_wrench (force, torque).
+ *
+ * \ingroup Control
+ */
+
+#include <Eigen/Dense>
+
+#include "impedance.h"
+#include "coupling_matrix.h"
+#include "r2_kinematics.h"
+#include "log.h"
+#include "utils.h"
+
+typedef Eigen::Matrix<double, 6, 1> vec6;
+typedef Eigen::Matrix<double, 6, 6> mat6;
+
+static impedance_gains gains;
+
+/**
+ * \brief Joint rates of an arm in the order of the DH joints
+ */
+static vec6 dhJointVelocities(mechanism *mech) {
+  vec6 qd;
+  qd << mech->joint[SHOULDER].jvel, mech->joint[ELBOW].jvel, mech->joint[Z_INS].jvel,
+      mech->joint[TOOL_ROT].jvel, mech->joint[WRIST].jvel,
+      (mech->joint[GRASP2].jvel - mech->joint[GRASP1].jvel) / 2.0;
+  return qd;
+}
+
+/**
+ * \brief Scales a vector down to a largest norm
+ */
+static inline Eigen::Vector3d limitNorm(const Eigen::Vector3d &v, double max) {
+  double n = v.norm();
+  return (n > max && n > 0) ? Eigen::Vector3d(v * (max / n)) : v;
+}
+
+/**
+ * \brief Impedance torques of one arm
+ *
+ * Uses the link frames of the last r2_fwd_kin() and the joint velocities of
+ * this cycle.
+ *
+ * \param mech     the mechanism
+ * \param m        index of the mechanism in the device
+ * \param out_tau  receives the capstan torque of every DOF, without gravity
+ * \return 0 on success, -1 without a cable coupling for the arm
+ */
+int impedanceTorques(mechanism *mech, int m, float out_tau[MAX_DOF_PER_MECH]) {
+  const tf::Transform *links = getFKLinks(m);
+  tf::Transform xf;
+  double Jd[6][6];
+  mat6 J;
+
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) out_tau[j] = 0;
+  if (getCouplingMap(mech) == NULL) return -1;
+
+  xf.setIdentity();
+  for (int i = 0; i < 6; i++) xf *= links[i];
+  getJacobian(links, Jd);
+  for (int r = 0; r < 6; r++)
+    for (int c = 0; c < 6; c++) J(r, c) = Jd[r][c];
+
+  // pose error: pos_d is in microns
+  Eigen::Vector3d dp(mech->pos_d.x / (1000.0 * 1000.0) - xf.getOrigin()[0],
+                     mech->pos_d.y / (1000.0 * 1000.0) - xf.getOrigin()[1],
+                     mech->pos_d.z / (1000.0 * 1000.0) - xf.getOrigin()[2]);
+  Eigen::Matrix3d R, R_d;
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++) {
+      R(r, c) = xf.getBasis()[r][c];
+      R_d(r, c) = mech->ori_d.R[r][c];
+    }
+  Eigen::AngleAxisd rot_err(R_d * R.transpose());
+  Eigen::Vector3d dr = rot_err.angle() * rot_err.axis();
+
+  // spring and damper in frame 0
+  vec6 v = J * dhJointVelocities(mech);
+  Eigen::Vector3d f, t;
+  for (int k = 0; k < 3; k++) {
+    f[k] = gains.k[k] * dp[k] - gains.d[k] * v[k];
+    t[k] = gains.k[k + 3] * dr[k] - gains.d[k + 3] * v[k + 3];
+  }
+  vec6 wrench;
+  wrench << limitNorm(f, gains.max_force), limitNorm(t, gains.max_torque);
+  vec6 tau_dh = J.transpose() * wrench;
+
+  // theta6 = (grasp2 - grasp1) / 2, the opening grasp1 + grasp2 is held apart
+  float grasp = mech->joint[GRASP1].jpos + mech->joint[GRASP2].jpos;
+  float grasp_vel = mech->joint[GRASP1].jvel + mech->joint[GRASP2].jvel;
+  float tau_open = gains.k_grasp * (mech->ori_d.grasp / 1000.0 - grasp) - gains.d_grasp * grasp_vel;
+
+  float tau_j[MAX_DOF_PER_MECH] = {0};
+  tau_j[SHOULDER] = tau_dh[0];
+  tau_j[ELBOW] = tau_dh[1];
+  tau_j[Z_INS] = tau_dh[2];
+  tau_j[TOOL_ROT] = tau_dh[3];
+  tau_j[WRIST] = tau_dh[4];
+  tau_j[GRASP1] = -tau_dh[5] / 2 + tau_open;
+  tau_j[GRASP2] = tau_dh[5] / 2 + tau_open;
+
+  couplingJointToCapstanTorque(mech->type == GOLD_ARM ? 0 : 1, tau_j, out_tau);
+
+  return 0;
+}
+
+/**
+ * \brief Reads the impedance gains
+ *
+ * \param n  the ros node handle
+ * \return 0
+ * \ingroup ROS
+ */
+int init_impedance(ros::NodeHandle &n) {
+  float grasp[2] = {IMPEDANCE_K_GRASP, IMPEDANCE_D_GRASP};
+  float wrench[2] = {IMPEDANCE_MAX_FORCE, IMPEDANCE_MAX_TORQUE};
+
+  for (int k = 0; k < 3; k++) {
+    gains.k[k] = IMPEDANCE_K_POS;
+    gains.k[k + 3] = IMPEDANCE_K_ROT;
+    gains.d[k] = IMPEDANCE_D_POS;
+    gains.d[k + 3] = IMPEDANCE_D_ROT;
+  }
+  getParamList(n, "/impedance_stiffness", gains.k, 6);
+  getParamList(n, "/impedance_damping", gains.d, 6);
+  getParamList(n, "/impedance_grasp", grasp, 2);
+  getParamList(n, "/impedance_max_wrench", wrench, 2);
+  gains.k_grasp = grasp[0];
+  gains.d_grasp = grasp[1];
+  gains.max_force = wrench[0];
+  gains.max_torque = wrench[1];
+
+  log_msg("Impedance gains K %.1f %.1f %.1f %.3f %.3f %.3f, D %.2f %.2f %.2f %.4f %.4f %.4f",
+          gains.k[0], gains.k[1], gains.k[2], gains.k[3], gains.k[4], gains.k[5], gains.d[0],
+          gains.d[1], gains.d[2], gains.d[3], gains.d[4], gains.d[5]);
+
+  return 0;
+}
@@ -41,6 +41,11 @@
 #include "init.h"
 #include "USB_init.h"
 #include "local_io.h"
+#include "gravity_input.h"
+#include "state_estimate.h"
+#include "coupling_matrix.h"
+#include "pid_control.h"
+#include "utils.h"
 
 #ifdef DV_ADAPTER
 const e_tool_type use_tool = dv_adapter;
@@ -85,8 +90,13 @@ void initRobotData(device *device0, int runlevel, param_pass *currParams) {
   // kinematics to propogate.
   static int init_wait_loop = 0;
 
-  // initialize gravity direction data
-  if (!initialized) {
+  // gravity direction data: follow the gravity/IMU topic once it publishes,
+  // otherwise initialize to straight down
+  position grav_in;
+  if (getGravityInput(&grav_in)) {
+    currParams->grav_dir = grav_in;
+    device0->grav_dir = grav_in;
+  } else if (!initialized) {
     currParams->grav_dir.x = 0;
     currParams->grav_dir.y = 0;
     currParams->grav_dir.z = 980;
@@ -268,6 +278,12 @@ void initDOFs(device *device0) {
       device0->mech[i].mech_tool = green_arm_tool;
     }
 
+    // Encoder directions and cable coupling follow from the arm and tool,
+    // restart the state estimate at the next measurement
+    initEncMap(&device0->mech[i]);
+    initCouplingMatrices(&device0->mech[i]);
+    clearFilter(&device0->mech[i]);
+
     for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
       DOF *_joint = &(device0->mech[i].joint[j]);
       int dofindex = _joint->type;
@@ -287,15 +303,6 @@ void initDOFs(device *device0) {
       _joint->mvel_d = 0;
       _joint->mvel = 0;
 
-      // Initialize the position and velocity history for filter
-      for (int k = 0; k < HISTORY_SIZE; k++) {
-        _dof->old_mpos[k] = 0;
-        _dof->old_mpos_d[k] = 0;
-        _dof->old_mvel[k] = 0;
-        _dof->old_mvel_d[k] = 0;
-      }
-      _dof->filterRdy = 0;
-
       // Set inital current command to zero
       _joint->current_cmd = 0;
 
@@ -319,11 +326,13 @@ void initDOFs(device *device0) {
         _dof->DAC_per_amp = (float)(K_DAC_PER_AMP_HIGH_CURRENT);  // DAC counts to AMPS
         _dof->i_max = (float)(I_MAX_BIG_MOTOR);
         _dof->i_cont = (float)(I_CONT_BIG_MOTOR);
+        _dof->overdrive_time = (float)(OVERDRIVE_TIME_BIG_MOTOR);
       } else  // set tool stuff
       {
         _dof->DAC_per_amp = (float)(K_DAC_PER_AMP_LOW_CURRENT);  // DAC counts to AMPS
         _dof->i_max = (float)(I_MAX_SMALL_MOTOR);
         _dof->i_cont = (float)(I_CONT_SMALL_MOTOR);
+        _dof->overdrive_time = (float)(OVERDRIVE_TIME_SMALL_MOTOR);
 
         //#ifdef RAVEN_II_SQUARE
         //                _dof->tau_per_amp = torque_sign *
@@ -481,6 +490,26 @@ void initDOFs(device *device0) {
   dofs_inited = 1;
 }
 
+/**
+ * \brief Reads an optional per-DOF gain list of both arms
+ *
+ * \param n      the ros node handle
+ * \param name   parameter name after /gains_gold_ or /gains_green_
+ * \param gains  gain set of all dof types
+ * \param field  the gain to set
+ */
+static void getOptionalGains(ros::NodeHandle &n, const char *name, joint_gains *gains,
+                             float joint_gains::*field) {
+  const char *arm_names[MAX_MECH] = {"gold", "green"};
+
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    float v[MAX_DOF_PER_MECH];
+    std::string param = std::string("/gains_") + arm_names[arm] + "_" + name;
+    if (!getParamList(n, param, v, MAX_DOF_PER_MECH)) continue;
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) gains[arm * MAX_DOF_PER_MECH + j].*field = v[j];
+  }
+}
+
 /**\fn int init_ravengains(ros::NodeHandle n, device *device0)
   \brief Get ravengains from ROS parameter server.
   \struct device
@@ -488,19 +517,20 @@ void initDOFs(device *device0) {
   \warning The order of gains in the parameter is very important.
  *      Make sure that numerical order of parameters matches the numerical order
  of the dof types
-  \post dof_types[].kp and dof_types[].kd have been set from ROS parameters
+  \post the joint controller gains have been set from ROS parameters: kp, kd
+ and ki, and optionally i_limit, friction_coulomb, friction_viscous, gravity,
+ kv and kvi.  Joints with a nonzero ki run PID control.
   \return
   \ingroup DataStructures
 */
 int init_ravengains(ros::NodeHandle n, device *device0) {
   XmlRpc::XmlRpcValue kp_green, kp_gold, kd_green, kd_gold, ki_green, ki_gold;
+  joint_gains gains[MAX_MECH * MAX_DOF_PER_MECH];
   bool res = 0;
   log_msg("Getting gains params...");
 
-  // initialize all gains to zero
-  for (int i = 0; i < MAX_MECH * MAX_DOF_PER_MECH; i++) {
-    DOF_types[i].KP = DOF_types[i].KD = DOF_types[i].KI = 0.0;
-  }
+  // initialize all gains to the defaults, zero position gains
+  for (int i = 0; i < MAX_MECH * MAX_DOF_PER_MECH; i++) defaultJointGains(i, &gains[i]);
 
   /// Get gains from parameter server, use default value of 0.0 if parameters
   /// ain't found
@@ -530,16 +560,15 @@ int init_ravengains(ros::NodeHandle n, device *device0) {
         if (device0->mech[i].type == GOLD_ARM) {
           initgold = true;
           dofindex = j;
-          DOF_types[dofindex].KP =
-              (double)kp_gold[j];  // Cast XMLRPC value to a double and set gain
-          DOF_types[dofindex].KD = (double)kd_gold[j];  //   ""
-          DOF_types[dofindex].KI = (double)ki_gold[j];  //   ""
+          gains[dofindex].kp = (double)kp_gold[j];  // Cast XMLRPC value to a double and set gain
+          gains[dofindex].kd = (double)kd_gold[j];  //   ""
+          gains[dofindex].ki = (double)ki_gold[j];  //   ""
         } else if (device0->mech[i].type == GREEN_ARM) {
           initgreen = true;
           dofindex = 1 * MAX_DOF_PER_MECH + j;
-          DOF_types[dofindex].KP = (double)kp_green[j];  //   ""
-          DOF_types[dofindex].KD = (double)kd_green[j];  //   ""
-          DOF_types[dofindex].KI = (double)ki_green[j];  //   ""
+          gains[dofindex].kp = (double)kp_green[j];  //   ""
+          gains[dofindex].kd = (double)kd_green[j];  //   ""
+          gains[dofindex].ki = (double)ki_green[j];  //   ""
         } else {
           ROS_ERROR("What device is this?? %d\n", device0->mech[i].type);
         }
@@ -553,27 +582,31 @@ int init_ravengains(ros::NodeHandle n, device *device0) {
       ROS_ERROR("Failed to set gains for green arm (ser:%d not %d).  Set to zero",
                 device0->mech[1].type, GREEN_ARM);
     }
-    log_msg("  PD gains set to");
-    log_msg(
-        "    gold: %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, "
-        "%.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, "
-        "%.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf",
-        DOF_types[0].KP, DOF_types[0].KD, DOF_types[0].KI, DOF_types[1].KP, DOF_types[1].KD,
-        DOF_types[1].KI, DOF_types[2].KP, DOF_types[2].KD, DOF_types[2].KI, DOF_types[3].KP,
-        DOF_types[3].KD, DOF_types[3].KI, DOF_types[4].KP, DOF_types[4].KD, DOF_types[4].KI,
-        DOF_types[5].KP, DOF_types[5].KD, DOF_types[5].KI, DOF_types[6].KP, DOF_types[6].KD,
-        DOF_types[6].KI, DOF_types[7].KP, DOF_types[7].KD, DOF_types[7].KI);
+  }
+
+  getOptionalGains(n, "i_limit", gains, &joint_gains::i_limit);
+  getOptionalGains(n, "friction_coulomb", gains, &joint_gains::fc);
+  getOptionalGains(n, "friction_viscous", gains, &joint_gains::fv);
+  getOptionalGains(n, "gravity", gains, &joint_gains::kg);
+  getOptionalGains(n, "kv", gains, &joint_gains::kv);
+  getOptionalGains(n, "kvi", gains, &joint_gains::kvi);
+  for (int i = 0; i < MAX_MECH * MAX_DOF_PER_MECH; i++)
+    gains[i].law = (gains[i].ki != 0) ? ctrl_pid : ctrl_pd;
+
+  log_msg("  PID gains set to");
+  for (int m = 0; m < MAX_MECH; m++) {
+    const joint_gains *g = &gains[m * MAX_DOF_PER_MECH];
     log_msg(
-        "    green: %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, "
-        "%.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf, "
-        "%.3lf/%.3lf/%.3lf, %.3lf/%.3lf/%.3lf",
-        DOF_types[8].KP, DOF_types[8].KD, DOF_types[8].KI, DOF_types[9].KP, DOF_types[9].KD,
-        DOF_types[9].KI, DOF_types[10].KP, DOF_types[10].KD, DOF_types[10].KI, DOF_types[11].KP,
-        DOF_types[11].KD, DOF_types[11].KI, DOF_types[12].KP, DOF_types[12].KD, DOF_types[12].KI,
-        DOF_types[13].KP, DOF_types[13].KD, DOF_types[13].KI, DOF_types[14].KP, DOF_types[14].KD,
-        DOF_types[14].KI, DOF_types[15].KP, DOF_types[15].KD, DOF_types[15].KI);
+        "    %s: %.3f/%.3f/%.3f, %.3f/%.3f/%.3f, %.3f/%.3f/%.3f, %.3f/%.3f/%.3f, "
+        "%.3f/%.3f/%.3f, %.3f/%.3f/%.3f, %.3f/%.3f/%.3f, %.3f/%.3f/%.3f",
+        m == 0 ? "gold" : "green", g[0].kp, g[0].kd, g[0].ki, g[1].kp, g[1].kd, g[1].ki, g[2].kp,
+        g[2].kd, g[2].ki, g[3].kp, g[3].kd, g[3].ki, g[4].kp, g[4].kd, g[4].ki, g[5].kp, g[5].kd,
+        g[5].ki, g[6].kp, g[6].kd, g[6].ki, g[7].kp, g[7].kd, g[7].ki);
   }
 
+  // Taken up by the control loop in its first cycle
+  setJointGains(gains);
+
   return 0;
 }
 
@@ -34,11 +34,12 @@
 *
 *  \todo standardize numbering system 0 or 1 origin for motor designation
 *  \todo standardize 3 or 4 insertion axis
-*  \todo analyze (DANYING) coupling and convert to matrix maths
 *
 */
 
 #include "inv_cable_coupling.h"
+#include "coupling_matrix.h"
+#include "joint_fusion.h"
 #include "log.h"
 
 extern DOF_type DOF_types[];
@@ -64,172 +65,35 @@ void invCableCoupling(device *device0, int runlevel) {
 /**
 * \brief Calculates desired motor positions from desired joint positions
 *
-* \todo update to matrix calculations for the coupling (here and fwd)
+* The coupling matrices of each arm are described in coupling_matrix.cpp.
+* With joint fusion active jpos_d excludes the cable stretch, which is added
+* back so that mpos_d matches the motor encoders.
+*
+* \param mech           the mechanism
+* \param no_use_actual  nonzero to couple the tool to the desired rather than
+*                       the actual insertion motor position
 */
 
 void invMechCableCoupling(mechanism *mech, int no_use_actual) {
-  if (mech->type != GOLD_ARM && mech->type != GREEN_ARM) {
+  const coupling_map *c = getCouplingMap(mech);
+  if (c == NULL) {
     log_msg("bad mech type!");
     return;
   }
 
-  float th1, th2, th3, th5, th6, th7;
-  float d4;
-  float m1, m2, m3, m4, m5, m6, m7;
-  float tr1 = 0, tr2 = 0, tr3 = 0, tr4 = 0, tr5 = 0, tr6 = 0, tr7 = 0;
-
-  th1 = mech->joint[SHOULDER].jpos_d;
-  th2 = mech->joint[ELBOW].jpos_d;
-  th3 = mech->joint[TOOL_ROT].jpos_d;
-  d4 = mech->joint[Z_INS].jpos_d;
-  th5 = mech->joint[WRIST].jpos_d;
-  th6 = mech->joint[GRASP1].jpos_d;
-  th7 = mech->joint[GRASP2].jpos_d;
-
-  if (mech->type == GOLD_ARM) {
-    tr1 = DOF_types[SHOULDER_GOLD].TR;
-    tr2 = DOF_types[ELBOW_GOLD].TR;
-    tr3 = DOF_types[TOOL_ROT_GOLD].TR;
-    tr4 = DOF_types[Z_INS_GOLD].TR;
-    tr5 = DOF_types[WRIST_GOLD].TR;
-    tr6 = DOF_types[GRASP1_GOLD].TR;
-    tr7 = DOF_types[GRASP2_GOLD].TR;
-
-  } else if (mech->type == GREEN_ARM) {
-    tr1 = DOF_types[SHOULDER_GREEN].TR;
-    tr2 = DOF_types[ELBOW_GREEN].TR;
-    tr3 = DOF_types[TOOL_ROT_GREEN].TR;
-    tr4 = DOF_types[Z_INS_GREEN].TR;
-    tr5 = DOF_types[WRIST_GREEN].TR;
-    tr6 = DOF_types[GRASP1_GREEN].TR;
-    tr7 = DOF_types[GRASP2_GREEN].TR;
-  }
-
-  // --------------Coupling and Transmission
-  // Matrix---------------------------------------------------
-  // trs are transmission ration for each joint defined in define.h
-  // GB_RATIO = (GEAR_BOX_GP42_TR/GEAR_BOX_GP32_TR * (
-  // CAPSTAN_RADIUS_GP32/CAPSTAN_RADIUS_GP42))
-  // js and d are joint angles/placement; ms are motor angles
-  // Numeration: 1-shoulder; 2-eblow; 3-insertion; 4-tool rotation; 5-wrist;
-  // 6-upper grasper; 7- lower grasper
-  // -------------------------------------------------------------------------------------------------
-  // Tool Type: Raven Diamond Tool
-  // Gold Arm - Left Arm:
-  // M_l = C_l * J_l ----[m1,m2,m3,m4,m5,m6,m7]'= C_l*[j1,j2,d3,j4,j5,j6,j7]
-  // C_l = [tr1 				 0 				 0 	       0   0
-  // 0
-  // 0;
-  //        tr2*CABLE_COUPLING_01          tr2 				 0 	       0
-  //        0   0  0;
-  //        tr3*CABLE_COUPLING_02          tr3*CABLE_COUPLING_12           tr3
-  //        0   0   0  0;
-  //        tr3*CABLE_COUPLING_02/GB_RATIO tr3*CABLE_COUPLING_12G/B_RATIO
-  //        tr3/GB_RATIO  tr4 0   0  0;
-  //        tr3*CABLE_COUPLING_02/GB_RATIO tr3*CABLE_COUPLING_12G/B_RATIO
-  //        tr3/GB_RATIO  0   tr5 0  0;
-  //        tr3*CABLE_COUPLING_02/GB_RATIO tr3*CABLE_COUPLING_12G/B_RATIO
-  //        tr3/GB_RATIO  0   0  tr6 0;
-  //        tr3*CABLE_COUPLING_02/GB_RATIO tr3*CABLE_COUPLING_12G/B_RATIO
-  //        tr3/GB_RATIO  0   0  0  tr7;]
-  //
-  // Green Arm - Right Arm:
-  // M_r = C_r * J_r ----[m1,m2,m3,m4,m5,m6,m7]'= C_l*[j1,j2,d3,j4,j5,j6,j7]
-  // C_r = [tr1 				   0 				   0 	          0   0
-  // 0
-  // 0;
-  //        tr2*CABLE_COUPLING_01            tr2 				   0
-  //        0   0   0  0;
-  //        tr3*CABLE_COUPLING_02            tr3*CABLE_COUPLING_12           tr3
-  //        0   0   0  0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  tr4 0   0  0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   tr5 0  0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   0  tr6 0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   0  0  tr7;]
-  // -------------------------------------------------------------------------------------------------
-  // Tool Type: Raven Square Tool
-  // C_l=C_r
-  //      = [tr1 				   0 				   0
-  //      0   0   0  0;
-  //        tr2*CABLE_COUPLING_01            tr2 				   0
-  //        0   0   0  0;
-  //        tr3*CABLE_COUPLING_02            tr3*CABLE_COUPLING_12           tr3
-  //        0   0   0  0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  tr4 0   0  0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   tr5 0  0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   0  tr6 0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   0  0  tr7;]
-  // -------------------------------------------------------------------------------------------------
-  // Tool Type: DaVinci Square Tool
-  // C_l=C_r
-  //      = [tr1 				   0 				   0
-  //      0   0       0   0;
-  //        tr2*CABLE_COUPLING_01            tr2 				   0
-  //        0   0       0   0;
-  //        tr3*CABLE_COUPLING_02            tr3*CABLE_COUPLING_12           tr3
-  //        0   0       0   0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  tr4 0       0   0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   tr      0   0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   tr6/2   tr6 0;
-  //        -tr3*CABLE_COUPLING_02/GB_RATIO -tr3*CABLE_COUPLING_12G/B_RATIO
-  //        -tr3/GB_RATIO  0   -tr7/2  0   tr7;]
-
-  m1 = tr1 * th1;
-  m2 = tr2 * (th2 + CABLE_COUPLING_01 * th1);
-  m4 = tr4 * (d4 + CABLE_COUPLING_02 * th1 + CABLE_COUPLING_12 * th2);
-
-  // Use the current joint position for cable coupling
-  float m4_actual = mech->joint[Z_INS].mpos;
-
-  if (no_use_actual) m4_actual = m4;
-
-  int sgn = 0;
-  switch (mech->mech_tool.t_style) {
-    case raven:
-      sgn = (mech->type == GOLD_ARM) ? 1 : -1;
-      break;
-    case dv:
-      sgn = (mech->type != GOLD_ARM) ? 1 : -1;
-      break;
-    case square_raven:
-      sgn = -1;
-      break;
-    default:
-      log_msg("undefined tool style!!! inv_cable_coupling.cpp");
-      break;
+  float q[CPL_N], m_actual[CPL_N], m[CPL_N];
+  for (int j = 0; j < CPL_N; j++) {
+    q[j] = mech->joint[j].jpos_d + fusedStretch(mech, j);
+    m_actual[j] = mech->joint[j].mpos;
   }
 
-  int sgn_6 = sgn;
-#ifdef OPPOSE_GRIP
-  sgn_6 *= -1;
-
-#endif
-
-  float tool_coupling = mech->mech_tool.wrist_coupling;
-  m3 = (tr3 * th3) + sgn * m4_actual / GB_RATIO;
-  m5 = (tr5 * th5) + sgn * m4_actual / GB_RATIO;
-  m6 = (tr6 * (th6 + th5 * tool_coupling)) + sgn_6 * m4_actual / GB_RATIO;  // was th6 +th5*...
-  m7 = (tr7 * (th7 - th5 * tool_coupling)) + sgn * m4_actual / GB_RATIO;
+  // Motors coupled to other motors (the tool on insertion) follow the current
+  // motor positions unless told otherwise
+  couplingJointToMotor(c, q, no_use_actual ? NULL : m_actual, m);
 
   /*Now have solved for desired motor positions mpos_d*/
-  mech->joint[SHOULDER].mpos_d = m1;
-  mech->joint[ELBOW].mpos_d = m2;
-  mech->joint[TOOL_ROT].mpos_d = m3;
-  mech->joint[Z_INS].mpos_d = m4;
-  mech->joint[WRIST].mpos_d = m5;
-  mech->joint[GRASP1].mpos_d = m6;
-  mech->joint[GRASP2].mpos_d = m7;
+  for (int j = 0; j < CPL_N; j++)
+    if (j != NO_CONNECTION) mech->joint[j].mpos_d = m[j];
 
   return;
 }
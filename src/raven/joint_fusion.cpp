@@ -0,0 +1,271 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file joint_fusion.cpp
+ *
+ * \brief Fusion of motor and joint encoders into the joint state
+ *
+ * On arms with joint encoders the shoulder, elbow and insertion are measured
+ * twice: through the motor encoders and the cable coupling, which sees cable
+ * stretch, and directly at the joint, which is coarser and not stretched.
+ * After the cable coupling and fwdJointEncoders() one of these replaces jpos
+ * and jvel of those joints, ahead of forward kinematics, the Jacobian and
+ * gravity compensation:
+ *  - fuse_motor: the motor encoder joint state, unchanged.
+ *  - fuse_complementary: the motor encoder joint state minus the cable
+ *    stretch, low-passed at FUSION_STRETCH_HZ from the difference of the two
+ *    positions.  Motion comes from the motor side, the static pose from the
+ *    joint side.
+ *  - fuse_kalman: a Kalman filter with joint position, velocity and cable
+ *    stretch as state, measuring the motor-side position (joint plus stretch)
+ *    and the joint-side position.  Its gain is the steady-state one, found at
+ *    startup from the encoder resolutions.
+ *
+ * The fused jpos excludes the cable stretch the motors still see, so
+ * invCableCoupling() adds fusedStretch() back to jpos_d; otherwise a pose copied
+ * from jpos would start motor control off by the stretch.
+ *
+ * The choice is /joint_fusion ("motor", "complementary" or "kalman") and can
+ * be changed from the console; the RT thread restarts the filter on a change.
+ * Joints that are not homed, and arms without JOINT_ENCODERS, always use the
+ * motor joint state.
+ *
+ * \ingroup Control
+ */
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <Eigen/Dense>
+
+#include "joint_fusion.h"
+#include "defines.h"
+#include "struct.h"
+#include "motor.h"
+#include "log.h"
+
+extern int NUM_MECH;
+
+#define FUSED_JOINTS 3  // SHOULDER, ELBOW, Z_INS
+
+static const char *fusionNames[fuse_last_type] = {"motor", "complementary", "kalman"};
+
+/// Noise model of one joint, in rad or m
+struct fusion_noise {
+  double motor;    // motor-side joint position noise
+  double joint;    // joint encoder position noise
+  double accel;    // acceleration, per sqrt(s)
+  double stretch;  // stretch drift, per sqrt(s)
+};
+
+// Encoder noise is the quantization of one count, the motor count seen
+// through the transmission ratio
+const static fusion_noise FUSION_NOISE[] = {
+    {(2 * M_PI / ENC_CNTS_PER_REV) / SHOULDER_TR_GREEN_ARM / sqrt(12.0),
+     (2 * M_PI / (ROTARY_JOINT_ENC_PER_REV)) / sqrt(12.0), 5.0, 0.02},
+    {(2 * M_PI / ENC_CNTS_PER_REV) / ELBOW_TR_GREEN_ARM / sqrt(12.0),
+     (2 * M_PI / (ROTARY_JOINT_ENC_PER_REV)) / sqrt(12.0), 5.0, 0.02},
+    {(2 * M_PI / ENC_CNTS_PER_REV) / Z_INS_TR_GREEN_ARM / sqrt(12.0),
+     (1.0 / LINEAR_JOINT_ENC_PER_M) / sqrt(12.0), 0.5, 0.002}};
+
+/// Fused state of one joint
+struct fusion_state {
+  int ready;
+  float q, qd, s;  // joint position, velocity and cable stretch
+};
+
+/// Steady-state Kalman gain from (motor-side, joint-side) innovations to (q, qd, s)
+struct fusion_gain {
+  float K[3][2];
+};
+
+static volatile int requested = fuse_motor;
+static int active = fuse_motor;
+static fusion_state state[MAX_MECH][FUSED_JOINTS];
+static fusion_gain gain[FUSED_JOINTS];
+
+/**
+ * \brief Steady-state Kalman gain of one axis
+ *
+ * State x = (q, qd, s), constant velocity with a random walk stretch;
+ * measurements z = (q + s, q).
+ */
+static void kalmanGain(const fusion_noise &nz, fusion_gain *out) {
+  const double T = STEP_PERIOD;
+  Eigen::Matrix3d F, Q, P = Eigen::Matrix3d::Identity();
+  Eigen::Matrix<double, 2, 3> H;
+  Eigen::Matrix2d R;
+  Eigen::Matrix<double, 3, 2> K;
+
+  F << 1, T, 0, 0, 1, 0, 0, 0, 1;
+  H << 1, 0, 1, 1, 0, 0;
+  Q.setZero();
+  Q(0, 0) = pow(nz.accel, 2) * pow(T, 3) / 3;
+  Q(0, 1) = Q(1, 0) = pow(nz.accel, 2) * pow(T, 2) / 2;
+  Q(1, 1) = pow(nz.accel, 2) * T;
+  Q(2, 2) = pow(nz.stretch, 2) * T;
+  R << pow(nz.motor, 2), 0, 0, pow(nz.joint, 2);
+
+  // iterate the Riccati recursion to convergence
+  for (int i = 0; i < 20000; i++) {
+    Eigen::Matrix3d Pp = F * P * F.transpose() + Q;
+    K = Pp * H.transpose() * (H * Pp * H.transpose() + R).inverse();
+    Eigen::Matrix3d Pn = (Eigen::Matrix3d::Identity() - K * H) * Pp;
+    double change = (Pn - P).norm();
+    P = Pn;
+    if (change < 1e-18) break;
+  }
+
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 2; c++) out->K[r][c] = K(r, c);
+}
+
+/**
+ * \brief Fuses the joint state of one joint
+ *
+ * \param st     fused state of the joint
+ * \param g      Kalman gain of the joint's axis
+ * \param joint  the joint; jpos/jvel come from the motor side, j_enc_pos from
+ *               the joint encoder.  jpos/jvel receive the fused state.
+ */
+static void fuseJoint(fusion_state *st, const fusion_gain *g, DOF *joint) {
+  float zm = joint->jpos, zj = joint->j_enc_pos;
+
+  if (!st->ready) {
+    st->q = zj;
+    st->qd = joint->jvel;
+    st->s = zm - zj;
+    st->ready = TRUE;
+  }
+
+  if (active == fuse_complementary) {
+    const float a = 1 - exp(-2 * M_PI * FUSION_STRETCH_HZ * STEP_PERIOD);
+    st->s += a * ((zm - zj) - st->s);
+    st->q = zm - st->s;
+    st->qd = joint->jvel;
+  } else {
+    float q = st->q + st->qd * STEP_PERIOD;
+    float em = zm - (q + st->s), ej = zj - q;
+    st->q = q + g->K[0][0] * em + g->K[0][1] * ej;
+    st->qd += g->K[1][0] * em + g->K[1][1] * ej;
+    st->s += g->K[2][0] * em + g->K[2][1] * ej;
+  }
+
+  joint->jpos = st->q;
+  joint->jvel = st->qd;
+}
+
+/**
+ * \brief Replaces the positioning joints' state with the fused state
+ *
+ * Runs after fwdCableCoupling() and fwdJointEncoders().
+ *
+ * \param device0  the robot device
+ */
+void fuseJointEncoders(device *device0) {
+  if (requested != active) {
+    active = requested;
+    memset(state, 0, sizeof(state));
+  }
+  if (!JOINT_ENCODERS || active == fuse_motor) return;
+
+  for (int i = 0; i < NUM_MECH; i++) {
+    mechanism *mech = &device0->mech[i];
+    int arm = (mech->type == GOLD_ARM) ? 0 : 1;
+
+    // joint encoder offsets are only known once homed
+    for (int j = 0; j < FUSED_JOINTS; j++) {
+      if (mech->joint[j].state == jstate_ready)
+        fuseJoint(&state[arm][j], &gain[j], &mech->joint[j]);
+      else
+        state[arm][j].ready = FALSE;
+    }
+  }
+}
+
+/**
+ * \brief Cable stretch the fused state of a joint leaves out
+ *
+ * \param mech  the mechanism
+ * \param j     the joint index
+ * \return the estimated stretch in joint units, 0 for joints that are not fused
+ */
+float fusedStretch(mechanism *mech, int j) {
+  int arm = (mech->type == GOLD_ARM) ? 0 : 1;
+
+  if (!JOINT_ENCODERS || active == fuse_motor || j < 0 || j >= FUSED_JOINTS) return 0;
+  if (!state[arm][j].ready) return 0;
+  return state[arm][j].s;
+}
+
+/**
+ * \brief Selects the joint state source; the RT thread switches at its next cycle
+ *
+ * \param type  a fusion_type
+ * \return 0 on success, -1 for an unknown type
+ */
+int setJointFusion(int type) {
+  if (type < 0 || type >= fuse_last_type) return -1;
+  requested = type;
+  return 0;
+}
+
+/**
+ * \return the selected fusion_type
+ */
+int getJointFusion() { return requested; }
+
+/**
+ * \return the name of a fusion type, or "unknown"
+ */
+const char *jointFusionName(int type) {
+  return (type >= 0 && type < fuse_last_type) ? fusionNames[type] : "unknown";
+}
+
+/**
+ * \brief Computes the Kalman gains and reads the startup choice from /joint_fusion
+ *
+ * \param n  the ros node handle
+ * \return 0 on success, -1 if the parameter names an unknown fusion
+ */
+int init_joint_fusion(ros::NodeHandle &n) {
+  std::string name;
+  int type = -1;
+
+  for (int j = 0; j < FUSED_JOINTS; j++) kalmanGain(FUSION_NOISE[j], &gain[j]);
+
+  n.param("/joint_fusion", name, std::string(fusionNames[fuse_motor]));
+  for (int i = 0; i < fuse_last_type; i++)
+    if (name == fusionNames[i]) type = i;
+
+  if (type < 0) {
+    log_msg("Unknown joint fusion %s, using motor encoders", name.c_str());
+    return -1;
+  }
+  setJointFusion(type);
+
+  if (!JOINT_ENCODERS && type != fuse_motor)
+    log_msg("Joint fusion %s needs JOINT_ENCODERS, using motor encoders", name.c_str());
+  else
+    log_msg("Joint state from %s fusion", name.c_str());
+
+  return 0;
+}
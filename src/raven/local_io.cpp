@@ -54,6 +54,10 @@
 #include "r2_kinematics.h"
 #include "reconfigure.h"
 #include "r2_jacobian.h"
+#include "command_fanin.h"
+#include "trajectory_plan.h"
+#include "homing_record.h"
+#include "overdrive_detect.h"
 
 extern int NUM_MECH;
 extern USBStruct USBBoards;
@@ -67,6 +71,24 @@ tf::Quaternion Q_ori[2];
 pthread_mutexattr_t data1MutexAttr;
 pthread_mutex_t data1Mutex;
 
+volatile unsigned int data1Writes;  // bumped on every producer-side write of data1
+
+/// Origin rebase request posted by the RT thread without locking data1Mutex.
+/// seq is odd while the request is being written.
+struct origin_rebase {
+  volatile unsigned int seq;
+  position xd[MAX_MECH_PER_DEV];
+  orientation rd[MAX_MECH_PER_DEV];
+  int armidx[MAX_MECH_PER_DEV];
+};
+static origin_rebase rebaseReq;
+static volatile int rebaseWriter;            // held while posting a request
+static volatile int originDirty = TRUE;      // device origin moved since the last request
+static volatile unsigned int rebaseApplied;  // seq of the last applied request
+static volatile unsigned int rebaseWrites;   // data1Writes when it was applied
+static tf::Matrix3x3 Q_ori_rebase[2];        // rebased orientation, pending conversion
+static int Q_ori_stale[2];                   // Q_ori needs refreshing from Q_ori_rebase
+
 volatile int isUpdated;  // TODO: HK volatile int instead of atomic_t ///Should we use
                          // atomic builtins?
                          // http://gcc.gnu.org/onlinedocs/gcc-4.1.2/gcc/Atomic-Builtins.html
@@ -74,6 +96,9 @@ volatile int isUpdated;  // TODO: HK volatile int instead of atomic_t ///Should
 extern offsets offsets_l;
 extern offsets offsets_r;
 
+static void applyOriginRebase();
+static void refreshQori(int armidx);
+
 /**
  * \brief Initialize data arrays to zero and create mutex
  *
@@ -97,6 +122,9 @@ int initLocalioData() {
     data1.rd[i].pitch = 0;
     data1.rd[i].roll = 0;
     data1.rd[i].grasp = 0;
+    data1.abs_pose_active[i] = 0;
+    data1.abs_pose_seq[i] = 0;
+    data1.abs_pose_ticks[i] = 1;
     Q_ori[i] = Q_ori[i].getIdentity();
   }
   data1.surgeon_mode = 0;
@@ -110,15 +138,16 @@ int initLocalioData() {
  *
  * \param u pointer to new data
  * \param size
+ * \param src command source the packet came from
  *
  * \ingroup DataStructures
  * \todo check checksum, figure out what to do if the checksum fails
  */
 
-int receiveUserspace(void *u, int size) {
+int receiveUserspace(void *u, int size, int src) {
   if (size == sizeof(u_struct)) {
     isUpdated = TRUE;
-    teleopIntoDS1((u_struct *)u);
+    teleopIntoDS1((u_struct *)u, src);
   }
   return 0;
 }
@@ -126,24 +155,25 @@ int receiveUserspace(void *u, int size) {
 /**
  * \brief Puts the master data into protected structure
  *
- * Takes the data from the master structure and places it into the parameter
- *passing structure.
+ * Takes the data from the master structure and deposits it with the packet's
+ *command source.  The increments reach data1 at the next merge (see
+ *mergeCommandSources()).
  *
- * \question why is setting the sequence number like this a hack?
  * \todo Apply transform to incoming data </capslock>
  * \param us_t a pointer to the user input structure
+ * \param src command source the packet came from
  *
  *  \ingroup DataStructures
  */
-void teleopIntoDS1(u_struct *us_t) {
+void teleopIntoDS1(u_struct *us_t, int src) {
   position p;
   int i, armidx, armserial, loops;
-  pthread_mutex_lock(&data1Mutex);
-  tf::Quaternion q_temp;
-  tf::Matrix3x3 rot_mx_temp;
+  cmd_increment inc;
 
   // TODO:: APPLY TRANSFORM TO INCOMING DATA
 
+  pthread_mutex_lock(&data1Mutex);
+
   // this function wants to loop through boards instead of mechanisms
   // TODO:: loop over mechanisms instead?
   loops = USBBoards.activeAtStart;
@@ -165,70 +195,175 @@ void teleopIntoDS1(u_struct *us_t) {
     p.z = us_t->delz[armidx];
 
     // set local quaternion from teleop quaternion data
-    q_temp.setX(us_t->Qx[armidx]);
-    q_temp.setY(us_t->Qy[armidx]);
-    q_temp.setZ(us_t->Qz[armidx]);
-    q_temp.setW(us_t->Qw[armidx]);
+    inc.dq.setX(us_t->Qx[armidx]);
+    inc.dq.setY(us_t->Qy[armidx]);
+    inc.dq.setZ(us_t->Qz[armidx]);
+    inc.dq.setW(us_t->Qw[armidx]);
 
-    fromITP(&p, q_temp, armserial);
+    fromITP(&p, inc.dq, armserial);
 
-    data1.xd[armidx].x += p.x;
-    data1.xd[armidx].y += p.y;
-    data1.xd[armidx].z += p.z;
-
-    // Add quaternion increment
-    Q_ori[armidx] = q_temp * Q_ori[armidx];
-    rot_mx_temp.setRotation(Q_ori[armidx]);
-
-    // Set rotation command
-    for (int j = 0; j < 3; j++)
-      for (int k = 0; k < 3; k++) data1.rd[armidx].R[j][k] = rot_mx_temp[j][k];
+    inc.dx = p.x;
+    inc.dy = p.y;
+    inc.dz = p.z;
 
 #ifdef OMNI_GAIN
-    const int grasp_gain = OMNI_GAIN;
+    int grasp_gain = OMNI_GAIN;
 #else
-    const int grasp_gain = 1;
+    int grasp_gain = 1;
 #endif
 
 #ifdef SCISSOR_RIGHT
     if (armserial == GREEN_ARM_SERIAL) grasp_gain *= 4;
-
 #endif
 
+    inc.dgrasp = -grasp_gain * us_t->grasp[armidx];
+
+    depositSourceIncrement(src, armidx, inc);
+  }
+
+  depositSourcePedal(src, us_t->surgeon_mode);
+  pthread_mutex_unlock(&data1Mutex);
+}
+
+/**
+ * \brief Merges the command sources into data1. Call with data1Mutex held.
+ *
+ * Runs once per control tick from getRcvdParams(), so concurrent sources
+ *produce a single command and a handover takes effect within one cycle.
+ *
+ *  \ingroup DataStructures
+ */
+static void mergeCommandSources() {
+  cmd_increment inc;
+  int changed = 0;
+
+  for (int armidx = 0; armidx < MAX_MECH_PER_DEV; armidx++) {
+    if (arbitrateArm(armidx, &inc) < 0) continue;
+
+    // arms under absolute pose command ignore master increments
+    if (data1.abs_pose_active[armidx]) continue;
+
+    if (inc.dx || inc.dy || inc.dz || inc.dgrasp || inc.dq != tf::Quaternion::getIdentity())
+      changed = 1;
+
+    data1.xd[armidx].x += inc.dx;
+    data1.xd[armidx].y += inc.dy;
+    data1.xd[armidx].z += inc.dz;
+
+    // Add quaternion increment
+    if (inc.dq != tf::Quaternion::getIdentity()) {
+      refreshQori(armidx);
+      Q_ori[armidx] = inc.dq * Q_ori[armidx];
+      tf::Matrix3x3 rot_mx_temp(Q_ori[armidx]);
+
+      // Set rotation command
+      for (int j = 0; j < 3; j++)
+        for (int k = 0; k < 3; k++) data1.rd[armidx].R[j][k] = rot_mx_temp[j][k];
+    }
+
     const int graspmax = (M_PI / 2 * 1000);
     int graspmin = (-10.0 * 1000.0 DEG2RAD);
 
 #ifdef SCISSOR_RIGHT
-    if (armserial == GREEN_ARM_SERIAL) graspmin = (-40.0 * 1000.0 DEG2RAD);
+    if (armidx == 1) graspmin = (-40.0 * 1000.0 DEG2RAD);
 #endif
-    data1.rd[armidx].grasp -= grasp_gain * us_t->grasp[armidx];
+    data1.rd[armidx].grasp += inc.dgrasp;
     if (data1.rd[armidx].grasp > graspmax)
       data1.rd[armidx].grasp = graspmax;
     else if (data1.rd[armidx].grasp < graspmin)
       data1.rd[armidx].grasp = graspmin;
   }
 
-  /// \question HK: why is this a hack?
-  // HACK HACK HACK
-  // HACK HACK HACK
-  // HACK HACK HACK
-  // HACK HACK HACK
-  data1.last_sequence = us_t->sequence;
+  int surgeon_mode, last_sequence;
+  if (arbitratePedal(&surgeon_mode, &last_sequence) >= 0) {
+    if (data1.surgeon_mode != surgeon_mode) changed = 1;
+    data1.surgeon_mode = surgeon_mode;
+    data1.last_sequence = last_sequence;
+  }
 
-  // commented debug output
-  //    log_msg("updated d1.xd to: (%d,%d,%d)/(%d,%d,%d)",
-  //           data1.xd[0].x, data1.xd[0].y, data1.xd[0].z,
-  //           data1.xd[1].x, data1.xd[1].y, data1.xd[1].z);
+  if (changed) data1Writes++;
+}
 
-  data1.surgeon_mode = us_t->surgeon_mode;
-  pthread_mutex_unlock(&data1Mutex);
+static float watchdogGain[MAX_MECH_PER_DEV] = {1, 1};
+static volatile int disengagePending = FALSE;
+
+/**
+ * \brief Runs the per-arm master watchdog
+ *
+ * Liveness comes from the monotonic arrival time of the last command for each
+ * arm from any command source, so it is independent of the control rate and of
+ * console or toolkit updates.  Once an arm has been silent for
+ * MASTER_CONN_TIMEOUT its command gain ramps to zero over MASTER_RAMP_TIME, and
+ * back up if commands resume.  The gain scales the steps of the arm's set point
+ * toward the master command (see updateDeviceState()), so the arm holds its pose
+ * under full control while it ramps.  When every commanded arm has ramped out
+ * the surgeon mode is set to pedal-up.
+ *
+ * Called from the RT thread; never blocks on data1Mutex.
+ *
+ * \ingroup Networking
+ */
+static void updateMasterWatchdog() {
+  static u_64 lastCheck = 0;
+  static int allDown = FALSE;
+  u_64 now = monotonic_ns();
+  float step = lastCheck ? (float)(now - lastCheck) / (MASTER_RAMP_TIME * 1000000.0) : 0;
+  int tracked = 0, down = TRUE;
+
+  lastCheck = now;
+  for (int armidx = 0; armidx < MAX_MECH_PER_DEV; armidx++) {
+    u_64 arrival = armLastArrival(armidx);
+    if (arrival == 0) {
+      // never commanded by a master, nothing to watch
+      watchdogGain[armidx] = 1;
+      continue;
+    }
+    tracked = TRUE;
+
+    if (now - arrival > (u_64)MASTER_CONN_TIMEOUT * 1000000) {
+      if (watchdogGain[armidx] == 1)
+        log_msg("Master connection timeout on arm %d.  Ramping down.\n", armidx);
+      watchdogGain[armidx] -= step;
+      if (watchdogGain[armidx] < 0) watchdogGain[armidx] = 0;
+    } else {
+      watchdogGain[armidx] += step;
+      if (watchdogGain[armidx] > 1) watchdogGain[armidx] = 1;
+    }
+    if (watchdogGain[armidx] > 0) down = FALSE;
+  }
+
+  down = down && tracked;
+  if (down && !allDown) disengagePending = TRUE;
+  allDown = down;
+
+  // set surgeon_mode "DISENGAGED" if currently "ENGAGED", retry next tick if
+  // a producer holds the lock
+  if (disengagePending && pthread_mutex_trylock(&data1Mutex) == 0) {
+    if (data1.surgeon_mode) {
+      log_msg("Master connection timeout.  surgeon_mode -> up.\n");
+      data1.surgeon_mode = SURGEON_DISENGAGED;
+      data1Writes++;
+      isUpdated = TRUE;
+    }
+    pthread_mutex_unlock(&data1Mutex);
+    disengagePending = FALSE;
+  }
 }
 
+/**
+ * \brief Command gain of an arm as set by the master watchdog
+ *
+ * \param armidx 0 for the gold arm, 1 for the green arm
+ * \return 1 while the arm is commanded, ramping to 0 after a master timeout
+ * \ingroup Networking
+ */
+float masterWatchdogGain(int armidx) { return watchdogGain[armidx]; }
+
 /**
  * \brief Checks if there has been a recent update from master
  *
- * Checks if there has been a recent update from master.
- * If it has been too long since last update it sets state to pedal-up.
+ * Runs the master watchdog, which ramps down and eventually sets pedal-up if
+ * the master has gone silent, see updateMasterWatchdog().
  *
  * \return true if updates have been received from master or toolkit since last
  *module update
@@ -238,20 +373,7 @@ void teleopIntoDS1(u_struct *us_t) {
  *
  */
 int checkLocalUpdates() {
-  static unsigned long int lastUpdated;
-
-  if (isUpdated || lastUpdated == 0) {
-    lastUpdated = gTime;
-  } else if (((gTime - lastUpdated) > MASTER_CONN_TIMEOUT) && (data1.surgeon_mode)) {
-    // if timeout period is expired, set surgeon_mode "DISENGAGED" if currently
-    // "ENGAGED"
-    log_msg("Master connection timeout.  surgeon_mode -> up.\n");
-    data1.surgeon_mode = SURGEON_DISENGAGED;
-    //       data1.surgeon_mode = 1;
-
-    lastUpdated = gTime;
-    isUpdated = TRUE;
-  }
+  updateMasterWatchdog();
 
   return isUpdated;
 }
@@ -275,12 +397,73 @@ param_pass *getRcvdParams(param_pass *d1) {
     return d1;
   // pthread_mutex_lock(&data1Mutex); //Priority inversion enabled. Should force
   // completion of other parts and enter into this section.
+  applyOriginRebase();
+  mergeCommandSources();
   memcpy(d1, &data1, sizeof(param_pass));
   isUpdated = 0;
   pthread_mutex_unlock(&data1Mutex);
   return d1;
 }
 
+/**
+ * \brief Applies a pending origin rebase to data1
+ *
+ * Consumer side of updateMasterRelativeOrigin().  Must be called with
+ *data1Mutex held.  The request is copied out of the seqlock and dropped if the
+ *writer was active meanwhile; it stays pending and is picked up by the next
+ *caller.
+ *
+ *  \ingroup DataStructures
+ */
+static void applyOriginRebase() {
+  unsigned int seq = rebaseReq.seq;
+  if (seq == rebaseApplied || (seq & 1)) return;  // nothing new, or being written
+
+  __sync_synchronize();
+  position xd[MAX_MECH_PER_DEV];
+  orientation rd[MAX_MECH_PER_DEV];
+  int armidx[MAX_MECH_PER_DEV];
+  memcpy(xd, rebaseReq.xd, sizeof(xd));
+  memcpy(rd, rebaseReq.rd, sizeof(rd));
+  memcpy(armidx, rebaseReq.armidx, sizeof(armidx));
+  __sync_synchronize();
+  if (rebaseReq.seq != seq) return;  // torn read
+
+  for (int i = 0; i < NUM_MECH; i++) {
+    // absolute targets are not relative to the master; leave them alone
+    if (data1.abs_pose_active[i]) continue;
+
+    data1.xd[i] = xd[i];
+
+    // CHECK GRASP SKIPPING CONDITION
+    // Grasp angle should not be updated unless the angle change is "large"
+    if (fabs(data1.rd[i].grasp - rd[i].grasp) / 1000 > 45 * d2r) data1.rd[i].grasp = rd[i].grasp;
+
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < 3; k++) data1.rd[i].R[j][k] = rd[i].R[j][k];
+
+    // The local quaternion orientation rep is refreshed lazily by the producers
+    Q_ori_rebase[armidx[i]].setValue(rd[i].R[0][0], rd[i].R[0][1], rd[i].R[0][2], rd[i].R[1][0],
+                                     rd[i].R[1][1], rd[i].R[1][2], rd[i].R[2][0], rd[i].R[2][1],
+                                     rd[i].R[2][2]);
+    Q_ori_stale[armidx[i]] = TRUE;
+  }
+  rebaseApplied = seq;
+  rebaseWrites = data1Writes;
+}
+
+/**
+ * \brief Brings Q_ori up to date after a rebase. Call with data1Mutex held.
+ *
+ * \param armidx 0 for gold, 1 for green
+ *  \ingroup DataStructures
+ */
+static void refreshQori(int armidx) {
+  if (!Q_ori_stale[armidx]) return;
+  Q_ori_rebase[armidx].getRotation(Q_ori[armidx]);
+  Q_ori_stale[armidx] = FALSE;
+}
+
 /**
  * \brief Resets the desired position to the robot's current position
  *
@@ -290,39 +473,53 @@ param_pass *getRcvdParams(param_pass *d1) {
  *changing too much
  * while the robot is moving
  *
- * Reset writable copy of DS1
+ * This is called from the RT thread, so it never touches data1Mutex.  Instead
+ *it posts the new origin as a "rebase request" through a seqlock, and whoever
+ *next holds the mutex (a producer callback, or getRcvdParams()) applies it to
+ *data1.  If another caller is already posting, this call is dropped; the RT
+ *loop posts again on the next cycle.
+ *
+ * The pedal-up loop calls this every cycle with the result of
+ *set_posd_to_pos(), so an idle robot, whose pose only shows encoder noise,
+ *posts nothing until the pose moves or master increments arrive.
+ *
+ * \param device0  the device whose desired pose is the new origin
+ * \param moved    FALSE if the origin has not moved since the last call
+ *
  *  \ingroup Networking
  */
-void updateMasterRelativeOrigin(device *device0) {
-  int armidx;
-  orientation *_ori;
-  tf::Matrix3x3 tmpmx;
+void updateMasterRelativeOrigin(device *device0, int moved) {
+  static int posted = 0;
+  static unsigned int postedSeq;
+
+  if (moved) originDirty = TRUE;
+  if (__sync_lock_test_and_set(&rebaseWriter, 1)) return;
+
+  // Nothing to do if the last request was consumed, nothing has written data1
+  // since, and the device origin has not moved.  Keeps an idle robot quiet.
+  if (posted && postedSeq == rebaseApplied && rebaseWrites == data1Writes && !originDirty) {
+    __sync_lock_release(&rebaseWriter);
+    return;
+  }
+  originDirty = FALSE;
 
   // update data1 (network position desired) to device0.position_desired (device
   // position desired)
   //   This eliminates accumulation of deltas from network while robot is idle.
-  pthread_mutex_lock(&data1Mutex);
+  rebaseReq.seq++;  // odd: write in progress
+  __sync_synchronize();
   for (int i = 0; i < NUM_MECH; i++) {
-    data1.xd[i].x = device0->mech[i].pos_d.x;
-    data1.xd[i].y = device0->mech[i].pos_d.y;
-    data1.xd[i].z = device0->mech[i].pos_d.z;
-    _ori = &(device0->mech[i].ori_d);
-
-    // CHECK GRASP SKIPPING CONDITION
-    // Grasp angle should not be updated unless the angle change is "large"
-    if (fabs(data1.rd[i].grasp - _ori->grasp) / 1000 > 45 * d2r) data1.rd[i].grasp = _ori->grasp;
-
-    for (int j = 0; j < 3; j++)
-      for (int k = 0; k < 3; k++) data1.rd[i].R[j][k] = _ori->R[j][k];
-
-    // Set the local quaternion orientation rep.
-    armidx = device0->mech[i].type == GREEN_ARM_SERIAL ? 1 : 0;
-    tmpmx.setValue(_ori->R[0][0], _ori->R[0][1], _ori->R[0][2], _ori->R[1][0], _ori->R[1][1],
-                   _ori->R[1][2], _ori->R[2][0], _ori->R[2][1], _ori->R[2][2]);
-    tmpmx.getRotation(Q_ori[armidx]);
+    rebaseReq.xd[i] = device0->mech[i].pos_d;
+    rebaseReq.rd[i] = device0->mech[i].ori_d;
+    rebaseReq.armidx[i] = device0->mech[i].type == GREEN_ARM_SERIAL ? 1 : 0;
   }
-  pthread_mutex_unlock(&data1Mutex);
-  isUpdated = TRUE;
+  __sync_synchronize();
+  rebaseReq.seq++;  // even: request complete
+  postedSeq = rebaseReq.seq;
+  posted = 1;
+  __sync_lock_release(&rebaseWriter);
+
+  isUpdated = TRUE;  // make the RT thread fetch data1, which applies the request
 
   return;
 }
@@ -330,6 +527,7 @@ void updateMasterRelativeOrigin(device *device0) {
 void setSurgeonMode(int pedalstate) {
   pthread_mutex_lock(&data1Mutex);
   data1.surgeon_mode = pedalstate;
+  data1Writes++;
   pthread_mutex_unlock(&data1Mutex);
   isUpdated = TRUE;
   log_msg("surgeon mode: %d", data1.surgeon_mode);
@@ -341,22 +539,30 @@ void setSurgeonMode(int pedalstate) {
 #include <tf/transform_datatypes.h>
 #include <raven_2/raven_state.h>
 #include <raven_2/raven_automove.h>
+#include <raven_2/raven_absolute_pose.h>
 #include <sensor_msgs/JointState.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 void publish_joints(robot_device *);
 void autoincrCallback(raven_2::raven_automove);
+void absposeCallback(raven_2::raven_absolute_pose);
+void publish_source_diagnostics(const ros::TimerEvent &);
 
 using namespace raven_2;
 // Global publisher for raven data
 ros::Publisher pub_ravenstate;
 ros::Subscriber sub_automove;
+ros::Subscriber sub_abspose;
+ros::Publisher pub_diagnostics;
+ros::Timer diag_timer;
 ros::Publisher joint_publisher;
 
 /**
  *  \brief Initiates all ROS publishers and subscribers
  *
  *  Currently advertises ravenstate, joint states, and 2 visualization markers.
- *  Subscribes to automove
+ *  Subscribes to automove and absolute pose commands
+ *  Publishes command source statistics on /diagnostics once a second
  *
  *  \param n the address of a nodeHandle
  * \ingroup ROS
@@ -371,6 +577,11 @@ int init_ravenstate_publishing(ros::NodeHandle &n) {
   sub_automove = n.subscribe<raven_automove>("raven_automove", 1, autoincrCallback,
                                              ros::TransportHints().unreliable()
                                                                   .reliable());
+  sub_abspose = n.subscribe<raven_absolute_pose>("raven_absolute_pose", 1, absposeCallback,
+                                                 ros::TransportHints().unreliable().reliable());
+
+  pub_diagnostics = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+  diag_timer = n.createTimer(ros::Duration(1.0), publish_source_diagnostics);
 
   return 0;
 }
@@ -378,9 +589,9 @@ int init_ravenstate_publishing(ros::NodeHandle &n) {
 /**
  *\brief Callback for the automove topic - Updates the data1 structure
  *
- * Callback for the automove topic. Updates the data1 structure with the
- *information from the
- * ROS topic. Properly locks the data1 mutex. Accepts cartesian or quaternion
+ * Callback for the automove topic. Deposits the increments from the ROS
+ *topic with the "automove" command source, to be merged into data1 at the next
+ *control tick. Properly locks the data1 mutex. Accepts cartesian or quaternion
  *increments.
  *
  * \param msg the
@@ -388,16 +599,21 @@ int init_ravenstate_publishing(ros::NodeHandle &n) {
  *
  */
 void autoincrCallback(raven_2::raven_automove msg) {
+  static int src = registerCommandSource("automove", 0, 1.0, FALSE);
   tf::Transform in_incr[2];
   tf::transformMsgToTF(msg.tf_incr[0], in_incr[0]);
   tf::transformMsgToTF(msg.tf_incr[1], in_incr[1]);
 
+  if (src < 0) return;
+  noteSourcePacket(src, TRUE);
+
   pthread_mutex_lock(&data1Mutex);
 
   // this function wants to loop through boards instead of mechanisms
   // TODO:: loop over mechanisms instead?
   int loops = USBBoards.activeAtStart;
   int armidx;
+  cmd_increment inc;
 
   for (int i = 0; i < loops; i++) {
     if (USBBoards.boards[i] == GOLD_ARM_SERIAL) {
@@ -408,26 +624,291 @@ void autoincrCallback(raven_2::raven_automove msg) {
       continue;  // don't do any teleop data for joint encoders
     }
 
-    // add position increment
+    // position increment
     tf::Vector3 tmpvec = in_incr[armidx].getOrigin();
-    data1.xd[armidx].x += int(tmpvec[0]);
-    data1.xd[armidx].y += int(tmpvec[1]);
-    data1.xd[armidx].z += int(tmpvec[2]);
-
-    // add rotation increment
-    tf::Quaternion q_temp(in_incr[armidx].getRotation());
-    if (q_temp != tf::Quaternion::getIdentity()) {
-      Q_ori[armidx] = q_temp * Q_ori[armidx];
-      tf::Matrix3x3 rot_mx_temp(Q_ori[armidx]);
-      for (int j = 0; j < 3; j++)
-        for (int k = 0; k < 3; k++) data1.rd[armidx].R[j][k] = rot_mx_temp[j][k];
+    inc.dx = int(tmpvec[0]);
+    inc.dy = int(tmpvec[1]);
+    inc.dz = int(tmpvec[2]);
+
+    // rotation increment
+    inc.dq = in_incr[armidx].getRotation();
+    inc.dgrasp = 0;
+
+    depositSourceIncrement(src, armidx, inc);
+  }
+
+  pthread_mutex_unlock(&data1Mutex);
+  isUpdated = TRUE;
+}
+
+/**
+ *\brief Callback for the absolute pose topic - Sets absolute targets in data1
+ *
+ * Unlike automove, the message carries a full pose and grasp per arm which
+ *replaces xd/rd rather than adding to them.  The RT thread interpolates from the
+ *current desired pose to the target (see update_absolute_pose_trajectory()), so
+ *planners can stream setpoints without accumulating drift.  An arm stays under
+ *absolute command, ignoring master increments, until a message releases it with
+ *arm_active = 0.
+ *
+ * \param msg the absolute pose command
+ * \ingroup ROS
+ *
+ */
+void absposeCallback(raven_2::raven_absolute_pose msg) {
+  static int src = registerCommandSource("abspose", 0, 1.0, FALSE);
+  ros::Time now = ros::Time::now();
+  ros::Time stamp = msg.hdr.stamp.isZero() ? now : msg.hdr.stamp;
+
+  if (src >= 0) noteSourcePacket(src, TRUE);
+  if ((now - stamp).toSec() * 1000 > MASTER_CONN_TIMEOUT) {
+    log_msg("Dropped stale absolute pose command (%.3f s old)", (now - stamp).toSec());
+    return;
+  }
+
+  // time left to reach the target, in control cycles
+  int ticks = (int)(((stamp + msg.move_time) - now).toSec() * 1000);
+  if (ticks < 1) ticks = 1;
+
+  const int graspmax = (M_PI / 2 * 1000);
+  const int graspmin = (-10.0 * 1000.0 DEG2RAD);
+
+  pthread_mutex_lock(&data1Mutex);
+  applyOriginRebase();
+
+  // this function wants to loop through boards instead of mechanisms
+  int loops = USBBoards.activeAtStart;
+  int armidx;
+
+  for (int i = 0; i < loops; i++) {
+    if (USBBoards.boards[i] == GOLD_ARM_SERIAL) {
+      armidx = 0;
+    } else if (USBBoards.boards[i] == GREEN_ARM_SERIAL) {
+      armidx = 1;
+    } else {
+      continue;  // don't do any teleop data for joint encoders
+    }
+
+    if (!msg.arm_active[armidx]) {
+      // hand the arm back to incremental teleop, starting from the last target
+      data1.abs_pose_active[armidx] = 0;
+      continue;
     }
+
+    data1.xd[armidx].x = msg.pos[armidx * 3];
+    data1.xd[armidx].y = msg.pos[armidx * 3 + 1];
+    data1.xd[armidx].z = msg.pos[armidx * 3 + 2];
+
+    // go through a quaternion to re-orthonormalize the incoming matrix
+    const float *R = &msg.ori[armidx * 9];
+    tf::Matrix3x3 rot_mx_temp(R[0], R[1], R[2], R[3], R[4], R[5], R[6], R[7], R[8]);
+    tf::Quaternion q_temp;
+    rot_mx_temp.getRotation(q_temp);
+    q_temp.normalize();
+    Q_ori[armidx] = q_temp;
+    Q_ori_stale[armidx] = FALSE;
+    rot_mx_temp.setRotation(q_temp);
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < 3; k++) data1.rd[armidx].R[j][k] = rot_mx_temp[j][k];
+
+    int grasp = (int)(msg.grasp[armidx] * 1000);
+    if (grasp > graspmax)
+      grasp = graspmax;
+    else if (grasp < graspmin)
+      grasp = graspmin;
+    data1.rd[armidx].grasp = grasp;
+
+    data1.abs_pose_active[armidx] = 1;
+    data1.abs_pose_ticks[armidx] = ticks;
+    data1.abs_pose_seq[armidx]++;
+    if (src >= 0) noteSourceArmAlive(src, armidx);
   }
 
+  data1Writes++;
   pthread_mutex_unlock(&data1Mutex);
   isUpdated = TRUE;
 }
 
+/**
+ * \brief Adds a key/value pair to a diagnostic status
+ * \ingroup ROS
+ */
+static void addDiagValue(diagnostic_msgs::DiagnosticStatus &status, const char *key,
+                         const char *fmt, double value) {
+  char buf[32];
+  diagnostic_msgs::KeyValue kv;
+  snprintf(buf, sizeof(buf), fmt, value);
+  kv.key = key;
+  kv.value = buf;
+  status.values.push_back(kv);
+}
+
+/**
+ * \brief Publishes network QoS statistics of every command source, the
+ *trajectory playback of each arm, its last homing run and the safety
+ *supervisor
+ *
+ * Runs from a 1 Hz ROS timer in the spinner thread, off the RT path.  A source
+ *is reported stale when it stopped sending, and as a warning when more than 1%
+ *of its packets were lost.  An arm's trajectory is reported as a warning over
+ *the second in which its stream ran dry or a batch was refused, and its homing
+ *as a warning while a joint's margin is low or its free-running current rising.
+ *The safety supervisor is an error over the second in which a joint faulted
+ *and a warning when it reported any other limit.
+ *
+ * \ingroup ROS
+ */
+void publish_source_diagnostics(const ros::TimerEvent &) {
+  diagnostic_msgs::DiagnosticArray msg;
+  source_stats st;
+  char key[32];
+
+  msg.header.stamp = ros::Time::now();
+  for (int src = 0; src < numCommandSources(); src++) {
+    if (getSourceStats(src, &st) < 0) continue;
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = std::string("raven_2: command source ") + st.name;
+    status.hardware_id = st.name;
+
+    double loss = (st.packets + st.lost) ? (double)st.lost / (st.packets + st.lost) : 0;
+    if (st.rate == 0) {
+      status.level = diagnostic_msgs::DiagnosticStatus::STALE;
+      status.message = "No packets";
+    } else if (loss > 0.01) {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Packet loss";
+    } else {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = "OK";
+    }
+
+    addDiagValue(status, "packets/sec", "%.1f", st.rate);
+    addDiagValue(status, "packets", "%.0f", st.packets);
+    addDiagValue(status, "loss rate", "%.4f", loss);
+    addDiagValue(status, "duplicates", "%.0f", st.duplicates);
+    addDiagValue(status, "out of order", "%.0f", st.out_of_order);
+    addDiagValue(status, "max reorder depth", "%.0f", st.max_reorder);
+    addDiagValue(status, "sequence resets", "%.0f", st.resets);
+    addDiagValue(status, "checksum failures", "%.0f", st.checksum_fail);
+    addDiagValue(status, "jitter (us)", "%.1f", st.jitter_us);
+    addDiagValue(status, "max latency (us)", "%.1f", st.latency_max_us);
+    for (int b = 0; b < LATENCY_BINS; b++) {
+      if (b < LATENCY_BINS - 1)
+        snprintf(key, sizeof(key), "latency <= %d us", latency_bin_us[b]);
+      else
+        snprintf(key, sizeof(key), "latency > %d us", latency_bin_us[b - 1]);
+      addDiagValue(status, key, "%.0f", st.latency_hist[b]);
+    }
+    msg.status.push_back(status);
+  }
+
+  static traj_stats last[MAX_MECH];
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    traj_stats ts;
+    if (getTrajStats(arm, &ts) < 0) continue;
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = std::string("raven_2: trajectory ") + (arm == 0 ? "gold" : "green");
+    status.hardware_id = arm == 0 ? "gold" : "green";
+    if (ts.underruns != last[arm].underruns) {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Stream underrun";
+    } else if (ts.overflows != last[arm].overflows) {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Queue full";
+    } else {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = ts.queued ? "Playing" : "Idle";
+    }
+    last[arm] = ts;
+
+    addDiagValue(status, "queued segments", "%.0f", ts.queued);
+    addDiagValue(status, "lead (ms)", "%.0f", ts.lead);
+    addDiagValue(status, "lag (ms)", "%.0f", ts.lag);
+    addDiagValue(status, "max lag (ms)", "%.0f", ts.max_lag);
+    addDiagValue(status, "segments played", "%.0f", ts.segments);
+    addDiagValue(status, "underruns", "%.0f", ts.underruns);
+    addDiagValue(status, "late points", "%.0f", ts.late);
+    addDiagValue(status, "refused batches", "%.0f", ts.overflows);
+    addDiagValue(status, "dropped paths", "%.0f", ts.dropped);
+    msg.status.push_back(status);
+  }
+
+  static const char *dofNames[MAX_DOF_PER_MECH] = {"shoulder", "elbow", "insertion", "",
+                                                   "tool roll", "wrist", "grasp 1", "grasp 2"};
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    homing_report hr;
+    if (getHomingReport(arm, &hr) < 0) continue;
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = std::string("raven_2: homing ") + (arm == 0 ? "gold" : "green");
+    status.hardware_id = arm == 0 ? "gold" : "green";
+    if (hr.warnings) {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Low hard-stop margin";
+    } else {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = hr.warm ? "Warm start" : "Homed";
+    }
+
+    addDiagValue(status, "runs", "%.0f", hr.runs);
+    addDiagValue(status, "duration (ms)", "%.0f", hr.duration_ms);
+    addDiagValue(status, "tool", "%.0f", hr.tool);
+    for (int d = 0; d < MAX_DOF_PER_MECH; d++) {
+      const homing_joint_report *jr = &hr.joint[d];
+      if (!jr->searched) continue;
+      snprintf(key, sizeof(key), "%s search (ms)", dofNames[d]);
+      addDiagValue(status, key, "%.0f", jr->search_ms);
+      snprintf(key, sizeof(key), "%s margin (A)", dofNames[d]);
+      addDiagValue(status, key, "%.3f", jr->margin);
+      snprintf(key, sizeof(key), "%s free current (A)", dofNames[d]);
+      addDiagValue(status, key, "%.3f", jr->free_amps);
+      snprintf(key, sizeof(key), "%s threshold (A)", dofNames[d]);
+      addDiagValue(status, key, "%.3f", jr->threshold);
+    }
+    msg.status.push_back(status);
+  }
+
+  static safety_stats lastSafety;
+  safety_stats ss;
+  if (getSafetyStats(&ss) == 0) {
+    diagnostic_msgs::DiagnosticStatus status;
+    unsigned int events = 0, lastEvents = 0;
+    for (int c = 0; c < sc_last; c++) {
+      events += ss.events[c];
+      lastEvents += lastSafety.events[c];
+    }
+    status.name = "raven_2: safety";
+    status.hardware_id = "raven_2";
+    if (ss.faults != lastSafety.faults) {
+      status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+      status.message = std::string("Fault: ") + safetyCheckName(ss.last.check);
+    } else if (events != lastEvents) {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = std::string("Limit: ") + safetyCheckName(ss.last.check);
+    } else {
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+      status.message = "OK";
+    }
+    lastSafety = ss;
+
+    addDiagValue(status, "policy", "%.0f", ss.policy);
+    for (int c = 0; c < sc_last; c++) {
+      snprintf(key, sizeof(key), "%s events", safetyCheckName(c));
+      addDiagValue(status, key, "%.0f", ss.events[c]);
+    }
+    addDiagValue(status, "faults", "%.0f", ss.faults);
+    addDiagValue(status, "dropped events", "%.0f", ss.dropped);
+    addDiagValue(status, "last event joint", "%.0f", ss.last.joint);
+    addDiagValue(status, "cost mean (ns)", "%.0f", ss.cost_mean_ns);
+    addDiagValue(status, "cost max (ns)", "%.0f", ss.cost_max_ns);
+    msg.status.push_back(status);
+  }
+
+  if (!msg.status.empty()) pub_diagnostics.publish(msg);
+}
+
 /**
  * \brief Publishes the raven_state message from the robot and currParams
  *structures
@@ -59,6 +59,8 @@
 #include "DS1.h"
 #include "log.h"
 #include "local_io.h"
+#include "command_fanin.h"
+#include "utils.h"
 
 #define SERVER_PORT "36000"  // used if the robot needs to send data to the server
 //#define SERVER_ADDR  "192.168.0.102"
@@ -113,7 +115,7 @@ int initSock(const char *port) {
 }
 
 /**\fn int UDPChecksum(u_struct *u)
-  \brief Calculate chesum for a teleoperation packet, not called anywhere
+  \brief Calculate chesum for a teleoperation packet, only used for statistics
   \param u a u_struct pointer
   \struct u_struct structure passed from master to slave itp_teleoperation.h
   \return positive integer number
@@ -130,6 +132,57 @@ int UDPChecksum(u_struct *u) {
   return chk;
 }
 
+/**\fn int masterSource(const sockaddr_in &from)
+  \brief Maps the sender of a packet to its command source, registering new
+  masters as "master0", "master1", ... in order of first contact
+
+  Masters are told apart by host address, so a master that restarts on a new
+  port keeps its source.  Once the source table is full, a new master takes
+  over the source of one that has sent nothing for MASTER_CONN_TIMEOUT.
+  \param from sender address
+  \return command source id, -1 if no source is free (the packet is dropped)
+  \ingroup Network
+*/
+static int masterSource(const sockaddr_in &from) {
+  static in_addr_t addrs[MAX_CMD_SOURCES];
+  static int srcs[MAX_CMD_SOURCES];
+  static int n = 0;
+  static unsigned int dropped = 0;
+  char name[32];
+  int slot = -1, src = -1;
+
+  for (int i = 0; i < n; i++)
+    if (addrs[i] == from.sin_addr.s_addr) return srcs[i];
+
+  if (n < MAX_CMD_SOURCES) {
+    sprintf(name, "master%d", n);
+    src = registerCommandSource(name, 0, 1.0, TRUE);
+    if (src >= 0) slot = n++;
+  }
+
+  // reclaim the source of a master that has gone away
+  u_64 now = monotonic_ns();
+  for (int i = 0; slot < 0 && i < n; i++) {
+    if (now - sourceLastPacket(srcs[i]) > (u_64)MASTER_CONN_TIMEOUT * 1000000) {
+      slot = i;
+      src = srcs[i];
+      restartSourceSequence(src);
+    }
+  }
+
+  if (slot < 0) {
+    if (dropped++ % 1000 == 0)
+      log_msg("No command source free for master %s:%d, %u packets dropped",
+              inet_ntoa(from.sin_addr), ntohs(from.sin_port), dropped);
+    return -1;
+  }
+
+  addrs[slot] = from.sin_addr.s_addr;
+  srcs[slot] = src;
+  log_msg("  %s is %s:%d", commandSourceName(src), inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+  return src;
+}
+
 // \todo DELET line 144-147? why volatile v_struct?
 // Chek packet validity, incl. sequence numbering and checksumming
 // int checkPacket(u_struct &u, int seq);
@@ -161,9 +214,12 @@ void *network_process(void *param1) {
   int logFile;
   struct timeval tv;
   struct timezone tz;
-  char logbuffer[100];
+  char logbuffer[200];
   unsigned int seq = 0;
   volatile int bytesread;
+  sockaddr_in fromName;
+  socklen_t fromLength;
+  int src;
 
   // print some status messages
   log_msg("Starting network services...");
@@ -232,7 +288,8 @@ void *network_process(void *param1) {
     // Select: data on socket
     if (FD_ISSET(sock, &rmask))  // check whether the diescriptor sock is added                                 
     {                            // to the fdset mask
-      bytesread = recvfrom(sock, &u, uSize, 0, NULL, NULL);
+      fromLength = sizeof(fromName);
+      bytesread = recvfrom(sock, &u, uSize, 0, (sockaddr *)&fromName, &fromLength);
       if (bytesread != uSize)
       {
         ROS_ERROR("ERROR: Rec'd wrong ustruct size on socket!\n");
@@ -242,6 +299,12 @@ void *network_process(void *param1) {
 
       if (k++ % 2000 == 0) log_msg(".");
 
+      // each master has its own sequence space
+      if ((src = masterSource(fromName)) < 0) continue;
+
+      // checksum failures are counted, but the packet is not rejected (yet)
+      noteSourcePacket(src, u.checksum == UDPChecksum(&u));
+
       //
       //            if (u.checksum != UDPChecksum(&u))   // Check checksum
       //            {
@@ -254,61 +317,57 @@ void *network_process(void *param1) {
       //
       //            }
       //            else
-      if (u.sequence == 0)  // Zero seqnum means reflect packet to sender
-      {
-        gettimeofday(&tv, &tz);
-        sprintf(logbuffer, "%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)));
-        log_msg("%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)));
-
-        retval = write(logFile, logbuffer, strlen(logbuffer));
-
-      } 
-      else if (u.sequence > seq + 1)  // Skipping sequence number (dropped)
-      {
-        gettimeofday(&tv, &tz);
-        sprintf(logbuffer, "%s Skipped (dropped?) packets %d - %d\n", ctime(&(tv.tv_sec)), seq + 1,
-                u.sequence - 1);
-        ROS_ERROR("%s Skipped (dropped?) packets %d - %d\n", ctime(&(tv.tv_sec)), seq + 1,
-                  u.sequence - 1);
-        retval = write(logFile, logbuffer, strlen(logbuffer));
-        seq = u.sequence;
-
-        // TODO:: should this include a "receiveUserspace" call?
-
-      } 
-      else if (u.sequence == seq)  // Repeated sequence number
-      {
-        gettimeofday(&tv, &tz);
-        sprintf(logbuffer, "%s Duplicated packet %d - %d\n", ctime(&(tv.tv_sec)), seq, u.sequence);
-        ROS_ERROR("%s Duplicated packet %d - %d\n", ctime(&(tv.tv_sec)), seq, u.sequence);
-        retval = write(logFile, logbuffer, strlen(logbuffer));
-
-      }
-
-      else if (u.sequence > seq)  // Valid packet
-      {
-        seq = u.sequence;
-        receiveUserspace(&u, uSize);  // coordinates transform from ITP frame to robot 0 frame
-      }
-
-      // TODO: reset sequence should not be 'else if'  (maybe?)
-      else if (seq > 1000 &&
-               u.sequence < seq - 1000)  // reset sequence(skipped more than 1000 packets)
-      {
-        gettimeofday(&tv, &tz);
-        sprintf(logbuffer, "%s Sequence numbering reset from %d to %d\n", ctime(&(tv.tv_sec)), seq,
-                u.sequence);
-        log_msg("%s Sequence numbering reset from %d to %d\n", ctime(&(tv.tv_sec)), seq,
-                u.sequence);
-        seq = u.sequence;
-        retval = write(logFile, logbuffer, strlen(logbuffer));
-      } 
-      else 
-      {
-        gettimeofday(&tv, &tz);
-        sprintf(logbuffer, "%s Out of sequence packet %d\n", ctime(&(tv.tv_sec)), seq);
-        ROS_ERROR("%s Out of sequence packet %d\n", ctime(&(tv.tv_sec)), seq);
-        retval = write(logFile, logbuffer, strlen(logbuffer));
+      switch (checkSourceSequence(src, u.sequence, &seq)) {
+        case seq_reflect:  // Zero seqnum means reflect packet to sender
+          gettimeofday(&tv, &tz);
+          sprintf(logbuffer, "%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)));
+          log_msg("%s Zero sequence -> reflect packet\n", ctime(&(tv.tv_sec)));
+
+          retval = write(logFile, logbuffer, strlen(logbuffer));
+          break;
+
+        case seq_skipped:  // Skipping sequence number (dropped)
+          gettimeofday(&tv, &tz);
+          sprintf(logbuffer, "%s %s skipped (dropped?) packets %d - %d\n", ctime(&(tv.tv_sec)),
+                  commandSourceName(src), seq + 1, u.sequence - 1);
+          ROS_ERROR("%s %s skipped (dropped?) packets %d - %d\n", ctime(&(tv.tv_sec)),
+                    commandSourceName(src), seq + 1, u.sequence - 1);
+          retval = write(logFile, logbuffer, strlen(logbuffer));
+
+          // TODO:: should this include a "receiveUserspace" call?
+          break;
+
+        case seq_duplicate:  // Repeated sequence number
+          gettimeofday(&tv, &tz);
+          sprintf(logbuffer, "%s %s duplicated packet %d - %d\n", ctime(&(tv.tv_sec)),
+                  commandSourceName(src), seq, u.sequence);
+          ROS_ERROR("%s %s duplicated packet %d - %d\n", ctime(&(tv.tv_sec)),
+                    commandSourceName(src), seq, u.sequence);
+          retval = write(logFile, logbuffer, strlen(logbuffer));
+          break;
+
+        case seq_valid:  // Valid packet
+          // coordinates transform from ITP frame to robot 0 frame
+          receiveUserspace(&u, uSize, src);
+          break;
+
+        case seq_reset:  // reset sequence(skipped more than 1000 packets)
+          gettimeofday(&tv, &tz);
+          sprintf(logbuffer, "%s %s sequence numbering reset from %d to %d\n",
+                  ctime(&(tv.tv_sec)), commandSourceName(src), seq, u.sequence);
+          log_msg("%s %s sequence numbering reset from %d to %d\n", ctime(&(tv.tv_sec)),
+                  commandSourceName(src), seq, u.sequence);
+          retval = write(logFile, logbuffer, strlen(logbuffer));
+          break;
+
+        case seq_out_of_order:
+          gettimeofday(&tv, &tz);
+          sprintf(logbuffer, "%s %s out of sequence packet %d\n", ctime(&(tv.tv_sec)),
+                  commandSourceName(src), seq);
+          ROS_ERROR("%s %s out of sequence packet %d\n", ctime(&(tv.tv_sec)),
+                    commandSourceName(src), seq);
+          retval = write(logFile, logbuffer, strlen(logbuffer));
+          break;
       }
     }
 
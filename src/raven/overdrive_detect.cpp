@@ -19,16 +19,21 @@
  */
 
 /**
- * \file: overdrive_detect.c
+ * \file overdrive_detect.cpp
  * \author Kenneth Fodero
  * \version 2005
- * \brief  Functions related to checking for motor over heating
+ * \brief  Runtime safety supervisor: motor current, I2t thermal, joint
+ * velocity and workspace limits
  *
  * \ingroup Control
  *
  * 5/06 Modified by Hawkeye King
  */
 
+#include <cmath>
+#include <string>
+#include <vector>
+
 #include "overdrive_detect.h"
 
 extern DOF_type DOF_types[];     // Defined in globals.cpp
@@ -36,91 +41,294 @@ extern int NUM_MECH;             // Defined in rt_process_preempt.cpp
 extern int soft_estopped;        // Defined in rt_process_preempt.cpp
 extern unsigned long int gTime;  // Defined in rt_process_preempt.cpp
 
+/// Supervisor state of one joint
+struct joint_guard {
+  float heat;              // low-passed squared current (A^2)
+  int count[sc_last];      // consecutive cycles over each limit
+  int stage[sc_last];      // highest stage reported since each limit was last clear
+};
+
+static joint_guard guards[MAX_MECH * MAX_DOF_PER_MECH];
+
+static volatile int policy = SAFETY_POLICY;
+static int debounce = SAFETY_DEBOUNCE;
+static float vel_limit[MAX_DOF_PER_MECH] = {3, 3, 0.5, 0, 20, 20, 20, 20};  // 0 = unchecked
+static int check_workspace = TRUE;
+
+static safety_event queue[SAFETY_QUEUE];
+static volatile unsigned int qHead = 0, qTail = 0;
+static volatile unsigned int qDropped = 0;
+
+static volatile u_64 cost_sum = 0, cost_max = 0, cost_cycles = 0;
+
+static safety_stats stats;  // ROS thread only
+static ros::Timer event_timer;
+
+static const char *checkNames[sc_last] = {"instant current", "current", "thermal", "velocity",
+                                          "workspace"};
+static const char *stageNames[ss_last] = {"ok", "warn", "limit", "fault"};
+static const char *policyNames[3] = {"none", "soft", "hard"};
+
+/**
+ * \brief Queues a limit crossing for the ROS thread
+ *
+ * Only a rise in stage is queued, so a limit held for many cycles costs one
+ *event.  Never blocks; the event is dropped when the queue is full.
+ */
+static void postEvent(joint_guard *g, int joint, int check, int stage, float value, float limit) {
+  if (stage <= g->stage[check]) return;
+  g->stage[check] = stage;
+
+  unsigned int next = (qHead + 1) % SAFETY_QUEUE;
+  if (next == qTail) {
+    qDropped++;
+    return;
+  }
+  safety_event *e = &queue[qHead];
+  e->time = gTime;
+  e->joint = joint;
+  e->check = check;
+  e->stage = stage;
+  e->value = value;
+  e->limit = limit;
+  __sync_synchronize();
+  qHead = next;
+}
+
+/**
+ * \brief Counts consecutive cycles over a limit
+ *
+ * \return the number of cycles, 0 (and the stage cleared) when under it
+ */
+static int over(joint_guard *g, int check, int is_over) {
+  if (!is_over) {
+    g->count[check] = 0;
+    g->stage[check] = ss_ok;
+    return 0;
+  }
+  return ++g->count[check];
+}
+
+/**
+ * \brief Stage of a limit that is only reported under SOFT_REGULATION and
+ *e-stops under HARD_REGULATION once it has held for the debounce count
+ */
+static int debouncedStage(int count) {
+  if (policy == HARD_REGULATION && count >= debounce) return ss_fault;
+  return ss_warn;
+}
+
+/**
+ * \brief Runs every check on one joint
+ *
+ * \return TRUE if the joint faulted
+ */
+static int checkJoint(DOF *_joint, int runlevel) {
+  const DOF_type *t = &DOF_types[_joint->type];
+  joint_guard *g = &guards[_joint->type];
+  int dof = _joint->type % MAX_DOF_PER_MECH;
+  int dac_max = t->DAC_max;
+  int fault = FALSE;
+  int n, stage;
+
+  // I2t: heat tracks i^2 with the time constant that lets the motor run
+  // overdrive_time at i_max from cold before reaching i_cont^2
+  float amps = _joint->current_cmd / t->DAC_per_amp;
+  float i_cont2 = t->i_cont * t->i_cont;
+  if (t->overdrive_time > 0 && t->i_max > t->i_cont) {
+    float tau = t->overdrive_time / -log(1 - i_cont2 / (t->i_max * t->i_max));
+    g->heat += (amps * amps - g->heat) * ONE_MS / tau;
+  }
+
+  // Kill current if greater than MAX_INST_DAC.  Probably indicates a
+  // problem.
+  if (over(g, sc_inst_current, abs(_joint->current_cmd) > MAX_INST_DAC)) {
+    postEvent(g, _joint->type, sc_inst_current, ss_fault, _joint->current_cmd, MAX_INST_DAC);
+    _joint->current_cmd = 0;
+    return TRUE;
+  }
+
+  // DAC_max: report, clip, or clip and e-stop after the debounce count
+  n = over(g, sc_current, abs(_joint->current_cmd) > dac_max && runlevel >= RL_INIT);
+  if (n) {
+    stage = policy == NO_REGULATION ? ss_warn : ss_limit;
+    if (policy == HARD_REGULATION && n >= debounce) stage = ss_fault;
+    postEvent(g, _joint->type, sc_current, stage, _joint->current_cmd, dac_max);
+    if (stage == ss_fault) fault = TRUE;
+    if (stage >= ss_limit) _joint->current_cmd = (_joint->current_cmd > 0) ? dac_max : -dac_max;
+  }
+
+  // Thermal: warn near the limit, then derate to i_cont or e-stop
+  if (over(g, sc_thermal, g->heat > SAFETY_THERMAL_WARN * i_cont2)) {
+    stage = ss_warn;
+    if (g->heat >= i_cont2 && policy == SOFT_REGULATION) stage = ss_limit;
+    if (g->heat >= i_cont2 && policy == HARD_REGULATION) stage = ss_fault;
+    postEvent(g, _joint->type, sc_thermal, stage, g->heat, i_cont2);
+    if (stage == ss_fault) fault = TRUE;
+    int i_dac = (int)(t->i_cont * t->DAC_per_amp);
+    if (stage == ss_limit && abs(_joint->current_cmd) > i_dac)
+      _joint->current_cmd = (_joint->current_cmd > 0) ? i_dac : -i_dac;
+  }
+
+  // Velocity
+  n = over(g, sc_velocity,
+           vel_limit[dof] > 0 && fabs(_joint->jvel) > vel_limit[dof] && runlevel >= RL_INIT);
+  if (n) {
+    stage = debouncedStage(n);
+    postEvent(g, _joint->type, sc_velocity, stage, _joint->jvel, vel_limit[dof]);
+    if (stage == ss_fault) fault = TRUE;
+  }
+
+  // Workspace: software joint limits plus a margin, while the pedal is down
+  float margin = dof == Z_INS ? SAFETY_WORKSPACE_LIN : SAFETY_WORKSPACE_ANG;
+  n = over(g, sc_workspace, check_workspace && runlevel == RL_PEDAL_DN &&
+                                (_joint->jpos < t->min_limit - margin ||
+                                 _joint->jpos > t->max_limit + margin));
+  if (n) {
+    stage = debouncedStage(n);
+    postEvent(g, _joint->type, sc_workspace, stage, _joint->jpos,
+          _joint->jpos < t->min_limit ? t->min_limit : t->max_limit);
+    if (stage == ss_fault) fault = TRUE;
+  }
+
+  if (fault) _joint->current_cmd = 0;
+  return fault;
+}
+
 /**
  * \brief detect over current and calculate commanded torque
  * \param device0 pointer to robot_device struct defined in DS0.h
+ * \param runlevel the current runlevel
  *
- * \output TRUE if the instant DAC value is too high
+ * \output TRUE if a joint faulted and the robot should e-stop
  * \output FALSE otherwise
  *
- * This function loops through all active joints to detect current situations
- * that could cause overheating or breakage, it checks joint current_cmd against
- * MAX_INST_DAC that is defined in defines.h
+ * This function loops through every joint of every arm and checks, with
+ * per-joint state:
+ *   - current_cmd against MAX_INST_DAC (always cut and e-stop);
+ *   - current_cmd against the joint's DAC_max;
+ *   - an I2t thermal model built from i_cont, i_max and overdrive_time;
+ *   - joint velocity against /safety_joint_vel;
+ *   - joint position against the software limits while the pedal is down.
+ *
+ * What a crossing does depends on /safety_policy: NO_REGULATION reports it,
+ * SOFT_REGULATION clips the current at DAC_max or the continuous current, and
+ * HARD_REGULATION e-stops once a limit has held for /safety_debounce cycles.
+ * Crossings go to a lock-free queue and are logged by the ROS thread, never
+ * from here.  The work per cycle is the same whatever the outcome; its time is
+ * measured and reported in the diagnostics.
  */
 int overdriveDetect(device *device0, int runlevel) {
-  int i, j;
-  DOF *_joint;
   int ret = FALSE;
-  static int count = 0;
-
-  for (i = 0; i < NUM_MECH; i++)
-    for (j = 0; j < (MAX_DOF_PER_MECH - 1); j++) {
-      _joint = &(device0->mech[i].joint[j]);
-      int _dac_max = DOF_types[_joint->type].DAC_max;
-
-      // Kill current if greater than MAX_INST_DAC.  Probably indicates a
-      // problem.
-      if (abs(_joint->current_cmd) > MAX_INST_DAC) {
-        log_msg("Instant i command too high. Joint type: %d DAC:%d \t tau:%0.3f\n", _joint->type,
-                _joint->current_cmd, _joint->tau_d);
-        _joint->current_cmd = 0;
-        ret = TRUE;
-        count = 0;
-      }
-
-      else if (abs(_joint->current_cmd) > _dac_max && runlevel >= RL_INIT) {
-        if (SAFETY_POLICY == NO_REGULATION)  // print and do nothing
-        {
-          if (gTime % 100 == 0)  // Print out safety message
-          {
-            if (_joint->current_cmd > 0)
-              err_msg("[NO_REG] Joint type %d current high (%d) at DAC:%d\n", _joint->type,
-                      _dac_max, _joint->current_cmd);
-            else
-              err_msg("[NO_REG] Joint type %d current low (%d) at DAC:%d\n", _joint->type,
-                      _dac_max * -1, _joint->current_cmd);
-          }
-          count = 0;
-
-        } else if (SAFETY_POLICY == SOFT_REGULATION)  // print and clip current
-        {
-          if (gTime % 100 == 0)  // Print out safety message
-          {
-            if (_joint->current_cmd > 0)
-              err_msg(
-                  "[SOFT_REG] Joint type %d current clipped high (%d) at "
-                  "DAC:%d\n",
-                  _joint->type, _dac_max, _joint->current_cmd);
-            else
-              err_msg(
-                  "[SOFT_REG] Joint type %d current clipped low (%d) at "
-                  "DAC:%d\n",
-                  _joint->type, _dac_max * -1, _joint->current_cmd);
-          }
-          // Clip current to max_torque or -1*max_torque
-          _joint->current_cmd = (_joint->current_cmd > 0) ? _dac_max : _dac_max * -1;
-          count = 0;
-
-        } else  // SAFETY_POLICY == HARD_REGULATION
-        {
-          if (count > 10) {
-            if (_joint->current_cmd > 0)
-              err_msg(
-                  "[HARD_REG] Joint type %d current Estop high (%d) at "
-                  "DAC:%d\n",
-                  _joint->type, _dac_max, _joint->current_cmd);
-            else
-              err_msg("[HARD_REG] Joint type %d current Estop low (%d) at DAC:%d\n", _joint->type,
-                      _dac_max * -1, _joint->current_cmd);
-
-            _joint->current_cmd = 0;  // Reset current to 0 (and trigger Estop)
-            ret = TRUE;
-            count = 0;
-          }
-          count++;
-        }
-      }
+  u_64 t0 = monotonic_ns();
+
+  for (int i = 0; i < NUM_MECH; i++)
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+      if (j == NO_CONNECTION) continue;
+      if (checkJoint(&(device0->mech[i].joint[j]), runlevel)) ret = TRUE;
+    }
+
+  u_64 dt = monotonic_ns() - t0;
+  cost_sum += dt;
+  cost_cycles++;
+  if (dt > cost_max) cost_max = dt;
+
+  return ret;
+}
+
+/**
+ * \brief Drains the fault event queue, logging each event
+ */
+static void drainEvents(const ros::TimerEvent &) {
+  while (qTail != qHead) {
+    __sync_synchronize();
+    const safety_event &e = queue[qTail];
+    log_msg("Safety [%s]: joint %d %s %s, %.3f (limit %.3f) at %lu", policyNames[stats.policy],
+            e.joint, checkNames[e.check], stageNames[e.stage], e.value, e.limit, e.time);
+    stats.events[e.check]++;
+    if (e.stage == ss_fault) stats.faults++;
+    stats.last = e;
+    __sync_synchronize();  // done with the slot before the RT thread may reuse it
+    qTail = (qTail + 1) % SAFETY_QUEUE;
+  }
+  stats.dropped = qDropped;
+}
+
+/**
+ * \brief Copies the supervisor counters
+ *
+ * Call from the ROS thread.
+ *
+ * \param out  the counters
+ * \return 0
+ */
+int getSafetyStats(safety_stats *out) {
+  *out = stats;
+  u_64 cycles = cost_cycles;
+  out->cost_mean_ns = cycles ? (float)cost_sum / cycles : 0;
+  out->cost_max_ns = cost_max;
+  return 0;
+}
+
+/**
+ * \brief Name of a safety_check
+ */
+const char *safetyCheckName(int check) {
+  return check >= 0 && check < sc_last ? checkNames[check] : "unknown";
+}
+
+/**
+ * \brief Name of a safety_stage
+ */
+const char *safetyStageName(int stage) {
+  return stage >= 0 && stage < ss_last ? stageNames[stage] : "unknown";
+}
+
+/**
+ * \brief Reads the supervisor configuration and starts draining its events
+ *
+ * /safety_policy is none, soft or hard (default SAFETY_POLICY),
+ * /safety_debounce the cycles a limit must hold before a hard e-stop,
+ * /safety_joint_vel the velocity limit of each of the 8 DOFs (0 to skip) and
+ * /safety_workspace turns the workspace check on or off.
+ *
+ * \param n  the ros node handle
+ * \return 0, or -1 if a parameter was not usable
+ */
+int init_overdrive_detect(ros::NodeHandle &n) {
+  std::string name;
+  std::vector<double> vel;
+  bool workspace = true;
+  int ret = 0;
+
+  n.param("/safety_policy", name, std::string(policyNames[SAFETY_POLICY]));
+  n.param("/safety_debounce", debounce, SAFETY_DEBOUNCE);
+  n.param("/safety_workspace", workspace, true);
+
+  int p = -1;
+  for (int i = NO_REGULATION; i <= HARD_REGULATION; i++)
+    if (name == policyNames[i]) p = i;
+  if (p < 0) {
+    log_msg("Unknown safety policy %s, using %s", name.c_str(), policyNames[SAFETY_POLICY]);
+    ret = -1;
+  } else
+    policy = p;
+
+  if (n.getParam("/safety_joint_vel", vel)) {
+    if (vel.size() == MAX_DOF_PER_MECH)
+      for (int j = 0; j < MAX_DOF_PER_MECH; j++) vel_limit[j] = vel[j];
+    else {
+      log_msg("/safety_joint_vel needs %d values, got %d", MAX_DOF_PER_MECH, (int)vel.size());
+      ret = -1;
     }
+  }
+
+  debounce = std::max(debounce, 1);
+  check_workspace = workspace ? TRUE : FALSE;
+  stats.policy = policy;
+  event_timer = n.createTimer(ros::Duration(SAFETY_EVENT_PERIOD), drainEvents);
+  log_msg("Safety policy %s, debounce %d cycles, workspace check %s", policyNames[policy],
+          debounce, check_workspace ? "on" : "off");
 
   return ret;
 }
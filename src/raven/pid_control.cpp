@@ -37,12 +37,24 @@
 /**
  * \brief PD and PI controllers for control
  *
- * \ingroup Control
+ * Every joint has a controller of its own, holding its integrator state, run
+ * by mpos_PD_control() for motor position and jvel_PI_control() for joint
+ * velocity.  Motor position control is PD or PID, with the integral limited
+ * to i_limit (if set) and held while the output saturates the amplifier, plus a
+ * friction feed-forward along the desired motor velocity.
+ *
+ * The gains of all joints form one set, double buffered so they can be
+ * retuned while the robot runs: setJointGains() writes the idle set from a
+ * non-RT thread and the RT thread adopts it in updateControllerGains() at the
+ * start of its next cycle.  The set_joint_gains service does this for one arm
+ * at a time.
  *
- * \todo play with the feed-forward friction term in the PD controller
+ * \ingroup Control
  */
 
 #include <cstdlib>
+#include <cmath>
+#include <raven_2/SetJointGains.h>
 #include "pid_control.h"
 #include "log.h"
 #include "utils.h"
@@ -52,78 +64,102 @@
 extern DOF_type DOF_types[];
 extern unsigned long int gTime;
 
+#define NUM_JOINTS (MAX_MECH * MAX_DOF_PER_MECH)
+
+static joint_controller controllers[NUM_JOINTS];
+
+// Gain sets, [buffer][dof type]; the RT thread uses gainSets[activeGains]
+static joint_gains gainSets[2][NUM_JOINTS];
+static volatile int activeGains = 0;
+static volatile int pendingGains = FALSE;
+
+static ros::ServiceServer gain_service;
+
 /**
- * \brief calculates PD control (or PI) for
+ * \brief Largest torque magnitude the amplifier of a joint can output
+ *
+ * tau_per_amp is negative on joints whose motor turns against the joint, so
+ * only its magnitude counts here.
  */
+static inline float maxJointTorque(int type) {
+  const DOF_type *_dof = &DOF_types[type];
+  if (_dof->DAC_per_amp == 0) return HUGE_VALF;
+  return _dof->DAC_max * fabsf(_dof->tau_per_amp) / fabsf(_dof->DAC_per_amp);
+}
 
-void mpos_PD_control(DOF *joint, int reset_I) {
-  float err = 0.0;
-  float errVel = 0.0;
-  static float errInt[MAX_MECH * MAX_DOF_PER_MECH] = {0};
-  float pTerm = 0.0, vTerm = 0.0, iTerm = 0.0;
-  float friction_feedforward = 0.0;
-
-  float kp = DOF_types[joint->type].KP;
-  float kd = DOF_types[joint->type].KD;
-  float ki = DOF_types[joint->type].KI;
+/**
+ * \brief Friction feed-forward torque for a desired motor velocity
+ */
+static inline float frictionFeedforward(const joint_gains *g, float mvel_d) {
+  float coulomb = mvel_d / fmaxf(fabsf(mvel_d), FRICTION_FF_DEADBAND);
+  return g->fc * coulomb + g->fv * mvel_d;
+}
 
-  /* PD CONTROL LAW */
+/**
+ * \brief calculates PD control (or PID) on motor position
+ *
+ * \param joint    the joint, tau_d receives the torque
+ * \param reset_I  nonzero to clear the integral
+ */
+void mpos_PD_control(DOF *joint, int reset_I) {
+  const joint_gains *g = &gainSets[activeGains][joint->type];
+  joint_controller *c = &controllers[joint->type];
+  float iTerm = 0.0;
 
   // Calculate error
-  err = joint->mpos_d - joint->mpos;
-  errVel = joint->mvel_d - joint->mvel;
-
-  // Calculate position term
-  pTerm = err * kp;
+  float err = joint->mpos_d - joint->mpos;
+  float errVel = joint->mvel_d - joint->mvel;
 
-  // Calculate velocity term
-  vTerm = errVel * kd;
+  // Position and velocity terms, feed-forward friction
+  float tau = err * g->kp + errVel * g->kd + frictionFeedforward(g, joint->mvel_d);
 
-  // Calculate integral
-  if (reset_I)
-    errInt[joint->type] = 0;
-  else
-    errInt[joint->type] += err * ONE_MS;
+  if (g->law == ctrl_pid && g->ki != 0) {
+    // Keep the integral torque across a change of ki
+    if (c->ki != g->ki) {
+      c->pos_int = (c->ki != 0) ? c->pos_int * c->ki / g->ki : 0;
+      c->ki = g->ki;
+    }
 
-  // Calculate integral term
-  iTerm = errInt[joint->type] * ki;
+    if (reset_I) {
+      c->pos_int = 0;
+    } else {
+      // Hold the integral while the output saturates in the direction of the error
+      float pos_int = c->pos_int + err * ONE_MS;
+      float out = tau + g->ki * pos_int;
+      if (fabsf(out) < maxJointTorque(joint->type) || out * err < 0) c->pos_int = pos_int;
+    }
 
-  // Calculate feedforward friction term
-  //    errSign = err < 0 ? -1 : 1;
-  //    if (fabs(err) >= eps) {
-  //        friction_feedforward = errSign * friction_comp_torque[joint->type];
-  //    }
-  //    else {
-  //        friction_feedforward = err * friction_comp_torque[joint->type] /
-  //        eps;
-  //    }
+    if (g->i_limit > 0) {
+      float int_max = g->i_limit / fabsf(g->ki);
+      if (c->pos_int > int_max)
+        c->pos_int = int_max;
+      else if (c->pos_int < -int_max)
+        c->pos_int = -int_max;
+    }
+    iTerm = g->ki * c->pos_int;
+  } else {
+    c->pos_int = 0;
+  }
 
   // Finally place torque
-  joint->tau_d = pTerm + vTerm + iTerm + friction_feedforward;
+  joint->tau_d = tau + iTerm;
 }
 
 /**
 *    jointVelControl()
 *       Move joints at constant rate.
+*
+*    Tool joints are controlled on motor velocity, the others on joint velocity.
+*
+*    \return the integral of the velocity error
 */
 float jvel_PI_control(DOF *_joint, int resetI) {
-  // Set gains.  Gains have been "empirically" tuned.
-  // TODO: move this to a permanent place.
-  float ki;
-  float kv[MAX_MECH * MAX_DOF_PER_MECH] = {0};
-  kv[SHOULDER_GOLD] = kv[SHOULDER_GREEN] = (0.528 / (15 DEG2RAD));
-  kv[ELBOW_GOLD] = kv[ELBOW_GREEN] = (0.528 / (15 DEG2RAD));
-  kv[Z_INS_GOLD] = kv[Z_INS_GREEN] = (0.400 / 0.1);
-  kv[TOOL_ROT_GOLD] = kv[TOOL_ROT_GREEN] = (0.005 / (15 DEG2RAD));
-  kv[WRIST_GOLD] = kv[WRIST_GREEN] = 0;
-  kv[GRASP1_GOLD] = kv[GRASP1_GREEN] = 0;
-  kv[GRASP2_GOLD] = kv[GRASP2_GREEN] = 0;
-
-  static float jVelIntErr[MAX_MECH * MAX_DOF_PER_MECH];  // Integral of velocity error
+  const joint_gains *g = &gainSets[activeGains][_joint->type];
+  joint_controller *c = &controllers[_joint->type];
 
   // Reset integral term
   if (resetI) {
-    jVelIntErr[_joint->type] = 0;
+    c->vel_int = 0;
     return 0;
   }
   float jVelErr;
@@ -135,11 +171,170 @@ float jvel_PI_control(DOF *_joint, int resetI) {
     jVelErr = _joint->jvel_d - _joint->jvel;
 
   // Integrate error over 1ms
-  jVelIntErr[_joint->type] += jVelErr * ONE_MS;
-  ki = kv[_joint->type] * 0.1 * 0;
+  c->vel_int += jVelErr * ONE_MS;
 
   // Calculate PI velocity control
-  _joint->tau_d = (kv[_joint->type] * jVelErr + ki * jVelIntErr[_joint->type]);
+  _joint->tau_d = (g->kv * jVelErr + g->kvi * c->vel_int);
+
+  return c->vel_int;
+}
+
+/**
+ * \return the gravity compensation torque of a joint, scaled by its gain
+ */
+float gravityFeedforward(DOF *joint) {
+  return gainSets[activeGains][joint->type].kg * joint->tau_g;
+}
+
+/**
+ * \brief Adopts gains published by setJointGains() since the last cycle
+ *
+ * Called by the RT thread at the start of each cycle, before any controller
+ * runs.
+ */
+void updateControllerGains() {
+  if (!pendingGains) return;
+
+  activeGains = !activeGains;
+  __sync_synchronize();
+  pendingGains = FALSE;
+}
+
+/**
+ * \brief Publishes new gains for all joints
+ *
+ * The set is written to the idle buffer and adopted by the RT thread at the
+ * start of its next cycle.  Single writer only.
+ *
+ * \param gains  gains of every dof type
+ * \return 0 on success, -1 if the previous set has not been adopted yet
+ */
+int setJointGains(const joint_gains gains[NUM_JOINTS]) {
+  if (pendingGains) return -1;
 
-  return jVelIntErr[_joint->type];
+  joint_gains *idle = gainSets[!activeGains];
+  for (int i = 0; i < NUM_JOINTS; i++) idle[i] = gains[i];
+  __sync_synchronize();
+  pendingGains = TRUE;
+
+  return 0;
+}
+
+/**
+ * \brief Copies the gains in use, or the ones about to be adopted
+ */
+void getJointGains(joint_gains gains[NUM_JOINTS]) {
+  const joint_gains *set = gainSets[pendingGains ? !activeGains : activeGains];
+  for (int i = 0; i < NUM_JOINTS; i++) gains[i] = set[i];
+}
+
+/**
+ * \brief Default gains of a dof type, zero position gains
+ *
+ * The velocity gains have been "empirically" tuned.
+ */
+void defaultJointGains(int dof_type, joint_gains *gains) {
+  const float kv[MAX_DOF_PER_MECH] = {
+      (0.528 / (15 DEG2RAD)), (0.528 / (15 DEG2RAD)), (0.400 / 0.1), 0, (0.005 / (15 DEG2RAD)),
+      0, 0, 0};
+
+  gains->law = ctrl_pd;
+  gains->kp = gains->kd = gains->ki = 0;
+  gains->i_limit = 0;
+  gains->fc = gains->fv = 0;
+  gains->kg = 1;
+  gains->kv = kv[dof_type % MAX_DOF_PER_MECH];
+  gains->kvi = 0;
+}
+
+/**
+ * \return the printable name of a control law
+ */
+const char *controlLawName(int law) {
+  switch (law) {
+    case ctrl_pd:
+      return "PD";
+    case ctrl_pid:
+      return "PID";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * \brief Copies the values of a service field into one arm of a gain set
+ *
+ * \return FALSE if the field has neither zero nor MAX_DOF_PER_MECH values
+ */
+template <class T>
+static int copyGainField(const std::vector<T> &in, joint_gains *arm, float joint_gains::*field) {
+  if (in.empty()) return TRUE;
+  if (in.size() != MAX_DOF_PER_MECH) return FALSE;
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) arm[j].*field = in[j];
+  return TRUE;
+}
+
+/**
+ * \brief set_joint_gains service, retunes the joint controllers of one arm
+ */
+static bool setGainsCallback(raven_2::SetJointGainsRequest &req,
+                             raven_2::SetJointGainsResponse &res) {
+  joint_gains gains[NUM_JOINTS];
+  getJointGains(gains);
+
+  int arm;
+  if (req.arm == "gold")
+    arm = 0;
+  else if (req.arm == "green")
+    arm = 1;
+  else {
+    res.success = false;
+    res.message = "arm must be gold or green";
+    return true;
+  }
+  joint_gains *g = &gains[arm * MAX_DOF_PER_MECH];
+
+  int ok = TRUE;
+  if (!req.law.empty()) {
+    ok = (req.law.size() == MAX_DOF_PER_MECH);
+    for (int j = 0; ok && j < MAX_DOF_PER_MECH; j++) {
+      if (req.law[j] < 0 || req.law[j] >= ctrl_last_law) ok = FALSE;
+      g[j].law = req.law[j];
+    }
+  }
+  ok = ok && copyGainField(req.kp, g, &joint_gains::kp);
+  ok = ok && copyGainField(req.kd, g, &joint_gains::kd);
+  ok = ok && copyGainField(req.ki, g, &joint_gains::ki);
+  ok = ok && copyGainField(req.i_limit, g, &joint_gains::i_limit);
+  ok = ok && copyGainField(req.friction_coulomb, g, &joint_gains::fc);
+  ok = ok && copyGainField(req.friction_viscous, g, &joint_gains::fv);
+  ok = ok && copyGainField(req.gravity, g, &joint_gains::kg);
+  ok = ok && copyGainField(req.kv, g, &joint_gains::kv);
+  ok = ok && copyGainField(req.kvi, g, &joint_gains::kvi);
+  if (!ok) {
+    res.success = false;
+    res.message = "each field needs 0 or 8 values, laws 0 (PD) or 1 (PID)";
+    return true;
+  }
+
+  if (setJointGains(gains) < 0) {
+    res.success = false;
+    res.message = "previous gains not taken up yet, try again";
+    return true;
+  }
+
+  log_msg("New %s arm gains set", req.arm.c_str());
+  res.success = true;
+  return true;
+}
+
+/**
+ * \brief Advertises the set_joint_gains service
+ *
+ * \param n  the ros node handle
+ * \return 0
+ */
+int init_gain_service(ros::NodeHandle &n) {
+  gain_service = n.advertiseService("set_joint_gains", setGainsCallback);
+  return 0;
 }
@@ -36,6 +36,7 @@
 #include <ros/ros.h>
 
 #include "r2_kinematics.h"
+#include "resolved_rate.h"
 #include "log.h"
 #include "local_io.h"
 #include "defines.h"
@@ -68,14 +69,42 @@ double ds[2][6] = {{0, 0, V, d4, 0, 0}, {0, 0, V, d4, 0, 0}};
 double robot_thetas[2][6] = {{V, V, M_PI / 2, V, V, V}, {V, V, -M_PI / 2, V, V, V}};
 
 int printIK = 0;
+
+// Link transforms ^i_{i+1}T from the last r2_fwd_kin, one set per mechanism
+static tf::Transform fk_links[MAX_MECH][6];
+
+// Branch of the analytic IK solution chosen last cycle, one per mechanism
+struct ik_branch_cache {
+  int valid;
+  int branch;
+  ik_branch_stats st;
+};
+static ik_branch_cache branch_cache[MAX_MECH];
+
+// The cached branch is kept while its squared distance from the current
+// joints is below IK_BRANCH_TOL and it is away from where branches meet
+const static double IK_BRANCH_TOL = 0.01;
+const static double IK_BRANCH_SIN2 = 0.1;    // |sin theta2|
+const static double IK_BRANCH_INS = 3 * Lw;  // m, insertion distance from the RCM
+
 void print_btVector(tf::Vector3 vv);
 int check_solutions(double *in_thetas, ik_solution *iksol, int &out_idx, double &out_err);
+static double solutionDistance(const double *in_thetas, ik_solution &io_sol, int &io_rollover);
 int apply_joint_limits(double *Js, double *Js_sat);
 
 //--------------------------------------------------------------------------------
 //  Calculate a transform between two links
 //--------------------------------------------------------------------------------
 
+/// Link transform from one row of a modified DH table
+static tf::Transform dhTransform(double alpha, double a, double theta, double d) {
+  double st = sin(theta), ct = cos(theta);
+  double sa = sin(alpha), ca = cos(alpha);
+
+  return tf::Transform(tf::Matrix3x3(ct, -st, 0, st * ca, ct * ca, -sa, st * sa, ct * sa, ca),
+                       tf::Vector3(a, -sa * d, ca * d));
+}
+
 /**\fn tf::Transform getFKTransform (int a, int b)
  * \brief Retrieve the forward kinematics transform from a to b, i.e., ^a_bT
  * \param a - an integer value, starting link frame id
@@ -89,18 +118,7 @@ tf::Transform getFKTransform(int a, int b) {
     ROS_ERROR("Invalid start/end indices.");
   }
 
-  double xx = cos(dh_theta[a]), xy = -sin(dh_theta[a]), xz = 0;
-  double yx = sin(dh_theta[a]) * cos(dh_alpha[a]), yy = cos(dh_theta[a]) * cos(dh_alpha[a]),
-         yz = -sin(dh_alpha[a]);
-  double zx = sin(dh_theta[a]) * sin(dh_alpha[a]), zy = cos(dh_theta[a]) * sin(dh_alpha[a]),
-         zz = cos(dh_alpha[a]);
-
-  double px = dh_a[a];
-  double py = -sin(dh_alpha[a]) * dh_d[a];
-  double pz = cos(dh_alpha[a]) * dh_d[a];
-
-  xf.setBasis(tf::Matrix3x3(xx, xy, xz, yx, yy, yz, zx, zy, zz));
-  xf.setOrigin(tf::Vector3(px, py, pz));
+  xf = getLinkTransform(a);
 
   // recursively find transforms for following links
   if (b > a + 1) xf *= getFKTransform(a + 1, b);
@@ -108,6 +126,68 @@ tf::Transform getFKTransform(int a, int b) {
   return xf;
 }
 
+/**\fn tf::Transform getLinkTransform(int a)
+ * \brief Retrieve the transform across a single link, i.e., ^a_{a+1}T, from the
+ * currently selected DH table
+ * \param a - an integer value, link frame id
+ * \return a tf::Transform object transforms link a to link a+1
+ *  \ingroup Kinematics
+ */
+tf::Transform getLinkTransform(int a) {
+  return dhTransform(dh_alpha[a], dh_a[a], dh_theta[a], dh_d[a]);
+}
+
+/**\fn void getLinkTransforms(const double in_thetas[6], l_r in_arm, tf::Transform out_links[6])
+ * \brief Computes all six link transforms ^i_{i+1}T of an arm from DH thetas.
+ * Unlike fwd_kin() this does not touch the shared DH tables, so it is safe to
+ * call outside the RT thread.
+ * \param in_thetas - DH joint values (see joint2theta())
+ * \param in_arm - Arm type, left / right
+ * \param out_links - receives the six link transforms
+ *  \ingroup Kinematics
+ */
+void getLinkTransforms(const double in_thetas[6], l_r in_arm, tf::Transform out_links[6]) {
+  for (int i = 0; i < 6; i++) {
+    double theta = (i == 2) ? robot_thetas[in_arm][i] : in_thetas[i];
+    double d = (i == 2) ? in_thetas[i] : ds[in_arm][i];
+    out_links[i] = dhTransform(alphas[in_arm][i], aas[in_arm][i], theta, d);
+  }
+}
+
+/**\fn void getJacobian(const tf::Transform in_links[6], double out_J[6][6])
+ * \brief Geometric Jacobian of an arm in frame 0, from its link transforms
+ *
+ * Column i maps the rate of DH joint i (theta, or d for the prismatic joint 2)
+ * to the linear (rows 0-2, m/s) and angular (rows 3-5, rad/s) velocity of the
+ * end effector frame.  The joint angles differ from the DH thetas by constant
+ * offsets only, so it applies to joint rates as well.
+ * \param in_links - the six link transforms ^i_{i+1}T, e.g. from getFKLinks()
+ * \param out_J - receives the Jacobian
+ *  \ingroup Kinematics
+ */
+void getJacobian(const tf::Transform in_links[6], double out_J[6][6]) {
+  tf::Transform frames[6];
+  tf::Transform xf;
+
+  // ^0_{i+1}T, whose z axis is the axis of joint i
+  xf.setIdentity();
+  for (int i = 0; i < 6; i++) {
+    xf *= in_links[i];
+    frames[i] = xf;
+  }
+  tf::Vector3 p_e = xf.getOrigin();
+
+  for (int i = 0; i < 6; i++) {
+    tf::Vector3 z = frames[i].getBasis().getColumn(2);
+    tf::Vector3 v = (i == 2) ? z : z.cross(p_e - frames[i].getOrigin());
+    tf::Vector3 w = (i == 2) ? tf::Vector3(0, 0, 0) : z;
+    for (int r = 0; r < 3; r++) {
+      out_J[r][i] = v[r];
+      out_J[r + 3][i] = w[r];
+    }
+  }
+}
+
 //--------------------------------------------------------------------------------
 //  Forward kinematics
 //--------------------------------------------------------------------------------
@@ -144,8 +224,8 @@ int r2_fwd_kin(device *d0, int runlevel) {
     double lo_thetas[6];
     joint2theta(lo_thetas, joints, arm);
 
-    /// execute FK
-    fwd_kin(lo_thetas, arm, xf);
+    /// execute FK, keeping the link transforms for the dynamics
+    fwd_kin(lo_thetas, arm, xf, fk_links[m]);
 
     d0->mech[m].pos.x = xf.getOrigin()[0] * (1000.0 * 1000.0);
     d0->mech[m].pos.y = xf.getOrigin()[1] * (1000.0 * 1000.0);
@@ -186,10 +266,11 @@ int r2_fwd_kin(device *d0, int runlevel) {
  * \param in_arm - Arm type, left / right ( kin.armtype arm = left/right)
  * \param out_xform - a reference of tf::Transform object represents the forward
  * kinematic transfrom from zero frame to endeffector frame of one arm
+ * \param out_links - if not NULL, receives the six link transforms ^i_{i+1}T
  * \return: 0 on success, -1 on failure
  *  \ingroup Kinematics
  */
-int fwd_kin(double in_j[6], l_r in_arm, tf::Transform &out_xform) {
+int fwd_kin(double in_j[6], l_r in_arm, tf::Transform &out_xform, tf::Transform *out_links) {
   dh_alpha = alphas[in_arm];
   dh_theta = robot_thetas[in_arm];
   dh_a = aas[in_arm];
@@ -202,7 +283,15 @@ int fwd_kin(double in_j[6], l_r in_arm, tf::Transform &out_xform) {
       dh_theta[i] = in_j[i];  // *M_PI/180;
   }
 
-  out_xform = getFKTransform(0, 6);
+  if (out_links) {
+    out_xform.setIdentity();
+    for (int i = 0; i < 6; i++) {
+      out_links[i] = getLinkTransform(i);
+      out_xform *= out_links[i];
+    }
+  } else {
+    out_xform = getFKTransform(0, 6);
+  }
 
   // rotate to match "tilted" base
   /*
@@ -297,10 +386,84 @@ int getATransform(mechanism &in_mch, tf::Transform &out_xform, int frameA, int f
   return 0;
 }
 
+/**\fn const tf::Transform *getFKLinks(int m)
+ * \brief Link transforms ^i_{i+1}T, i = 0..5, of mechanism m as computed by the
+ * last r2_fwd_kin() call, so later stages of the control cycle need not redo FK
+ * \param m - mechanism index in the device
+ * \return pointer to six transforms, valid until the next r2_fwd_kin()
+ *  \ingroup Kinematics
+ */
+const tf::Transform *getFKLinks(int m) { return fk_links[m]; }
+
 //-------------------------------------------------------------------------------
 //  Inverse kinematics
 //-------------------------------------------------------------------------------
 
+/**\fn static int solveAnalyticIK(int m, const tf::Transform &in_xf, l_r in_arm,
+ * double *in_thetas, ik_solution iksol[8], int &out_idx)
+ * \brief analytic inverse kinematics of one arm, trying last cycle's branch first
+ *
+ * The chosen branch rarely changes from one cycle to the next, so only that
+ * branch is solved while it stays close to the current joints and away from
+ * the configurations where branches meet (theta2 at 0 or pi, or the wrist at
+ * the remote center).  Otherwise all eight are solved and check_solutions()
+ * picks one, which counts as a fallback.
+ * \param m - index of the mechanism in the device
+ * \param in_xf - the desired end effector pose
+ * \param in_arm - Arm type, left / right
+ * \param in_thetas - the current DH joint values
+ * \param iksol - receives the solutions
+ * \param out_idx - receives the index of the chosen solution
+ * \return as check_solutions()
+ *  \ingroup Kinematics
+ */
+static int solveAnalyticIK(int m, const tf::Transform &in_xf, l_r in_arm, double *in_thetas,
+                           ik_solution iksol[8], int &out_idx) {
+  ik_branch_cache &c = branch_cache[m];
+  double sol_err;
+
+  c.st.solves++;
+  if (c.valid && !printIK) {
+    ik_solution &sol = iksol[c.branch];
+    int rollover = 0;
+    if (inv_kin(in_xf, in_arm, iksol, 1 << c.branch) == 0 && sol.invalid != ik_invalid &&
+        fabs(sin(sol.th2)) > IK_BRANCH_SIN2 && fabs(sol.d3 + d4) > IK_BRANCH_INS &&
+        solutionDistance(in_thetas, sol, rollover) < IK_BRANCH_TOL) {
+      out_idx = c.branch;
+      return rollover;
+    }
+    c.st.fallbacks++;
+  }
+
+  int ret = inv_kin(in_xf, in_arm, iksol);
+  if (ret < 0) log_msg("ik failed gracefully (arm%d ret:%d", in_arm, ret);
+
+  // Check solutions - compare IK solutions to current joint angles...
+  int check_result = check_solutions(in_thetas, iksol, out_idx, sol_err);
+  if (check_result < 0) {
+    c.valid = FALSE;
+    return check_result;
+  }
+  if (c.valid && out_idx != c.branch) c.st.switches++;
+  c.branch = out_idx;
+  c.valid = TRUE;
+
+  return check_result;
+}
+
+/**\fn int getIKBranchStats(int m, ik_branch_stats *out)
+ * \brief copies the branch selection counters of one mechanism
+ * \param m - index of the mechanism in the device
+ * \param out - receives the counters
+ * \return 0 on success, -1 for an unknown mechanism
+ *  \ingroup Kinematics
+ */
+int getIKBranchStats(int m, ik_branch_stats *out) {
+  if (m < 0 || m >= MAX_MECH) return -1;
+  *out = branch_cache[m].st;
+  return 0;
+}
+
 /**\fn int r2_inv_kin(device *d0, int runlevel)
  * \brief run the ravenII inverse kinematics from device struct
  * \param d0  - a pointer points to robot_device struct
@@ -313,6 +476,7 @@ int r2_inv_kin(device *d0, int runlevel) {
   tf::Transform xf;
   orientation *ori_d;
   position *pos_d;
+  int method = updateIKMethod();
 
   //  Do FK for each mechanism
   for (int m = 0; m < NUM_MECH; m++) {
@@ -353,12 +517,7 @@ int r2_inv_kin(device *d0, int runlevel) {
                             xf = zrot_r.inverse() * xf;
                     }
     */
-    //		DO IK
-    ik_solution iksol[8] = {{}, {}, {}, {}, {}, {}, {}, {}};
-    int ret = inv_kin(xf, arm, iksol);
-    if (ret < 0) log_msg("ik failed gracefully (arm%d ret:%d", arm, ret);
-
-    // Check solutions - compare IK solutions to current joint angles...
+    // current joint angles, to pick the IK solution closest to them
     double wrist2 =
         (d0->mech[m].joint[GRASP2].jpos - d0->mech[m].joint[GRASP1].jpos) / 2.0;  // grep "
     double joints[6] = {d0->mech[m].joint[SHOULDER].jpos, d0->mech[m].joint[ELBOW].jpos,
@@ -369,12 +528,20 @@ int r2_inv_kin(device *d0, int runlevel) {
     double lo_thetas[6];
 
     joint2theta(lo_thetas, joints, arm);  // this is the one that's wrong
+
+    //		DO IK
+    ik_solution iksol[8] = {{}, {}, {}, {}, {}, {}, {}, {}};
+    ik_solution sol;
     int sol_idx = 0;
-    double sol_err;
-    int check_result = 0;
-    if ((check_result = check_solutions(lo_thetas, iksol, sol_idx, sol_err)) < 0) {
-      //			cout << "IK failed\n";
-      return -1;
+
+    if (method == ik_resolved_rate) {
+      if (resolvedRateIK(m, arm, xf, lo_thetas, runlevel, sol) < 0) return -1;
+    } else {
+      if (solveAnalyticIK(m, xf, arm, lo_thetas, iksol, sol_idx) < 0) {
+        //			cout << "IK failed\n";
+        return -1;
+      }
+      sol = iksol[sol_idx];
     }
 
     double Js[6];
@@ -382,7 +549,7 @@ int r2_inv_kin(device *d0, int runlevel) {
     double thetas_sat[6];
     tf::Transform xf_sat;
     double gangle = double(d0->mech[m].ori_d.grasp) / 1000.0;
-    theta2joint(iksol[sol_idx], Js);
+    theta2joint(sol, Js);
 
     // check joint limits for saturating
     int limited = apply_joint_limits(Js, Js_sat);
@@ -409,16 +576,24 @@ int r2_inv_kin(device *d0, int runlevel) {
     d0->mech[m].joint[GRASP1].jpos_d = -Js[5] + gangle / 2;
     d0->mech[m].joint[GRASP2].jpos_d = Js[5] + gangle / 2;
 
+    if (method == ik_resolved_rate) {
+      Js_sat[5] = Js[5];
+      resolvedRateCommit(m, arm, Js_sat);
+    }
+
     if (printIK != 0)  // && d0->mech[m].type == GREEN_ARM_SERIAL )
     {
-      log_msg("All IK solutions for mechanism %d.  Chosen solution:%d:", m, sol_idx);
+      if (method == ik_resolved_rate)
+        log_msg("Resolved-rate IK for mechanism %d:", m);
+      else
+        log_msg("All IK solutions for mechanism %d.  Chosen solution:%d:", m, sol_idx);
       log_msg(
           "Current     :\t( %3f,\t %3f,\t %3f,\t %3f,\t %3f,\t %3f (\t "
           "%3f/\t %3f))",
           joints[0] * r2d, joints[1] * r2d, joints[2], joints[3] * r2d, joints[4] * r2d,
           joints[5] * r2d, d0->mech[m].joint[GRASP1].jpos * r2d,
           d0->mech[m].joint[GRASP2].jpos * r2d);
-      for (int i = 0; i < 8; i++) {
+      for (int i = 0; i < 8 && method == ik_analytic; i++) {
         theta2joint(iksol[i], Js);
         log_msg("ik_joints[%d]:\t( %3f,\t %3f,\t %3f,\t %3f,\t %3f,\t %3f)", i, Js[0] * r2d,
                 Js[1] * r2d, Js[2], Js[3] * r2d, Js[4] * r2d, Js[5] * r2d);
@@ -431,7 +606,8 @@ int r2_inv_kin(device *d0, int runlevel) {
   return 0;
 }
 
-/**\fn  inv_kin(tf::Transform in_T06, l_r in_arm, ik_solution iksol[8])
+/**\fn  inv_kin(tf::Transform in_T06, l_r in_arm, ik_solution iksol[8], unsigned int
+ * in_branches)
  * \brief Runs the Raven II INVERSE kinematics to determine end effector
  *position.
  *
@@ -446,12 +622,15 @@ int r2_inv_kin(device *d0, int runlevel) {
  * \param ik_solution iksol[8] - The 8 solutions:  8 element array of joint
  *angles ( float j[] = {shoulder, elbow, vacant joint, ins,roll, wrist, grasp1,
  *grasp2} )
+ * \param in_branches - bit mask of the solutions to compute, the others are
+ *left invalid
  * \return 0 - success, -1 - bad arm, -2 - too close to RCM.
  * \question  why __attribute__ optimize?
  * \ingroup Kinematics
  */
 
-int __attribute__((optimize("0"))) inv_kin(tf::Transform in_T06, l_r in_arm, ik_solution iksol[8]) {
+int __attribute__((optimize("0")))
+inv_kin(tf::Transform in_T06, l_r in_arm, ik_solution iksol[8], unsigned int in_branches) {
   dh_theta = robot_thetas[in_arm];
   dh_d = ds[in_arm];
   dh_alpha = alphas[in_arm];
@@ -463,7 +642,10 @@ int __attribute__((optimize("0"))) inv_kin(tf::Transform in_T06, l_r in_arm, ik_
     return -1;
   }
 
-  for (int i = 0; i < 8; i++) iksol[i].arm = in_arm;
+  for (int i = 0; i < 8; i++) {
+    iksol[i].arm = in_arm;
+    if (!(in_branches & (1 << i))) iksol[i].invalid = ik_invalid;
+  }
 
   //  Step 1, Compute P5
   tf::Transform T60 = in_T06.inverse();
@@ -478,6 +660,7 @@ int __attribute__((optimize("0"))) inv_kin(tf::Transform in_T06, l_r in_arm, ik_
 
   //  Step 2, compute displacement of prismatic joint d3
   for (int i = 0; i < 2; i++) {
+    if (!(in_branches & (0xf << (4 * i)))) continue;
     double insertion = 0;
     insertion += p05[4 * i].length();  // Two step process avoids compiler
                                        // optimization problem. (Yeah, right. It
@@ -497,6 +680,7 @@ int __attribute__((optimize("0"))) inv_kin(tf::Transform in_T06, l_r in_arm, ik_
   //  Step 3, calculate theta 2
   for (int i = 0; i < 8; i += 2)  // p05 solutions
   {
+    if (!(in_branches & (3 << i))) continue;
     double z0p5 = p05[i][2];
 
     double d = iksol[i].d3 + d4;
@@ -724,6 +908,33 @@ int apply_joint_limits(double *Js, double *Js_sat) {
   return limited;
 }
 
+/**\fn static double solutionDistance(const double *in_thetas, ik_solution &io_sol,
+ * int &io_rollover)
+ * \brief squared distance of an inverse kinematics solution from the current joints
+ * \param in_thetas - the current DH joint values
+ * \param io_sol - the solution, its tool roll is unrolled to the side of the current one
+ * \param io_rollover - set to 1 if the tool roll was unrolled
+ * \return the sum of squared errors, insertion weighted by 100/m
+ *  \ingroup Kinematics
+ */
+static double solutionDistance(const double *in_thetas, ik_solution &io_sol, int &io_rollover) {
+  // check for rollover on tool roll
+  if (fabs(in_thetas[3] - io_sol.th4) > 300 * d2r) {
+    io_rollover = 1;
+    if (in_thetas[3] > io_sol.th4)
+      io_sol.th4 += 2 * M_PI;
+    else
+      io_sol.th4 -= 2 * M_PI;
+  }
+
+  const double err[6] = {in_thetas[0] - io_sol.th1,        in_thetas[1] - io_sol.th2,
+                         100 * (in_thetas[2] - io_sol.d3), in_thetas[3] - io_sol.th4,
+                         in_thetas[4] - io_sol.th5,        in_thetas[5] - io_sol.th6};
+  double s2err = 0;
+  for (int i = 0; i < 6; i++) s2err += err[i] * err[i];
+  return s2err;
+}
+
 /**\fn int check_solutions(double *in_thetas, ik_solution * iksol, int &out_idx,
  * double &out_err)
  * \brief check the inverse kinematic solutions
@@ -747,22 +958,7 @@ int check_solutions(double *in_thetas, ik_solution *iksol, int &out_idx, double
       continue;
     }
 
-    // check for rollover on tool roll
-    if (fabs(in_thetas[3] - iksol[i].th4) > 300 * d2r) {
-      rollover = 1;
-      if (in_thetas[3] > iksol[i].th4)
-        iksol[i].th4 += 2 * M_PI;
-      else
-        iksol[i].th4 -= 2 * M_PI;
-    }
-
-    double s2err = 0;
-    s2err += pow(in_thetas[0] - iksol[i].th1, 2);
-    s2err += pow(in_thetas[1] - iksol[i].th2, 2);
-    s2err += pow(100 * (in_thetas[2] - iksol[i].d3), 2);
-    s2err += pow(in_thetas[3] - iksol[i].th4, 2);
-    s2err += pow(in_thetas[4] - iksol[i].th5, 2);
-    s2err += pow(in_thetas[5] - iksol[i].th6, 2);
+    double s2err = solutionDistance(in_thetas, iksol[i], rollover);
     if (s2err < minerr) {
       minerr = s2err;
       minidx = i;
@@ -0,0 +1,388 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file resolved_rate.cpp
+ *
+ * \brief Resolved-rate (damped least squares) inverse kinematics
+ *
+ * The analytic inverse kinematics solves all eight branches of an arm every
+ * cycle and keeps the one closest to the current joints.  In teleoperation
+ * the desired pose moves by a small increment per cycle, and a step
+ *
+ *     dq = J^T (J J^T + lambda^2 I)^-1 dx
+ *
+ * from the last commanded joints reaches it at a fraction of the cost.  dx is
+ * the error between the desired pose and the forward kinematics of the last
+ * command (position over IK_RR_LENGTH, rotation as axis times angle) and J
+ * the geometric Jacobian of getJacobian(), scaled the same way.  Because the
+ * error is taken from the pose rather than accumulated from increments, the
+ * solution does not drift.
+ *
+ * Near a singularity, where the manipulability sqrt(det(J J^T)) of the scaled
+ * Jacobian falls below w0, the step is damped with lambda = lambda0 (1 - w / w0)
+ * instead of flipping branch.  The default w0 is reached with the wrist about
+ * 2 cm from the remote center, where the analytic solution gives out.  Away
+ * from singularities the analytic solver re-anchors the solution every anchor
+ * period, and whenever a step leaves a residual above IK_RR_TOL_POS /
+ * IK_RR_TOL_ROT, e.g. after a jump of the master.  While the pedal is up each
+ * cycle starts from the measured joints.
+ *
+ * The method comes from /ik_method ("analytic" or "resolved_rate") and can be
+ * changed from the console.  /ik_anchor_period (cycles), /ik_manipulability
+ * (w0) and /ik_damping (lambda0) tune it.  With /ik_benchmark set, a startup
+ * benchmark logs the cost and accuracy of both methods on small steps from
+ * random poses.
+ *
+ * \ingroup Kinematics
+ */
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "resolved_rate.h"
+#include "defines.h"
+#include "struct.h"
+#include "log.h"
+#include "utils.h"
+
+typedef Eigen::Matrix<double, 6, 1> vec6;
+typedef Eigen::Matrix<double, 6, 6> mat6;
+
+int check_solutions(double *in_thetas, ik_solution *iksol, int &out_idx, double &out_err);
+
+static const char *methodNames[ik_last_method] = {"analytic", "resolved_rate"};
+
+// Residual at which the steps of one cycle stop early
+const static double CONVERGED_POS = 1.0e-7;  // m
+const static double CONVERGED_ROT = 1.0e-6;  // rad
+
+/// Resolved-rate state of one mechanism
+struct rr_state {
+  int valid;         // thetas holds the last command
+  int since_anchor;  // cycles since the last analytic solution
+  double thetas[6];  // DH joint values of the last command
+};
+
+static rr_state state[MAX_MECH];
+static volatile int requested = ik_analytic;
+static int active = ik_analytic;
+static int anchor_period = IK_RR_ANCHOR_PERIOD;
+static double w0 = IK_RR_MANIPULABILITY;
+static double lambda0 = IK_RR_DAMPING;
+
+/**
+ * \brief Scaled pose error from an end effector pose to the desired one
+ */
+static void poseError(const tf::Transform &in_xf_d, const tf::Transform &in_xf, vec6 &out_e) {
+  Eigen::Matrix3d R, R_d;
+
+  for (int r = 0; r < 3; r++) {
+    out_e[r] = (in_xf_d.getOrigin()[r] - in_xf.getOrigin()[r]) / IK_RR_LENGTH;
+    for (int c = 0; c < 3; c++) {
+      R(r, c) = in_xf.getBasis()[r][c];
+      R_d(r, c) = in_xf_d.getBasis()[r][c];
+    }
+  }
+  Eigen::AngleAxisd rot_err(R_d * R.transpose());
+  out_e.tail<3>() = rot_err.angle() * rot_err.axis();
+}
+
+/**
+ * \brief Damped least squares steps towards a pose
+ *
+ * \param arm        left or right DH table
+ * \param in_xf      the desired end effector pose in frame 0
+ * \param io_thetas  DH joint values to start from, receives the result
+ * \param out_err    receives the remaining position (m) and rotation (rad) error
+ * \return TRUE if a step was damped, i.e. the arm is near a singularity
+ */
+static int dlsSolve(l_r arm, const tf::Transform &in_xf, double io_thetas[6], double out_err[2]) {
+  tf::Transform links[6];
+  tf::Transform xf;
+  double Jd[6][6];
+  mat6 J;
+  vec6 e;
+  int damped = FALSE;
+
+  for (int it = 0;; it++) {
+    getLinkTransforms(io_thetas, arm, links);
+    xf.setIdentity();
+    for (int i = 0; i < 6; i++) xf *= links[i];
+    poseError(in_xf, xf, e);
+    out_err[0] = e.head<3>().norm() * IK_RR_LENGTH;
+    out_err[1] = e.tail<3>().norm();
+    if (it == IK_RR_ITERATIONS || (out_err[0] < CONVERGED_POS && out_err[1] < CONVERGED_ROT))
+      break;
+
+    getJacobian(links, Jd);
+    for (int r = 0; r < 6; r++)
+      for (int c = 0; c < 6; c++) J(r, c) = (r < 3) ? Jd[r][c] / IK_RR_LENGTH : Jd[r][c];
+
+    // det(J J^T) is the product of the LDLT pivots
+    mat6 A = J * J.transpose();
+    Eigen::LDLT<mat6> ldlt(A);
+    double w = sqrt(fabs(ldlt.vectorD().prod()));
+    if (w < w0) {
+      double lambda = lambda0 * (1 - w / w0);
+      A.diagonal().array() += lambda * lambda;
+      ldlt.compute(A);
+      damped = TRUE;
+    }
+    vec6 dq = J.transpose() * ldlt.solve(e);
+    for (int i = 0; i < 6; i++) io_thetas[i] += dq[i];
+  }
+
+  return damped;
+}
+
+/**
+ * \brief Resolved-rate inverse kinematics of one arm
+ *
+ * \param m          index of the mechanism in the device
+ * \param arm        left or right DH table
+ * \param in_xf      the desired end effector pose in frame 0
+ * \param in_thetas  DH joint values of the current joint positions
+ * \param runlevel   the current runlevel
+ * \param out_sol    receives the solution
+ * \return 0 on success, 1 if re-anchored to the analytic solution, -1 if the
+ * residual is too large and the analytic solver fails as well
+ * \ingroup Kinematics
+ */
+int resolvedRateIK(int m, l_r arm, const tf::Transform &in_xf, double *in_thetas, int runlevel,
+                   ik_solution &out_sol) {
+  rr_state &st = state[m];
+  const double *seed = (st.valid && runlevel == RL_PEDAL_DN) ? st.thetas : in_thetas;
+  double q[6];
+  double err[2];
+  int ret = 0;
+
+  for (int i = 0; i < 6; i++) q[i] = seed[i];
+  int damped = dlsSolve(arm, in_xf, q, err);
+  int stalled = err[0] > IK_RR_TOL_POS || err[1] > IK_RR_TOL_ROT;
+
+  // next to a singularity the analytic branch could flip, the damped steps carry on there
+  if (!damped && (++st.since_anchor >= anchor_period || stalled)) {
+    ik_solution iksol[8] = {{}, {}, {}, {}, {}, {}, {}, {}};
+    int idx = 0;
+    double sol_err;
+    inv_kin(in_xf, arm, iksol);
+    if (check_solutions(in_thetas, iksol, idx, sol_err) >= 0) {
+      q[0] = iksol[idx].th1;
+      q[1] = iksol[idx].th2;
+      q[2] = iksol[idx].d3;
+      q[3] = iksol[idx].th4;
+      q[4] = iksol[idx].th5;
+      q[5] = iksol[idx].th6;
+      st.since_anchor = 0;
+      ret = 1;
+    } else if (stalled) {
+      return -1;
+    }
+  }
+
+  out_sol = ik_zerosol;
+  out_sol.arm = arm;
+  out_sol.th1 = q[0];
+  out_sol.th2 = q[1];
+  out_sol.d3 = q[2];
+  out_sol.th4 = q[3];
+  out_sol.th5 = q[4];
+  out_sol.th6 = q[5];
+
+  return ret;
+}
+
+/**
+ * \brief Keeps the joints commanded after the joint limits as the next start
+ *
+ * \param m          index of the mechanism in the device
+ * \param arm        left or right DH table
+ * \param in_joints  the commanded joint positions
+ * \ingroup Kinematics
+ */
+void resolvedRateCommit(int m, l_r arm, double *in_joints) {
+  joint2theta(state[m].thetas, in_joints, arm);
+  state[m].valid = TRUE;
+}
+
+/**
+ * \brief Applies a method chosen from the console, called by the RT thread
+ *
+ * \return the ik_method to use this cycle
+ * \ingroup Kinematics
+ */
+int updateIKMethod() {
+  if (active != requested) {
+    active = requested;
+    for (int m = 0; m < MAX_MECH; m++) {
+      state[m].valid = FALSE;
+      state[m].since_anchor = 0;
+    }
+  }
+  return active;
+}
+
+/**
+ * \brief Selects the inverse kinematics from the next cycle on
+ *
+ * \param method  an ik_method
+ * \return 0 on success, -1 for an unknown method
+ */
+int setIKMethod(int method) {
+  if (method < 0 || method >= ik_last_method) return -1;
+  requested = method;
+  return 0;
+}
+
+/**
+ * \return the selected ik_method
+ */
+int getIKMethod() { return requested; }
+
+/**
+ * \return the name of an ik_method, or "unknown"
+ */
+const char *ikMethodName(int method) {
+  return (method >= 0 && method < ik_last_method) ? methodNames[method] : "unknown";
+}
+
+/**
+ * \brief Pose error of DH joint values, for the benchmark
+ */
+static void solutionError(const double in_thetas[6], const tf::Transform &in_xf, double &io_pos,
+                          double &io_rot) {
+  tf::Transform links[6];
+  tf::Transform xf;
+  vec6 e;
+
+  getLinkTransforms(in_thetas, dh_left, links);
+  xf.setIdentity();
+  for (int i = 0; i < 6; i++) xf *= links[i];
+  poseError(in_xf, xf, e);
+  io_pos = fmax(io_pos, e.head<3>().norm() * IK_RR_LENGTH);
+  io_rot = fmax(io_rot, e.tail<3>().norm());
+}
+
+/**
+ * \brief Times both methods on a teleoperation-sized step from random poses
+ */
+static void benchmark() {
+  // the tool beyond the RCM, where the analytic solution exists
+  const double lo[6] = {SHOULDER_MIN_LIMIT, ELBOW_MIN_LIMIT, -d4 + 3 * Lw, -M_PI / 2, -1, -0.5};
+  const double hi[6] = {SHOULDER_MAX_LIMIT, ELBOW_MAX_LIMIT, Z_INS_MAX_LIMIT, M_PI / 2, 1, 0.5};
+  const double step[6] = {1e-3, 1e-3, 1e-4, 1e-3, 1e-3, 1e-3};  // rad and m per cycle
+  std::vector<tf::Transform> goals(IK_RR_BENCH);
+  std::vector<double> start(6 * IK_RR_BENCH);
+  std::vector<double> analytic_q(6 * IK_RR_BENCH);
+  std::vector<double> rr_q(6 * IK_RR_BENCH);
+  std::vector<int> failed(IK_RR_BENCH, FALSE);
+  unsigned int seed = 1;
+
+  for (int s = 0; s < IK_RR_BENCH; s++) {
+    double joints[6], thetas[6];
+    tf::Transform links[6];
+    for (int k = 0; k < 6; k++) joints[k] = lo[k] + (hi[k] - lo[k]) * rand_r(&seed) / RAND_MAX;
+    joint2theta(&start[6 * s], joints, dh_left);
+    for (int k = 0; k < 6; k++)
+      thetas[k] = start[6 * s + k] + step[k] * (2.0 * rand_r(&seed) / RAND_MAX - 1);
+    getLinkTransforms(thetas, dh_left, links);
+    goals[s].setIdentity();
+    for (int i = 0; i < 6; i++) goals[s] *= links[i];
+  }
+
+  u_64 t0 = monotonic_ns();
+  for (int s = 0; s < IK_RR_BENCH; s++) {
+    ik_solution iksol[8] = {{}, {}, {}, {}, {}, {}, {}, {}};
+    int idx = 0;
+    double sol_err;
+    double *q = &analytic_q[6 * s];
+    inv_kin(goals[s], dh_left, iksol);
+    if (check_solutions(&start[6 * s], iksol, idx, sol_err) < 0) {
+      failed[s] = TRUE;
+      continue;
+    }
+    q[0] = iksol[idx].th1;
+    q[1] = iksol[idx].th2;
+    q[2] = iksol[idx].d3;
+    q[3] = iksol[idx].th4;
+    q[4] = iksol[idx].th5;
+    q[5] = iksol[idx].th6;
+  }
+  u_64 t1 = monotonic_ns();
+  for (int s = 0; s < IK_RR_BENCH; s++) {
+    double err[2];
+    for (int k = 0; k < 6; k++) rr_q[6 * s + k] = start[6 * s + k];
+    dlsSolve(dh_left, goals[s], &rr_q[6 * s], err);
+  }
+  u_64 t2 = monotonic_ns();
+
+  double analytic_pos = 0, analytic_rot = 0, rr_pos = 0, rr_rot = 0;
+  int failures = 0;
+  for (int s = 0; s < IK_RR_BENCH; s++) {
+    solutionError(&rr_q[6 * s], goals[s], rr_pos, rr_rot);
+    if (failed[s])
+      failures++;
+    else
+      solutionError(&analytic_q[6 * s], goals[s], analytic_pos, analytic_rot);
+  }
+
+  double analytic = (double)(t1 - t0) / IK_RR_BENCH;
+  double rr = (double)(t2 - t1) / IK_RR_BENCH;
+  log_msg("Resolved-rate IK: %.0f ns per arm vs %.0f ns analytic (%.1fx)", rr, analytic,
+          analytic / rr);
+  log_msg("Resolved-rate IK: max error %.2g um %.2g mrad vs %.2g um %.2g mrad analytic (%d failed)",
+          rr_pos * 1e6, rr_rot * 1e3, analytic_pos * 1e6, analytic_rot * 1e3, failures);
+}
+
+/**
+ * \brief Reads the inverse kinematics method and tuning, and runs the benchmark
+ * if /ik_benchmark is set (default off)
+ *
+ * \param n  the ros node handle
+ * \return 0 on success, -1 if the parameter names an unknown method
+ * \ingroup ROS
+ */
+int init_resolved_rate(ros::NodeHandle &n) {
+  std::string name;
+  bool bench;
+  int method = -1;
+
+  n.param("/ik_method", name, std::string(methodNames[ik_analytic]));
+  n.param("/ik_anchor_period", anchor_period, IK_RR_ANCHOR_PERIOD);
+  n.param("/ik_manipulability", w0, IK_RR_MANIPULABILITY);
+  n.param("/ik_damping", lambda0, IK_RR_DAMPING);
+  n.param("/ik_benchmark", bench, false);
+
+  if (bench) benchmark();
+
+  for (int i = 0; i < ik_last_method; i++)
+    if (name == methodNames[i]) method = i;
+  if (method < 0) {
+    log_msg("Unknown inverse kinematics %s, using analytic", name.c_str());
+    return -1;
+  }
+  setIKMethod(method);
+  log_msg("Inverse kinematics: %s", name.c_str());
+
+  return 0;
+}
@@ -64,6 +64,21 @@
 #include "r2_kinematics.h"
 #include "network_layer.h"
 #include "reconfigure.h"
+#include "grav_comp.h"
+#include "grav_ident.h"
+#include "gravity_lut.h"
+#include "gravity_input.h"
+#include "encoder_check.h"
+#include "joint_fusion.h"
+#include "coupling_matrix.h"
+#include "pid_control.h"
+#include "impedance.h"
+#include "resolved_rate.h"
+#include "trajectory.h"
+#include "trajectory_plan.h"
+#include "homing.h"
+#include "homing_cache.h"
+#include "homing_record.h"
 
 using namespace std;
 
@@ -236,6 +251,9 @@ static void *rt_process(void *) {
       std::cout << "bzlup" << loops << "0us time:" << (double)t2.tv_sec + (double)t2.tv_nsec / SEC
                 << std::endl;
 
+    // Soft e-stop on persistent encoder faults
+    if (checkEncoderFaults(currParams.runlevel)) soft_estopped = TRUE;
+
     // Run Safety State Machine
     stateMachine(&device0, &currParams, &rcvdParams);
 
@@ -314,6 +332,22 @@ int init_ros(int argc, char **argv) {
   //    rosrt::init();
   init_ravenstate_publishing(n);
   init_ravengains(n, &device0);
+  init_gain_service(n);
+  init_estimators(n);
+  init_joint_fusion(n);
+  init_cable_coupling(n);
+  init_impedance(n);
+  init_resolved_rate(n);
+  init_trajectory(n);
+  init_trajectory_plan(n);
+  init_homing(n);
+  init_homing_cache(n);
+  init_homing_record(n);
+  init_overdrive_detect(n);
+  init_dynamics(n);
+  init_gravity_lut(n);
+  init_gravity_ident(n);
+  init_gravity_input(n);
 
   return 0;
 }
@@ -357,6 +391,7 @@ int main(int argc, char **argv) {
   USBShutdown();
   // Suspend main until all threads terminate
   pthread_join(rt_thread, NULL);
+  saveHomingCache(&device0);
   pthread_join(console_thread, NULL);
   pthread_join(net_thread, NULL);
 
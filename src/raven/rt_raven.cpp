@@ -45,6 +45,8 @@
 #include "state_estimate.h"
 #include "pid_control.h"
 #include "grav_comp.h"
+#include "grav_ident.h"
+#include "joint_fusion.h"
 #include "t_to_DAC_val.h"
 #include "fwd_cable_coupling.h"
 #include "trajectory.h"
@@ -52,6 +54,8 @@
 #include "local_io.h"
 #include "update_device_state.h"
 #include "r2_jacobian.h"
+#include "impedance.h"
+#include "trajectory_plan.h"
 
 extern int NUM_MECH;                       // Defined in rt_process_preempt.cpp
 extern unsigned long int gTime;            // Defined in rt_process_preempt.cpp
@@ -59,6 +63,8 @@ extern DOF_type DOF_types[];               // Defined in DOF_type.h
 extern t_controlmode newRobotControlMode;  // Defined in .h
 
 int raven_cartesian_space_command(device *device0, param_pass *currParams);
+int raven_cartesian_impedance(device *device0, param_pass *currParams);
+int raven_trajectory_control(device *device0, param_pass *currParams);
 int raven_joint_velocity_control(device *device0, param_pass *currParams);
 int raven_motor_position_control(device *device0, param_pass *currParams);
 int raven_homing(device *device0, param_pass *currParams, int begin_homing = 0);
@@ -108,6 +114,9 @@ int controlRaven(device *device0, param_pass *currParams) {
   // Initialization code
   initRobotData(device0, currParams->runlevel, currParams);
 
+  // Adopt controller gains published since the last cycle
+  updateControllerGains();
+
   // Compute Mpos & Velocities
   stateEstimate(device0);
 
@@ -119,6 +128,9 @@ int controlRaven(device *device0, param_pass *currParams) {
     fwdJointEncoders(device0);
   }
 
+  // Fuse motor and joint encoders into jpos/jvel of the positioning joints
+  fuseJointEncoders(device0);
+
   // Forward kinematics
   r2_fwd_kin(device0, currParams->runlevel);
 
@@ -139,7 +151,7 @@ int controlRaven(device *device0, param_pass *currParams) {
       getGravityTorque(*device0, *currParams);
 
       while (loop_over_joints(device0, _mech, _joint, i, j))
-        _joint->tau_d = _joint->tau_g;  // Add gravity torque
+        _joint->tau_d = gravityFeedforward(_joint);  // Add gravity torque
 
       TorqueToDAC(device0);
 
@@ -149,6 +161,14 @@ int controlRaven(device *device0, param_pass *currParams) {
     case cartesian_space_control:
       ret = raven_cartesian_space_command(device0, currParams);
       break;
+    // Cartesian impedance control, a task-space spring and damper through J^T
+    case cartesian_impedance_control:
+      ret = raven_cartesian_impedance(device0, currParams);
+      break;
+    // Plays the paths queued by the trajectory planner
+    case trajectory_control:
+      ret = raven_trajectory_control(device0, currParams);
+      break;
     // Motor PD control runs PD control on motor position
     case motor_pd_control:
       initialized = false;
@@ -169,8 +189,7 @@ int controlRaven(device *device0, param_pass *currParams) {
       initialized = false;
       // initialized = robot_ready(device0) ? true:false;
       ret = raven_homing(device0, currParams);
-      set_posd_to_pos(device0);
-      updateMasterRelativeOrigin(device0);
+      updateMasterRelativeOrigin(device0, set_posd_to_pos(device0));
 
       if (robot_ready(device0)) {
         currParams->robotControlMode = cartesian_space_control;
@@ -206,6 +225,8 @@ int controlRaven(device *device0, param_pass *currParams) {
 *  	\brief  This function runs pd_control on motor position.
 *
 *	\desc This function:
+*  		0. in pedal down, calls update_absolute_pose_trajectory() to step
+*absolute pose commands
 *  		1. calls the r2_inv_kin() to calculate the inverse kinematics
 *  		2. call the invCableCoupling() to calculate the inverse cable
 *coupling
@@ -231,8 +252,10 @@ int raven_cartesian_space_command(device *device0, param_pass *currParams) {
   if (currParams->runlevel < RL_PEDAL_UP) {
     return -1;
   } else if (currParams->runlevel < RL_PEDAL_DN) {
-    set_posd_to_pos(device0);
-    updateMasterRelativeOrigin(device0);
+    updateMasterRelativeOrigin(device0, set_posd_to_pos(device0));
+  } else {
+    // Step any absolute pose commands toward their targets
+    update_absolute_pose_trajectory(device0, currParams);
   }
 
   // Inverse kinematics
@@ -257,7 +280,139 @@ int raven_cartesian_space_command(device *device0, param_pass *currParams) {
   _mech = NULL;
   _joint = NULL;
   while (loop_over_joints(device0, _mech, _joint, i, j)) {
-    _joint->tau_d += _joint->tau_g;  // Add gravity torque
+    _joint->tau_d += gravityFeedforward(_joint);  // Add gravity torque
+  }
+
+  // Feed the online gravity identification
+  sampleGravityIdent(device0, currParams);
+
+  TorqueToDAC(device0);
+
+  return 0;
+}
+
+/**
+*	\fn int raven_cartesian_impedance(device *device0, param_pass
+**currParams)
+*
+*  	\brief  This function runs cartesian impedance control.
+*
+*	\desc This function:
+*  		0. in pedal down, calls update_absolute_pose_trajectory() to step
+*absolute pose commands
+*  		1. calls getGravityTorque() to calulate gravity torques on each
+*joints.
+*  		2. in pedal down, calls impedanceTorques() for the torques of a
+*task-space spring and damper toward pos_d / ori_d, no inverse kinematics runs
+*  		3. holds the joint and motor set points at the current pose, so
+*switching to a position mode starts without a jump
+*  		4. calls TorqueToDAC() to apply write torque value's on DAC
+*
+*  	\param device0 robot_device struct defined in DS0.h
+*  	\param currParams param_pass struct defined in DS1.h
+*
+*  	\return 0 when torque is applied to DAC
+*		   -1 if Pedal is up and
+*
+*	\ingroup Control
+*/
+int raven_cartesian_impedance(device *device0, param_pass *currParams) {
+  if (currParams->runlevel < RL_PEDAL_UP) {
+    return -1;
+  } else if (currParams->runlevel < RL_PEDAL_DN) {
+    updateMasterRelativeOrigin(device0, set_posd_to_pos(device0));
+  } else {
+    // Step any absolute pose commands toward their targets
+    update_absolute_pose_trajectory(device0, currParams);
+  }
+
+  // Gravity compensation calculation
+  getGravityTorque(*device0, *currParams);
+
+  for (int m = 0; m < NUM_MECH; m++) {
+    mechanism *_mech = &(device0->mech[m]);
+    float tau[MAX_DOF_PER_MECH] = {0};
+
+    if (currParams->runlevel == RL_PEDAL_DN) {
+      impedanceTorques(_mech, m, tau);
+    }
+
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+      DOF *_joint = &(_mech->joint[j]);
+      _joint->jpos_d = _joint->jpos;
+      _joint->mpos_d = _joint->mpos;
+      _joint->tau_d = tau[j] + gravityFeedforward(_joint);  // Add gravity torque
+    }
+  }
+
+  // Feed the online gravity identification
+  sampleGravityIdent(device0, currParams);
+
+  TorqueToDAC(device0);
+
+  return 0;
+}
+
+/**
+*	\fn int raven_trajectory_control(device *device0, param_pass
+**currParams)
+*
+*  	\brief  This function plays the queued joint and Cartesian paths.
+*
+*	\desc This function:
+*  		0. calls trajUpdate() to step the queued paths, which hold their
+*command while idle and are dropped outside pedal down
+*  		1. calls the r2_inv_kin() to calculate the inverse kinematics,
+*then trajApply() to set the joints of arms on a joint path
+*  		2. call the invCableCoupling() to calculate the inverse cable
+*coupling
+*  		3. set all the joints to zero if pedal is not down otherwise it
+*calls mpos_PD_control() to run the PD control law
+*  		4. calls getGravityTorque() to calulate gravity torques on each
+*joints.
+*  		5. calls TorqueToDAC() to apply write torque value's on DAC
+*
+*  	\param device0 robot_device struct defined in DS0.h
+*  	\param currParams param_pass struct defined in DS1.h
+*
+*  	\return 0 when torque is applied to DAC
+*		   -1 if Pedal is up and
+*
+*	\ingroup Control
+*/
+int raven_trajectory_control(device *device0, param_pass *currParams) {
+  DOF *_joint = NULL;
+  mechanism *_mech = NULL;
+  int i = 0, j = 0;
+
+  trajUpdate(device0, currParams->runlevel);
+
+  if (currParams->runlevel < RL_PEDAL_UP) {
+    return -1;
+  } else if (currParams->runlevel < RL_PEDAL_DN) {
+    updateMasterRelativeOrigin(device0, set_posd_to_pos(device0));
+  }
+
+  // Inverse kinematics
+  r2_inv_kin(device0, currParams->runlevel);
+  trajApply(device0);
+
+  // Inverse Cable Coupling
+  invCableCoupling(device0, currParams->runlevel);
+
+  while (loop_over_joints(device0, _mech, _joint, i, j)) {
+    if (currParams->runlevel != RL_PEDAL_DN)
+      _joint->tau_d = 0;
+    else
+      mpos_PD_control(_joint);
+  }
+
+  // Gravity compensation calculation
+  getGravityTorque(*device0, *currParams);
+  _mech = NULL;
+  _joint = NULL;
+  while (loop_over_joints(device0, _mech, _joint, i, j)) {
+    _joint->tau_d += gravityFeedforward(_joint);  // Add gravity torque
   }
 
   TorqueToDAC(device0);
@@ -291,11 +446,9 @@ int raven_cartesian_space_command(device *device0, param_pass *currParams) {
 int raven_sinusoidal_joint_motion(device *device0, param_pass *currParams) {
   static int controlStart = 0;
   static unsigned long int delay = 0;
-  const float f_period[8] = {6, 7, 10, 9999999, 10, 5, 10, 6};
-  //    const float f_magnitude[8] = {0 DEG2RAD, 0 DEG2RAD, 0.0, 9999999, 0
-  //    DEG2RAD, 25 DEG2RAD, 0 DEG2RAD, 0 DEG2RAD};
-  const float f_magnitude[8] = {10 DEG2RAD, 10 DEG2RAD, 0.02,       9999999,
-                                30 DEG2RAD, 30 DEG2RAD, 30 DEG2RAD, 30 DEG2RAD};
+  float f_period[MAX_DOF_PER_MECH], f_magnitude[MAX_DOF_PER_MECH];
+
+  getSinusoidParams(f_period, f_magnitude);
 
   /// checking pedal down??
   // If we're not in pedal down or init.init then do nothing.
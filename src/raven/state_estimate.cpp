@@ -28,314 +28,326 @@
  *
  */
 
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
 #include "state_estimate.h"
 #include "log.h"
 
 extern DOF_type DOF_types[];
 extern int NUM_MECH;
 
-void getStateLPF(DOF *joint);
+static void estimateJointState(DOF *joint, float motorPos);
 
-/*
- * stateEstimate()
- */
+// 3rd order Butterworth coefficients
+//  50 HZ:  B = {0.0029, 0.0087, 0.0087, 0.0029}
+//          A = {1.0000, 2.3741, -1.9294, 0.5321}
+//  75 Hz:  B = {0.00859, 0.0258, 0.0258, 0.00859}
+//          A = {1.0000, 2.0651, -1.52, 0.3861}
+//  20 Hz:  B = {0.0002196, 0.0006588, 0.0006588, 0.0002196}
+//          A = {1.0000, 2.7488, -2.5282, 0.7776}
+//  120 Hz:
+const static float BW_B[] = {0.02864, 0.08591, 0.08591, 0.02864};
+const static float BW_A[] = {1.0000, 1.5189, -0.9600, 0.2120};
 
-void stateEstimate(robot_device *device0) {
-  DOF *_joint;
-  int i, j;
+// Kalman filter model: white noise acceleration, encoder quantization noise
+#define KF_ACCEL_NOISE 500.0  // rad/s^2, std dev of the motor acceleration per step
+#define KF_ENC_NOISE ((2.0 * PI / ENC_CNTS_PER_REV) / sqrt(12.0))  // rad
 
-  // Loop through all joints
-  for (i = 0; i < NUM_MECH; i++) {
-    for (j = 0; j < MAX_DOF_PER_MECH; j++) {
-      _joint = &(device0->mech[i].joint[j]);
+// Levant differentiator: Lipschitz bound of the motor velocity and the usual
+// first order gains
+#define LEVANT_L 500.0  // rad/s^2
+#define LEVANT_LAMBDA0 1.1
+#define LEVANT_LAMBDA1 1.5
 
-      //            if (_joint->type == TOOL_ROT_GOLD || _joint->type ==
-      //            TOOL_ROT_GOLD)
-      //                encToMPos(_joint);
-      //            else
-      getStateLPF(_joint, device0->mech[i].tool_type);
-    }
+static const char *estimatorNames[est_last_type] = {"raw", "butterworth", "kalman", "levant"};
+
+// Per-cycle estimator state, kept apart from the DOF_types configuration
+static mech_estimator mech_est[MAX_MECH];
+
+/**
+ * \return the estimator of a DOF type (arm * MAX_DOF_PER_MECH + dof)
+ */
+static inline joint_estimator *jointEstimator(int type) {
+  return &mech_est[type / MAX_DOF_PER_MECH].joint[type % MAX_DOF_PER_MECH];
+}
+
+/**
+ * \return the DOF_types arm index of a mechanism
+ */
+static inline int mechArm(mechanism *mech) { return mech->type == GOLD_ARM ? 0 : 1; }
+
+/**
+ * \brief Steady-state Kalman gains of the constant velocity model
+ *
+ * For the discrete white noise acceleration model the steady-state Kalman
+ * filter is an alpha-beta filter whose gains follow from the tracking index
+ * (Kalata 1984).
+ */
+static void kalmanGains(float *alpha, float *beta) {
+  static float a = -1, b;
+
+  if (a < 0) {
+    double lambda = KF_ACCEL_NOISE * STEP_PERIOD * STEP_PERIOD / KF_ENC_NOISE;
+    double r = (4 + lambda - sqrt(8 * lambda + lambda * lambda)) / 4;
+    a = 1 - r * r;
+    b = 2 * (2 - a) - 4 * sqrt(1 - a);
   }
+  *alpha = a;
+  *beta = b;
 }
 
-/*
- * filterPosition()
+/**
+ * \brief Initializes an estimator to a position and velocity
  *
- *  Apply an LPF to the motor position to eliminate
- * high frequency content in the control loop.  The HF
- * will drive the cable transmission unstable.
+ * \param e    the estimator
+ * \param pos  motor position (rad)
+ * \param vel  motor velocity (rad/s)
+ */
+void initEstimator(joint_estimator *e, float pos, float vel) {
+  for (int i = 0; i < EST_HISTORY; i++) e->in[i] = e->out[i] = pos;
+  e->head = 0;
+  e->x[0] = e->pos = pos;
+  e->x[1] = e->vel = vel;
+  e->ready = TRUE;
+}
+
+/**
+ * \brief Runs an estimator on a new motor position
+ *
+ * Switches estimator first if one was requested, starting the new one from the
+ * current estimate so the switch is bumpless.  The estimator only touches its
+ * own state, so several may run side by side on the same measurement.
  *
+ * \param e         the estimator, receives pos and vel
+ * \param motorPos  measured motor position (rad)
  */
-void getStateLPF(DOF *joint, int tool_type) {
-  // 50 HZ 3rd order butterworth
-  //    float B[] = {0.0029,  0.0087,  0.0087,  0.0029};
-  //    float A[] = {1.0000,  2.3741, -1.9294,  0.5321};
-  // 75 Hz 3rd order butterworth
-  //    float B[] = {0.00859,  0.0258,  0.0258,  0.00859};
-  //    float A[] = {1.0000,   2.0651, -1.52,  0.3861};
-  //  20 Hz 3rd order butterworth
-  //    float B[] = {0.0002196,  0.0006588,  0.0006588,  0.0002196};
-  //    float A[] = {1.0000,   2.7488, -2.5282,  0.7776};
-  //  120 Hz 3rd order butterworth
-  float B[] = {0.02864, 0.08591, 0.08591, 0.02864};
-  float A[] = {1.0000, 1.5189, -0.9600, 0.2120};
-  //    float B[] = {1.0, 0,0,0};
-  //    float A[] = {0,0,0,0};
-
-  float *oldPos = DOF_types[joint->type].old_mpos;
-  float *oldFiltPos = DOF_types[joint->type].old_filtered_mpos;
-  float filtPos = 0;
-  float f_enc_val = joint->enc_val;
-
-//#ifdef RAVEN_II
-//    if ( (joint->type == SHOULDER_GOLD) ||
-//         (joint->type == ELBOW_GOLD) ||
-//         (joint->type == Z_INS_GOLD)
-//         ||
-//#ifndef RAVEN_II_SQUARE
-//         (joint->type == TOOL_ROT_GOLD) ||
-//         (joint->type == WRIST_GOLD) ||
-//         (joint->type == GRASP1_GOLD) ||
-//         (joint->type == GRASP2_GOLD)
-//#endif
-//         ||
-//         (joint->type == TOOL_ROT_GREEN) ||
-//         (joint->type == WRIST_GREEN) ||
-//         (joint->type == GRASP1_GREEN) ||
-//         (joint->type == GRASP2_GREEN)
-//         )
-//         f_enc_val *= -1;
-//#endif
-
-#ifdef RAVEN_II
-  switch (tool_type) {
-    case RII_square_type:
-      if ((joint->type == SHOULDER_GOLD) || (joint->type == ELBOW_GOLD) ||
-          (joint->type == Z_INS_GOLD) || (joint->type == TOOL_ROT_GREEN) ||
-          (joint->type == WRIST_GREEN) || (joint->type == GRASP1_GREEN) ||
-          (joint->type == GRASP2_GREEN))
-        f_enc_val *= -1;
+void runEstimator(joint_estimator *e, float motorPos) {
+  if (e->requested != e->type) {
+    int type = e->requested;
+    if (type >= 0 && type < est_last_type) {
+      e->type = type;
+      if (e->ready) initEstimator(e, e->pos, e->vel);
+    } else {
+      e->requested = e->type;
+    }
+  }
+  if (!e->ready) initEstimator(e, motorPos, 0);
+
+  const int h0 = e->head, h1 = (h0 - 1) & (EST_HISTORY - 1), h2 = (h0 - 2) & (EST_HISTORY - 1);
+  const int next = (h0 + 1) & (EST_HISTORY - 1);
+
+  switch (e->type) {
+    case est_butterworth: {
+      float filtPos = BW_B[0] * motorPos + BW_B[1] * e->in[h0] + BW_B[2] * e->in[h1] +
+                      BW_B[3] * e->in[h2] + BW_A[1] * e->out[h0] + BW_A[2] * e->out[h1] +
+                      BW_A[3] * e->out[h2];
+      e->vel = (filtPos - e->out[h0]) / STEP_PERIOD;
+      e->pos = filtPos;
       break;
+    }
 
-    case dv_adapter:
-      if ((joint->type == SHOULDER_GOLD) || (joint->type == ELBOW_GOLD) ||
-          (joint->type == Z_INS_GOLD))
-        f_enc_val *= -1;
+    case est_kalman: {
+      float alpha, beta;
+      kalmanGains(&alpha, &beta);
+      float pred = e->x[0] + e->x[1] * STEP_PERIOD;
+      float resid = motorPos - pred;
+      e->x[0] = pred + alpha * resid;
+      e->x[1] += beta / STEP_PERIOD * resid;
+      e->pos = e->x[0];
+      e->vel = e->x[1];
       break;
+    }
 
+    case est_levant: {
+      float err = e->x[0] - motorPos;
+      float sgn = (err > 0) - (err < 0);
+      float v = -LEVANT_LAMBDA1 * sqrt(LEVANT_L * fabs(err)) * sgn + e->x[1];
+      e->x[0] += v * STEP_PERIOD;
+      e->x[1] += -LEVANT_LAMBDA0 * LEVANT_L * sgn * STEP_PERIOD;
+      e->pos = e->x[0];
+      e->vel = e->x[1];
+      break;
+    }
+
+    case est_raw:
     default:
-      if ((joint->type == SHOULDER_GOLD) || (joint->type == ELBOW_GOLD) ||
-          (joint->type == Z_INS_GOLD) || (joint->type == TOOL_ROT_GOLD) ||
-          (joint->type == WRIST_GOLD) || (joint->type == GRASP1_GOLD) ||
-          (joint->type == GRASP2_GOLD) || (joint->type == TOOL_ROT_GREEN) ||
-          (joint->type == WRIST_GREEN) || (joint->type == GRASP1_GREEN) ||
-          (joint->type == GRASP2_GREEN))
-        f_enc_val *= -1;
+      e->vel = (motorPos - e->in[h0]) / STEP_PERIOD;
+      e->pos = motorPos;
       break;
   }
 
-#ifdef OPPOSE_GRIP
-  if ((joint->type == GRASP1_GOLD) || (joint->type == GRASP1_GREEN)) f_enc_val *= -1;
-#endif
-
-//    static int i = 0;
-//    static int j = 0;
-//    j++;
-//    if (j % 100){
-//
-//
-//    i++;
-//    if (i % (17) == 0){
-//        log_msg("joint %i enc_val :  %f    f_enc :  %f", joint->type,
-//        joint->enc_val, f_enc_val);
-//        log_msg("tool type in state estimate -->  %i", tool_type);
-//        //i = 0;
-//    }
-//    j=0;
-//    }
-#endif
-
-  // Calculate motor angle from encoder value
-  float motorPos =
-      (2.0 * PI) * (1.0 / ((float)ENC_CNTS_PER_REV)) * (f_enc_val - (float)joint->enc_offset);
+  e->in[next] = motorPos;
+  e->out[next] = e->pos;
+  e->head = next;
+}
 
-  // Initialize filter to steady state
-  if (!DOF_types[joint->type].filterRdy) {
-    oldPos[2] = motorPos;
-    oldPos[1] = motorPos;
-    oldPos[0] = motorPos;
-    oldFiltPos[2] = motorPos;
-    oldFiltPos[1] = motorPos;
-    oldFiltPos[0] = motorPos;
-    //    rt_printk("FILTER BEING READIED %d\n", gTime);
-    DOF_types[joint->type].filterRdy = TRUE;
-  }
+/**
+ * \brief Estimates a joint's motor state from its motor position
+ */
+static void estimateJointState(DOF *joint, float motorPos) {
+  joint_estimator *e = jointEstimator(joint->type);
 
-  // Compute filtered motor angle
-  filtPos = B[0] * motorPos + B[1] * oldPos[0] + B[2] * oldPos[1] + B[3] * oldPos[2] +
-            A[1] * oldFiltPos[0] + A[2] * oldFiltPos[1] + A[3] * oldFiltPos[2];
+  runEstimator(e, motorPos);
+  joint->mpos = e->pos;
+  joint->mvel = e->vel;
+}
 
-// Compute velocity from first difference
-// This is safe b/c noise is removed by LPF
+/**
+ * \brief Resets a mechanism's estimators to rest at the desired motor positions
+ *
+ * \param mech  the mechanism
+ */
+void resetFilter(mechanism *mech) {
+  mech_estimator *me = &mech_est[mechArm(mech)];
 
-// removed filter functionality - CIGIT 7/30/15
-// the filter was shown to cause fluttering in the tool joints after homing
-#ifdef NO_LPF
-  joint->mvel = (motorPos - oldPos[0]) / STEP_PERIOD;
-  joint->mpos = motorPos;
+  for (int i = 0; i < MAX_DOF_PER_MECH; i++)
+    initEstimator(&me->joint[i], mech->joint[i].mpos_d, 0);
+}
 
-  static int print_once = 0;
-  if (print_once < 1) {
-    log_msg("!!!!!!!!!!!!!    LPF FILTER IS OFF    !!!!!!111!!1!1!!!", 0);
-    print_once++;
-  }
-#else  // use the filter
-  joint->mvel = (filtPos - oldFiltPos[0]) / STEP_PERIOD;
-  joint->mpos = filtPos;
-#endif
+/**
+ * \brief Clears a mechanism's estimators, restarting them at the next measurement
+ *
+ * \param mech  the mechanism
+ */
+void clearFilter(mechanism *mech) {
+  mech_estimator *me = &mech_est[mechArm(mech)];
 
-  // Update old values for filter
-  oldPos[2] = oldPos[1];
-  oldPos[1] = oldPos[0];
-  oldPos[0] = motorPos;
-  oldFiltPos[2] = oldFiltPos[1];
-  oldFiltPos[1] = oldFiltPos[0];
-  oldFiltPos[0] = filtPos;
+  for (int i = 0; i < MAX_DOF_PER_MECH; i++) me->joint[i].ready = FALSE;
+}
 
-  return;
+/**
+ * \brief Requests a different estimator for a joint
+ *
+ * Safe to call from any thread; the RT thread switches at its next update.
+ *
+ * \param arm   0 for gold, 1 for green
+ * \param dof   the DOF index within the arm
+ * \param type  an estimator_type
+ * \return 0 on success, -1 for an unknown arm, DOF or type
+ */
+int setJointEstimator(int arm, int dof, int type) {
+  if (arm < 0 || arm >= MAX_MECH || dof < 0 || dof >= MAX_DOF_PER_MECH) return -1;
+  if (type < 0 || type >= est_last_type) return -1;
+  mech_est[arm].joint[dof].requested = type;
+  return 0;
 }
 
-void getStateLPF(DOF *joint, style t_style) {
-  // 50 HZ 3rd order butterworth
-  //    float B[] = {0.0029,  0.0087,  0.0087,  0.0029};
-  //    float A[] = {1.0000,  2.3741, -1.9294,  0.5321};
-  // 75 Hz 3rd order butterworth
-  //    float B[] = {0.00859,  0.0258,  0.0258,  0.00859};
-  //    float A[] = {1.0000,   2.0651, -1.52,  0.3861};
-  //  20 Hz 3rd order butterworth
-  //    float B[] = {0.0002196,  0.0006588,  0.0006588,  0.0002196};
-  //    float A[] = {1.0000,   2.7488, -2.5282,  0.7776};
-  //  120 Hz 3rd order butterworth
-  float B[] = {0.02864, 0.08591, 0.08591, 0.02864};
-  float A[] = {1.0000, 1.5189, -0.9600, 0.2120};
-  //    float B[] = {1.0, 0,0,0};
-  //    float A[] = {0,0,0,0};
-
-  float *oldPos = DOF_types[joint->type].old_mpos;
-  float *oldFiltPos = DOF_types[joint->type].old_filtered_mpos;
-  float filtPos = 0;
-  float f_enc_val = joint->enc_val;
-
-//#ifdef RAVEN_II
-//    if ( (joint->type == SHOULDER_GOLD) ||
-//         (joint->type == ELBOW_GOLD) ||
-//         (joint->type == Z_INS_GOLD)
-//         ||
-//#ifndef RAVEN_II_SQUARE
-//         (joint->type == TOOL_ROT_GOLD) ||
-//         (joint->type == WRIST_GOLD) ||
-//         (joint->type == GRASP1_GOLD) ||
-//         (joint->type == GRASP2_GOLD)
-//#endif
-//         ||
-//         (joint->type == TOOL_ROT_GREEN) ||
-//         (joint->type == WRIST_GREEN) ||
-//         (joint->type == GRASP1_GREEN) ||
-//         (joint->type == GRASP2_GREEN)
-//         )
-//         f_enc_val *= -1;
-//#endif
-
-#ifdef RAVEN_II
-  switch (t_style) {
-    case square_raven:
-      if ((joint->type == SHOULDER_GOLD) || (joint->type == ELBOW_GOLD) ||
-          (joint->type == Z_INS_GOLD) || (joint->type == TOOL_ROT_GREEN) ||
-          (joint->type == WRIST_GREEN) || (joint->type == GRASP1_GREEN) ||
-          (joint->type == GRASP2_GREEN))
-        f_enc_val *= -1;
-      break;
+/**
+ * \return the estimator_type selected for a joint, or -1
+ */
+int getJointEstimator(int arm, int dof) {
+  if (arm < 0 || arm >= MAX_MECH || dof < 0 || dof >= MAX_DOF_PER_MECH) return -1;
+  return mech_est[arm].joint[dof].requested;
+}
 
-    case dv:
-      if ((joint->type == SHOULDER_GOLD) || (joint->type == ELBOW_GOLD) ||
-          (joint->type == Z_INS_GOLD))
-        f_enc_val *= -1;
-      break;
+/**
+ * \return the name of an estimator type, or "unknown"
+ */
+const char *estimatorName(int type) {
+  return (type >= 0 && type < est_last_type) ? estimatorNames[type] : "unknown";
+}
 
-    default:
-      if ((joint->type == SHOULDER_GOLD) || (joint->type == ELBOW_GOLD) ||
-          (joint->type == Z_INS_GOLD) || (joint->type == TOOL_ROT_GOLD) ||
-          (joint->type == WRIST_GOLD) || (joint->type == GRASP1_GOLD) ||
-          (joint->type == GRASP2_GOLD) || (joint->type == TOOL_ROT_GREEN) ||
-          (joint->type == WRIST_GREEN) || (joint->type == GRASP1_GREEN) ||
-          (joint->type == GRASP2_GREEN))
-        f_enc_val *= -1;
-      break;
-  }
+/**
+ * \return the estimator type with the given name, or -1
+ */
+int estimatorFromName(const char *name) {
+  for (int i = 0; i < est_last_type; i++)
+    if (!strcmp(name, estimatorNames[i])) return i;
+  return -1;
+}
 
-#ifdef OPPOSE_GRIP
-  if ((joint->type == GRASP1_GOLD) || (joint->type == GRASP1_GREEN)) f_enc_val *= -1;
+/**
+ * \brief Selects the startup estimator of every joint
+ *
+ * The parameter /state_estimator names the estimator for all joints; the
+ * lists /state_estimator_gold and /state_estimator_green may name one per DOF
+ * to override it.  Without parameters the estimator follows NO_LPF.
+ *
+ * \param n  the ros node handle
+ * \return 0 on success, -1 if a parameter names an unknown estimator
+ */
+int init_estimators(ros::NodeHandle &n) {
+#ifdef NO_LPF
+  std::string def_name = "raw";
+#else
+  std::string def_name = "butterworth";
 #endif
+  std::string name;
+  int ret = 0;
+
+  n.param("/state_estimator", name, def_name);
+  int def = estimatorFromName(name.c_str());
+  if (def < 0) {
+    log_msg("Unknown state estimator %s, using %s", name.c_str(), def_name.c_str());
+    def = estimatorFromName(def_name.c_str());
+    ret = -1;
+  }
 
-  static int i = 0;
-  static int j = 0;
-  j++;
-  if (j % 100) {
-    i++;
-    if (i % (17) == 0) {
-      //        log_msg("joint %i enc_val :  %f    f_enc :  %f", joint->type,
-      //        joint->enc_val, f_enc_val);
-      log_msg("tool type in state estimate -->  %i", t_style);
-      // i = 0;
+  for (int arm = 0; arm < MAX_MECH; arm++) {
+    std::vector<std::string> names;
+    n.getParam(arm == 0 ? "/state_estimator_gold" : "/state_estimator_green", names);
+    for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+      joint_estimator *e = &mech_est[arm].joint[j];
+      int type = def;
+      if (j < (int)names.size() && estimatorFromName(names[j].c_str()) >= 0)
+        type = estimatorFromName(names[j].c_str());
+      else if (j < (int)names.size())
+        ret = -1;
+      e->type = e->requested = type;
+      e->ready = FALSE;
     }
-    j = 0;
+    log_msg("State estimators %s: %s %s %s %s %s %s %s", arm == 0 ? "gold" : "green",
+            estimatorName(mech_est[arm].joint[0].type), estimatorName(mech_est[arm].joint[1].type),
+            estimatorName(mech_est[arm].joint[2].type), estimatorName(mech_est[arm].joint[4].type),
+            estimatorName(mech_est[arm].joint[5].type), estimatorName(mech_est[arm].joint[6].type),
+            estimatorName(mech_est[arm].joint[7].type));
   }
-#endif
 
-  // Calculate motor angle from encoder value
-  float motorPos =
-      (2.0 * PI) * (1.0 / ((float)ENC_CNTS_PER_REV)) * (f_enc_val - (float)joint->enc_offset);
+  return ret;
+}
 
-  // Initialize filter to steady state
-  if (!DOF_types[joint->type].filterRdy) {
-    oldPos[2] = motorPos;
-    oldPos[1] = motorPos;
-    oldPos[0] = motorPos;
-    oldFiltPos[2] = motorPos;
-    oldFiltPos[1] = motorPos;
-    oldFiltPos[0] = motorPos;
-    //    rt_printk("FILTER BEING READIED %d\n", gTime);
-    DOF_types[joint->type].filterRdy = TRUE;
+/*
+ * stateEstimate()
+ */
+
+void stateEstimate(robot_device *device0) {
+  int i, j;
+
+  // Loop through all joints
+  for (i = 0; i < NUM_MECH; i++) {
+    for (j = 0; j < MAX_DOF_PER_MECH; j++) {
+      getStateLPF(&device0->mech[i], j);
+    }
   }
+}
 
-  // Compute filtered motor angle
-  filtPos = B[0] * motorPos + B[1] * oldPos[0] + B[2] * oldPos[1] + B[3] * oldPos[2] +
-            A[1] * oldFiltPos[0] + A[2] * oldFiltPos[1] + A[3] * oldFiltPos[2];
+/*
+ * filterPosition()
+ *
+ *  Apply an LPF to the motor position to eliminate
+ * high frequency content in the control loop.  The HF
+ * will drive the cable transmission unstable.
+ *
+ * \param mech  the mechanism
+ * \param dof   the DOF index within the mechanism
+ */
+void getStateLPF(mechanism *mech, int dof) {
+  DOF *joint = &mech->joint[dof];
 
-  // Compute velocity from first difference
-  // This is safe b/c noise is removed by LPF
-  joint->mvel = (filtPos - oldFiltPos[0]) / STEP_PERIOD;
-  joint->mpos = filtPos;
+  // Calculate motor angle from encoder value, in the direction of the
+  // mechanism's encoder map (see initEncMap())
+  float f_enc_val = mech->enc.motor_sign[dof] * joint->enc_val;
+  float motorPos =
+      (2.0 * PI) * (1.0 / ((float)ENC_CNTS_PER_REV)) * (f_enc_val - (float)joint->enc_offset);
 
-  // Update old values for filter
-  oldPos[2] = oldPos[1];
-  oldPos[1] = oldPos[0];
-  oldPos[0] = motorPos;
-  oldFiltPos[2] = oldFiltPos[1];
-  oldFiltPos[1] = oldFiltPos[0];
-  oldFiltPos[0] = filtPos;
+  estimateJointState(joint, motorPos);
 
   return;
 }
 
-void resetFilter(DOF *_joint) {
-  // reset filter
-  for (int i = 0; i <= 2; i++) {
-    DOF_types[_joint->type].old_mpos[i] = _joint->mpos_d;
-    DOF_types[_joint->type].old_filtered_mpos[i] = _joint->mpos_d;
-  }
-}
-
 /*
   if (joint->type == SHOULDER_B) {
     if (gTime % 100 == 0)
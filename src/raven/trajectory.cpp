@@ -29,6 +29,7 @@
 */
 
 #include <ros/ros.h>
+#include <tf/transform_datatypes.h>
 
 #include "trajectory.h"
 #include "log.h"
@@ -36,6 +37,7 @@
 #include "defines.h"
 
 extern unsigned long int gTime;
+extern int NUM_MECH;
 
 // Store trajectory parameters
 /**    Holds trajectory paramters
@@ -54,6 +56,31 @@ struct _trajectory {
 };
 _trajectory trajectory[MAX_MECH * MAX_DOF_PER_MECH];
 
+/**    Holds the cartesian segment toward an absolute pose command
+ *
+ *   \ingroup Control
+ */
+struct _pose_trajectory {
+  /*@{*/
+  int running;                 /**<segment has been started                  */
+  int seq;                     /**<abs_pose_seq of the current target         */
+  unsigned long int startTime; /**<gTime at the start of the segment          */
+  int ticks;                   /**<segment length in control cycles           */
+  position startPos;           /**<micrometers                                */
+  position endPos;             /**<micrometers                                */
+  tf::Quaternion startOri;     /**<orientation at the start of the segment    */
+  tf::Quaternion endOri;       /**<target orientation                         */
+  int startGrasp;              /**<milliradians                               */
+  int endGrasp;                /**<milliradians                               */
+                               /*@{*/
+};
+_pose_trajectory pose_trajectory[MAX_MECH];
+
+// Period (s) and amplitude (rad, m) of the multi-DOF sinusoid, per DOF of a mech
+static float sinusoid_period[MAX_DOF_PER_MECH] = {6, 7, 10, 9999999, 10, 5, 10, 6};
+static float sinusoid_magnitude[MAX_DOF_PER_MECH] = {
+    10 DEG2RAD, 10 DEG2RAD, 0.02, 9999999, 30 DEG2RAD, 30 DEG2RAD, 30 DEG2RAD, 30 DEG2RAD};
+
 /**
 *    initialize trajectory parameters. Magnitude is set according to difference
 *between _endPos and current joint position.
@@ -84,7 +111,8 @@ _trajectory trajectory[MAX_MECH * MAX_DOF_PER_MECH];
 *   -# Single full cycle      All joints (update_position_trajectory())
 *
 * \todo The trajectory generator seems to have a lot of hacks and special cases.
-*Need more general refactoring.  Also consider polynomial trajectories.
+*Need more general refactoring.  Polynomial paths through waypoints are in
+*trajectory_plan.cpp.
 *
 */
 int start_trajectory(DOF *_joint, float _endPos, float _period) {
@@ -283,3 +311,111 @@ int update_position_trajectory(DOF *_joint) {
 
   return 0;
 }
+
+/**
+*  update_absolute_pose_trajectory()
+*     Step each arm under absolute pose command toward its target.
+*     \ingroup Control
+*
+*  A new segment starts from the current pos_d/ori_d whenever a new target
+*arrives or pedal down resumes after a gap.  Position and grasp are linearly
+*interpolated and orientation is slerped.  The segment is stretched if needed
+*so the commanded motion stays within ABS_POSE_MAX_VEL and
+*ABS_POSE_MAX_ANG_VEL.
+*
+*   \param device0     robot_device struct defined in DS0.h
+*   \param currParams  param_pass struct defined in DS1.h
+*/
+int update_absolute_pose_trajectory(device *device0, param_pass *currParams) {
+  static unsigned long int lastTime = 0;
+  int restart = (gTime != lastTime + 1);  // not called last cycle
+  lastTime = gTime;
+
+  for (int m = 0; m < NUM_MECH; m++) {
+    _pose_trajectory *traj = &(pose_trajectory[m]);
+    mechanism *_mech = &(device0->mech[m]);
+
+    if (!currParams->abs_pose_active[m]) {
+      traj->running = 0;
+      continue;
+    }
+
+    if (restart || !traj->running || traj->seq != currParams->abs_pose_seq[m]) {
+      const orientation *_rd = &(currParams->rd[m]);
+      tf::Matrix3x3 mx;
+
+      traj->running = 1;
+      traj->seq = currParams->abs_pose_seq[m];
+      traj->startTime = gTime;
+      traj->startPos = _mech->pos_d;
+      traj->endPos = currParams->xd[m];
+      traj->startGrasp = _mech->ori_d.grasp;
+      traj->endGrasp = _rd->grasp;
+
+      mx.setValue(_mech->ori_d.R[0][0], _mech->ori_d.R[0][1], _mech->ori_d.R[0][2],
+                  _mech->ori_d.R[1][0], _mech->ori_d.R[1][1], _mech->ori_d.R[1][2],
+                  _mech->ori_d.R[2][0], _mech->ori_d.R[2][1], _mech->ori_d.R[2][2]);
+      mx.getRotation(traj->startOri);
+      mx.setValue(_rd->R[0][0], _rd->R[0][1], _rd->R[0][2], _rd->R[1][0], _rd->R[1][1],
+                  _rd->R[1][2], _rd->R[2][0], _rd->R[2][1], _rd->R[2][2]);
+      mx.getRotation(traj->endOri);
+      if (traj->startOri.dot(traj->endOri) < 0) traj->endOri = -traj->endOri;  // short way round
+
+      // stretch the segment to respect the speed limits
+      float dx = traj->endPos.x - traj->startPos.x;
+      float dy = traj->endPos.y - traj->startPos.y;
+      float dz = traj->endPos.z - traj->startPos.z;
+      float dist = sqrt(dx * dx + dy * dy + dz * dz);
+      float angle = traj->startOri.angleShortestPath(traj->endOri);
+      int min_lin = (int)ceil(dist / (ABS_POSE_MAX_VEL * MICRON_PER_M * ONE_MS));
+      int min_ang = (int)ceil(angle / (ABS_POSE_MAX_ANG_VEL * ONE_MS));
+
+      traj->ticks = currParams->abs_pose_ticks[m];
+      if (traj->ticks < min_lin) traj->ticks = min_lin;
+      if (traj->ticks < min_ang) traj->ticks = min_ang;
+      if (traj->ticks < 1) traj->ticks = 1;
+    }
+
+    float s = (float)(gTime - traj->startTime) / traj->ticks;
+    if (s > 1) s = 1;
+
+    _mech->pos_d.x = traj->startPos.x + (int)(s * (traj->endPos.x - traj->startPos.x));
+    _mech->pos_d.y = traj->startPos.y + (int)(s * (traj->endPos.y - traj->startPos.y));
+    _mech->pos_d.z = traj->startPos.z + (int)(s * (traj->endPos.z - traj->startPos.z));
+    _mech->ori_d.grasp = traj->startGrasp + (int)(s * (traj->endGrasp - traj->startGrasp));
+
+    tf::Matrix3x3 rot_mx(traj->startOri.slerp(traj->endOri, s));
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < 3; k++) _mech->ori_d.R[j][k] = rot_mx[j][k];
+  }
+
+  return 0;
+}
+
+/**
+ * \brief The period and amplitude of the multi-DOF sinusoid
+ *
+ * \param out_period     period of each DOF, s
+ * \param out_magnitude  amplitude of each DOF, rad and m
+ * \ingroup Control
+ */
+void getSinusoidParams(float *out_period, float *out_magnitude) {
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    out_period[j] = sinusoid_period[j];
+    out_magnitude[j] = sinusoid_magnitude[j];
+  }
+}
+
+/**
+ * \brief Reads the multi-DOF sinusoid from /sinusoid_period and
+ * /sinusoid_magnitude
+ *
+ * \param n  the ros node handle
+ * \return 0
+ * \ingroup ROS
+ */
+int init_trajectory(ros::NodeHandle &n) {
+  getParamList(n, "/sinusoid_period", sinusoid_period, MAX_DOF_PER_MECH);
+  getParamList(n, "/sinusoid_magnitude", sinusoid_magnitude, MAX_DOF_PER_MECH);
+  return 0;
+}
@@ -0,0 +1,1117 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file trajectory_plan.cpp
+ *
+ * \brief Queued multi-waypoint paths of polynomial segments, in joint or
+ * Cartesian space
+ *
+ * A path is a list of waypoints for one arm, started from the end of the path
+ * queued before it or, when the arm is idle, from its commanded state.  The
+ * planner times every segment to the speed and acceleration limits, computes
+ * its coefficients in normalized time t in [0, 1] and queues it; all of this
+ * runs in the caller's thread.  Each cycle the control loop only evaluates
+ * the current segment at t = cycles / length:
+ *
+ *   - quintic: p(t) = c0 + c1 t + ... + c5 t^5 per axis, zero acceleration
+ *     at the waypoints and, at the inner ones, the mean of the adjacent
+ *     slopes as velocity when they agree in sign.  The segment is stretched
+ *     until the sampled speed and acceleration stay within the limits.
+ *   - minimum jerk: the quintic at rest at both ends, 10 t^3 - 15 t^4 + 6 t^5,
+ *     whose peak speed and acceleration are 1.875 and 5.774 times the mean.
+ *   - trapezoid: p0 + (p1 - p0) s(t), with s accelerating for a fraction b
+ *     of the segment, cruising, and decelerating.  The slowest axis on its
+ *     own sets b, and the length is then fitted to every axis.
+ *
+ * Joint paths interpolate the eight DOFs (rad, and m for the insertion).
+ * Cartesian paths interpolate the tool position and grasp, and slerp the
+ * orientation with the same time law (the minimum jerk one for quintic
+ * paths, so the orientation comes to rest at each waypoint).  A waypoint's
+ * duration is the shortest time of its segment.
+ *
+ * The queue of each arm is a single producer, single consumer ring: the
+ * planner (serialized by a mutex) only moves the tail, the control loop only
+ * the head, so the control loop never waits.  The control loop publishes
+ * its commanded state every cycle under a sequence counter; a path planned
+ * from a state that has changed since is dropped when it starts.
+ *
+ * Clients can also stream time stamped points, in batches on the
+ * raven_trajectory topic or through trajStream().  Each point becomes a cubic
+ * Hermite segment from the one before, due at its time stamp, with the
+ * Catmull-Rom tangent when the next point is known.  A batch continues the
+ * queued motion; points already due are dropped as late, and a segment faster
+ * than the speed limits is stretched, which delays the points after it.  A
+ * segment that starts playing with no later point queued is brought to rest
+ * at its end point; if the queue then runs dry before a batch marked as the
+ * end, the arm holds the last point and an underrun is counted.  The lag of
+ * each segment behind its time stamp, underruns, late points and overflows
+ * are kept per arm (see getTrajStats()) and published on /diagnostics.
+ *
+ * Paths are played by the trajectory control mode while the pedal is down,
+ * and dropped when it comes up.  They come from the plan_trajectory service
+ * or trajPlanPath().  Default limits come from /traj_joint_vel and
+ * /traj_joint_acc (8 values each), /traj_linear_limits and
+ * /traj_angular_limits (speed and acceleration).
+ *
+ * \ingroup Control
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <raven_2/PlanTrajectory.h>
+#include <raven_2/raven_trajectory.h>
+
+#include "trajectory_plan.h"
+#include "r2_kinematics.h"
+#include "defines.h"
+#include "struct.h"
+#include "log.h"
+#include "utils.h"
+
+extern int NUM_MECH;
+extern unsigned long int gTime;
+
+#define TRAJ_MJ_VEL 1.875     // peak speed of the minimum jerk profile over the mean
+#define TRAJ_MJ_ACC 5.7735    // peak acceleration over distance / time^2
+#define TRAJ_SAMPLES 32       // samples of a quintic segment checked against the limits
+#define TRAJ_STRETCH 8        // attempts at fitting a quintic segment to the limits
+
+static const char *profileNames[] = {"quintic", "min_jerk", "trapezoid", "cubic"};
+static const char *spaceNames[] = {"joint", "cartesian"};
+
+/// A point of a path in the coordinates of its space
+struct traj_point {
+  double x[TRAJ_AXES];  // joints (rad, m), or position (micrometers) and grasp (mrad)
+  tf::Quaternion ori;   // Cartesian orientation
+};
+
+/// Segments of one arm, passed from the planner to the control loop
+struct traj_queue {
+  traj_segment seg[TRAJ_QUEUE_LEN];
+  volatile unsigned int head;  // segment being played, moved by the control loop
+  volatile unsigned int tail;  // one past the last queued segment, moved by the planner
+  volatile int flush;          // set by the planner to have the control loop drop the queue
+  volatile unsigned int open;  // tail while the last streamed segment may still be continued
+};
+
+/// Commanded state of one arm, published by the control loop
+struct traj_snapshot {
+  unsigned long int time;           // gTime of the sample, 0 if never written
+  traj_point at[traj_last_space];  // in joint and Cartesian coordinates
+};
+
+static traj_queue queues[MAX_MECH];
+static traj_snapshot snapshots[MAX_MECH];
+static volatile unsigned int snapshotSeq = 0;  // odd while the control loop writes
+
+// planner side
+static pthread_mutex_t planMutex = PTHREAD_MUTEX_INITIALIZER;
+static traj_point planEnd[MAX_MECH];                 // end of the last queued path
+static double planEndVel[MAX_MECH][TRAJ_AXES];       // its velocity per s, streams only
+static unsigned long int planEndTick[MAX_MECH];      // gTime it is due to be reached
+static int planSpace[MAX_MECH];
+static int planOpen[MAX_MECH];                       // the last queued segment expects more
+static traj_limits limits;
+static traj_stats stats[MAX_MECH];  // fields written by one side each
+static ros::ServiceServer plan_service;
+static ros::Subscriber stream_sub;
+
+// control loop side
+static int played[MAX_MECH];  // cycles into the current segment
+static int playing[MAX_MECH];
+static int jointActive[MAX_MECH];
+static double jointCmd[MAX_MECH][TRAJ_AXES];
+
+/**
+ * \brief Minimum jerk profile from 0 to 1
+ */
+static inline double minJerk(double t) { return t * t * t * (10 + t * (-15 + t * 6)); }
+
+/**
+ * \brief Trapezoidal speed profile from 0 to 1, accelerating for a fraction b
+ */
+static inline double trapezoid(double t, double b) {
+  if (t < b) return t * t / (2 * b * (1 - b));
+  if (t > 1 - b) return 1 - (1 - t) * (1 - t) / (2 * b * (1 - b));
+  return (t - b / 2) / (1 - b);
+}
+
+/**
+ * \brief Quintic from p0 to p1 with end velocities v0, v1 (per unit of t) and
+ * zero end accelerations
+ */
+static void quinticCoeffs(double p0, double p1, double v0, double v1, double c[6]) {
+  double h = p1 - p0;
+
+  c[0] = p0;
+  c[1] = v0;
+  c[2] = 0;
+  c[3] = 10 * h - 6 * v0 - 4 * v1;
+  c[4] = -15 * h + 8 * v0 + 7 * v1;
+  c[5] = 6 * h - 3 * v0 - 3 * v1;
+}
+
+/**
+ * \brief Evaluates a segment at normalized time t
+ *
+ * \param s        the segment
+ * \param t        normalized time, 0 to 1
+ * \param out_x    axis values
+ * \param out_ori  orientation of a Cartesian segment, may be NULL
+ */
+static void evalSegment(const traj_segment &s, double t, double out_x[TRAJ_AXES],
+                        tf::Quaternion *out_ori) {
+  if (s.profile == traj_trapezoid) {
+    double u = trapezoid(t, s.beta);
+    for (int a = 0; a < TRAJ_AXES; a++) out_x[a] = s.c[a][0] + s.c[a][1] * u;
+    if (out_ori) *out_ori = s.ori[0].slerp(s.ori[1], u);
+  } else if (s.profile == traj_cubic) {
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      const double *c = s.c[a];
+      out_x[a] = c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+    }
+    // a stopped segment eases out of its turn
+    if (out_ori) *out_ori = s.ori[0].slerp(s.ori[1], s.stop ? t + t * t * (1 - t) : t);
+  } else {
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      const double *c = s.c[a];
+      out_x[a] = c[0] + t * (c[1] + t * (c[2] + t * (c[3] + t * (c[4] + t * c[5]))));
+    }
+    if (out_ori) *out_ori = s.ori[0].slerp(s.ori[1], minJerk(t));
+  }
+}
+
+/**
+ * \brief Brings a cubic segment to rest at its end point
+ *
+ * Used on the last streamed segment when no later point has been queued, so
+ * the set points do not stop dead at the end point.  Raises the end velocity
+ * terms of the cubics by the old end velocity; the end point is unchanged.
+ */
+static void stopSegment(traj_segment *s) {
+  for (int a = 0; a < TRAJ_AXES; a++) {
+    double *c = s->c[a];
+    double v1 = c[1] + 2 * c[2] + 3 * c[3];
+    c[2] += v1;
+    c[3] -= v1;
+  }
+  s->stop = TRUE;
+}
+
+/**
+ * \brief Channel an axis is limited in, -1 if the axis is not interpolated
+ *
+ * Joints are limited one by one.  Cartesian paths limit the position as a
+ * whole (channel 0), the grasp (1) and the rotation (2, not an axis).
+ */
+static int axisChannel(int space, int a, const traj_limits &lim) {
+  if (space == traj_joint) return lim.jvel[a] > 0 && lim.jacc[a] > 0 ? a : -1;
+  if (a < 3) return 0;
+  return a == 3 ? 1 : -1;
+}
+
+/**
+ * \brief Speed and acceleration limits of the channels, in axis units
+ */
+static void channelLimits(int space, const traj_limits &lim, double vmax[TRAJ_AXES],
+                          double amax[TRAJ_AXES]) {
+  if (space == traj_joint) {
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      vmax[a] = lim.jvel[a];
+      amax[a] = lim.jacc[a];
+    }
+    return;
+  }
+  for (int a = 0; a < TRAJ_AXES; a++) vmax[a] = amax[a] = 0;
+  vmax[0] = lim.lin_vel * MICRON_PER_M;
+  amax[0] = lim.lin_acc * MICRON_PER_M;
+  vmax[1] = lim.jvel[GRASP1] * 1000;
+  amax[1] = lim.jacc[GRASP1] * 1000;
+  vmax[2] = lim.ang_vel;
+  amax[2] = lim.ang_acc;
+}
+
+/**
+ * \brief Distance covered in each channel between two points
+ */
+static void channelDistances(int space, const traj_limits &lim, const traj_point &p0,
+                             const traj_point &p1, double out_h[TRAJ_AXES]) {
+  for (int ch = 0; ch < TRAJ_AXES; ch++) out_h[ch] = 0;
+  for (int a = 0; a < TRAJ_AXES; a++) {
+    int ch = axisChannel(space, a, lim);
+    if (ch >= 0) out_h[ch] += (p1.x[a] - p0.x[a]) * (p1.x[a] - p0.x[a]);
+  }
+  for (int ch = 0; ch < TRAJ_AXES; ch++) out_h[ch] = sqrt(out_h[ch]);
+  if (space == traj_cartesian) out_h[2] = p0.ori.angleShortestPath(p1.ori);
+}
+
+/**
+ * \brief Shortest minimum jerk segment covering h within the limits
+ */
+static double minJerkTime(const double h[TRAJ_AXES], const double vmax[TRAJ_AXES],
+                          const double amax[TRAJ_AXES]) {
+  double T = 0;
+
+  for (int ch = 0; ch < TRAJ_AXES; ch++) {
+    if (h[ch] <= 0 || vmax[ch] <= 0 || amax[ch] <= 0) continue;
+    T = std::max(T, TRAJ_MJ_VEL * h[ch] / vmax[ch]);
+    T = std::max(T, sqrt(TRAJ_MJ_ACC * h[ch] / amax[ch]));
+  }
+  return T;
+}
+
+/**
+ * \brief Shortest trapezoidal segment covering h within the limits
+ *
+ * \param out_beta  the fraction of the segment spent accelerating
+ */
+static double trapezoidTime(const double h[TRAJ_AXES], const double vmax[TRAJ_AXES],
+                            const double amax[TRAJ_AXES], float *out_beta) {
+  double T = 0, slowest = 0, b = 0.5;
+
+  // the slowest channel, time optimal on its own, sets the blends
+  for (int ch = 0; ch < TRAJ_AXES; ch++) {
+    if (h[ch] <= 0 || vmax[ch] <= 0 || amax[ch] <= 0) continue;
+    double t_ch, b_ch;
+    if (h[ch] >= vmax[ch] * vmax[ch] / amax[ch]) {
+      t_ch = h[ch] / vmax[ch] + vmax[ch] / amax[ch];
+      b_ch = vmax[ch] / amax[ch] / t_ch;
+    } else {
+      t_ch = 2 * sqrt(h[ch] / amax[ch]);
+      b_ch = 0.5;
+    }
+    if (t_ch > slowest) {
+      slowest = t_ch;
+      b = b_ch;
+    }
+  }
+
+  // peak speed h / (T (1 - b)), peak acceleration h / (T^2 b (1 - b))
+  for (int ch = 0; ch < TRAJ_AXES; ch++) {
+    if (h[ch] <= 0 || vmax[ch] <= 0 || amax[ch] <= 0) continue;
+    T = std::max(T, h[ch] / (vmax[ch] * (1 - b)));
+    T = std::max(T, sqrt(h[ch] / (amax[ch] * b * (1 - b))));
+  }
+  *out_beta = b;
+  return T;
+}
+
+/**
+ * \brief How far a polynomial segment of length T exceeds the limits
+ *
+ * Channels with a zero acceleration limit are only checked for speed.
+ *
+ * \return the largest of speed / limit and sqrt(acceleration / limit) over
+ * the sampled times, at most 1 if the segment is within the limits
+ */
+static double polyExcess(const traj_segment &s, double T, const traj_limits &lim,
+                         const double vmax[TRAJ_AXES], const double amax[TRAJ_AXES]) {
+  double excess = 0;
+
+  for (int i = 0; i <= TRAJ_SAMPLES; i++) {
+    double t = (double)i / TRAJ_SAMPLES;
+    double v2[TRAJ_AXES] = {0}, a2[TRAJ_AXES] = {0};
+
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      int ch = axisChannel(s.space, a, lim);
+      if (ch < 0) continue;
+      const double *c = s.c[a];
+      double v = (c[1] + t * (2 * c[2] + t * (3 * c[3] + t * (4 * c[4] + t * 5 * c[5])))) / T;
+      double acc = (2 * c[2] + t * (6 * c[3] + t * (12 * c[4] + t * 20 * c[5]))) / (T * T);
+      v2[ch] += v * v;
+      a2[ch] += acc * acc;
+    }
+    for (int ch = 0; ch < TRAJ_AXES; ch++) {
+      if (vmax[ch] > 0) excess = std::max(excess, sqrt(v2[ch]) / vmax[ch]);
+      if (amax[ch] > 0) excess = std::max(excess, sqrt(sqrt(a2[ch]) / amax[ch]));
+    }
+  }
+  return excess;
+}
+
+/**
+ * \brief Converts a waypoint to a point of its space
+ *
+ * Joints that are not interpolated keep their value from prev.
+ */
+static void waypointToPoint(int space, const traj_limits &lim, const traj_waypoint &wp,
+                            const traj_point &prev, traj_point *out) {
+  if (space == traj_joint) {
+    for (int a = 0; a < TRAJ_AXES; a++)
+      out->x[a] = axisChannel(space, a, lim) >= 0 ? wp.q[a] : prev.x[a];
+    out->ori = prev.ori;
+    return;
+  }
+
+  tf::Matrix3x3 mx(wp.R[0][0], wp.R[0][1], wp.R[0][2], wp.R[1][0], wp.R[1][1], wp.R[1][2],
+                   wp.R[2][0], wp.R[2][1], wp.R[2][2]);
+  for (int a = 0; a < TRAJ_AXES; a++) out->x[a] = 0;
+  for (int a = 0; a < 3; a++) out->x[a] = wp.pos[a] * MICRON_PER_M;
+  out->x[3] = wp.grasp * 1000;
+  mx.getRotation(out->ori);
+  out->ori.normalize();
+  if (prev.ori.dot(out->ori) < 0) out->ori = -out->ori;  // short way round
+}
+
+/**
+ * \brief Checks that a joint waypoint is within the joint limits of the
+ * inverse kinematics
+ */
+static int withinJointLimits(const traj_waypoint &wp) {
+  return wp.q[SHOULDER] >= SHOULDER_MIN_LIMIT && wp.q[SHOULDER] <= SHOULDER_MAX_LIMIT &&
+         wp.q[ELBOW] >= ELBOW_MIN_LIMIT && wp.q[ELBOW] <= ELBOW_MAX_LIMIT &&
+         wp.q[Z_INS] >= Z_INS_MIN_LIMIT && wp.q[Z_INS] <= Z_INS_MAX_LIMIT;
+}
+
+/**
+ * \brief Reads the commanded state last published by the control loop
+ *
+ * \return 0, or -1 if it is older than TRAJ_MAX_AGE cycles
+ */
+static int readSnapshot(int arm, int space, traj_point *out) {
+  traj_snapshot s;
+  unsigned int seq;
+
+  do {
+    seq = snapshotSeq;
+    __sync_synchronize();
+    s = snapshots[arm];
+    __sync_synchronize();
+  } while ((seq & 1) || seq != snapshotSeq);
+
+  if (s.time == 0 || gTime - s.time > TRAJ_MAX_AGE) return -1;
+  *out = s.at[space];
+  return 0;
+}
+
+/**
+ * \brief Finds where a new path of an arm starts, with the planner locked
+ *
+ * \param arm       0 gold, 1 green
+ * \param space     space of the new path
+ * \param num       segments it needs in the queue
+ * \param out       the starting point
+ * \param out_vel   the velocity there, per s
+ * \param out_tick  the gTime it is reached
+ * \return 0, or the errors of trajPlanPath()
+ */
+static int pathStart(int arm, int space, unsigned int num, traj_point *out,
+                     double out_vel[TRAJ_AXES], unsigned long int *out_tick) {
+  traj_queue *q = &queues[arm];
+
+  // the end of the queued path, or the commanded state if idle
+  if (q->flush) return -2;
+  if (q->head == q->tail) {
+    if (readSnapshot(arm, space, out) < 0) return -2;
+    for (int a = 0; a < TRAJ_AXES; a++) out_vel[a] = 0;
+    *out_tick = gTime + 1;
+  } else if (planSpace[arm] != space) {
+    return -3;
+  } else {
+    *out = planEnd[arm];
+    for (int a = 0; a < TRAJ_AXES; a++) out_vel[a] = planEndVel[arm][a];
+    *out_tick = planEndTick[arm];
+  }
+
+  if (TRAJ_QUEUE_LEN - (q->tail - q->head) < num) {
+    stats[arm].overflows++;
+    return -4;
+  }
+
+  // continue an open stream unless the control loop has already stopped it
+  if (planOpen[arm] && !__sync_bool_compare_and_swap(&q->open, q->tail, 0))
+    for (int a = 0; a < TRAJ_AXES; a++) out_vel[a] = 0;
+  planOpen[arm] = FALSE;
+  return 0;
+}
+
+/**
+ * \brief Hands the segments written past the tail to the control loop, with
+ * the planner locked
+ */
+static void pathQueued(int arm, int space, int num, const traj_point &end,
+                       const double vel[TRAJ_AXES], unsigned long int tick) {
+  traj_queue *q = &queues[arm];
+
+  planEnd[arm] = end;
+  for (int a = 0; a < TRAJ_AXES; a++) planEndVel[arm][a] = vel[a];
+  planEndTick[arm] = tick;
+  planSpace[arm] = space;
+  planOpen[arm] = q->seg[(q->tail + num - 1) % TRAJ_QUEUE_LEN].more;
+  q->open = planOpen[arm] ? q->tail + num : 0;
+  __sync_synchronize();
+  q->tail += num;
+}
+
+/**
+ * \brief Plans a path and queues it behind the current one
+ *
+ * The segments are timed to the limits, with each waypoint's duration as a
+ * lower bound, and queued as a whole or not at all.  Call it from any thread
+ * but the control loop.
+ *
+ * \param arm      0 gold, 1 green
+ * \param space    traj_joint or traj_cartesian
+ * \param profile  a traj_profile
+ * \param wps      the waypoints, after the start
+ * \param num      number of waypoints, up to TRAJ_MAX_WAYPOINTS
+ * \param lim      the limits, NULL for the defaults
+ * \return the number of segments queued, -1 on bad arguments, -2 if the arm
+ * is not under trajectory control or a cancel is pending, -3 if the path
+ * changes space behind a queued one, -4 if the queue is full
+ * \ingroup Control
+ */
+int trajPlanPath(int arm, int space, int profile, const traj_waypoint *wps, int num,
+                 const traj_limits *lim) {
+  if (arm < 0 || arm >= MAX_MECH || space < 0 || space >= traj_last_space || profile < 0 ||
+      profile >= traj_cubic || num < 1 || num > TRAJ_MAX_WAYPOINTS)
+    return -1;
+  for (int k = 0; k < num; k++)
+    if (space == traj_joint && !withinJointLimits(wps[k])) return -1;
+
+  pthread_mutex_lock(&planMutex);
+  traj_limits l = lim ? *lim : limits;
+  traj_queue *q = &queues[arm];
+  traj_point pts[TRAJ_MAX_WAYPOINTS + 1];
+  double vel[TRAJ_MAX_WAYPOINTS + 1][TRAJ_AXES] = {{0}};
+  unsigned long int tick;
+
+  // planned paths end at rest, and only quintic ones can start moving
+  int ret = pathStart(arm, space, num, &pts[0], vel[0], &tick);
+  if (ret < 0) {
+    pthread_mutex_unlock(&planMutex);
+    return ret;
+  }
+  if (profile != traj_quintic)
+    for (int a = 0; a < TRAJ_AXES; a++) vel[0][a] = 0;
+
+  double vmax[TRAJ_AXES], amax[TRAJ_AXES], h[TRAJ_AXES];
+  double T[TRAJ_MAX_WAYPOINTS];
+  float beta[TRAJ_MAX_WAYPOINTS];
+  channelLimits(space, l, vmax, amax);
+  for (int k = 0; k < num; k++) {
+    waypointToPoint(space, l, wps[k], pts[k], &pts[k + 1]);
+    channelDistances(space, l, pts[k], pts[k + 1], h);
+    beta[k] = 0.5;
+    if (profile == traj_trapezoid)
+      T[k] = trapezoidTime(h, vmax, amax, &beta[k]);
+    else
+      T[k] = minJerkTime(h, vmax, amax);
+    T[k] = std::max(T[k], (double)std::max(wps[k].duration, ONE_MS));
+  }
+
+  // velocities at the waypoints, only quintic paths move through them
+  for (int k = 1; profile == traj_quintic && k < num; k++) {
+    double v2[TRAJ_AXES] = {0};
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      int ch = axisChannel(space, a, l);
+      if (ch < 0) continue;
+      double in = (pts[k].x[a] - pts[k - 1].x[a]) / T[k - 1];
+      double out = (pts[k + 1].x[a] - pts[k].x[a]) / T[k];
+      vel[k][a] = in * out > 0 ? (in + out) / 2 : 0;
+      v2[ch] += vel[k][a] * vel[k][a];
+    }
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      int ch = axisChannel(space, a, l);
+      if (ch >= 0 && sqrt(v2[ch]) > vmax[ch]) vel[k][a] *= vmax[ch] / sqrt(v2[ch]);
+    }
+  }
+
+  double total = 0;
+  for (int k = 0; k < num; k++) {
+    traj_segment *s = &q->seg[(q->tail + k) % TRAJ_QUEUE_LEN];
+    s->space = space;
+    s->profile = profile;
+    s->more = FALSE;
+    s->stop = FALSE;
+    s->start = tick;
+    s->beta = beta[k];
+    s->ori[0] = pts[k].ori;
+    s->ori[1] = pts[k + 1].ori;
+
+    for (int i = 0; i < TRAJ_STRETCH; i++) {
+      s->ticks = (int)ceil(T[k] / ONE_MS - 1e-6);
+      double len = s->ticks * ONE_MS;
+      for (int a = 0; a < TRAJ_AXES; a++) {
+        double *c = s->c[a];
+        if (profile == traj_trapezoid) {
+          c[0] = pts[k].x[a];
+          c[1] = pts[k + 1].x[a] - pts[k].x[a];
+          c[2] = c[3] = c[4] = c[5] = 0;
+        } else {
+          quinticCoeffs(pts[k].x[a], pts[k + 1].x[a], vel[k][a] * len, vel[k + 1][a] * len, c);
+        }
+      }
+      if (profile != traj_quintic) break;
+
+      double excess = polyExcess(*s, len, l, vmax, amax);
+      if (excess <= 1) break;
+      T[k] = len * excess * 1.01;
+    }
+    total += s->ticks * ONE_MS;
+    tick += s->ticks;
+  }
+
+  pathQueued(arm, space, num, pts[num], vel[num], tick);
+  pthread_mutex_unlock(&planMutex);
+
+  log_msg("Queued a %d segment %s %s path on the %s arm, %.2f s", num, profileNames[profile],
+          spaceNames[space], arm == 0 ? "gold" : "green", total);
+  return num;
+}
+
+/**
+ * \brief Queues a batch of time stamped points behind the current motion
+ *
+ * Each point due after the end of the queued motion becomes a cubic Hermite
+ * segment, stretched if needed to the speed limits; points due before it are
+ * dropped as late.  The batch is queued as a whole or not at all.  Call it
+ * from any thread but the control loop.
+ *
+ * \param arm    0 gold, 1 green
+ * \param space  traj_joint or traj_cartesian
+ * \param wps    the points, durations are ignored
+ * \param at     gTime at which each point is due, increasing
+ * \param num    number of points, up to TRAJ_MAX_STREAM
+ * \param end    no points follow, the arm is to stop at the last one
+ * \return the number of segments queued, or the errors of trajPlanPath()
+ * \ingroup Control
+ */
+int trajStream(int arm, int space, const traj_waypoint *wps, const long int *at, int num,
+               int end) {
+  if (arm < 0 || arm >= MAX_MECH || space < 0 || space >= traj_last_space || num < 1 ||
+      num > TRAJ_MAX_STREAM)
+    return -1;
+  for (int k = 0; k < num; k++) {
+    if (space == traj_joint && !withinJointLimits(wps[k])) return -1;
+    if (k > 0 && at[k] <= at[k - 1]) return -1;
+  }
+
+  pthread_mutex_lock(&planMutex);
+  traj_queue *q = &queues[arm];
+  traj_point pts[TRAJ_MAX_STREAM + 1];
+  double vel[TRAJ_MAX_STREAM + 1][TRAJ_AXES];
+  long int due[TRAJ_MAX_STREAM + 1];
+  unsigned long int tick;
+
+  int ret = pathStart(arm, space, num, &pts[0], vel[0], &tick);
+  if (ret < 0) {
+    pthread_mutex_unlock(&planMutex);
+    return ret;
+  }
+
+  // drop the points already due, but for the last one of the batch
+  int first = 0;
+  while (first < num - 1 && at[first] <= (long int)tick) first++;
+  stats[arm].late += first;
+  int n = 0;
+  due[0] = tick;
+  for (int k = first; k < num; k++, n++) {
+    waypointToPoint(space, limits, wps[k], pts[n], &pts[n + 1]);
+    due[n + 1] = std::max(at[k], due[n] + 1);
+  }
+
+  // Catmull-Rom tangents, backward slope at the end of a batch, rest at the end of the stream
+  double vmax[TRAJ_AXES], amax[TRAJ_AXES], h[TRAJ_AXES];
+  double no_acc[TRAJ_AXES] = {0};  // the client's timing owns the accelerations
+  channelLimits(space, limits, vmax, amax);
+  for (int k = 1; k <= n; k++) {
+    int next = k < n ? k + 1 : k;
+    double v2[TRAJ_AXES] = {0};
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      int ch = axisChannel(space, a, limits);
+      vel[k][a] = 0;
+      if (ch < 0 || (k == n && end)) continue;
+      vel[k][a] = (pts[next].x[a] - pts[k - 1].x[a]) / ((due[next] - due[k - 1]) * ONE_MS);
+      v2[ch] += vel[k][a] * vel[k][a];
+    }
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      int ch = axisChannel(space, a, limits);
+      if (ch >= 0 && vmax[ch] > 0 && sqrt(v2[ch]) > vmax[ch]) vel[k][a] *= vmax[ch] / sqrt(v2[ch]);
+    }
+  }
+
+  for (int k = 0; k < n; k++) {
+    traj_segment *s = &q->seg[(q->tail + k) % TRAJ_QUEUE_LEN];
+
+    // the orientation turns at a constant rate
+    channelDistances(space, limits, pts[k], pts[k + 1], h);
+    long int ticks = due[k + 1] - (long int)tick;
+    if (space == traj_cartesian && vmax[2] > 0)
+      ticks = std::max(ticks, (long int)ceil(h[2] / vmax[2] / ONE_MS));
+
+    s->space = space;
+    s->profile = traj_cubic;
+    s->ticks = std::max(ticks, 1L);
+    s->start = due[k];  // so the lag counts the stretches
+    s->more = (k == n - 1) && !end;
+    s->stop = FALSE;
+    s->beta = 0;
+    s->ori[0] = pts[k].ori;
+    s->ori[1] = pts[k + 1].ori;
+
+    // stretch segments faster than the speed limits, delaying the rest
+    for (int i = 0; i < TRAJ_STRETCH; i++) {
+      double len = s->ticks * ONE_MS;
+      for (int a = 0; a < TRAJ_AXES; a++) {
+        double *c = s->c[a];
+        double x0 = pts[k].x[a], x1 = pts[k + 1].x[a];
+        double v0 = vel[k][a] * len, v1 = vel[k + 1][a] * len;
+        c[0] = x0;
+        c[1] = v0;
+        c[2] = -3 * x0 + 3 * x1 - 2 * v0 - v1;
+        c[3] = 2 * x0 - 2 * x1 + v0 + v1;
+        c[4] = c[5] = 0;
+      }
+      double excess = polyExcess(*s, len, limits, vmax, no_acc);
+      if (excess <= 1) break;
+      s->ticks = (int)ceil(s->ticks * excess * 1.01);
+    }
+    tick += s->ticks;
+  }
+
+  pathQueued(arm, space, n, pts[n], vel[n], tick);
+  pthread_mutex_unlock(&planMutex);
+  return n;
+}
+
+/**
+ * \brief Has the control loop drop the queued path of an arm
+ *
+ * \param arm  0 gold, 1 green
+ * \return 0, or -1 for an unknown arm
+ * \ingroup Control
+ */
+int trajCancel(int arm) {
+  if (arm < 0 || arm >= MAX_MECH) return -1;
+  if (queues[arm].head != queues[arm].tail) queues[arm].flush = TRUE;
+  return 0;
+}
+
+/**
+ * \brief Number of segments of an arm queued or playing
+ *
+ * \ingroup Control
+ */
+int trajQueued(int arm) {
+  if (arm < 0 || arm >= MAX_MECH) return -1;
+  return queues[arm].tail - queues[arm].head;
+}
+
+/**
+ * \brief The default limits
+ *
+ * \ingroup Control
+ */
+void getTrajLimits(traj_limits *out) { *out = limits; }
+
+/**
+ * \brief Playback statistics of an arm
+ *
+ * \param arm  0 gold, 1 green
+ * \param out  the statistics
+ * \return 0, or -1 for an unknown arm
+ * \ingroup Control
+ */
+int getTrajStats(int arm, traj_stats *out) {
+  if (arm < 0 || arm >= MAX_MECH) return -1;
+
+  *out = stats[arm];
+  out->queued = queues[arm].tail - queues[arm].head;
+  pthread_mutex_lock(&planMutex);
+  out->lead = out->queued ? (long int)(planEndTick[arm] - gTime) : 0;
+  pthread_mutex_unlock(&planMutex);
+  return 0;
+}
+
+/**
+ * \brief Name of a profile, as in the plan_trajectory service
+ *
+ * \ingroup Control
+ */
+const char *trajProfileName(int profile) {
+  if (profile < 0 || profile >= traj_last_profile) return "unknown";
+  return profileNames[profile];
+}
+
+/**
+ * \brief Name of a space, as in the plan_trajectory service
+ *
+ * \ingroup Control
+ */
+const char *trajSpaceName(int space) {
+  if (space < 0 || space >= traj_last_space) return "unknown";
+  return spaceNames[space];
+}
+
+/**
+ * \brief Checks that a segment starts at the commanded state of its arm
+ */
+static int startsAtCommand(const traj_segment &s, const mechanism *mech) {
+  if (s.space == traj_joint) {
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      double tol = a == Z_INS ? TRAJ_START_TOL_ANG / 10 : TRAJ_START_TOL_ANG;
+      if (fabs(s.c[a][0] - mech->joint[a].jpos_d) > tol) return FALSE;
+    }
+    return TRUE;
+  }
+
+  const orientation *ori = &mech->ori_d;
+  tf::Matrix3x3 mx(ori->R[0][0], ori->R[0][1], ori->R[0][2], ori->R[1][0], ori->R[1][1],
+                   ori->R[1][2], ori->R[2][0], ori->R[2][1], ori->R[2][2]);
+  tf::Quaternion q;
+  mx.getRotation(q);
+
+  return fabs(s.c[0][0] - mech->pos_d.x) <= TRAJ_START_TOL_POS &&
+         fabs(s.c[1][0] - mech->pos_d.y) <= TRAJ_START_TOL_POS &&
+         fabs(s.c[2][0] - mech->pos_d.z) <= TRAJ_START_TOL_POS &&
+         fabs(s.c[3][0] - ori->grasp) <= TRAJ_START_TOL_ANG * 1000 &&
+         q.angleShortestPath(s.ori[0]) <= TRAJ_START_TOL_ANG;
+}
+
+/**
+ * \brief Sets pos_d / ori_d to the forward kinematics of joint set points
+ */
+static void setPoseFromJoints(mechanism *mech, const double q[TRAJ_AXES]) {
+  l_r arm = mech->type == GOLD_ARM_SERIAL ? dh_left : dh_right;
+  double joints[6] = {q[SHOULDER], q[ELBOW],  q[Z_INS],
+                      q[TOOL_ROT], q[WRIST], (q[GRASP2] - q[GRASP1]) / 2};
+  double thetas[6];
+  tf::Transform xf;
+
+  joint2theta(thetas, joints, arm);
+  fwd_kin(thetas, arm, xf);
+
+  mech->pos_d.x = xf.getOrigin()[0] * MICRON_PER_M;
+  mech->pos_d.y = xf.getOrigin()[1] * MICRON_PER_M;
+  mech->pos_d.z = xf.getOrigin()[2] * MICRON_PER_M;
+  mech->ori_d.grasp = (q[GRASP2] + q[GRASP1]) * 1000;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) mech->ori_d.R[i][j] = xf.getBasis()[i][j];
+}
+
+/**
+ * \brief Steps the queued paths, before the inverse kinematics
+ *
+ * Cartesian segments set pos_d / ori_d.  Joint segments set the pose to the
+ * forward kinematics of their set points, which trajApply() then copies to
+ * jpos_d.  Idle arms hold their command.  Outside pedal down, and on a
+ * cancel, the queues are dropped.
+ *
+ * \param device0   robot_device struct defined in DS0.h
+ * \param runlevel  current runlevel
+ * \return the number of arms on a path
+ * \ingroup Control
+ */
+int trajUpdate(device *device0, int runlevel) {
+  int active = 0;
+
+  for (int m = 0; m < NUM_MECH; m++) {
+    mechanism *mech = &(device0->mech[m]);
+    int arm = mech->type == GOLD_ARM ? 0 : 1;
+    traj_queue *q = &queues[arm];
+
+    jointActive[arm] = FALSE;
+    if (q->flush || runlevel != RL_PEDAL_DN) {
+      if (q->head != q->tail) {
+        log_msg("%s arm path dropped", arm == 0 ? "Gold" : "Green");
+        stats[arm].dropped++;
+      }
+      q->head = q->tail;
+      q->flush = FALSE;
+      played[arm] = 0;
+      playing[arm] = FALSE;
+      continue;
+    }
+    if (q->head == q->tail) {
+      playing[arm] = FALSE;
+      continue;
+    }
+
+    const traj_segment *s = &q->seg[q->head % TRAJ_QUEUE_LEN];
+    if (!playing[arm] && !startsAtCommand(*s, mech)) {
+      log_msg("%s arm path does not start at the commanded state, dropped",
+              arm == 0 ? "Gold" : "Green");
+      stats[arm].dropped++;
+      q->head = q->tail;
+      continue;
+    }
+    playing[arm] = TRUE;
+    active++;
+
+    if (played[arm] == 0) {
+      // the last point streamed so far: come to rest at it unless more arrive first
+      if (s->more && __sync_bool_compare_and_swap(&q->open, q->head + 1, 0))
+        stopSegment(&q->seg[q->head % TRAJ_QUEUE_LEN]);
+
+      long int lag = (long int)(gTime - s->start);
+      stats[arm].lag = lag > 0 ? lag : 0;
+      if (lag > stats[arm].max_lag) stats[arm].max_lag = lag;
+    }
+
+    double x[TRAJ_AXES];
+    tf::Quaternion ori;
+    played[arm]++;
+    evalSegment(*s, (double)played[arm] / s->ticks, x, &ori);
+
+    if (s->space == traj_joint) {
+      for (int a = 0; a < TRAJ_AXES; a++) jointCmd[arm][a] = x[a];
+      jointActive[arm] = TRUE;
+      setPoseFromJoints(mech, x);
+    } else {
+      tf::Matrix3x3 mx(ori);
+      mech->pos_d.x = lround(x[0]);
+      mech->pos_d.y = lround(x[1]);
+      mech->pos_d.z = lround(x[2]);
+      mech->ori_d.grasp = lround(x[3]);
+      for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) mech->ori_d.R[i][j] = mx[i][j];
+    }
+
+    if (played[arm] >= s->ticks) {
+      // a stream that ran dry holds its last point
+      if (s->more && q->head + 1 == q->tail) {
+        log_msg("%s arm trajectory stream underrun", arm == 0 ? "Gold" : "Green");
+        stats[arm].underruns++;
+      }
+      stats[arm].segments++;
+      played[arm] = 0;
+      __sync_synchronize();
+      q->head++;
+    }
+  }
+
+  return active;
+}
+
+/**
+ * \brief Applies the joint set points after the inverse kinematics, and
+ * publishes the commanded state to the planner
+ *
+ * \param device0  robot_device struct defined in DS0.h
+ * \ingroup Control
+ */
+void trajApply(device *device0) {
+  snapshotSeq++;
+  __sync_synchronize();
+
+  for (int m = 0; m < NUM_MECH; m++) {
+    mechanism *mech = &(device0->mech[m]);
+    int arm = mech->type == GOLD_ARM ? 0 : 1;
+    traj_snapshot *snap = &snapshots[arm];
+    const orientation *ori = &mech->ori_d;
+
+    if (jointActive[arm])
+      for (int a = 0; a < TRAJ_AXES; a++) mech->joint[a].jpos_d = jointCmd[arm][a];
+
+    snap->time = gTime;
+    for (int a = 0; a < TRAJ_AXES; a++) {
+      snap->at[traj_joint].x[a] = mech->joint[a].jpos_d;
+      snap->at[traj_cartesian].x[a] = 0;
+    }
+    snap->at[traj_cartesian].x[0] = mech->pos_d.x;
+    snap->at[traj_cartesian].x[1] = mech->pos_d.y;
+    snap->at[traj_cartesian].x[2] = mech->pos_d.z;
+    snap->at[traj_cartesian].x[3] = ori->grasp;
+    tf::Matrix3x3(ori->R[0][0], ori->R[0][1], ori->R[0][2], ori->R[1][0], ori->R[1][1],
+                  ori->R[1][2], ori->R[2][0], ori->R[2][1], ori->R[2][2])
+        .getRotation(snap->at[traj_cartesian].ori);
+  }
+
+  __sync_synchronize();
+  snapshotSeq++;
+}
+
+/**
+ * \brief Looks up a name in a list
+ *
+ * \return its index, or -1
+ */
+static int lookupName(const std::string &name, const char **names, int num) {
+  for (int i = 0; i < num; i++)
+    if (name == names[i]) return i;
+  return -1;
+}
+
+/**
+ * \brief Unpacks the flattened waypoints of a service request or message
+ *
+ * \param space  traj_joint (8 values per point) or traj_cartesian (13)
+ * \param v      the values
+ * \param out    the waypoints, durations zeroed
+ * \param max    room in out
+ * \return the number of waypoints, or -1 if v does not fit
+ */
+static int unpackWaypoints(int space, const std::vector<double> &v, traj_waypoint *out,
+                           unsigned int max) {
+  unsigned int size = space == traj_joint ? MAX_DOF_PER_MECH : 13;
+  unsigned int num = v.size() / size;
+
+  if (num < 1 || num > max || v.size() != num * size) return -1;
+  for (unsigned int k = 0; k < num; k++) {
+    const double *p = &v[k * size];
+    traj_waypoint *wp = &out[k];
+    memset(wp, 0, sizeof(traj_waypoint));
+    if (space == traj_joint) {
+      for (int a = 0; a < MAX_DOF_PER_MECH; a++) wp->q[a] = p[a];
+    } else {
+      for (int i = 0; i < 3; i++) wp->pos[i] = p[i];
+      for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) wp->R[i][j] = p[3 + 3 * i + j];
+      wp->grasp = p[12];
+    }
+  }
+  return num;
+}
+
+/**
+ * \brief Plans a path from the plan_trajectory service
+ */
+static bool planCallback(raven_2::PlanTrajectoryRequest &req,
+                         raven_2::PlanTrajectoryResponse &res) {
+  int arm = req.arm == "gold" ? 0 : (req.arm == "green" ? 1 : -1);
+  int space = lookupName(req.space, spaceNames, traj_last_space);
+  int profile = lookupName(req.profile, profileNames, traj_cubic);
+
+  res.success = false;
+  if (arm < 0) {
+    res.message = "arm must be gold or green";
+    return true;
+  }
+  if (req.cancel) {
+    trajCancel(arm);
+    res.success = true;
+    return true;
+  }
+  if (space < 0 || profile < 0) {
+    res.message = "space joint or cartesian, profile quintic, min_jerk or trapezoid";
+    return true;
+  }
+
+  traj_waypoint wps[TRAJ_MAX_WAYPOINTS];
+  int num = unpackWaypoints(space, req.waypoints, wps, TRAJ_MAX_WAYPOINTS);
+  if (num < 0 || (!req.durations.empty() && (int)req.durations.size() != num)) {
+    res.message = "waypoints need 8 (joint) or 13 (cartesian) values each, durations 0 or one each";
+    return true;
+  }
+  for (int k = 0; !req.durations.empty() && k < num; k++) wps[k].duration = req.durations[k];
+
+  switch (trajPlanPath(arm, space, profile, wps, num)) {
+    case -1:
+      res.message = "waypoint outside the joint limits";
+      break;
+    case -2:
+      res.message = "arm not under trajectory control, or a cancel is pending";
+      break;
+    case -3:
+      res.message = "wait for the queued path in the other space to finish";
+      break;
+    case -4:
+      res.message = "queue full";
+      break;
+    default:
+      res.success = true;
+  }
+  return true;
+}
+
+/**
+ * \brief Queues a batch of points from the raven_trajectory topic
+ *
+ * Time stamps are turned into control cycles against the ROS clock when the
+ * batch arrives.
+ *
+ * \param msg the batch
+ * \ingroup ROS
+ */
+static void streamCallback(raven_2::raven_trajectory msg) {
+  int arm = msg.arm == "gold" ? 0 : (msg.arm == "green" ? 1 : -1);
+  int space = lookupName(msg.space, spaceNames, traj_last_space);
+  static traj_waypoint wps[TRAJ_MAX_STREAM];  // the spinner thread is the only caller
+  static long int at[TRAJ_MAX_STREAM];
+
+  int num = space < 0 ? -1 : unpackWaypoints(space, msg.points, wps, TRAJ_MAX_STREAM);
+  if (arm < 0 || num < 0 || (int)msg.time_from_start.size() != num) {
+    log_msg("raven_trajectory: bad arm, space or point count, batch ignored");
+    return;
+  }
+
+  ros::Time now = ros::Time::now();
+  ros::Time stamp = msg.hdr.stamp.isZero() ? now : msg.hdr.stamp;
+  long int tick = gTime;
+  for (int k = 0; k < num; k++)
+    at[k] = tick + lround(((stamp - now).toSec() + msg.time_from_start[k]) * 1000);
+
+  int ret = trajStream(arm, space, wps, at, num, msg.end);
+  if (ret < 0) log_msg("raven_trajectory: %s arm batch refused (%d)", msg.arm.c_str(), ret);
+}
+
+/**
+ * \brief Reads a list of limits, keeping the defaults if it is not given
+ */
+static void getLimitList(ros::NodeHandle &n, const char *name, float *out, unsigned int size) {
+  float v[MAX_DOF_PER_MECH];
+
+  if (size > MAX_DOF_PER_MECH || !getParamList(n, name, v, size)) return;
+  for (unsigned int i = 0; i < size; i++) {
+    if (v[i] < 0) {
+      log_msg("%s must not be negative, ignored", name);
+      return;
+    }
+  }
+  for (unsigned int i = 0; i < size; i++) out[i] = v[i];
+}
+
+/**
+ * \brief Reads the default limits, advertises the plan_trajectory service and
+ * subscribes to raven_trajectory
+ *
+ * \param n  the ros node handle
+ * \return 0
+ * \ingroup ROS
+ */
+int init_trajectory_plan(ros::NodeHandle &n) {
+  const float jvel[MAX_DOF_PER_MECH] = {1.0, 1.0, 0.1, 0, 3.0, 3.0, 3.0, 3.0};
+  const float jacc[MAX_DOF_PER_MECH] = {4.0, 4.0, 0.4, 0, 20.0, 20.0, 20.0, 20.0};
+  float lin[2] = {ABS_POSE_MAX_VEL, TRAJ_LIN_ACC};
+  float ang[2] = {ABS_POSE_MAX_ANG_VEL, TRAJ_ANG_ACC};
+
+  for (int j = 0; j < MAX_DOF_PER_MECH; j++) {
+    limits.jvel[j] = jvel[j];
+    limits.jacc[j] = jacc[j];
+  }
+  getLimitList(n, "/traj_joint_vel", limits.jvel, MAX_DOF_PER_MECH);
+  getLimitList(n, "/traj_joint_acc", limits.jacc, MAX_DOF_PER_MECH);
+  getLimitList(n, "/traj_linear_limits", lin, 2);
+  getLimitList(n, "/traj_angular_limits", ang, 2);
+  limits.lin_vel = lin[0];
+  limits.lin_acc = lin[1];
+  limits.ang_vel = ang[0];
+  limits.ang_acc = ang[1];
+
+  plan_service = n.advertiseService("plan_trajectory", planCallback);
+  stream_sub = n.subscribe<raven_2::raven_trajectory>("raven_trajectory", 10, streamCallback);
+  return 0;
+}
@@ -19,7 +19,10 @@
  */
 
 #include "update_device_state.h"
+#include <cmath>
+#include <tf/transform_datatypes.h>
 #include "log.h"
+#include "local_io.h"
 
 extern DOF_type DOF_types[];
 extern int NUM_MECH;
@@ -36,6 +39,38 @@ int newDofTorqueTorque = 0;            // torque value in mNm
 float newDofPosPos = 0;                // pos delta in rad or m
 t_controlmode newRobotControlMode = homing_mode;
 
+/**
+ * \brief Moves the desired pose of an arm part way to the master command
+ *
+ * Used while the master watchdog ramps an arm's command gain down, so that the
+ * set point holds still (gain 0) instead of the arm losing its stiffness, and
+ * catches up smoothly if commands resume.
+ *
+ * \param _mech  the arm
+ * \param xd     commanded position
+ * \param rd     commanded orientation
+ * \param gain   fraction of the step to take, 0 to 1
+ */
+static void stepCommandToward(mechanism *_mech, const position *xd, const orientation *rd,
+                              float gain) {
+  _mech->pos_d.x += (int)lroundf(gain * (xd->x - _mech->pos_d.x));
+  _mech->pos_d.y += (int)lroundf(gain * (xd->y - _mech->pos_d.y));
+  _mech->pos_d.z += (int)lroundf(gain * (xd->z - _mech->pos_d.z));
+  _mech->ori_d.grasp += (int)lroundf(gain * (rd->grasp - _mech->ori_d.grasp));
+
+  const float(*R)[3] = _mech->ori_d.R;
+  tf::Quaternion from, to;
+  tf::Matrix3x3(R[0][0], R[0][1], R[0][2], R[1][0], R[1][1], R[1][2], R[2][0], R[2][1], R[2][2])
+      .getRotation(from);
+  R = rd->R;
+  tf::Matrix3x3(R[0][0], R[0][1], R[0][2], R[1][0], R[1][1], R[1][2], R[2][0], R[2][1], R[2][2])
+      .getRotation(to);
+
+  tf::Matrix3x3 rot(from.slerp(to, gain));
+  for (int j = 0; j < 3; j++)
+    for (int k = 0; k < 3; k++) _mech->ori_d.R[j][k] = rot[j][k];
+}
+
 /**
  * updateDeviceState - Function that update the device state based on parameters
  *passed from
@@ -56,18 +91,33 @@ int updateDeviceState(param_pass *currParams, param_pass *rcvdParams, device *de
     currParams->rd[i].pitch = rcvdParams->rd[i].pitch * WRIST_SCALE_FACTOR;
     currParams->rd[i].roll = rcvdParams->rd[i].roll;
     currParams->rd[i].grasp = rcvdParams->rd[i].grasp;
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < 3; k++) currParams->rd[i].R[j][k] = rcvdParams->rd[i].R[j][k];
+    currParams->abs_pose_active[i] = rcvdParams->abs_pose_active[i];
+    currParams->abs_pose_seq[i] = rcvdParams->abs_pose_seq[i];
+    currParams->abs_pose_ticks[i] = rcvdParams->abs_pose_ticks[i];
   }
 
   // set desired mech position in pedal_down runlevel
-  if (currParams->runlevel == RL_PEDAL_DN) {
+  // (arms under absolute pose command are interpolated in the control loop,
+  // and under trajectory control the queued paths own the set points)
+  if (currParams->runlevel == RL_PEDAL_DN && currParams->robotControlMode != trajectory_control) {
     for (int i = 0; i < NUM_MECH; i++) {
-      device0->mech[i].pos_d.x = rcvdParams->xd[i].x;
-      device0->mech[i].pos_d.y = rcvdParams->xd[i].y;
-      device0->mech[i].pos_d.z = rcvdParams->xd[i].z;
-      device0->mech[i].ori_d.grasp = rcvdParams->rd[i].grasp;
+      if (rcvdParams->abs_pose_active[i]) continue;
+
+      mechanism *_mech = &device0->mech[i];
+      float gain = masterWatchdogGain(_mech->type == GREEN_ARM_SERIAL ? 1 : 0);
+      if (gain >= 1) {
+        _mech->pos_d.x = rcvdParams->xd[i].x;
+        _mech->pos_d.y = rcvdParams->xd[i].y;
+        _mech->pos_d.z = rcvdParams->xd[i].z;
+        _mech->ori_d.grasp = rcvdParams->rd[i].grasp;
 
-      for (int j = 0; j < 3; j++)
-        for (int k = 0; k < 3; k++) device0->mech[i].ori_d.R[j][k] = rcvdParams->rd[i].R[j][k];
+        for (int j = 0; j < 3; j++)
+          for (int k = 0; k < 3; k++) _mech->ori_d.R[j][k] = rcvdParams->rd[i].R[j][k];
+      } else {
+        stepCommandToward(_mech, &rcvdParams->xd[i], &rcvdParams->rd[i], gain);
+      }
     }
   }
 
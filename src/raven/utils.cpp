@@ -29,9 +29,11 @@
  */
 
 #include <cmath>
+#include <vector>
 #include "utils.h"
 #include "DS0.h"
 #include "defines.h"
+#include "log.h"
 
 extern int NUM_MECH;
 
@@ -252,6 +254,19 @@ int robot_ready(robot_device *device0) {
   return 1;
 }
 
+/**
+*	\fn u_64 monotonic_ns()
+*
+*	\brief current CLOCK_MONOTONIC time, for timestamping across threads
+*
+*	\return nanoseconds since an arbitrary fixed point
+*/
+u_64 monotonic_ns() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (u_64)t.tv_sec * NSEC_PER_SEC + t.tv_nsec;
+}
+
 /**
 *	\fn  timespec tsSubtract (timespec time1, timespec time2)
 *
@@ -286,15 +301,22 @@ timespec tsSubtract(timespec time1, timespec time2) {
 }
 
 /**
-*	\fn void set_posd_to_pos(robot_device* device0)
+*	\fn int set_posd_to_pos(robot_device* device0)
 *
 *	\brief set the desired position to the robots current position
 *
 *	\param device0 a pointer points to the robot_device struct
 *
-*	\return void
+*	\return 1 if the desired pose has moved by more than the ORIGIN_DEADBAND_*
+*limits since the last call that returned 1, i.e. the master origin needs a
+*rebase; 0 while the robot only shows encoder noise
 */
-void set_posd_to_pos(robot_device *device0) {
+int set_posd_to_pos(robot_device *device0) {
+  static position lastPos[MAX_MECH];
+  static orientation lastOri[MAX_MECH];
+  static int first = 1;
+  int moved = first;
+
   for (int m = 0; m < NUM_MECH; m++) {
     device0->mech[m].pos_d.x = device0->mech[m].pos.x;
     device0->mech[m].pos_d.y = device0->mech[m].pos.y;
@@ -306,5 +328,48 @@ void set_posd_to_pos(robot_device *device0) {
 
     for (int k = 0; k < 3; k++)
       for (int j = 0; j < 3; j++) device0->mech[m].ori_d.R[k][j] = device0->mech[m].ori.R[k][j];
+
+    // only motion beyond the deadbands moves the master origin
+    const mechanism *_mech = &device0->mech[m];
+    if (abs(_mech->pos_d.x - lastPos[m].x) > ORIGIN_DEADBAND_POS ||
+        abs(_mech->pos_d.y - lastPos[m].y) > ORIGIN_DEADBAND_POS ||
+        abs(_mech->pos_d.z - lastPos[m].z) > ORIGIN_DEADBAND_POS ||
+        abs(_mech->ori_d.grasp - lastOri[m].grasp) > ORIGIN_DEADBAND_GRASP)
+      moved = 1;
+    for (int k = 0; k < 3; k++)
+      for (int j = 0; j < 3; j++)
+        if (fabs(_mech->ori_d.R[k][j] - lastOri[m].R[k][j]) > ORIGIN_DEADBAND_ROT) moved = 1;
+  }
+
+  if (moved) {
+    for (int m = 0; m < NUM_MECH; m++) {
+      lastPos[m] = device0->mech[m].pos_d;
+      lastOri[m] = device0->mech[m].ori_d;
+    }
   }
+  first = 0;
+  return moved;
+}
+
+/**
+ * \brief Reads a list of numbers from a ROS parameter
+ *
+ * A list of the wrong length is logged and ignored.
+ *
+ * \param n     the ros node handle
+ * \param name  the parameter
+ * \param out   receives the values; left unchanged if the list is not read
+ * \param size  the number of values the list must have
+ * \return 1 if the parameter was given with size values, otherwise 0
+ */
+int getParamList(ros::NodeHandle &n, const std::string &name, float *out, unsigned int size) {
+  std::vector<double> v;
+
+  if (!n.getParam(name, v)) return 0;
+  if (v.size() != size) {
+    log_msg("%s needs %d values, ignored", name.c_str(), size);
+    return 0;
+  }
+  for (unsigned int i = 0; i < size; i++) out[i] = v[i];
+  return 1;
 }
@@ -0,0 +1,93 @@
+/* Raven 2 Control - Control software for the Raven II robot
+ * Copyright (C) 2005-2012  H. Hawkeye King, Blake Hannaford, and the University
+ *of Washington BioRobotics Laboratory
+ *
+ * This file is part of Raven 2 Control.
+ *
+ * Raven 2 Control is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Raven 2 Control is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Raven 2 Control.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file test_pid_control.cpp
+ * \brief Unit tests of the joint position controller
+ *
+ * pid_control.cpp is built on its own, the globals and helpers it takes from
+ * the rest of r2_control are defined here.
+ */
+
+#include <cstring>
+#include <gtest/gtest.h>
+#include "pid_control.h"
+#include "defines.h"
+
+DOF_type DOF_types[MAX_MECH * MAX_DOF_PER_MECH];
+unsigned long int gTime = 0;
+
+int log_msg(const char *fmt, ...) { return 0; }
+int is_toolDOF(int jointType) { return (jointType % MAX_DOF_PER_MECH) > Z_INS; }
+int is_toolDOF(DOF *_joint) { return is_toolDOF(_joint->type); }
+
+class PidControlTest : public ::testing::Test {
+ protected:
+  DOF joint;
+
+  void SetUp() {
+    memset(&joint, 0, sizeof(joint));
+    joint.type = SHOULDER_GOLD;
+
+    // Amplifier limit of 2 Nm, motor turning against the joint
+    DOF_type *_dof = &DOF_types[SHOULDER_GOLD];
+    _dof->DAC_max = 2000;
+    _dof->DAC_per_amp = 1000;
+    _dof->tau_per_amp = -1.0;
+
+    joint_gains gains[MAX_MECH * MAX_DOF_PER_MECH];
+    for (int i = 0; i < MAX_MECH * MAX_DOF_PER_MECH; i++) defaultJointGains(i, &gains[i]);
+    gains[SHOULDER_GOLD].law = ctrl_pid;
+    gains[SHOULDER_GOLD].kp = 1.0;
+    gains[SHOULDER_GOLD].ki = 10.0;
+    ASSERT_EQ(setJointGains(gains), 0);
+    updateControllerGains();
+
+    mpos_PD_control(&joint, 1);
+  }
+};
+
+/// A constant error below saturation builds up the integral
+TEST_F(PidControlTest, IntegralGrowsWithNegativeTorquePerAmp) {
+  joint.mpos_d = 0.1;
+
+  mpos_PD_control(&joint);
+  float first = joint.tau_d;
+  for (int i = 0; i < 100; i++) mpos_PD_control(&joint);
+
+  EXPECT_GT(first, 0.1);
+  EXPECT_NEAR(joint.tau_d - 0.1, 10.0 * 0.1 * 101 * ONE_MS, 1e-4);
+}
+
+/// The integral holds while the output saturates in the direction of the error
+TEST_F(PidControlTest, IntegralHeldAtSaturation) {
+  joint.mpos_d = 5.0;
+
+  mpos_PD_control(&joint);
+  float first = joint.tau_d;
+  for (int i = 0; i < 100; i++) mpos_PD_control(&joint);
+
+  EXPECT_FLOAT_EQ(joint.tau_d, first);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}